@@ -8,6 +8,7 @@
 
 #include <atomic>
 #include <memory>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -48,8 +49,19 @@ class Benchmark {
     capacity_ = atoi(props.GetProperty("capacity").c_str());
     num_shards_ = atoi(props.GetProperty("shards").c_str());
 
+    auto numa = props.GetProperty("numa", "none");
+    if (!numa.compare("place")) {
+      numa_policy_ = NumaPolicy::PLACE;
+    } else if (!numa.compare("local")) {
+      numa_policy_ = NumaPolicy::LOCAL;
+    } else if (numa.compare("none")) {
+      std::cout << "Wrong numa policy!" << std::endl;
+      exit(0);
+    }
+
     CacheType type = CacheType::LRU;
-    if (!cache.compare("frozenhot_cache")) {
+    if (!cache.compare("origin_frozenhot_cache")) {
+      // The original FrozenHot implementation, kept for comparison.
       enable_frozen_hot_ = true;
       FH_cache_.reset(
           new tstarling::ConcurrentScalableCache<uint64_t,
@@ -66,13 +78,71 @@ class Benchmark {
         type = CacheType::ASYNC;
       } else if (!cache.compare("segment_cache")) {
         type = CacheType::SEGMENT;
+      } else if (!cache.compare("compact_lru_cache")) {
+        type = CacheType::COMPACT_LRU;
+      } else if (!cache.compare("frozenhot_cache")) {
+        type = CacheType::FROZENHOT;
+      } else if (!cache.compare("frozenhot_fifo_cache")) {
+        type = CacheType::FROZENHOT_FIFO;
+      } else if (!cache.compare("frozenhot_lfu_cache")) {
+        type = CacheType::FROZENHOT_LFU;
       } else {
         std::cout << "Wrong cache name!" << std::endl;
         exit(0);
       }
       cache_.reset(
           new ConcurrentScalableCache<uint64_t, std::shared_ptr<std::string>>(
-              capacity_, num_shards_, type));
+              capacity_, num_shards_, type, numa_policy_));
+      if (atoi(props.GetProperty("l0", "0").c_str())) {
+        cache_->EnableL0Cache();
+      }
+      auto flash_path = props.GetProperty("flash", "");
+      if (!flash_path.empty()) {
+        uint64_t flash_size =
+            atoll(props.GetProperty("flash_size", "1024").c_str());
+        if (!cache_->EnableFlashTier(flash_path, flash_size << 20)) {
+          exit(0);
+        }
+      }
+      uint64_t compress_depth =
+          atoll(props.GetProperty("compress_depth", "0").c_str());
+      if (compress_depth) {
+        uint64_t compress_size =
+            atoll(props.GetProperty("compress_size", "1024").c_str());
+        cache_->EnableCompressedTier(compress_depth, compress_size << 20);
+      }
+      if (atoi(props.GetProperty("adaptive", "0").c_str())) {
+        cache_->EnableAdaptivePolicy();
+      }
+      if (IsFrozenHot(type)) {
+        cache_->SetFrozenOptions(ParseFrozenOptions(props));
+      }
+      double mrc_rate = atof(props.GetProperty("mrc", "0").c_str());
+      if (mrc_rate > 0) {
+        cache_->EnableMrcProfiler(mrc_rate);
+      }
+      snapshot_save_path_ = props.GetProperty("snapshot_save", "");
+      auto snapshot_load_path = props.GetProperty("snapshot_load", "");
+      if (!snapshot_load_path.empty()) {
+        cache_->LoadSnapshot(snapshot_load_path);
+      }
+      auto metrics_target = props.GetProperty("metrics", "");
+      if (!metrics_target.empty()) {
+        auto format = props.GetProperty("metrics_format", "json");
+        if (format.compare("json") && format.compare("csv")) {
+          std::cout << "Wrong metrics format!" << std::endl;
+          exit(0);
+        }
+        uint32_t interval_ms =
+            atoi(props.GetProperty("metrics_interval_ms", "1000").c_str());
+        if (!cache_->EnableMetricsExport(
+                metrics_target,
+                format.compare("csv") ? MetricsFormat::JSON
+                                      : MetricsFormat::CSV,
+                interval_ms)) {
+          exit(0);
+        }
+      }
     }
 
     num_requests_ = atoi(props.GetProperty("requests").c_str());
@@ -104,25 +174,21 @@ class Benchmark {
     printf("small granularity: %lu and large granularity: %lu\n",
            small_granularity_, large_granularity_);
 
-    /**
-     * NUMA node0 CPU(s): 0-27, 56-83
-     * NUMA node1 CPU(s): 28-55, 84-111
-     */
+    int monitor_core = 0;
+    std::vector<int> client_cores;
+    AssignCores(monitor_core, client_cores);
+
     auto start_time = utils::NowMicros();
     std::vector<std::thread> client_vtc;
     const uint64_t num_requests_per_client = total_requests / num_threads_;
     for (uint64_t i = 0; i < num_threads_; i++) {
       uint64_t start = i * num_requests_per_client;
-      uint64_t core_id = 29 /* cpu core id in node 1 */ + i;
-      if (core_id > 55) {
-        core_id = core_id + 28;
-      }
-      client_vtc.emplace_back(
-          std::thread(BGWork, this, num_requests_per_client, core_id, start));
+      client_vtc.emplace_back(std::thread(BGWork, this, num_requests_per_client,
+                                          client_cores[i], start));
     }
 
     auto func = [&](int core_id) { this->StartMonitor(core_id); };
-    std::thread monitor(func, 28);
+    std::thread monitor(func, monitor_core);
 
     for (uint64_t i = 0; i < num_threads_; i++) {
       client_vtc[i].join();
@@ -145,12 +211,113 @@ class Benchmark {
     } else {
       cache_->PrintGlobalLat();
       cache_->PrintStatus();
+      if (!snapshot_save_path_.empty()) {
+        cache_->SaveSnapshot(snapshot_save_path_);
+      }
     }
   }
 
   void Print() {}
 
  private:
+  // Options of the frozen fast cache controller, from the "fh_" properties.
+  FrozenOptions ParseFrozenOptions(const Properties& props) {
+    FrozenOptions options;
+    auto get = [&](const char* name, double value) {
+      return atof(props.GetProperty(name, std::to_string(value)).c_str());
+    };
+    options.wait_stable_interval_us =
+        get("fh_wait_stable_interval_us", options.wait_stable_interval_us);
+    options.wait_stable_threshold =
+        get("fh_wait_stable_threshold", options.wait_stable_threshold);
+    options.check_interval_us =
+        get("fh_check_interval_us", options.check_interval_us);
+    options.gain_threshold = get("fh_gain_threshold", options.gain_threshold);
+    options.min_ratio = get("fh_min_ratio", options.min_ratio);
+    options.construct_passes =
+        get("fh_construct_passes", options.construct_passes);
+    options.drop_threshold = get("fh_drop_threshold", options.drop_threshold);
+    options.min_lifetime = get("fh_min_lifetime", options.min_lifetime);
+    options.max_lifetime = get("fh_max_lifetime", options.max_lifetime);
+    options.backoff_s = get("fh_backoff_s", options.backoff_s);
+    options.backoff_factor = get("fh_backoff_factor", options.backoff_factor);
+    options.max_backoff_s = get("fh_max_backoff_s", options.max_backoff_s);
+    options.ewma_weight = get("fh_ewma_weight", options.ewma_weight);
+    options.transition_fraction =
+        get("fh_transition_fraction", options.transition_fraction);
+    options.invalidation_budget =
+        get("fh_invalidation_budget", options.invalidation_budget);
+    options.phase_sample_ratio =
+        get("fh_phase_sample_ratio", options.phase_sample_ratio);
+    options.phase_min_samples =
+        get("fh_phase_min_samples", options.phase_min_samples);
+    options.phase_distance_threshold =
+        get("fh_phase_distance_threshold", options.phase_distance_threshold);
+    options.phase_change_delta =
+        get("fh_phase_change_delta", options.phase_change_delta);
+    options.phase_change_threshold =
+        get("fh_phase_change_threshold", options.phase_change_threshold);
+    options.curve_max_passes =
+        get("fh_curve_max_passes", options.curve_max_passes);
+    options.curve_step = get("fh_curve_step", options.curve_step);
+    options.curve_flat_threshold =
+        get("fh_curve_flat_threshold", options.curve_flat_threshold);
+    options.curve_max_ratio =
+        get("fh_curve_max_ratio", options.curve_max_ratio);
+    options.curve_requests = get("fh_curve_requests", options.curve_requests);
+    options.curve_pass_us = get("fh_curve_pass_us", options.curve_pass_us);
+    return options;
+  }
+
+  // The monitor takes the first core of the machine (in node order). Without
+  // numa awareness, clients fill up the remaining cores node by node, so they
+  // stay on as few nodes as possible. Otherwise, clients are spread over nodes
+  // in a round-robin way, so that every shard group has local clients.
+  void AssignCores(int& monitor_core, std::vector<int>& client_cores) {
+    std::vector<std::vector<int>> node_cpus;
+    for (auto node : utils::numa::GetNodes()) {
+      auto cpus = utils::numa::GetCpus(node);
+      if (!cpus.empty()) {
+        node_cpus.push_back(cpus);
+      }
+    }
+    if (node_cpus.empty()) {
+      printf("no cpus found on the numa nodes, using core 0\n");
+      node_cpus.push_back({0});
+    }
+    monitor_core = node_cpus[0][0];
+    node_cpus[0].erase(node_cpus[0].begin());
+    if (node_cpus[0].empty() && node_cpus.size() > 1) {
+      node_cpus.erase(node_cpus.begin());
+    }
+
+    std::vector<int> cpus;
+    if (numa_policy_ == NumaPolicy::NONE) {
+      for (auto& v : node_cpus) {
+        cpus.insert(cpus.end(), v.begin(), v.end());
+      }
+    } else {
+      for (size_t i = 0; cpus.size() < num_threads_; i++) {
+        bool found = false;
+        for (auto& v : node_cpus) {
+          if (i < v.size()) {
+            cpus.push_back(v[i]);
+            found = true;
+          }
+        }
+        if (!found) break;
+      }
+    }
+    if (cpus.empty()) {
+      cpus.push_back(monitor_core);
+    }
+
+    // Wrap around if there are more clients than cores.
+    for (uint64_t i = 0; i < num_threads_; i++) {
+      client_cores.push_back(cpus[i % cpus.size()]);
+    }
+  }
+
   static void BGWork(void* arg, uint64_t num_requests, int core_id,
                      uint64_t start) {
     reinterpret_cast<Benchmark*>(arg)->DelegateClient(num_requests, core_id,
@@ -343,6 +510,8 @@ class Benchmark {
     SetCPUAffinity(core_id);
     if (enable_frozen_hot_) {
       FH_cache_->FastHashMonitor();
+    } else if (IsFrozenHot(cache_->get_type())) {
+      cache_->FrozenMonitor();
     } else {
       cache_->Monitor();
     }
@@ -361,6 +530,10 @@ class Benchmark {
 
   bool enable_frozen_hot_ = false;
 
+  NumaPolicy numa_policy_ = NumaPolicy::NONE;
+
+  std::string snapshot_save_path_;
+
   uint64_t large_granularity_;
   uint64_t small_granularity_;
 
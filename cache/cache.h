@@ -5,11 +5,14 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <random>
 #include <vector>
 
+#include "options.h"
 #include "statistics.h"
 #include "utils.h"
 
@@ -33,13 +36,39 @@ class Cache {
 
   virtual bool Erase(Key key) = 0;
 
+  // Insert 'value' of 'key' found in a lower tier. The request is a hit, so
+  // the insert records no tickers, which would count it as a miss.
+  bool Promote(Key key, const Value& value) {
+    promoting_ = true;
+    bool ret = Insert(key, value);
+    promoting_ = false;
+    return ret;
+  }
+
+  // Look up 'key' without recording tickers, e.g. in a copy of the shard
+  // that owns it, where a miss is not a miss of the request.
+  bool Probe(Key key, Value& value) {
+    promoting_ = true;
+    bool ret = Lookup(key, value);
+    promoting_ = false;
+    return ret;
+  }
+
   virtual bool ConstructTier() { return false; }
 
   virtual bool ConstructFastCache(double ratio) { return false; }
 
   virtual void DeleteFastCache() {}
 
-  virtual bool GetCurve(bool should_stop) { return false; }
+  virtual bool GetCurve(const FrozenOptions& options,
+                        const std::atomic<bool>& should_stop) {
+    return false;
+  }
+
+  // Writes that replaced or invalidated a frozen entry since the fast cache
+  // was built, and the number of entries it was built with.
+  virtual uint64_t get_fast_cache_invalidations() { return 0; }
+  virtual uint64_t get_fast_cache_size() { return 0; }
 
   virtual void PrintStatus() {}
 
@@ -49,25 +78,66 @@ class Cache {
 
   virtual uint64_t get_size() { return 0; }
 
+  // Change the capacity at runtime. Shrinking does not evict by itself, the
+  // extra entries are removed in batches by 'EvictBatch'.
+  virtual void SetCapacity(uint64_t capacity) {}
+
+  // Evict at most 'max_num' entries while the cache is over its capacity, and
+  // return the number of evicted entries.
+  virtual uint64_t EvictBatch(uint64_t max_num) { return 0; }
+
   virtual bool is_full() { return false; }
 
+  // Called with every entry evicted for capacity (but not erased), e.g. to
+  // spill it into a secondary tier. It must be set before any request.
+  void SetEvictionCallback(
+      std::function<void(const Key&, const Value&)> callback) {
+    eviction_callback_ = std::move(callback);
+  }
+
+  // Visit the entries from the most to the least recently used one, which is
+  // the order that 'SaveSnapshot' writes them. Entries inserted or erased
+  // concurrently may or may not be visited.
+  virtual void ForEachEntry(
+      const std::function<void(const Key&, const Value&)>& func) {}
+
   Statistics stats;
 
   std::vector<CurveDataNode> curve_container;
 
-  // Used to sample stats
+  std::function<void(const Key&, const Value&)> eviction_callback_;
+
+  // Used to sample stats: every request, or every 'sample_interval_'-th one
+  // of a thread with 'sample_flag_'. Always false without stats, so that the
+  // tickers of a request cost nothing.
   bool sample_generator() {
-    if (!sample_flag_) {
+#ifdef KVCACHE_NO_STATS
+    return false;
+#else
+    if (promoting_) {
+      return false;
+    }
+    if (!sample_flag_.load(std::memory_order_relaxed)) {
       return true;
-    } else {
-      return ((double)(utils::random::Random::GetTLSInstance()->Next()) /
-              (double)(RAND_MAX)) < sample_percentage_;
     }
+    static thread_local uint32_t countdown = 0;
+    if (countdown > 0) {
+      countdown--;
+      return false;
+    }
+    countdown = sample_interval_ - 1;
+    return true;
+#endif
   }
 
-  const double sample_percentage_ = 1.0 / 100;
+  const uint32_t sample_interval_ = 100;
+
+  // Cleared by the curve thread while it profiles.
+  std::atomic<bool> sample_flag_ = false;
 
-  bool sample_flag_ = false;
+  // Set while this thread promotes an entry ('Promote') or probes one
+  // ('Probe').
+  inline static thread_local bool promoting_ = false;
 };
 
 }  // namespace kvcache
@@ -0,0 +1,445 @@
+#ifndef KVCACHE_COMPACT_LRU_CACHE_H
+#define KVCACHE_COMPACT_LRU_CACHE_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cache.h"
+#include "options.h"
+#include "phase_timer.h"
+#include "statistics.h"
+
+namespace kvcache {
+
+// CompactLruCache is an LRU cache whose metadata is packed into a contiguous
+// per-shard node array. Compared with LruCache, which allocates a list node and
+// a TBB::CHM node (holding the key again) for every entry, a node here stores
+// the key once, links the LRU list and the hash chain with 32-bit indexes, and
+// the hash index only holds a 32-bit slot index per bucket.
+//
+// The hash chains are protected by striped reader-writer locks, and the LRU
+// list (together with the free list) by 'list_mtx_'. The lock order is always
+// stripe -> list, and a second stripe is only taken with try_lock, so
+// there is no deadlock. Same as LruCache, the promotion in Lookup() is skipped
+// if the list lock is already held.
+//
+// The number of slots is fixed at construction, so 'SetCapacity' can't grow
+// the cache beyond its initial capacity.
+
+template <class Key, class Value>
+class CompactLruCache : public Cache<Key, Value> {
+ private:
+  constexpr static uint32_t kNil = UINT32_MAX;
+  constexpr static uint32_t kNumLockStripes = 1024;
+  // How many nodes from the LRU tail are tried when the stripe lock of the
+  // victim is held by others.
+  constexpr static uint32_t kMaxEvictionTries = 8;
+
+  struct Node {
+    Key key;
+    Value value;
+
+    uint32_t prev;
+    uint32_t next;
+    uint32_t hash_next;
+
+    Node() : key(), prev(kNil), next(kNil), hash_next(kNil) {}
+  };
+
+  using Entry = std::pair<Key, Value>;
+
+ public:
+  explicit CompactLruCache(uint64_t capacity);
+  CompactLruCache(const CompactLruCache&) = delete;
+  CompactLruCache& operator=(const CompactLruCache&) = delete;
+  virtual ~CompactLruCache() {}
+
+  virtual bool Lookup(Key key, Value& value) override;
+
+  virtual bool Insert(Key key, const Value& value) override;
+
+  virtual bool Erase(Key key) override;
+
+  virtual uint64_t get_size() override { return usage_.load(); }
+
+  virtual bool is_full() override { return usage_.load() >= capacity_; }
+
+  virtual void SetCapacity(uint64_t capacity) override {
+    if (capacity > max_slots_) {
+      printf("compact lru capacity is limited to %u\n", max_slots_);
+      capacity = max_slots_;
+    }
+    capacity_.store(capacity);
+  }
+
+  virtual uint64_t EvictBatch(uint64_t max_num) override;
+
+  virtual void PrintStatus() override;
+
+  virtual void ForEachEntry(
+      const std::function<void(const Key&, const Value&)>& func) override;
+
+ private:
+  uint32_t get_bucket(const Key& key) const {
+    uint64_t h = std::hash<Key>()(key) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<uint32_t>(h >> (64 - bucket_bits_));
+  }
+
+  std::shared_mutex& get_stripe(uint32_t bucket) {
+    return stripes_[bucket & (kNumLockStripes - 1)];
+  }
+
+  // The caller must hold the stripe lock of 'bucket'.
+  uint32_t HashFind(uint32_t bucket, const Key& key) const;
+  void HashRemove(uint32_t bucket, uint32_t index);
+
+  // The caller must hold the list mutex.
+  void LruAppend(uint32_t index);
+  void LruRemove(uint32_t index);
+  bool is_in_list(uint32_t index) const { return nodes_[index].prev != kNil; }
+
+  // Unlink an entry near the LRU tail from both the list and its hash chain,
+  // and return its slot. 'held' is the stripe already locked by the caller.
+  // If there is an eviction callback, the entry is moved into 'evicted', so
+  // the callback runs after the locks are released. The caller must hold the
+  // list mutex.
+  uint32_t EvictOne(std::shared_mutex* held, std::vector<Entry>& evicted);
+
+  // Get a slot for a new entry, evicting one if the cache is full. The caller
+  // must hold the list mutex.
+  uint32_t AllocateSlot(std::shared_mutex* held, std::vector<Entry>& evicted);
+
+  void NotifyEvicted(std::vector<Entry>& evicted) {
+    for (auto& entry : evicted) {
+      Cache<Key, Value>::eviction_callback_(entry.first, entry.second);
+    }
+  }
+
+ private:
+  const uint32_t max_slots_;
+  std::atomic<uint64_t> capacity_;
+  std::atomic<uint64_t> usage_;
+
+  // 'max_slots_' entries followed by the head and tail sentinels.
+  std::unique_ptr<Node[]> nodes_;
+  const uint32_t head_;
+  const uint32_t tail_;
+
+  // Slots below 'next_unused_' have been used, and the released ones are
+  // chained by 'next' from 'free_head_'. Protected by 'list_mtx_'.
+  uint32_t next_unused_;
+  uint32_t free_head_;
+
+  uint32_t bucket_bits_;
+  std::unique_ptr<uint32_t[]> buckets_;
+  std::unique_ptr<std::shared_mutex[]> stripes_;
+
+  CountedMutex list_mtx_{Cache<Key, Value>::get_stats(),
+                         Tickers::LIST_LOCK_ACQUIRE,
+                         Tickers::LIST_LOCK_CONTENDED};
+};
+
+template <class Key, class Value>
+CompactLruCache<Key, Value>::CompactLruCache(uint64_t capacity)
+    : max_slots_(static_cast<uint32_t>(std::min<uint64_t>(capacity, kNil - 2))),
+      capacity_(max_slots_),
+      usage_(0),
+      nodes_(new Node[max_slots_ + 2]),
+      head_(max_slots_),
+      tail_(max_slots_ + 1),
+      next_unused_(0),
+      free_head_(kNil),
+      bucket_bits_(1),
+      stripes_(new std::shared_mutex[kNumLockStripes]) {
+  nodes_[head_].next = tail_;
+  nodes_[tail_].prev = head_;
+
+  // Load factor <= 1.
+  while ((1ULL << bucket_bits_) < max_slots_) {
+    bucket_bits_++;
+  }
+  uint64_t num_buckets = 1ULL << bucket_bits_;
+  buckets_.reset(new uint32_t[num_buckets]);
+  for (uint64_t i = 0; i < num_buckets; i++) {
+    buckets_[i] = kNil;
+  }
+}
+
+template <class Key, class Value>
+bool CompactLruCache<Key, Value>::Lookup(Key key, Value& value) {
+  bool stat_yes = Cache<Key, Value>::sample_generator();
+  PHASE_TIMER_START(timer);
+  auto bucket = get_bucket(key);
+  std::shared_lock stripe_lock(get_stripe(bucket));
+  auto index = HashFind(bucket, key);
+  PHASE_TIMER_RECORD(timer, LOOKUP_PROBE);
+  if (index == kNil) {
+    stripe_lock.unlock();
+    if (stat_yes) {
+      Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_MISS);
+    }
+    return false;
+  }
+
+  value = nodes_[index].value;
+  // Acquire the lock, but don't block if it is already held.
+  std::unique_lock list_lock(list_mtx_, std::try_to_lock);
+  if (list_lock) {
+    PHASE_TIMER_RECORD(timer, LOOKUP_LIST_WAIT);
+    if (is_in_list(index)) {
+      LruRemove(index);
+      LruAppend(index);
+    }
+    list_lock.unlock();
+    PHASE_TIMER_RECORD(timer, LOOKUP_LIST_UPDATE);
+  } else {
+    Cache<Key, Value>::stats.RecordTick(Tickers::PROMOTION_SKIPPED);
+  }
+  stripe_lock.unlock();
+
+  if (stat_yes) {
+    Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_HIT);
+  }
+  return true;
+}
+
+template <class Key, class Value>
+bool CompactLruCache<Key, Value>::Insert(Key key, const Value& value) {
+  if (Cache<Key, Value>::sample_generator()) {
+    Cache<Key, Value>::stats.RecordTick(Tickers::INSERT);
+  }
+  if (capacity_.load() == 0) {
+    return false;
+  }
+
+  PHASE_TIMER_START(timer);
+  auto bucket = get_bucket(key);
+  auto& stripe = get_stripe(bucket);
+  std::vector<Entry> evicted;
+  while (true) {
+    std::unique_lock stripe_lock(stripe);
+    auto index = HashFind(bucket, key);
+    PHASE_TIMER_RECORD(timer, INSERT_PROBE);
+    if (index != kNil) {
+      // update value
+      nodes_[index].value = value;
+      return false;
+    }
+
+    std::unique_lock list_lock(list_mtx_);
+    PHASE_TIMER_RECORD(timer, INSERT_LIST_WAIT);
+    // The slot of a full cache is the one of an evicted entry.
+    index = AllocateSlot(&stripe, evicted);
+    PHASE_TIMER_RECORD(timer, INSERT_ALLOC);
+    if (index == kNil) {
+      // All the candidates near the LRU tail are locked by others, retry.
+      list_lock.unlock();
+      stripe_lock.unlock();
+      std::this_thread::yield();
+      continue;
+    }
+
+    auto& node = nodes_[index];
+    node.key = key;
+    node.value = value;
+    node.hash_next = buckets_[bucket];
+    buckets_[bucket] = index;
+    LruAppend(index);
+    list_lock.unlock();
+    stripe_lock.unlock();
+    PHASE_TIMER_RECORD(timer, INSERT_LIST_UPDATE);
+
+    NotifyEvicted(evicted);
+    PHASE_TIMER_RECORD(timer, INSERT_EVICT);
+    return true;
+  }
+}
+
+template <class Key, class Value>
+bool CompactLruCache<Key, Value>::Erase(Key key) {
+  PHASE_TIMER_START(timer);
+  auto bucket = get_bucket(key);
+  std::unique_lock stripe_lock(get_stripe(bucket));
+  auto index = HashFind(bucket, key);
+  if (index == kNil) {
+    PHASE_TIMER_RECORD(timer, ERASE_PROBE);
+    return false;
+  }
+  HashRemove(bucket, index);
+  nodes_[index].value = Value();
+  PHASE_TIMER_RECORD(timer, ERASE_PROBE);
+
+  std::unique_lock list_lock(list_mtx_);
+  PHASE_TIMER_RECORD(timer, ERASE_LIST_WAIT);
+  if (is_in_list(index)) {
+    LruRemove(index);
+  }
+  nodes_[index].next = free_head_;
+  free_head_ = index;
+  usage_--;
+  list_lock.unlock();
+  PHASE_TIMER_RECORD(timer, ERASE_LIST_UPDATE);
+  return true;
+}
+
+template <class Key, class Value>
+uint64_t CompactLruCache<Key, Value>::EvictBatch(uint64_t max_num) {
+  uint64_t count = 0;
+  std::vector<Entry> evicted;
+  std::unique_lock list_lock(list_mtx_);
+  while (count < max_num && usage_.load() > capacity_.load()) {
+    auto index = EvictOne(nullptr, evicted);
+    if (index == kNil) {
+      break;
+    }
+    nodes_[index].next = free_head_;
+    free_head_ = index;
+    usage_--;
+    count++;
+  }
+  list_lock.unlock();
+
+  NotifyEvicted(evicted);
+  return count;
+}
+
+template <class Key, class Value>
+void CompactLruCache<Key, Value>::PrintStatus() {
+  uint64_t num_buckets = 1ULL << bucket_bits_;
+  uint64_t bytes = sizeof(Node) * (max_slots_ + 2) +
+                   sizeof(uint32_t) * num_buckets +
+                   sizeof(std::shared_mutex) * kNumLockStripes;
+  printf("compact lru: %lu entries, %.1lf bytes/slot (node: %lu B)\n",
+         usage_.load(), 1.0 * bytes / std::max<uint32_t>(max_slots_, 1),
+         sizeof(Node));
+}
+
+template <class Key, class Value>
+void CompactLruCache<Key, Value>::ForEachEntry(
+    const std::function<void(const Key&, const Value&)>& func) {
+  // Collect the keys under the list lock, then read every value under its
+  // stripe lock, same as 'Lookup' does.
+  std::vector<Key> keys;
+  std::unique_lock list_lock(list_mtx_);
+  keys.reserve(usage_.load());
+  for (auto index = nodes_[head_].next; index != tail_;
+       index = nodes_[index].next) {
+    keys.push_back(nodes_[index].key);
+  }
+  list_lock.unlock();
+
+  for (auto& key : keys) {
+    auto bucket = get_bucket(key);
+    std::shared_lock stripe_lock(get_stripe(bucket));
+    auto index = HashFind(bucket, key);
+    if (index != kNil) {
+      func(key, nodes_[index].value);
+    }
+  }
+}
+
+template <class Key, class Value>
+uint32_t CompactLruCache<Key, Value>::HashFind(uint32_t bucket,
+                                               const Key& key) const {
+  auto index = buckets_[bucket];
+  while (index != kNil && !(nodes_[index].key == key)) {
+    index = nodes_[index].hash_next;
+  }
+  return index;
+}
+
+template <class Key, class Value>
+void CompactLruCache<Key, Value>::HashRemove(uint32_t bucket, uint32_t index) {
+  auto* link = &buckets_[bucket];
+  while (*link != kNil && *link != index) {
+    link = &nodes_[*link].hash_next;
+  }
+  if (*link == index) {
+    *link = nodes_[index].hash_next;
+  }
+  nodes_[index].hash_next = kNil;
+}
+
+template <class Key, class Value>
+void CompactLruCache<Key, Value>::LruAppend(uint32_t index) {
+  auto old_real_head = nodes_[head_].next;
+  nodes_[index].prev = head_;
+  nodes_[index].next = old_real_head;
+  nodes_[old_real_head].prev = index;
+  nodes_[head_].next = index;
+}
+
+template <class Key, class Value>
+void CompactLruCache<Key, Value>::LruRemove(uint32_t index) {
+  auto prev_index = nodes_[index].prev;
+  auto next_index = nodes_[index].next;
+  nodes_[prev_index].next = next_index;
+  nodes_[next_index].prev = prev_index;
+
+  nodes_[index].prev = kNil;
+}
+
+template <class Key, class Value>
+uint32_t CompactLruCache<Key, Value>::EvictOne(std::shared_mutex* held,
+                                               std::vector<Entry>& evicted) {
+  auto remove = [&](uint32_t bucket, uint32_t index) {
+    HashRemove(bucket, index);
+    LruRemove(index);
+    auto& node = nodes_[index];
+    if (Cache<Key, Value>::eviction_callback_) {
+      evicted.emplace_back(node.key, std::move(node.value));
+    }
+    node.value = Value();
+  };
+
+  // The caller holds the list mutex, so there is no wait for it. The probe is
+  // the search for a victim whose stripe is free.
+  PHASE_TIMER_START(timer);
+  auto victim = nodes_[tail_].prev;
+  for (uint32_t i = 0; i < kMaxEvictionTries && victim != head_; i++) {
+    auto bucket = get_bucket(nodes_[victim].key);
+    auto& stripe = get_stripe(bucket);
+    std::unique_lock victim_lock(stripe, std::defer_lock);
+    if (&stripe == held || victim_lock.try_lock()) {
+      PHASE_TIMER_RECORD(timer, EVICT_PROBE);
+      remove(bucket, victim);
+      PHASE_TIMER_RECORD(timer, EVICT_LIST_UPDATE);
+      return victim;
+    }
+    victim = nodes_[victim].prev;
+  }
+  PHASE_TIMER_RECORD(timer, EVICT_PROBE);
+  return kNil;
+}
+
+template <class Key, class Value>
+uint32_t CompactLruCache<Key, Value>::AllocateSlot(
+    std::shared_mutex* held, std::vector<Entry>& evicted) {
+  if (usage_.load() >= capacity_.load()) {
+    return EvictOne(held, evicted);
+  }
+
+  uint32_t index = kNil;
+  if (free_head_ != kNil) {
+    index = free_head_;
+    free_head_ = nodes_[index].next;
+  } else if (next_unused_ < max_slots_) {
+    index = next_unused_++;
+  } else {
+    return EvictOne(held, evicted);
+  }
+  usage_++;
+  return index;
+}
+
+}  // namespace kvcache
+
+#endif
@@ -0,0 +1,104 @@
+#include "compact_lru_cache.h"
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+class CompactLruCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    cache_ = new kvcache::CompactLruCache<uint64_t, uint64_t>(capacity);
+  }
+
+  void TearDown() override { delete cache_; }
+
+ public:
+  bool Insert(uint64_t key, uint64_t value) {
+    return cache_->Insert(key, value);
+  }
+
+  bool Lookup(uint64_t key, uint64_t& value) {
+    return cache_->Lookup(key, value);
+  }
+
+  bool Erase(uint64_t key) { return cache_->Erase(key); }
+
+  uint64_t Size() { return cache_->get_size(); }
+
+ private:
+  uint64_t capacity = 200;
+  kvcache::CompactLruCache<uint64_t, uint64_t>* cache_;
+};
+
+TEST_F(CompactLruCacheTest, HitAndMiss) {
+  uint64_t ret_value = 0;
+  for (uint64_t i = 0; i < 300; i++) {
+    Insert(i, i);
+  }
+  ASSERT_EQ(200, Size());
+
+  ASSERT_EQ(true, Lookup(150, ret_value));
+  ASSERT_EQ(150, ret_value);
+
+  ASSERT_EQ(true, Lookup(299, ret_value));
+  ASSERT_EQ(299, ret_value);
+
+  ASSERT_EQ(false, Lookup(99, ret_value));
+  ASSERT_EQ(false, Lookup(400, ret_value));
+}
+
+TEST_F(CompactLruCacheTest, PromoteUpdateAndErase) {
+  uint64_t ret_value = 0;
+  for (uint64_t i = 0; i < 200; i++) {
+    Insert(i, i);
+  }
+  // 0 becomes the most recently used one, so 1 is evicted instead.
+  ASSERT_EQ(true, Lookup(0, ret_value));
+  Insert(200, 200);
+  ASSERT_EQ(true, Lookup(0, ret_value));
+  ASSERT_EQ(false, Lookup(1, ret_value));
+
+  ASSERT_EQ(false, Insert(0, 1000));
+  ASSERT_EQ(true, Lookup(0, ret_value));
+  ASSERT_EQ(1000, ret_value);
+
+  ASSERT_EQ(true, Erase(0));
+  ASSERT_EQ(false, Erase(0));
+  ASSERT_EQ(false, Lookup(0, ret_value));
+  ASSERT_EQ(199, Size());
+
+  // The erased slot is reused.
+  Insert(201, 201);
+  ASSERT_EQ(200, Size());
+  ASSERT_EQ(true, Lookup(201, ret_value));
+  ASSERT_EQ(true, Lookup(2, ret_value));
+}
+
+TEST_F(CompactLruCacheTest, Concurrency) {
+  auto func = [&](uint64_t start, uint64_t num) {
+    for (uint64_t i = 0; i < num; i++) {
+      uint64_t key = start + i % 300;
+      uint64_t value = 0;
+      if (!Lookup(key, value)) {
+        Insert(key, key);
+      } else {
+        ASSERT_EQ(key, value);
+      }
+    }
+  };
+  std::vector<std::thread> client_vtc;
+  int num_clients = 4;
+  for (int i = 0; i < num_clients; i++) {
+    client_vtc.emplace_back(func, i * 100, 100000);
+  }
+  for (int i = 0; i < num_clients; i++) {
+    client_vtc[i].join();
+  }
+  ASSERT_EQ(200, Size());
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,80 @@
+#ifndef KVCACHE_COMPRESS_UTILS_H
+#define KVCACHE_COMPRESS_UTILS_H
+
+#include <stdint.h>
+
+#include <string>
+
+#if defined(KVCACHE_USE_LZ4)
+#include <lz4.h>
+#elif defined(KVCACHE_USE_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace utils {
+namespace compress {
+
+// Block compression used by the compressed tier. LZ4 is preferred
+// (KVCACHE_USE_LZ4), and zlib is the fallback (KVCACHE_USE_ZLIB). Without
+// either of them, blocks are stored as they are.
+
+inline const char* Name() {
+#if defined(KVCACHE_USE_LZ4)
+  return "lz4";
+#elif defined(KVCACHE_USE_ZLIB)
+  return "zlib";
+#else
+  return "none";
+#endif
+}
+
+// Compress 'size' bytes of 'data' into 'out'.
+inline bool Compress(const char* data, uint64_t size, std::string& out) {
+#if defined(KVCACHE_USE_LZ4)
+  out.resize(LZ4_compressBound(size));
+  int n = LZ4_compress_default(data, out.data(), size, out.size());
+  if (n <= 0) {
+    return false;
+  }
+  out.resize(n);
+#elif defined(KVCACHE_USE_ZLIB)
+  uLongf n = compressBound(size);
+  out.resize(n);
+  if (compress2(reinterpret_cast<Bytef*>(out.data()), &n,
+                reinterpret_cast<const Bytef*>(data), size,
+                Z_BEST_SPEED) != Z_OK) {
+    return false;
+  }
+  out.resize(n);
+#else
+  out.assign(data, size);
+#endif
+  return true;
+}
+
+// Uncompress 'size' bytes of 'data' into 'out', which is 'raw_size' bytes
+// before compression.
+inline bool Uncompress(const char* data, uint64_t size, uint64_t raw_size,
+                       std::string& out) {
+  out.resize(raw_size);
+#if defined(KVCACHE_USE_LZ4)
+  return LZ4_decompress_safe(data, out.data(), size, raw_size) ==
+         static_cast<int>(raw_size);
+#elif defined(KVCACHE_USE_ZLIB)
+  uLongf n = raw_size;
+  return uncompress(reinterpret_cast<Bytef*>(out.data()), &n,
+                    reinterpret_cast<const Bytef*>(data), size) == Z_OK &&
+         n == raw_size;
+#else
+  if (size != raw_size) {
+    return false;
+  }
+  out.assign(data, size);
+  return true;
+#endif
+}
+
+}  // namespace compress
+}  // namespace utils
+
+#endif
@@ -0,0 +1,274 @@
+#ifndef KVCACHE_COMPRESSED_TIER_H
+#define KVCACHE_COMPRESSED_TIER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "compress_utils.h"
+#include "snapshot.h"
+
+namespace kvcache {
+
+// CompressedTier keeps the entries evicted from a shard in compressed blocks,
+// so the same DRAM holds more entries at the cost of a decompression per hit.
+//
+// Records ('key | value length (uint32) | value bytes') are appended into a
+// staging block. Once it reaches 'kBlockSize', the block is compressed as a
+// whole and sealed into the arena. When the arena exceeds its capacity, the
+// oldest blocks are dropped, and their live entries are passed to the
+// eviction callback (e.g. the flash tier).
+//
+// A hit decompresses the block out of the lock. A record that is updated or
+// erased is left in its block as garbage until the block is dropped.
+
+template <class Key, class Value>
+class CompressedTier {
+ private:
+  constexpr static uint64_t kBlockSize = 4 << 10;  // 4KB before compression
+
+  struct Block {
+    uint64_t id;
+    uint32_t raw_size;
+    std::string data;
+    std::vector<Key> keys;
+  };
+
+  struct Location {
+    uint64_t block_id;
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  using BlockPtr = std::shared_ptr<const Block>;
+
+ public:
+  // 'capacity' is the size of the arena in bytes.
+  explicit CompressedTier(uint64_t capacity)
+      : capacity_(capacity),
+        arena_size_(0),
+        next_block_id_(0),
+        raw_bytes_(0),
+        compressed_bytes_(0),
+        num_hits_(0),
+        decompress_nanos_(0) {}
+  CompressedTier(const CompressedTier&) = delete;
+  CompressedTier& operator=(const CompressedTier&) = delete;
+
+  // Called with the live entries of dropped blocks. It must be set before
+  // any request.
+  void SetEvictionCallback(
+      std::function<void(const Key&, const Value&)> callback) {
+    eviction_callback_ = std::move(callback);
+  }
+
+  void Append(const Key& key, const Value& value);
+
+  bool Lookup(const Key& key, Value& value);
+
+  void Erase(const Key& key) {
+    std::unique_lock lock(mtx_);
+    index_.erase(key);
+  }
+
+  void PrintStatus();
+
+ private:
+  // Compress the staging block into the arena, and drop the oldest blocks if
+  // the arena is full. The caller must hold 'mtx_'.
+  void SealBlock(std::vector<BlockPtr>& dropped);
+
+  // Get the live entries of dropped blocks and pass them to the callback.
+  void NotifyDropped(std::vector<BlockPtr>& dropped,
+                     std::vector<std::vector<Location>>& locations);
+
+  static bool DecodeRecord(const Key& key, const char* record, uint32_t size,
+                           Value& value);
+
+ private:
+  const uint64_t capacity_;
+
+  std::mutex mtx_;
+  std::unordered_map<Key, Location> index_;
+
+  // Blocks in the arena, from the oldest one. Block ids are consecutive, and
+  // 'next_block_id_' is the id of the staging block.
+  std::deque<BlockPtr> blocks_;
+  uint64_t arena_size_;
+  uint64_t next_block_id_;
+  std::string staging_;
+  std::vector<Key> staging_keys_;
+
+  std::function<void(const Key&, const Value&)> eviction_callback_;
+
+  std::atomic<uint64_t> raw_bytes_;
+  std::atomic<uint64_t> compressed_bytes_;
+  std::atomic<uint64_t> num_hits_;
+  std::atomic<uint64_t> decompress_nanos_;
+};
+
+template <class Key, class Value>
+void CompressedTier<Key, Value>::Append(const Key& key, const Value& value) {
+  std::string record;
+  record.append(reinterpret_cast<const char*>(&key), sizeof(Key));
+  SnapshotCodec<Value>::Encode(value, record);
+
+  std::vector<BlockPtr> dropped;
+  std::vector<std::vector<Location>> locations;
+  std::unique_lock lock(mtx_);
+  index_[key] = Location{next_block_id_, static_cast<uint32_t>(staging_.size()),
+                         static_cast<uint32_t>(record.size())};
+  staging_.append(record);
+  staging_keys_.push_back(key);
+  arena_size_ += record.size();
+  if (staging_.size() >= kBlockSize) {
+    SealBlock(dropped);
+  }
+  if (dropped.empty()) {
+    return;
+  }
+
+  // Collect the live entries before unlocking, the decompression is done
+  // outside the lock.
+  locations.resize(dropped.size());
+  for (size_t i = 0; i < dropped.size(); i++) {
+    for (auto& k : dropped[i]->keys) {
+      auto iter = index_.find(k);
+      if (iter != index_.end() && iter->second.block_id == dropped[i]->id) {
+        locations[i].push_back(iter->second);
+        index_.erase(iter);
+      }
+    }
+  }
+  lock.unlock();
+
+  if (eviction_callback_) {
+    NotifyDropped(dropped, locations);
+  }
+}
+
+template <class Key, class Value>
+void CompressedTier<Key, Value>::SealBlock(std::vector<BlockPtr>& dropped) {
+  auto block = std::make_shared<Block>();
+  block->id = next_block_id_++;
+  block->raw_size = staging_.size();
+  if (!utils::compress::Compress(staging_.data(), staging_.size(),
+                                 block->data)) {
+    block->data.clear();
+  }
+  block->keys.swap(staging_keys_);
+
+  raw_bytes_ += staging_.size();
+  compressed_bytes_ += block->data.size();
+  arena_size_ = arena_size_ - staging_.size() + block->data.size();
+  staging_.clear();
+  blocks_.push_back(block);
+
+  while (arena_size_ > capacity_ && !blocks_.empty()) {
+    auto victim = blocks_.front();
+    blocks_.pop_front();
+    arena_size_ -= victim->data.size();
+    dropped.push_back(victim);
+  }
+}
+
+template <class Key, class Value>
+void CompressedTier<Key, Value>::NotifyDropped(
+    std::vector<BlockPtr>& dropped,
+    std::vector<std::vector<Location>>& locations) {
+  std::string raw;
+  for (size_t i = 0; i < dropped.size(); i++) {
+    auto& block = dropped[i];
+    if (locations[i].empty() ||
+        !utils::compress::Uncompress(block->data.data(), block->data.size(),
+                                     block->raw_size, raw)) {
+      continue;
+    }
+    for (auto& loc : locations[i]) {
+      Key key;
+      Value value;
+      memcpy(&key, raw.data() + loc.offset, sizeof(Key));
+      if (DecodeRecord(key, raw.data() + loc.offset, loc.size, value)) {
+        eviction_callback_(key, value);
+      }
+    }
+  }
+}
+
+template <class Key, class Value>
+bool CompressedTier<Key, Value>::Lookup(const Key& key, Value& value) {
+  std::unique_lock lock(mtx_);
+  auto iter = index_.find(key);
+  if (iter == index_.end()) {
+    return false;
+  }
+  auto loc = iter->second;
+  if (loc.block_id == next_block_id_) {
+    // Still in the staging block.
+    return DecodeRecord(key, staging_.data() + loc.offset, loc.size, value);
+  }
+  auto block = blocks_[loc.block_id - blocks_.front()->id];
+  lock.unlock();
+
+  auto start_time = std::chrono::steady_clock::now();
+  std::string raw;
+  bool ok = utils::compress::Uncompress(block->data.data(), block->data.size(),
+                                        block->raw_size, raw) &&
+            DecodeRecord(key, raw.data() + loc.offset, loc.size, value);
+  decompress_nanos_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start_time)
+                           .count();
+  num_hits_++;
+  return ok;
+}
+
+template <class Key, class Value>
+bool CompressedTier<Key, Value>::DecodeRecord(const Key& key,
+                                              const char* record,
+                                              uint32_t size, Value& value) {
+  const uint64_t header_size = sizeof(Key) + sizeof(uint32_t);
+  if (size < header_size || memcmp(record, &key, sizeof(Key)) != 0) {
+    return false;
+  }
+  uint32_t len;
+  memcpy(&len, record + sizeof(Key), sizeof(len));
+  uint64_t data_len = len == kSnapshotNullLength ? 0 : len;
+  if (size != header_size + data_len) {
+    return false;
+  }
+  return SnapshotCodec<Value>::Decode(record + header_size, len, value);
+}
+
+template <class Key, class Value>
+void CompressedTier<Key, Value>::PrintStatus() {
+  std::unique_lock lock(mtx_);
+  auto num_entries = index_.size();
+  auto num_blocks = blocks_.size();
+  auto arena_size = arena_size_;
+  lock.unlock();
+
+  auto compressed = compressed_bytes_.load();
+  auto hits = num_hits_.load();
+  printf(
+      "compressed tier (%s): %lu entries, %lu blocks, %.1lf MB, "
+      "compression ratio: %.2lf, %lu hits, avg. decompression: %.2lf us\n",
+      utils::compress::Name(), num_entries, num_blocks,
+      1.0 * arena_size / (1 << 20),
+      compressed ? 1.0 * raw_bytes_.load() / compressed : 1.0, hits,
+      hits ? decompress_nanos_.load() / 1000.0 / hits : 0.0);
+}
+
+}  // namespace kvcache
+
+#endif
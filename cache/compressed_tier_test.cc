@@ -0,0 +1,174 @@
+#include "compressed_tier.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "lru_cache.h"
+#include "scalable_cache.h"
+
+using StringTier =
+    kvcache::CompressedTier<uint64_t, std::shared_ptr<std::string>>;
+
+TEST(CompressedTierTest, AppendLookupAndErase) {
+  StringTier tier(1 << 20);
+  // About 170 blocks, all of them fit in the arena after compression.
+  for (uint64_t i = 0; i < 5000; i++) {
+    tier.Append(i, std::make_shared<std::string>(128, 'a' + i % 26));
+  }
+  tier.Append(5000, nullptr);
+
+  std::shared_ptr<std::string> value;
+  // In a sealed block.
+  ASSERT_TRUE(tier.Lookup(0, value));
+  ASSERT_EQ(std::string(128, 'a'), *value);
+  ASSERT_TRUE(tier.Lookup(1234, value));
+  ASSERT_EQ(std::string(128, 'a' + 1234 % 26), *value);
+  // In the staging block.
+  ASSERT_TRUE(tier.Lookup(5000, value));
+  ASSERT_EQ(nullptr, value);
+
+  // The newer copy wins.
+  tier.Append(1234, std::make_shared<std::string>("new"));
+  ASSERT_TRUE(tier.Lookup(1234, value));
+  ASSERT_EQ("new", *value);
+
+  tier.Erase(1234);
+  ASSERT_FALSE(tier.Lookup(1234, value));
+  ASSERT_FALSE(tier.Lookup(6000, value));
+}
+
+TEST(CompressedTierTest, DropOldestBlocks) {
+  kvcache::CompressedTier<uint64_t, uint64_t> tier(64 << 10);
+  uint64_t num_dropped = 0;
+  tier.SetEvictionCallback([&](const uint64_t& key, const uint64_t& value) {
+    ASSERT_EQ(key * 10, value);
+    num_dropped++;
+  });
+  // Records are 20 bytes, and the values don't compress well.
+  for (uint64_t i = 0; i < 100000; i++) {
+    tier.Append(i, i * 10);
+  }
+  tier.Erase(99999);
+
+  uint64_t value = 0;
+  ASSERT_FALSE(tier.Lookup(0, value));
+  ASSERT_TRUE(tier.Lookup(99998, value));
+  ASSERT_EQ(999980, value);
+  ASSERT_GT(num_dropped, 0);
+}
+
+TEST(CompressedTierTest, HoldShardEvictions) {
+  kvcache::CompressedTier<uint64_t, uint64_t> tier(1 << 20);
+  kvcache::LruCache<uint64_t, uint64_t> cache(100);
+  cache.SetEvictionCallback([&](const uint64_t& key, const uint64_t& value) {
+    tier.Append(key, value);
+  });
+  for (uint64_t i = 0; i < 300; i++) {
+    cache.Insert(i, i * 10);
+  }
+
+  uint64_t value = 0;
+  for (uint64_t i = 0; i < 200; i++) {
+    ASSERT_FALSE(cache.Lookup(i, value));
+    ASSERT_TRUE(tier.Lookup(i, value));
+    ASSERT_EQ(i * 10, value);
+  }
+  ASSERT_FALSE(tier.Lookup(250, value));
+}
+
+TEST(CompressedTierTest, PromotionCountsAsHit) {
+  kvcache::CompressedTier<uint64_t, uint64_t> tier(1 << 20);
+  kvcache::LruCache<uint64_t, uint64_t> cache(100);
+  cache.SetEvictionCallback([&](const uint64_t& key, const uint64_t& value) {
+    tier.Append(key, value);
+  });
+  for (uint64_t i = 0; i < 300; i++) {
+    cache.Insert(i, i * 10);
+  }
+  auto stats = cache.get_stats();
+  ASSERT_EQ(300, stats->GetTickerCount(kvcache::Tickers::INSERT));
+
+  uint64_t value = 0;
+  ASSERT_TRUE(tier.Lookup(0, value));
+  tier.Erase(0);
+  ASSERT_TRUE(cache.Promote(0, value));
+  ASSERT_EQ(300, stats->GetTickerCount(kvcache::Tickers::INSERT));
+  ASSERT_TRUE(cache.Lookup(0, value));
+  ASSERT_EQ(0, value);
+  // The promotion evicted the oldest entry.
+  ASSERT_TRUE(tier.Lookup(200, value));
+}
+
+TEST(CompressedTierTest, ShardsKeepDepth) {
+  kvcache::ConcurrentScalableCache<uint64_t, uint64_t> cache(
+      1000, 2, kvcache::CacheType::LRU);
+  cache.EnableCompressedTier(100, 1 << 20);
+  for (uint64_t i = 0; i < 1000; i++) {
+    cache.Insert(i, i * 10);
+  }
+  ASSERT_EQ(100, cache.get_size());
+  // Growing the cache does not grow the shards past the depth.
+  cache.SetCapacity(2000);
+  for (uint64_t i = 1000; i < 1100; i++) {
+    cache.Insert(i, i * 10);
+  }
+  ASSERT_EQ(100, cache.get_size());
+
+  uint64_t value = 0;
+  for (uint64_t i = 0; i < 1100; i++) {
+    ASSERT_TRUE(cache.Lookup(i, value));
+    ASSERT_EQ(i * 10, value);
+  }
+}
+
+TEST(CompressedTierTest, PromotionKeepsNewerWrites) {
+  kvcache::ConcurrentScalableCache<uint64_t, uint64_t> cache(
+      64, 1, kvcache::CacheType::LRU);
+  cache.EnableCompressedTier(64, 1 << 20);
+  // The writer writes increasing values of a few keys, and evicts them into
+  // the tier with fillers, while the readers promote them back.
+  const uint64_t num_keys = 8;
+  const uint64_t num_writes = 20000;
+  std::atomic<bool> stop = false;
+  std::atomic<uint64_t> errors = 0;
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 2; t++) {
+    readers.emplace_back([&] {
+      std::vector<uint64_t> last(num_keys, 0);
+      while (!stop.load()) {
+        for (uint64_t key = 0; key < num_keys; key++) {
+          uint64_t value = 0;
+          if (cache.Lookup(key, value)) {
+            if (value < last[key]) {
+              errors++;
+            }
+            last[key] = value;
+          }
+        }
+      }
+    });
+  }
+  for (uint64_t i = 1; i <= num_writes; i++) {
+    cache.Insert(i % num_keys, i);
+    cache.Insert(num_keys + i, 0);
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  ASSERT_EQ(0, errors.load());
+  for (uint64_t key = 0; key < num_keys; key++) {
+    uint64_t value = 0;
+    ASSERT_TRUE(cache.Lookup(key, value));
+    ASSERT_EQ(num_writes - (num_writes - key) % num_keys, value);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,180 @@
+#ifndef KVCACHE_EPOCH_H
+#define KVCACHE_EPOCH_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+// EpochManager reclaims memory that lock-free readers may still be reading,
+// e.g. a table that was replaced by a new one.
+//
+// A reader holds a 'Guard' while it reads the shared memory, which counts it
+// in the current epoch. A writer first unpublishes the memory (so that the
+// readers after it can't reach it), then either waits for the readers that
+// may have reached it ('Synchronize'), or hands it over ('Retire') to be
+// freed once they are gone, without blocking.
+//
+// The epoch only advances once the readers of the last one have left, so
+// readers are counted by the parity of their epoch, in one of 'kNumSlots'
+// slots, which threads share. A guard costs an atomic increment and
+// decrement of the slot, and it may be nested.
+
+class EpochManager {
+ public:
+  class Guard {
+   public:
+    explicit Guard(EpochManager* manager) {
+      auto& slot = manager->slots_[SlotIndex()];
+      while (true) {
+        uint64_t epoch = manager->epoch_.load();
+        counter_ = &slot.readers[epoch & 1];
+        counter_->fetch_add(1);
+        // A writer that advanced the epoch before the increment may not
+        // have seen it, so the reader moves to the new epoch.
+        if (manager->epoch_.load() == epoch) {
+          return;
+        }
+        counter_->fetch_sub(1, std::memory_order_release);
+      }
+    }
+    ~Guard() { counter_->fetch_sub(1, std::memory_order_release); }
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+   private:
+    std::atomic<uint64_t>* counter_;
+  };
+
+  EpochManager() = default;
+  EpochManager(const EpochManager&) = delete;
+  EpochManager& operator=(const EpochManager&) = delete;
+  // No reader may be left.
+  ~EpochManager() {
+    for (auto& [epoch, deleter] : retired_) {
+      deleter();
+    }
+  }
+
+  Guard Protect() { return Guard(this); }
+
+  // Wait until the readers that entered before the call have left.
+  void Synchronize();
+
+  // Call 'deleter' once the readers that entered before the call have left.
+  // It runs in a later 'Retire', 'Reclaim' or 'Synchronize'.
+  void Retire(std::function<void()> deleter) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    retired_.emplace_back(epoch_.load(), std::move(deleter));
+    ReclaimLocked(lock);
+  }
+
+  // Run the deleters whose readers have left, without waiting for the
+  // others.
+  void Reclaim() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ReclaimLocked(lock);
+  }
+
+  // Number of deleters that haven't run yet.
+  size_t pending() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return retired_.size();
+  }
+
+ private:
+  constexpr static uint32_t kNumSlots = 64;
+
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> readers[2] = {};
+  };
+
+  static uint32_t SlotIndex() {
+    static thread_local uint32_t index = next_slot_++ % kNumSlots;
+    return index;
+  }
+
+  // Return whether the readers of the epochs before the current one have
+  // left. Called with 'mutex_'.
+  bool Poll() {
+    uint64_t epoch = epoch_.load();
+    if (drained_ < epoch) {
+      for (auto& slot : slots_) {
+        if (slot.readers[(epoch - 1) & 1].load() != 0) {
+          return false;
+        }
+      }
+      drained_ = epoch;
+    }
+    return true;
+  }
+
+  // Advance the epoch if the deleters of the current one are waiting for it,
+  // and run the ones whose readers have left. Called with 'lock' held, which
+  // is released while the deleters run.
+  void ReclaimLocked(std::unique_lock<std::mutex>& lock) {
+    if (Poll() && !retired_.empty() && retired_.back().first == drained_) {
+      epoch_.store(drained_ + 1);
+      Poll();
+    }
+    RunDeleters(lock);
+  }
+
+  void RunDeleters(std::unique_lock<std::mutex>& lock) {
+    std::vector<std::function<void()>> deleters;
+    size_t num = 0;
+    while (num < retired_.size() && retired_[num].first < drained_) {
+      deleters.push_back(std::move(retired_[num].second));
+      num++;
+    }
+    if (num == 0) {
+      return;
+    }
+    retired_.erase(retired_.begin(), retired_.begin() + num);
+    lock.unlock();
+    for (auto& deleter : deleters) {
+      deleter();
+    }
+    lock.lock();
+  }
+
+  inline static std::atomic<uint32_t> next_slot_{0};
+
+  Slot slots_[kNumSlots];
+  std::atomic<uint64_t> epoch_{0};
+  // Writers only, under 'mutex_': the readers of the epochs before it have
+  // left, and the deleters in the order of their epoch.
+  std::mutex mutex_;
+  uint64_t drained_ = 0;
+  std::vector<std::pair<uint64_t, std::function<void()>>> retired_;
+};
+
+inline void EpochManager::Synchronize() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // The readers before the call are in this epoch or the last one.
+  uint64_t target = epoch_.load() + 1;
+  while (true) {
+    bool drained = Poll();
+    if (drained_ >= target) {
+      break;
+    }
+    if (drained) {
+      epoch_.store(drained_ + 1);
+      continue;
+    }
+    lock.unlock();
+    std::this_thread::yield();
+    lock.lock();
+  }
+  RunDeleters(lock);
+}
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,122 @@
+#include "epoch.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using utils::EpochManager;
+
+TEST(EpochManagerTest, RetireWaitsForReaders) {
+  EpochManager epoch;
+  int freed = 0;
+  {
+    auto guard = epoch.Protect();
+    epoch.Retire([&] { freed++; });
+    epoch.Reclaim();
+    ASSERT_EQ(0, freed);
+    ASSERT_EQ(1, epoch.pending());
+    // A nested guard doesn't hold the epoch any longer.
+    { auto nested = epoch.Protect(); }
+    epoch.Reclaim();
+    ASSERT_EQ(0, freed);
+  }
+  epoch.Reclaim();
+  ASSERT_EQ(1, freed);
+  ASSERT_EQ(0, epoch.pending());
+
+  // Without readers, a retired deleter runs right away.
+  epoch.Retire([&] { freed++; });
+  ASSERT_EQ(2, freed);
+  epoch.Retire([&] { freed++; });
+  ASSERT_EQ(3, freed);
+
+  // The ones left run with the manager.
+  {
+    EpochManager other;
+    {
+      auto guard = other.Protect();
+      other.Retire([&] { freed++; });
+    }
+    ASSERT_EQ(3, freed);
+  }
+  ASSERT_EQ(4, freed);
+}
+
+TEST(EpochManagerTest, SynchronizeWaitsForReaders) {
+  EpochManager epoch;
+  std::atomic<bool> entered = false;
+  std::atomic<bool> left = false;
+  std::thread reader([&] {
+    auto guard = epoch.Protect();
+    entered = true;
+    usleep(50000);
+    left = true;
+  });
+  while (!entered.load()) {
+    std::this_thread::yield();
+  }
+  epoch.Synchronize();
+  ASSERT_TRUE(left.load());
+  reader.join();
+  epoch.Synchronize();
+}
+
+TEST(EpochManagerTest, Stress) {
+  struct Object {
+    std::atomic<uint64_t> magic{42};
+  };
+  EpochManager epoch;
+  std::atomic<Object*> current{new Object()};
+  // Retired objects are cleared instead of freed, so that a reader that
+  // reads one too late sees it.
+  std::vector<std::unique_ptr<Object>> freed;
+  std::mutex freed_mtx;
+  std::atomic<bool> stop = false;
+  std::atomic<uint64_t> errors = 0;
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back([&] {
+      while (!stop.load()) {
+        auto guard = epoch.Protect();
+        auto object = current.load(std::memory_order_acquire);
+        for (int j = 0; j < 10; j++) {
+          if (object->magic.load(std::memory_order_relaxed) != 42) {
+            errors++;
+          }
+        }
+      }
+    });
+  }
+  for (int i = 0; i < 20000; i++) {
+    auto old = current.exchange(new Object(), std::memory_order_acq_rel);
+    auto deleter = [&, old] {
+      old->magic = 0;
+      std::lock_guard<std::mutex> lock(freed_mtx);
+      freed.emplace_back(old);
+    };
+    if (i % 2 == 0) {
+      epoch.Retire(deleter);
+    } else {
+      epoch.Synchronize();
+      deleter();
+    }
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  epoch.Synchronize();
+  ASSERT_EQ(0, errors.load());
+  ASSERT_EQ(0, epoch.pending());
+  ASSERT_EQ(20000, freed.size());
+  delete current.load();
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -4,9 +4,11 @@
 
 #include <atomic>
 #include <mutex>
+#include <vector>
 
 #include "cache.h"
 #include "options.h"
+#include "phase_timer.h"
 #include "tbb/concurrent_hash_map.h"
 
 namespace kvcache {
@@ -71,13 +73,22 @@ class FifoCache : public Cache<Key, Value> {
 
   virtual bool is_full() override { return usage_.load() >= capacity_; }
 
+  virtual void SetCapacity(uint64_t capacity) override {
+    capacity_.store(capacity);
+  }
+
+  virtual uint64_t EvictBatch(uint64_t max_num) override;
+
+  virtual void ForEachEntry(
+      const std::function<void(const Key&, const Value&)>& func) override;
+
  private:
   void ListRemove(ListNode* node);
   void ListPushFront(ListNode* node);
-  void EvictOne();
+  bool EvictOne();
 
  private:
-  const uint64_t capacity_;
+  std::atomic<uint64_t> capacity_;
   std::atomic<uint64_t> usage_;
 
   HashMap m_map;
@@ -85,7 +96,9 @@ class FifoCache : public Cache<Key, Value> {
   ListNode m_head;
   ListNode m_tail;
 
-  std::mutex m_list_mtx;
+  CountedMutex m_list_mtx{Cache<Key, Value>::get_stats(),
+                          Tickers::LIST_LOCK_ACQUIRE,
+                          Tickers::LIST_LOCK_CONTENDED};
 };
 
 template <class Key, class Value>
@@ -102,8 +115,11 @@ FifoCache<Key, Value>::FifoCache(uint64_t capacity)
 
 template <class Key, class Value>
 bool FifoCache<Key, Value>::Lookup(Key key, Value& value) {
+  PHASE_TIMER_START(timer);
   HashMapConstAccessor hash_accessor;
-  if (!m_map.find(hash_accessor, key)) {
+  bool found = m_map.find(hash_accessor, key);
+  PHASE_TIMER_RECORD(timer, LOOKUP_PROBE);
+  if (!found) {
     Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_MISS);
     return false;
   }
@@ -119,10 +135,14 @@ bool FifoCache<Key, Value>::Insert(Key key, const Value& value) {
     Cache<Key, Value>::stats.RecordTick(Tickers::INSERT);
   }
 
+  PHASE_TIMER_START(timer);
   auto node = new ListNode(key);
+  PHASE_TIMER_RECORD(timer, INSERT_ALLOC);
   HashMapAccessor hash_accessor;
   HashMapValuePair value_pair(key, HashMapValue(value, node));
-  if (!m_map.insert(hash_accessor, value_pair)) {
+  bool inserted = m_map.insert(hash_accessor, value_pair);
+  PHASE_TIMER_RECORD(timer, INSERT_PROBE);
+  if (!inserted) {
     // update value
     hash_accessor->second.m_value = value;
     delete node;
@@ -135,13 +155,16 @@ bool FifoCache<Key, Value>::Insert(Key key, const Value& value) {
   if (s >= capacity_) {
     EvictOne();
     done = true;
+    PHASE_TIMER_RECORD(timer, INSERT_EVICT);
   }
 
   // Note that we have to update the lru list before we increase 'usage_', so
   // that other threads don't attempt to evict list items.
   std::unique_lock list_lock(m_list_mtx);
+  PHASE_TIMER_RECORD(timer, INSERT_LIST_WAIT);
   ListPushFront(node);
   list_lock.unlock();
+  PHASE_TIMER_RECORD(timer, INSERT_LIST_UPDATE);
 
   if (!done) {
     usage_++;
@@ -160,6 +183,7 @@ bool FifoCache<Key, Value>::Insert(Key key, const Value& value) {
     // one extra element per insert() until the overfill is rectified.
     if (usage_.compare_exchange_strong(s, s - 1)) {
       EvictOne();
+      PHASE_TIMER_RECORD(timer, INSERT_EVICT);
     }
   }
   return true;
@@ -167,16 +191,21 @@ bool FifoCache<Key, Value>::Insert(Key key, const Value& value) {
 
 template <class Key, class Value>
 bool FifoCache<Key, Value>::Erase(Key key) {
+  PHASE_TIMER_START(timer);
   HashMapAccessor accessor;
-  if (!m_map.find(accessor, key)) {
+  bool found = m_map.find(accessor, key);
+  PHASE_TIMER_RECORD(timer, ERASE_PROBE);
+  if (!found) {
     return false;
   }
 
   // Remove target node from list.
   std::unique_lock list_lock(m_list_mtx);
+  PHASE_TIMER_RECORD(timer, ERASE_LIST_WAIT);
   auto node = reinterpret_cast<ListNode*>(accessor->second.m_list_node);
   ListRemove(node);
   list_lock.unlock();
+  PHASE_TIMER_RECORD(timer, ERASE_LIST_UPDATE);
 
   m_map.erase(accessor);
   delete node;
@@ -185,24 +214,73 @@ bool FifoCache<Key, Value>::Erase(Key key) {
 }
 
 template <class Key, class Value>
-void FifoCache<Key, Value>::EvictOne() {
+uint64_t FifoCache<Key, Value>::EvictBatch(uint64_t max_num) {
+  uint64_t count = 0;
+  while (count < max_num) {
+    uint64_t s = usage_.load();
+    if (s <= capacity_.load()) {
+      break;
+    }
+    if (!usage_.compare_exchange_strong(s, s - 1)) {
+      continue;
+    }
+    if (!EvictOne()) {
+      usage_++;
+      break;
+    }
+    count++;
+  }
+  return count;
+}
+
+template <class Key, class Value>
+void FifoCache<Key, Value>::ForEachEntry(
+    const std::function<void(const Key&, const Value&)>& func) {
+  // The newest entry is at the head of the list.
+  std::vector<Key> keys;
+  std::unique_lock list_lock(m_list_mtx);
+  keys.reserve(usage_.load());
+  for (auto node = m_head.m_next; node != &m_tail; node = node->m_next) {
+    keys.push_back(node->m_key);
+  }
+  list_lock.unlock();
+
+  for (auto& key : keys) {
+    HashMapConstAccessor hash_accessor;
+    if (m_map.find(hash_accessor, key)) {
+      func(key, hash_accessor->second.m_value);
+    }
+  }
+}
+
+template <class Key, class Value>
+bool FifoCache<Key, Value>::EvictOne() {
+  PHASE_TIMER_START(timer);
   std::unique_lock list_lock(m_list_mtx);
+  PHASE_TIMER_RECORD(timer, EVICT_LIST_WAIT);
   ListNode* node = m_tail.m_prev;
   if (node == &m_head) {
     printf("List is empty!\n");
-    return;
+    return false;
   }
   ListRemove(node);
   list_lock.unlock();
+  PHASE_TIMER_RECORD(timer, EVICT_LIST_UPDATE);
 
   HashMapAccessor hash_accessor;
-  if (!m_map.find(hash_accessor, node->m_key)) {
+  bool found = m_map.find(hash_accessor, node->m_key);
+  PHASE_TIMER_RECORD(timer, EVICT_PROBE);
+  if (!found) {
     printf("m_key: %ld Presumably unreachable\n", node->m_key);
-    return;
+    return false;
+  }
+  if (Cache<Key, Value>::eviction_callback_) {
+    Cache<Key, Value>::eviction_callback_(node->m_key,
+                                          hash_accessor->second.m_value);
   }
   m_map.erase(hash_accessor);
   delete node;
-  return;
+  return true;
 }
 
 template <class Key, class Value>
@@ -0,0 +1,368 @@
+#ifndef KVCACHE_FLASH_TIER_H
+#define KVCACHE_FLASH_TIER_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "snapshot.h"
+#include "tbb/concurrent_hash_map.h"
+#include "utils.h"
+
+namespace kvcache {
+
+// FlashTier keeps the entries evicted from DRAM in a circular log on a local
+// file, so a DRAM miss can be served at flash latency instead of the backend
+// latency.
+//
+// Records ('key | value length (uint32) | value bytes') are appended into an
+// in-memory block. Once it is full, it is handed over to a background writer,
+// which writes it to the file as a whole (with O_DIRECT if the file system
+// supports it), while the appends go on in a second block. An append only
+// waits for the writer if it is a whole block behind. A record never spans two
+// blocks. When the log wraps around, the oldest block is reused, and the index
+// entries still pointing into it are dropped.
+//
+// The index maps a key to the log sequence number (LSN) of its record, which
+// grows monotonically; the file offset is 'lsn % file_size_'. A read from the
+// file is validated against the LSN of the block being written after the read,
+// so a reader never returns a block that was overwritten during the read.
+
+template <class Key, class Value>
+class FlashTier {
+ private:
+  constexpr static uint64_t kBlockSize = 1 << 20;  // 1MB
+  constexpr static uint64_t kAlignment = 4096;
+
+  struct Location {
+    uint64_t lsn;
+    uint32_t size;
+  };
+
+  using Index = tbb::concurrent_hash_map<Key, Location>;
+  using IndexConstAccessor = typename Index::const_accessor;
+  using IndexAccessor = typename Index::accessor;
+
+ public:
+  // 'capacity' is the size of the log file in bytes, rounded down to blocks.
+  FlashTier(const std::string& path, uint64_t capacity);
+  FlashTier(const FlashTier&) = delete;
+  FlashTier& operator=(const FlashTier&) = delete;
+  ~FlashTier();
+
+  bool Open();
+
+  // Write an evicted entry to the log. Entries larger than a block are
+  // dropped.
+  void Append(const Key& key, const Value& value);
+
+  bool Lookup(const Key& key, Value& value);
+
+  // Drop the copy of 'key', e.g. when DRAM holds a newer value.
+  void Erase(const Key& key) {
+    if (index_.size() != 0) {
+      index_.erase(key);
+    }
+  }
+
+  void PrintStatus();
+
+ private:
+  uint64_t get_block(uint64_t lsn) const {
+    return (lsn / kBlockSize) % num_blocks_;
+  }
+
+  uint64_t get_offset(uint64_t lsn) const { return lsn % file_size_; }
+
+  // Hand the active block over to the writer, and start a new one. The last
+  // one must be written already. The caller must hold 'append_mtx_'.
+  void SealBlock();
+
+  // Write the sealed blocks to the file until 'stop_'.
+  void WriterWorker();
+
+  bool ReadRecord(const Location& loc, std::string& record);
+
+  bool DecodeRecord(const Key& key, const std::string& record, Value& value);
+
+ private:
+  const std::string path_;
+  const uint64_t num_blocks_;
+  const uint64_t file_size_;
+  int fd_;
+
+  Index index_;
+
+  // The block being filled, and its LSN. The block before it is being
+  // written from 'flushing_' while 'flush_pending_', and the ones before are
+  // on the file.
+  std::mutex append_mtx_;
+  char* active_;
+  uint64_t active_used_;
+  std::atomic<uint64_t> active_lsn_;
+
+  // The writer and its state, protected by 'append_mtx_'. 'writer_cv_'
+  // wakes the writer up for a sealed block, and 'flushed_cv_' the appends
+  // that wait for it.
+  char* flushing_;
+  bool flush_pending_;
+  bool stop_;
+  std::condition_variable writer_cv_;
+  std::condition_variable flushed_cv_;
+  std::thread writer_;
+
+  // Keys appended into each block, used to clean up the index when the block
+  // is reused. Protected by 'append_mtx_'.
+  std::vector<std::vector<Key>> block_keys_;
+
+  std::atomic<uint64_t> num_appends_;
+  std::atomic<uint64_t> num_dropped_;
+  std::atomic<uint64_t> num_blocks_written_;
+  std::atomic<uint64_t> num_stalls_;
+  std::atomic<uint64_t> num_reads_;
+  std::atomic<uint64_t> read_micros_;
+};
+
+template <class Key, class Value>
+FlashTier<Key, Value>::FlashTier(const std::string& path, uint64_t capacity)
+    : path_(path),
+      num_blocks_(std::max<uint64_t>(capacity / kBlockSize, 2)),
+      file_size_(num_blocks_ * kBlockSize),
+      fd_(-1),
+      active_(nullptr),
+      active_used_(0),
+      active_lsn_(0),
+      flushing_(nullptr),
+      flush_pending_(false),
+      stop_(false),
+      block_keys_(num_blocks_),
+      num_appends_(0),
+      num_dropped_(0),
+      num_blocks_written_(0),
+      num_stalls_(0),
+      num_reads_(0),
+      read_micros_(0) {}
+
+template <class Key, class Value>
+FlashTier<Key, Value>::~FlashTier() {
+  if (writer_.joinable()) {
+    std::unique_lock append_lock(append_mtx_);
+    stop_ = true;
+    append_lock.unlock();
+    writer_cv_.notify_one();
+    writer_.join();
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  free(active_);
+  free(flushing_);
+}
+
+template <class Key, class Value>
+bool FlashTier<Key, Value>::Open() {
+  fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0644);
+  if (fd_ < 0 && errno == EINVAL) {
+    printf("flash tier: O_DIRECT is not supported on %s\n", path_.c_str());
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+  }
+  if (fd_ < 0 || ftruncate(fd_, file_size_) != 0) {
+    printf("fail to open flash tier %s: %s\n", path_.c_str(), strerror(errno));
+    return false;
+  }
+  active_ = static_cast<char*>(aligned_alloc(kAlignment, kBlockSize));
+  flushing_ = static_cast<char*>(aligned_alloc(kAlignment, kBlockSize));
+  if (active_ == nullptr || flushing_ == nullptr) {
+    printf("fail to allocate the blocks of flash tier %s\n", path_.c_str());
+    return false;
+  }
+  memset(active_, 0, kBlockSize);
+  writer_ = std::thread(&FlashTier::WriterWorker, this);
+  printf("flash tier: %s, %lu MB\n", path_.c_str(), file_size_ >> 20);
+  return true;
+}
+
+template <class Key, class Value>
+void FlashTier<Key, Value>::Append(const Key& key, const Value& value) {
+  std::string record;
+  record.append(reinterpret_cast<const char*>(&key), sizeof(Key));
+  SnapshotCodec<Value>::Encode(value, record);
+  if (record.size() > kBlockSize) {
+    num_dropped_++;
+    return;
+  }
+
+  std::unique_lock append_lock(append_mtx_);
+  while (active_used_ + record.size() > kBlockSize) {
+    if (!flush_pending_) {
+      SealBlock();
+      break;
+    }
+    // The writer is a whole block behind.
+    num_stalls_++;
+    flushed_cv_.wait(append_lock, [this] { return !flush_pending_; });
+  }
+  auto lsn = active_lsn_.load() + active_used_;
+  memcpy(active_ + active_used_, record.data(), record.size());
+  active_used_ += record.size();
+  block_keys_[get_block(lsn)].push_back(key);
+
+  IndexAccessor accessor;
+  index_.insert(accessor, key);
+  accessor->second = Location{lsn, static_cast<uint32_t>(record.size())};
+  num_appends_++;
+}
+
+template <class Key, class Value>
+void FlashTier<Key, Value>::SealBlock() {
+  auto lsn = active_lsn_.load();
+  memset(active_ + active_used_, 0, kBlockSize - active_used_);
+  std::swap(active_, flushing_);
+  flush_pending_ = true;
+  writer_cv_.notify_one();
+  active_used_ = 0;
+  lsn += kBlockSize;
+  active_lsn_.store(lsn);
+
+  // The new active block reuses the oldest block on the file.
+  auto& keys = block_keys_[get_block(lsn)];
+  if (lsn >= file_size_) {
+    auto old_lsn = lsn - file_size_;
+    for (auto& key : keys) {
+      IndexAccessor accessor;
+      if (index_.find(accessor, key) && accessor->second.lsn >= old_lsn &&
+          accessor->second.lsn < old_lsn + kBlockSize) {
+        index_.erase(accessor);
+      }
+    }
+  }
+  keys.clear();
+}
+
+template <class Key, class Value>
+void FlashTier<Key, Value>::WriterWorker() {
+  std::unique_lock append_lock(append_mtx_);
+  while (true) {
+    writer_cv_.wait(append_lock, [this] { return flush_pending_ || stop_; });
+    if (!flush_pending_) {
+      return;
+    }
+    // The appends go on in the active block meanwhile, and neither buffer
+    // is swapped until the write is done.
+    auto offset = get_offset(active_lsn_.load() - kBlockSize);
+    append_lock.unlock();
+    if (pwrite(fd_, flushing_, kBlockSize, offset) !=
+        static_cast<ssize_t>(kBlockSize)) {
+      printf("fail to write flash tier: %s\n", strerror(errno));
+    }
+    num_blocks_written_++;
+    append_lock.lock();
+    flush_pending_ = false;
+    flushed_cv_.notify_all();
+  }
+}
+
+template <class Key, class Value>
+bool FlashTier<Key, Value>::Lookup(const Key& key, Value& value) {
+  Location loc;
+  {
+    IndexConstAccessor const_accessor;
+    if (!index_.find(const_accessor, key)) {
+      return false;
+    }
+    loc = const_accessor->second;
+  }
+
+  // The active block and the one being written are read from memory.
+  std::string record;
+  if (loc.lsn + kBlockSize >= active_lsn_.load()) {
+    std::unique_lock append_lock(append_mtx_);
+    auto active_lsn = active_lsn_.load();
+    if (loc.lsn >= active_lsn) {
+      record.assign(active_ + (loc.lsn - active_lsn), loc.size);
+      append_lock.unlock();
+      return DecodeRecord(key, record, value);
+    }
+    if (loc.lsn + kBlockSize >= active_lsn && flush_pending_) {
+      record.assign(flushing_ + (loc.lsn + kBlockSize - active_lsn), loc.size);
+      append_lock.unlock();
+      return DecodeRecord(key, record, value);
+    }
+  }
+
+  auto start_time = utils::NowMicros();
+  bool ok = ReadRecord(loc, record);
+  num_reads_++;
+  read_micros_ += utils::NowMicros() - start_time;
+  return ok && DecodeRecord(key, record, value);
+}
+
+template <class Key, class Value>
+bool FlashTier<Key, Value>::ReadRecord(const Location& loc,
+                                       std::string& record) {
+  // O_DIRECT needs the buffer, the offset and the length to be aligned.
+  auto offset = get_offset(loc.lsn);
+  auto start = offset & ~(kAlignment - 1);
+  auto end = (offset + loc.size + kAlignment - 1) & ~(kAlignment - 1);
+  auto buffer = static_cast<char*>(aligned_alloc(kAlignment, end - start));
+  if (buffer == nullptr) {
+    return false;
+  }
+  auto n = pread(fd_, buffer, end - start, start);
+  bool ok = n == static_cast<ssize_t>(end - start);
+
+  // The block is overwritten only when it is the active one.
+  auto block_lsn = loc.lsn - loc.lsn % kBlockSize;
+  ok = ok && block_lsn + file_size_ > active_lsn_.load();
+  if (ok) {
+    record.assign(buffer + (offset - start), loc.size);
+  }
+  free(buffer);
+  return ok;
+}
+
+template <class Key, class Value>
+bool FlashTier<Key, Value>::DecodeRecord(const Key& key,
+                                         const std::string& record,
+                                         Value& value) {
+  const uint64_t header_size = sizeof(Key) + sizeof(uint32_t);
+  if (record.size() < header_size ||
+      memcmp(record.data(), &key, sizeof(Key)) != 0) {
+    return false;
+  }
+  uint32_t len;
+  memcpy(&len, record.data() + sizeof(Key), sizeof(len));
+  uint64_t data_len = len == kSnapshotNullLength ? 0 : len;
+  if (record.size() != header_size + data_len) {
+    return false;
+  }
+  return SnapshotCodec<Value>::Decode(record.data() + header_size, len, value);
+}
+
+template <class Key, class Value>
+void FlashTier<Key, Value>::PrintStatus() {
+  auto reads = num_reads_.load();
+  printf(
+      "flash tier: %lu entries indexed, %lu appended (%lu dropped), "
+      "%lu MB written (%lu stalls), %lu reads, avg. read latency: %.2lf us\n",
+      index_.size(), num_appends_.load(), num_dropped_.load(),
+      num_blocks_written_.load() * kBlockSize >> 20, num_stalls_.load(), reads,
+      reads ? 1.0 * read_micros_.load() / reads : 0.0);
+  fflush(stdout);
+}
+
+}  // namespace kvcache
+
+#endif
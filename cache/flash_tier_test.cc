@@ -0,0 +1,159 @@
+#include "flash_tier.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "lru_cache.h"
+#include "scalable_cache.h"
+
+class FlashTierTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = "/tmp/kvcache_flash_tier_test." + std::to_string(getpid());
+  }
+
+  void TearDown() override { unlink(path_.c_str()); }
+
+  std::string path_;
+};
+
+TEST_F(FlashTierTest, AppendLookupAndErase) {
+  kvcache::FlashTier<uint64_t, std::shared_ptr<std::string>> tier(path_,
+                                                                  4 << 20);
+  ASSERT_TRUE(tier.Open());
+  // 2000 entries of 4KB span about 8 blocks, while the log only holds 4, so
+  // the oldest entries are overwritten.
+  for (uint64_t i = 0; i < 2000; i++) {
+    tier.Append(i, std::make_shared<std::string>(4096, 'a' + i % 26));
+  }
+  tier.Append(2000, nullptr);
+
+  // In the active block.
+  std::shared_ptr<std::string> value;
+  ASSERT_TRUE(tier.Lookup(1999, value));
+  ASSERT_EQ(std::string(4096, 'a' + 1999 % 26), *value);
+  ASSERT_TRUE(tier.Lookup(2000, value));
+  ASSERT_EQ(nullptr, value);
+
+  // On the file.
+  ASSERT_TRUE(tier.Lookup(1500, value));
+  ASSERT_EQ(std::string(4096, 'a' + 1500 % 26), *value);
+  ASSERT_FALSE(tier.Lookup(0, value));
+  ASSERT_FALSE(tier.Lookup(500, value));
+
+  tier.Erase(1500);
+  ASSERT_FALSE(tier.Lookup(1500, value));
+  ASSERT_FALSE(tier.Lookup(3000, value));
+}
+
+TEST_F(FlashTierTest, SpillEvictedEntries) {
+  kvcache::FlashTier<uint64_t, uint64_t> tier(path_, 4 << 20);
+  ASSERT_TRUE(tier.Open());
+  kvcache::LruCache<uint64_t, uint64_t> cache(100);
+  cache.SetEvictionCallback(
+      [&](const uint64_t& key, const uint64_t& value) {
+        tier.Append(key, value);
+      });
+  for (uint64_t i = 0; i < 300; i++) {
+    cache.Insert(i, i * 10);
+  }
+  cache.Erase(250);
+
+  uint64_t value = 0;
+  for (uint64_t i = 0; i < 200; i++) {
+    ASSERT_FALSE(cache.Lookup(i, value));
+    ASSERT_TRUE(tier.Lookup(i, value));
+    ASSERT_EQ(i * 10, value);
+  }
+  // Erased entries are not spilled.
+  ASSERT_FALSE(tier.Lookup(250, value));
+}
+
+TEST_F(FlashTierTest, ReadWhileWriting) {
+  kvcache::FlashTier<uint64_t, std::shared_ptr<std::string>> tier(path_,
+                                                                  4 << 20);
+  ASSERT_TRUE(tier.Open());
+  // The reader looks up the last entries, which are in the active block, in
+  // the one being written, or on the file.
+  std::atomic<uint64_t> appended = 0;
+  std::atomic<uint64_t> errors = 0;
+  std::thread reader([&] {
+    std::shared_ptr<std::string> value;
+    while (appended.load() < 3000) {
+      auto last = appended.load();
+      for (uint64_t i = last > 300 ? last - 300 : 0; i < last; i++) {
+        if (tier.Lookup(i, value) &&
+            *value != std::string(4096, 'a' + i % 26)) {
+          errors++;
+        }
+      }
+    }
+  });
+  for (uint64_t i = 0; i < 3000; i++) {
+    tier.Append(i, std::make_shared<std::string>(4096, 'a' + i % 26));
+    appended++;
+  }
+  reader.join();
+  ASSERT_EQ(0, errors.load());
+
+  // The last two blocks are always there.
+  std::shared_ptr<std::string> value;
+  for (uint64_t i = 3000 - 400; i < 3000; i++) {
+    ASSERT_TRUE(tier.Lookup(i, value));
+    ASSERT_EQ(std::string(4096, 'a' + i % 26), *value);
+  }
+}
+
+TEST_F(FlashTierTest, PromotionKeepsNewerWrites) {
+  kvcache::ConcurrentScalableCache<uint64_t, uint64_t> cache(
+      64, 1, kvcache::CacheType::LRU);
+  ASSERT_TRUE(cache.EnableFlashTier(path_, 4 << 20));
+  // The writer writes increasing values of a few keys, and evicts them into
+  // the tier with fillers, while the readers promote them back.
+  const uint64_t num_keys = 8;
+  const uint64_t num_writes = 20000;
+  std::atomic<bool> stop = false;
+  std::atomic<uint64_t> errors = 0;
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 2; t++) {
+    readers.emplace_back([&] {
+      std::vector<uint64_t> last(num_keys, 0);
+      while (!stop.load()) {
+        for (uint64_t key = 0; key < num_keys; key++) {
+          uint64_t value = 0;
+          if (cache.Lookup(key, value)) {
+            if (value < last[key]) {
+              errors++;
+            }
+            last[key] = value;
+          }
+        }
+      }
+    });
+  }
+  for (uint64_t i = 1; i <= num_writes; i++) {
+    cache.Insert(i % num_keys, i);
+    cache.Insert(num_keys + i, 0);
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  ASSERT_EQ(0, errors.load());
+  for (uint64_t key = 0; key < num_keys; key++) {
+    uint64_t value = 0;
+    ASSERT_TRUE(cache.Lookup(key, value));
+    ASSERT_EQ(num_writes - (num_writes - key) % num_keys, value);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
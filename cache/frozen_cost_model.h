@@ -0,0 +1,217 @@
+#ifndef KVCACHE_FROZEN_COST_MODEL_H
+#define KVCACHE_FROZEN_COST_MODEL_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "cache.h"
+#include "options.h"
+
+namespace kvcache {
+
+// FrozenCostModel predicts the average latency of requests with a frozen fast
+// cache, so that the monitor picks the frozen ratio and the lifetime of a
+// construction with the highest throughput.
+//
+// Every request probes the fast cache first. With a fast cache hit ratio 'h'
+// and a miss ratio 'm', a request takes
+//   L_fc + (1 - h - m) * L_dc + m * L_miss,
+// against (1 - m) * L_dc + m * L_miss without the fast cache. The latencies of
+// fast cache hits (L_fc), dynamic cache hits (L_dc) and misses (L_miss) are
+// moving averages of the measured ones.
+//
+// So a request gains h * L_dc - L_fc. As the hot set drifts, the hit ratio
+// decays after a construction, which is fitted as h0 * exp(-r * t), with 't'
+// in steps (sampled requests). With a refresh costing 'C', the lifetime 'T'
+// maximizes the average gain of a construction:
+//   (h0 * L_dc * (1 - exp(-r * T)) / r - L_fc * T - C) / T
+
+class FrozenCostModel {
+ public:
+  explicit FrozenCostModel(const FrozenOptions& options = FrozenOptions())
+      : options_(options) {}
+
+  // Latencies (us) of dynamic cache hits and misses, without a fast cache.
+  void ObserveBaseline(double dc_hit_lat, double miss_lat) {
+    dc_hit_lat_ = Average(dc_hit_lat_, dc_hit_lat);
+    miss_lat_ = Average(miss_lat_, miss_lat);
+  }
+
+  // Latency (us) of fast cache hits.
+  void ObserveFastCacheHit(double fc_hit_lat) {
+    fc_hit_lat_ = Average(fc_hit_lat_, fc_hit_lat);
+  }
+
+  // Latency (us) that a refresh added to the requests of its pass, in total.
+  void ObserveRefreshCost(double cost) {
+    refresh_cost_ = Average(refresh_cost_, std::max(cost, 0.0));
+  }
+
+  // A fast cache was constructed. The decay fitted for the last one goes to
+  // the averages, which are used until the new one has enough passes.
+  void StartFrozen() {
+    if (num_samples_ >= kMinSamples) {
+      double rate = 0, h0 = 0;
+      Fit(rate, h0);
+      decay_rate_ = Average(decay_rate_, rate);
+      initial_hit_ = Average(initial_hit_, h0);
+    }
+    num_samples_ = 0;
+    sum_t_ = sum_y_ = sum_tt_ = sum_ty_ = 0;
+  }
+
+  // The fast cache hit ratio of a pass ending 'step' steps after the
+  // construction.
+  void ObserveFrozenPass(uint64_t step, double fc_hit_ratio) {
+    if (fc_hit_ratio <= 0) {
+      return;
+    }
+    double t = step, y = std::log(fc_hit_ratio);
+    num_samples_++;
+    sum_t_ += t;
+    sum_y_ += y;
+    sum_tt_ += t * t;
+    sum_ty_ += t * y;
+  }
+
+  double BaselineLatency(double miss) const {
+    return (1 - miss) * dc_hit_lat_ + miss * miss_lat_;
+  }
+
+  double FrozenLatency(double fc_hit, double miss) const {
+    return fc_hit_lat_ + (1 - fc_hit - miss) * dc_hit_lat_ + miss * miss_lat_;
+  }
+
+  // Pick the ratio of 'curve' with the lowest predicted latency, or 1 if the
+  // latency measured with 100% frozen ('frozen_avg', 0 if unknown) is lower.
+  // The first point of 'curve' is the baseline. Return 0 if no ratio of at
+  // least 'min_ratio' beats the baseline by 'gain_threshold'. 'best_avg' is
+  // the latency of the returned ratio.
+  double ChooseRatio(const std::vector<CurveDataNode>& curve,
+                     double frozen_avg, double& best_avg) const {
+    if (curve.empty()) {
+      best_avg = 0;
+      return 0;
+    }
+    double baseline = BaselineLatency(curve[0].miss);
+    double best_size = 0;
+    best_avg = baseline;
+    for (auto& point : curve) {
+      if (point.size < options_.min_ratio) {
+        continue;
+      }
+      double avg = FrozenLatency(point.FC_hit, point.miss);
+      if (avg < best_avg) {
+        best_avg = avg;
+        best_size = point.size;
+      }
+    }
+    if (frozen_avg > 0 && frozen_avg < best_avg) {
+      best_avg = frozen_avg;
+      best_size = 1;
+    }
+    if (best_avg > baseline / (1 + options_.gain_threshold)) {
+      best_avg = baseline;
+      return 0;
+    }
+    return best_size;
+  }
+
+  // Steps until the next refresh, between 'min_lifetime' and 'max_lifetime'
+  // construction steps. It is the longest one until both the decay and the
+  // cost of a refresh are known.
+  uint64_t ChooseLifetime(uint64_t construct_step) const {
+    uint64_t step = std::max<uint64_t>(construct_step, 1);
+    uint64_t min_rounds = std::max<uint32_t>(options_.min_lifetime, 1);
+    uint64_t max_rounds = std::max<uint64_t>(options_.max_lifetime, min_rounds);
+    double rate = 0, h0 = 0;
+    if (!GetDecay(rate, h0) || refresh_cost_ < 0) {
+      return max_rounds * step;
+    }
+
+    uint64_t best_rounds = max_rounds;
+    double best_gain = -1e300;
+    for (uint64_t rounds = min_rounds; rounds <= max_rounds; rounds++) {
+      double t = 1.0 * rounds * step;
+      // The integral of h(t), which is h0 * t without decay.
+      double hits = rate * t < 1e-9 ? h0 * t
+                                    : h0 * (1 - std::exp(-rate * t)) / rate;
+      double gain = (hits * dc_hit_lat_ - fc_hit_lat_ * t - refresh_cost_) / t;
+      if (gain > best_gain) {
+        best_gain = gain;
+        best_rounds = rounds;
+      }
+    }
+    return best_rounds * step;
+  }
+
+  // Decay rate (per step) of the fast cache hit ratio, -1 if unknown.
+  double decay_rate() const {
+    double rate = -1, h0 = 0;
+    GetDecay(rate, h0);
+    return rate;
+  }
+
+  double fc_hit_lat() const { return fc_hit_lat_; }
+  double dc_hit_lat() const { return dc_hit_lat_; }
+  double miss_lat() const { return miss_lat_; }
+  double refresh_cost() const { return refresh_cost_; }
+
+ private:
+  // Passes of a construction before its own decay is used.
+  constexpr static uint64_t kMinSamples = 3;
+
+  // The first sample replaces the unknown (negative) average.
+  double Average(double average, double sample) const {
+    if (average < 0) {
+      return sample;
+    }
+    return options_.ewma_weight * sample +
+           (1 - options_.ewma_weight) * average;
+  }
+
+  // Least squares of log(h) = log(h0) - rate * t. A hit ratio that grows has
+  // no decay.
+  void Fit(double& rate, double& h0) const {
+    double n = num_samples_;
+    double det = n * sum_tt_ - sum_t_ * sum_t_;
+    double slope = det > 0 ? (n * sum_ty_ - sum_t_ * sum_y_) / det : 0;
+    double intercept = (sum_y_ - slope * sum_t_) / n;
+    rate = std::max(-slope, 0.0);
+    h0 = std::min(std::exp(intercept), 1.0);
+  }
+
+  bool GetDecay(double& rate, double& h0) const {
+    if (num_samples_ >= kMinSamples) {
+      Fit(rate, h0);
+      return true;
+    }
+    if (decay_rate_ < 0) {
+      return false;
+    }
+    rate = decay_rate_;
+    h0 = initial_hit_;
+    return true;
+  }
+
+  FrozenOptions options_;
+
+  // Negative until measured.
+  double fc_hit_lat_ = -1;
+  double dc_hit_lat_ = -1;
+  double miss_lat_ = -1;
+  double refresh_cost_ = -1;
+  double decay_rate_ = -1;
+  double initial_hit_ = -1;
+
+  // Sums of the fit of the current construction.
+  uint64_t num_samples_ = 0;
+  double sum_t_ = 0, sum_y_ = 0, sum_tt_ = 0, sum_ty_ = 0;
+};
+
+}  // namespace kvcache
+
+#endif
@@ -0,0 +1,102 @@
+#include "frozen_cost_model.h"
+
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using kvcache::CurveDataNode;
+using kvcache::FrozenCostModel;
+using kvcache::FrozenOptions;
+
+// Fast cache hits take 0.1us, dynamic cache hits 1us and misses 10us.
+static FrozenCostModel MakeModel(const FrozenOptions& options) {
+  FrozenCostModel model(options);
+  model.ObserveBaseline(1, 10);
+  model.ObserveFastCacheHit(0.1);
+  return model;
+}
+
+TEST(FrozenCostModelTest, ChooseBestRatio) {
+  auto model = MakeModel(FrozenOptions());
+  // Baseline: 0.9 * 1 + 0.1 * 10 = 1.9us.
+  std::vector<CurveDataNode> curve = {{0, 0, 0.1},
+                                      {0.2, 0.5, 0.1},
+                                      {0.5, 0.8, 0.12},
+                                      {0.8, 0.85, 0.2}};
+  double best_avg = 0;
+  EXPECT_DOUBLE_EQ(0.5, model.ChooseRatio(curve, 0, best_avg));
+  EXPECT_NEAR(0.1 + 0.08 * 1 + 0.12 * 10, best_avg, 1e-9);
+
+  // 100% frozen was measured faster than any point.
+  EXPECT_DOUBLE_EQ(1, model.ChooseRatio(curve, 0.5, best_avg));
+  EXPECT_DOUBLE_EQ(0.5, best_avg);
+}
+
+TEST(FrozenCostModelTest, NoRatioBelowThreshold) {
+  auto model = MakeModel(FrozenOptions());
+  // The best point saves 0.2us of 1.9us, less than 20%.
+  std::vector<CurveDataNode> curve = {{0, 0, 0.1}, {0.3, 0.3, 0.1}};
+  double best_avg = 0;
+  EXPECT_DOUBLE_EQ(0, model.ChooseRatio(curve, 0, best_avg));
+  EXPECT_NEAR(1.9, best_avg, 1e-9);
+
+  // Good enough with a lower threshold.
+  FrozenOptions options;
+  options.gain_threshold = 0.05;
+  model = MakeModel(options);
+  EXPECT_DOUBLE_EQ(0.3, model.ChooseRatio(curve, 0, best_avg));
+
+  // Too small a ratio is never picked.
+  options.min_ratio = 0.5;
+  model = MakeModel(options);
+  EXPECT_DOUBLE_EQ(0, model.ChooseRatio(curve, 0, best_avg));
+}
+
+TEST(FrozenCostModelTest, LongestLifetimeUntilMeasured) {
+  FrozenOptions options;
+  options.max_lifetime = 50;
+  auto model = MakeModel(options);
+  EXPECT_EQ(50 * 1000u, model.ChooseLifetime(1000));
+
+  // The decay is known, but not the cost of a refresh.
+  model.StartFrozen();
+  for (uint64_t t = 1000; t <= 5000; t += 1000) {
+    model.ObserveFrozenPass(t, 0.8 * std::exp(-1e-4 * t));
+  }
+  EXPECT_NEAR(1e-4, model.decay_rate(), 1e-9);
+  EXPECT_EQ(50 * 1000u, model.ChooseLifetime(1000));
+}
+
+TEST(FrozenCostModelTest, LifetimeFollowsDecayAndCost) {
+  FrozenOptions options;
+  options.max_lifetime = 1000;
+  auto model = MakeModel(options);
+  model.ObserveRefreshCost(100);
+
+  model.StartFrozen();
+  for (uint64_t t = 1000; t <= 5000; t += 1000) {
+    model.ObserveFrozenPass(t, 0.8 * std::exp(-1e-4 * t));
+  }
+  auto fast_decay = model.ChooseLifetime(1000);
+  EXPECT_LT(fast_decay, 1000 * 1000u);
+
+  // A slower decay is refreshed less often.
+  model.StartFrozen();
+  for (uint64_t t = 1000; t <= 5000; t += 1000) {
+    model.ObserveFrozenPass(t, 0.8 * std::exp(-1e-5 * t));
+  }
+  EXPECT_GT(model.ChooseLifetime(1000), fast_decay);
+
+  // And so is a costlier refresh.
+  auto slow_decay = model.ChooseLifetime(1000);
+  for (int i = 0; i < 20; i++) {
+    model.ObserveRefreshCost(10000);
+  }
+  EXPECT_GT(model.ChooseLifetime(1000), slow_decay);
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
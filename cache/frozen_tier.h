@@ -0,0 +1,155 @@
+#ifndef KVCACHE_FROZEN_TIER_H
+#define KVCACHE_FROZEN_TIER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "fast_hash/frozen_hash.h"
+
+namespace kvcache {
+
+// FrozenTier is the frozen fast cache of a FrozenHot shard, whatever the
+// policy of the shard ('FrozenHotCache', 'FrozenFifoCache', 'FrozenLfuCache').
+// The shard picks the hottest keys, and stages their values between
+// 'BeginBuild' and 'Publish'. Lookups of a published fast cache take no lock.
+//
+// The set of frozen keys is fixed until the next construction, but writes go
+// through ('Write'): an insert of a frozen key replaces its value in place,
+// and an erase invalidates it. Writes that race with a construction are
+// logged, and applied to the new fast cache before it is published.
+//
+// 'Value' must be a shared pointer.
+
+template <class Key, class Value>
+class FrozenTier {
+ public:
+  FrozenTier() : m_fast_hash(new fast_hash::FrozenHash<Value>()) {}
+  FrozenTier(const FrozenTier&) = delete;
+  FrozenTier& operator=(const FrozenTier&) = delete;
+
+  // 'value' is borrowed from the fast cache, see 'FastHash::find'.
+  bool Lookup(const Key& key, Value& value) {
+    return m_ready.load() && m_fast_hash->find(key, value);
+  }
+
+  // Pass a write of 'key' to the fast cache: its new value, or nullptr for an
+  // erase. The caller orders the writes of a key, e.g. by holding its
+  // accessor, and copies the key's current value between 'BeginBuild' and
+  // 'Publish' only after the writes that precede it. Return whether a frozen
+  // entry was replaced or invalidated.
+  bool Write(const Key& key, const Value* value);
+
+  // Start a construction. A write after this either is seen by the copy of
+  // its value, or is logged.
+  void BeginBuild() { m_building = true; }
+
+  // Freeze 'value' of 'key'.
+  void Stage(const Key& key, const Value& value) {
+    m_fast_hash->insert(key, value);
+    m_staged++;
+  }
+
+  // Publish the staged entries as the new fast cache, or delete it if none
+  // was staged. Return the number of frozen entries.
+  uint64_t Publish();
+
+  void Delete() {
+    if (!m_ready.load()) {
+      return;
+    }
+    m_ready = false;
+    m_fast_hash->clear();
+  }
+
+  // Call 'func(key, value)' for every frozen key that was hit since the fast
+  // cache was published, with its current value. The frozen keys are not
+  // promoted by their policy, so this is how a construction finds those that
+  // are still hot. Only the constructing thread may call it.
+  template <class Func>
+  void ForEachHit(Func&& func) {
+    if (m_ready.load()) {
+      m_fast_hash->for_each_hit(func);
+    }
+  }
+
+  bool ready() const { return m_ready.load(); }
+
+  // Writes that replaced or invalidated a frozen entry since the fast cache
+  // was published, and the number of entries it was built with.
+  uint64_t invalidations() const { return m_invalidations.load(); }
+  uint64_t size() const { return m_ready.load() ? m_fast_hash->size() : 0; }
+
+ private:
+  // It holds a reference of every frozen value, and releases the ones of a
+  // replaced fast cache once the lookups that may have read it are done.
+  std::unique_ptr<fast_hash::FrozenHash<Value>> m_fast_hash;
+  std::atomic<bool> m_ready = false;
+  uint64_t m_staged = 0;
+
+  // Writes (nullptr for an erase) while a fast cache is built, whose keys
+  // may have been frozen with their old value.
+  std::atomic<bool> m_building = false;
+  std::mutex m_dirty_mtx;
+  std::vector<std::pair<Key, Value>> m_dirty_writes;
+  std::atomic<uint64_t> m_invalidations{0};
+};
+
+template <class Key, class Value>
+bool FrozenTier<Key, Value>::Write(const Key& key, const Value* value) {
+  // The log is applied and the new fast cache published under the mutex, so
+  // a logged write is never lost, and is seen by the lookups after it.
+  std::unique_lock<std::mutex> dirty_lock(m_dirty_mtx, std::defer_lock);
+  if (m_building.load()) {
+    dirty_lock.lock();
+    if (m_building.load()) {
+      m_dirty_writes.emplace_back(key, value != nullptr ? *value : Value());
+    }
+  }
+  if (!m_ready.load()) {
+    return false;
+  }
+  bool frozen = value != nullptr ? m_fast_hash->update(key, *value)
+                                 : m_fast_hash->invalidate(key);
+  if (frozen) {
+    m_invalidations++;
+  }
+  return frozen;
+}
+
+template <class Key, class Value>
+uint64_t FrozenTier<Key, Value>::Publish() {
+  uint64_t count = m_staged;
+  m_staged = 0;
+  if (count > 0) {
+    m_fast_hash->prepare();
+  }
+
+  // The writes that raced with the construction went to the last fast cache,
+  // and may have been missed by the copy of their values.
+  std::unique_lock<std::mutex> dirty_lock(m_dirty_mtx);
+  if (count > 0) {
+    for (auto& [key, value] : m_dirty_writes) {
+      m_fast_hash->update_prepared(key, value);
+    }
+    m_fast_hash->publish();
+  }
+  m_ready = count > 0;
+  m_dirty_writes.clear();
+  m_invalidations = 0;
+  m_building = false;
+  dirty_lock.unlock();
+
+  if (count == 0) {
+    m_fast_hash->clear();
+  }
+  return count;
+}
+
+}  // namespace kvcache
+
+#endif
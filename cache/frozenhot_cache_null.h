@@ -1,101 +1,96 @@
-
 #ifndef FROZENHOT_LRU_CACHE_H
 #define FROZENHOT_LRU_CACHE_H
 
 #include <assert.h>
-#include <tbb/concurrent_hash_map.h>
-
-#include "fast_hash/clht_table.h"
-#include "options.h"
-
-namespace kvcache {
+#include <unistd.h>
 
-template <class Key, class Value>
-class FrozenHotCache : public Cache<Key, Value> {
- private:
-  constexpr static uint64_t kNullKey = 0;
-  constexpr static uint64_t kTombKey = 1;
-  constexpr static uint64_t kMarkerKey = 2;
-
-  // LRU list node.
-  //
-  // We make a copy of the key in the list node, allowing us to find the
-  // TBB::CHM element from the list node.
-  struct ListNode {
-    ListNode()
-        : m_key(kNullKey),
-          m_prev(out_of_list_marker_),
-          m_next(nullptr),
-          m_time(0) {}
-
-    ListNode(const Key& key)
-        : m_key(key),
-          m_prev(out_of_list_marker_),
-          m_next(nullptr),
-          m_time(NowMicros()) {}
-
-    bool is_in_list() const { return m_prev != out_of_list_marker_; }
-
-    Key m_key;
-    ListNode* m_prev;
-    ListNode* m_next;
-    uint64_t m_time;
-  };
-
-  static ListNode* const out_of_list_marker_;
-
-  // The value is stored in the hashtable. The list node is allocated from an
-  // internal object_pool. The ListNode* is owned by the lru list.
-  struct HashMapValue {
-    HashMapValue() : m_list_node(nullptr) {}
-    HashMapValue(const Value& value, ListNode* node)
-        : m_value(value), m_list_node(node) {}
-
-    Value m_value;
-    ListNode* m_list_node;
-  };
-
-  using HashMap =
-      tbb::concurrent_hash_map<Key, HashMapValue, tbb::tbb_hash_compare<Key>>;
-  using HashMapConstAccessor = HashMap::const_accessor;
-  using HashMapAccessor = HashMap::accessor;
-  using HashMapValuePair = HashMap::value_type;
-  using SnapshotValue = std::pair<const Key, Value>;
+#include <atomic>
+#include <mutex>
 
- public:
-  // The proxy object for TBB::CHM::const_accessor. Provides direct access to
-  // the user's value by dereferencing, thus hiding implementation details.
-  class ConstAccessor {
-   public:
-    ConstAccessor() {}
-    ~ConstAccessor() {}
+#include "cache.h"
+#include "frozenhot_shard.h"
+#include "statistics.h"
+#include "utils.h"
 
-    const Value& operator*() const { return *get(); }
-    const Value* operator->() const { return get(); }
+namespace kvcache {
 
-    const Value get() const { return m_hash_accessor->second.m_value; }
+// List node of 'FrozenHotCache'.
+template <class Key>
+struct FrozenListNode {
+  FrozenListNode()
+      : m_key(), m_prev(out_of_list_marker_), m_next(nullptr), m_time(0) {}
+
+  FrozenListNode(const Key& key)
+      : m_key(key),
+        m_prev(out_of_list_marker_),
+        m_next(nullptr),
+        m_time(utils::NowMicros()) {}
+
+  bool is_in_list() const { return m_prev != out_of_list_marker_; }
+
+  inline static FrozenListNode* const out_of_list_marker_ =
+      reinterpret_cast<FrozenListNode*>(-1);
+
+  Key m_key;
+  FrozenListNode* m_prev;
+  FrozenListNode* m_next;
+  uint64_t m_time;
+  // Set by a hit that doesn't promote the node (FIFO).
+  std::atomic<bool> m_referenced{false};
+};
 
-   private:
-    friend class FrozenHotCache;
-    HashMapConstAccessor m_hash_accessor;
-  };
+// FrozenHotCache is an LRU shard with a frozen fast cache in front of it.
+//
+// The monitor ('ConcurrentScalableCache::FrozenMonitor') profiles the curve of
+// the fast cache ratio with 'GetCurve', and then freezes the hottest part of
+// the LRU list into a 'FrozenTier': 'ConstructTier' freezes all of it,
+// 'ConstructFastCache' freezes a ratio of it. Lookups that hit the fast cache
+// take no lock and don't promote.
+//
+// The fast cache is built from a snapshot of the keys at the head of the list,
+// and is published at once when it is built. The LRU list keeps admitting and
+// evicting as usual meanwhile, and afterwards serves the keys that are not
+// frozen. The frozen entries are not promoted, so they sink in the list, and
+// make room for the others. A refresh still keeps the ones that are hit.
+//
+// The set of frozen keys is fixed until 'DeleteFastCache' or the next
+// construction replaces it, but writes go through to the fast cache. The
+// monitor refreshes a fast cache worn out by writes, see
+// 'get_fast_cache_invalidations'.
+//
+// Without 'kPromote', it is 'FrozenFifoCache'.
+//
+// 'Value' must be a shared pointer.
+
+template <class Key, class Value, bool kPromote = true>
+class FrozenHotCache
+    : public FrozenHotShard<FrozenHotCache<Key, Value, kPromote>, Key, Value,
+                            FrozenListNode<Key>> {
+ private:
+  using ListNode = FrozenListNode<Key>;
+  using Base = FrozenHotShard<FrozenHotCache, Key, Value, ListNode>;
+  friend Base;
 
  public:
-  FrozenHotCache(uint64_t capacity);
-  virtual ~FrozenHotCache();
-  // Disable copying or assigment
-  FrozenHotCache(const FrozenHotCache&) = delete;
-  FrozenHotCache& operator=(const FrozenHotCache&) = delete;
-
-  bool Lookup(Key key, Value& value) override;
-
-  bool Insert(Key key, const Value& value) override;
-
-  bool Erase(Key key) override;
+  FrozenHotCache(uint64_t capacity) : Base(capacity) {
+    m_head.m_prev = nullptr;
+    m_head.m_next = &m_tail;
+    m_tail.m_prev = &m_head;
+  }
 
-  virtual uint64_t get_size() override { return m_size.load(); }
+  virtual ~FrozenHotCache() {
+    auto node = m_head.m_next;
+    while (node != &m_tail) {
+      auto next = node->m_next;
+      if (node != &m_marker) {
+        delete node;
+      }
+      node = next;
+    }
+  }
 
-  virtual bool is_full() override { return m_size.load() >= m_max_size; }
+  virtual bool GetCurve(const FrozenOptions& options,
+                        const std::atomic<bool>& should_stop) override;
 
  private:
   // The caller must lock the list mutex while this is called
@@ -115,507 +110,183 @@ class FrozenHotCache : public Cache<Key, Value> {
     prev->m_next = next;
     next->m_prev = prev;
     //
-    node->m_prev = out_of_list_marker_;
+    node->m_prev = ListNode::out_of_list_marker_;
   }
 
   // The caller must lock the list mutex while this is called
   void LruPushAfterMarker(ListNode* node) {
-    assert(m_marker);
-    node->m_prev = m_marker;
-    node->m_next = m_marker->m_next;
-    m_marker->m_next->m_prev = node;
-    m_marker->m_next = node;
+    node->m_prev = &m_marker;
+    node->m_next = m_marker.m_next;
+    m_marker.m_next->m_prev = node;
+    m_marker.m_next = node;
   }
 
-  // Require list mutex
-  bool Evict();
-
-  virtual bool ConstructTier() override;
-
-  virtual bool ConstructFastCache(double ratio) override;
-
-  virtual void DeleteFastCache() override;
-
-  virtual bool GetCurve(bool should_stop) override;
-
- private:
-  size_t m_max_size;
-  std::atomic<size_t> m_size;
-
-  HashMap m_map;
-  std::unique_ptr<fast_hash::ClhtTable<Value>> m_fast_hash;
-
-  ListNode m_fast_head;
-  ListNode m_fast_tail;
-  ListNode* m_marker = nullptr;
-
-  ListNode m_head;
-  ListNode m_tail;
-  std::mutex m_list_mtx;
-
-  std::atomic<bool> fast_cache_ready = false;
-  std::atomic<bool> frozen_all = false;
-  std::atomic<bool> fast_cache_construct = false;
-  std::atomic<bool> enable_insert = true;
-  std::atomic<bool> curve_flag = false;
-
-  std::atomic<size_t> movement_counter{0};
-  std::atomic<size_t> eviction_counter{0};
+  // The hooks of 'FrozenHotShard'.
+  Tickers Touch(ListNode* node);
 
- private:
-  bool sample_generator() {
-    // if (!sample_flag_) {
-    //   return true;
-    // } else {
-    //   return RandomDouble() < sample_percentage_;
-    // }
-    return false;
-  }
-  const double sample_percentage_ = 1.0 / 100;
-  bool sample_flag_ = false;
-};
-
-template <class Key, class Value>
-typename FrozenHotCache<Key, Value>::ListNode* const
-    FrozenHotCache<Key, Value>::out_of_list_marker_ =
-        reinterpret_cast<ListNode*>(-1);
-
-template <class Key, class Value>
-FrozenHotCache<Key, Value>::FrozenHotCache(uint64_t capacity)
-    : m_max_size(capacity),
-      m_size(0),
-      m_map(std::thread::hardware_concurrency() * 4) {
-  m_head.m_prev = nullptr;
-  m_head.m_next = &m_tail;
-  m_tail.m_prev = &m_head;
-
-  m_fast_head.m_prev = nullptr;
-  m_fast_head.m_next = &m_fast_tail;
-  m_fast_tail.m_prev = &m_fast_head;
-
-  int align_len = 1 + int(log2(m_max_size));
-  m_fast_hash.reset(new fast_hash::ClhtTable<Value>(0, align_len));
-}
-
-template <class Key, class Value>
-FrozenHotCache<Key, Value>::~FrozenHotCache() {}
-
-template <class Key, class Value>
-bool FrozenHotCache<Key, Value>::Lookup(Key key, Value& value) {
-  bool stat_yes = sample_generator();
-  HashMapConstAccessor hash_accessor;
-
-  if (fast_cache_ready || frozen_all) {
-    if (m_fast_hash->Find(key, value)) {
-      if (stat_yes) {
-        Cache<Key, Value>::stats.RecordTick(Tickers::FAST_CACHE_HIT);
-      }
-      return true;
+  void ListInsert(ListNode* node) {
+    if (!Base::curve_flag.load()) {
+      LruPushFront(node);
     } else {
-      if (frozen_all) {
-        if (stat_yes) {
-          Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_MISS);
-        }
-        return false;
-      }
+      node->m_time = m_marker.m_time;
+      LruPushAfterMarker(node);
     }
   }
 
-  assert(!frozen_all);
-  if (!m_map.find(hash_accessor, key)) {
-    if (stat_yes) {
-      Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_MISS);
-    }
-    return false;
-  }
-
-  value = hash_accessor->second.m_value;
-  if (!fast_cache_construct.load()) {
-    auto node = hash_accessor->second.m_list_node;
-    uint64_t last_update = 0;
-    if (curve_flag.load()) {
-      // There is no lock, so corner case is that curve_flag turns into false,
-      // m_marker might cause core dump.
-      last_update = node->m_time;
-      if (m_marker && last_update <= m_marker->m_time) {
-        if (stat_yes) {
-          Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_HIT);
-        }
-        movement_counter++;
-        node->m_time = NowMicros();
-
-        // update node
-        std::unique_lock list_lock(m_list_mtx);
-        if (node->is_in_list()) {
-          LruRemove(node);
-          LruPushFront(node);
-        }
-
-      } else if (stat_yes) {
-        Cache<Key, Value>::stats.RecordTick(Tickers::FAST_CACHE_HIT);
-      }
-      return true;
-    }
-
-    std::unique_lock list_lock(m_list_mtx, std::try_to_lock);
-    if (list_lock) {
-      // The list node may be out of the list if it is in the process of being
-      // inserted or evicted. Doing this check allows us to lock the list for
-      // shorter periods of time.
-      if (fast_cache_construct) {
-        ;
-      } else if (node->is_in_list()) {
-        LruRemove(node);
-        LruPushFront(node);
-      }
-    }
-    list_lock.unlock();
-  }
-
-  if (stat_yes) {
-    Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_HIT);
-  }
-  return true;
-}
-
-template <class Key, class Value>
-bool FrozenHotCache<Key, Value>::Insert(Key key, const Value& value) {
-  bool stat_yes = sample_generator();
-  if (stat_yes) {
-    Cache<Key, Value>::stats.RecordTick(Tickers::INSERT);
-  }
-
-  if (!enable_insert.load()) {
-    return false;
-  }
-
-  auto node = new ListNode(key);
-  HashMapAccessor hash_accessor;
-  HashMapValuePair value_pair(key, HashMapValue(value, node));
-  if (!m_map.insert(hash_accessor, value_pair)) {
-    // update value
-    hash_accessor->second = HashMapValue(value, node);
-    return false;
-  }
+  void ListRemove(ListNode* node) { LruRemove(node); }
 
-  if (fast_cache_construct) {
-    eviction_counter++;
+  // The FIFO order tells nothing of the hits, so the hit nodes are frozen
+  // first. A frozen node starts over.
+  bool Referenced(ListNode* node) {
+    return kPromote || node->m_referenced.load(std::memory_order_relaxed);
   }
 
-  auto s = m_size.load();
-  bool done = false;
-  if (s >= m_max_size) {
-    done = Evict();
+  void OnFrozen(ListNode* node) {
+    node->m_referenced.store(false, std::memory_order_relaxed);
   }
 
-  // Note that we have to update the LRU list before we increment m_size.
-  std::unique_lock list_lock(m_list_mtx);
-  if (!enable_insert.load()) {
-    list_lock.unlock();
-    m_map.erase(hash_accessor);
-    delete node;
-    return false;
-  }
-  if (!curve_flag.load()) {
-    LruPushFront(node);
-  } else {
-    node->m_time = m_marker->m_time;
-    LruPushAfterMarker(node);
+  ListNode* ListEvict() {
+    ListNode* node = m_tail.m_prev;
+    if (node == &m_marker) {
+      // The marker reached the tail, so the rest of the curve is flat.
+      node = node->m_prev;
+    }
+    if (node == &m_head) {
+      return nullptr;
+    }
+    LruRemove(node);
+    return node;
   }
-  list_lock.unlock();
 
-  hash_accessor.release();  // for deadlock
-
-  if (!done) {
-    s = m_size++;
-  }
-  if (s > m_max_size) {
-    // It is possible for the size to temporarily exceed the maximum if there is
-    // a heavy-insert workload, once only as the cache fills. In this situation,
-    // we should avoid to have every thread simultaneously attempt to evict the
-    // extra entries, since we could end up underfilled. Instead, we do a
-    // compare-and-exchange to acquire an exclusive right to reduce the size to
-    // a particular value.
-
-    if (Evict()) {
-      m_size--;
+  template <class Func>
+  void ForEachNode(Func&& func) {
+    for (auto node = m_head.m_next; node != &m_tail; node = node->m_next) {
+      if (node != &m_marker && !func(node)) {
+        break;
+      }
     }
   }
-  return true;
-}
-
-template <class Key, class Value>
-bool FrozenHotCache<Key, Value>::Erase(Key key) {
-  return false;
-}
-
-template <class Key, class Value>
-bool FrozenHotCache<Key, Value>::ConstructTier() {
-  std::unique_lock list_lock(m_list_mtx);
-  fast_cache_construct = true;
-  enable_insert = false;
 
-  assert(m_fast_head.m_next == &m_fast_tail);
-  assert(m_fast_tail.m_prev == &m_fast_head);
+  ListNode m_marker;
 
-  m_fast_head.m_next = m_head.m_next;
-  m_head.m_next->m_prev = &m_fast_head;
-  m_fast_tail.m_prev = m_tail.m_prev;
-  m_tail.m_prev->m_next = &m_fast_tail;
-
-  m_head.m_next = &m_tail;
-  m_tail.m_prev = &m_head;
+  ListNode m_head;
+  ListNode m_tail;
 
-  list_lock.unlock();
+  std::atomic<size_t> movement_counter{0};
+};
 
-  auto temp_node = m_fast_head.m_next;
-  ListNode* delete_node = nullptr;
-  HashMapConstAccessor temp_hash_accessor;
-  uint32_t count = 0;
-  while (temp_node != &m_fast_tail) {
-    if (temp_node->m_key == kTombKey) {
-      delete_node = temp_node;
-      temp_node = temp_node->m_next;
-      LruRemove(delete_node);
-      delete delete_node;
-      continue;
+template <class Key, class Value, bool kPromote>
+Tickers FrozenHotCache<Key, Value, kPromote>::Touch(ListNode* node) {
+  if (Base::curve_flag.load()) {
+    // Nodes behind the marker would be misses of a fast cache frozen when
+    // the curve started. The ones in front of it are counted as fast cache
+    // hits, and the marker moves back by one for every promotion.
+    if (node->m_time > m_marker.m_time) {
+      return Tickers::FAST_CACHE_HIT;
     }
-
-    if (!m_map.find(temp_hash_accessor, temp_node->m_key)) {
-      delete_node = temp_node;
-      temp_node = temp_node->m_next;
-      if (delete_node->is_in_list()) {
-        LruRemove(delete_node);
-      }
-      delete delete_node;
-      continue;
+    movement_counter++;
+
+    // update node
+    std::unique_lock list_lock(Base::m_list_mtx);
+    node->m_time = utils::NowMicros();
+    if (node->is_in_list()) {
+      LruRemove(node);
+      LruPushFront(node);
     }
-
-    m_fast_hash->Insert(temp_node->m_key, temp_hash_accessor->second.m_value);
-    count++;
-    temp_node = temp_node->m_next;
-  }
-  printf("fast cache insert num: %d, m_size: %ld, (FC_ratio: %.2lf)\n", count,
-         m_size.load(), 1.0 * count / m_size.load());
-  fast_cache_construct = false;
-  return false;
-}
-
-template <class Key, class Value>
-bool FrozenHotCache<Key, Value>::ConstructFastCache(double FC_ratio) {
-  assert(FC_ratio <= 1 && FC_ratio >= 0);
-  assert(m_fast_head.m_next == &m_fast_tail);
-  assert(m_fast_tail.m_prev == &m_fast_head);
-
-  // clear evcition counter to start
-  if (eviction_counter.load() > 0) {
-    eviction_counter = 0;
+    return Tickers::CACHE_HIT;
   }
 
-  m_fast_head.m_next = m_head.m_next;
-
-  // for thread safety
-  fast_cache_construct = true;
-
-  uint64_t FC_size = FC_ratio * m_max_size;
-  uint64_t DC_size = m_max_size - FC_size;
-  printf("FC size: %lu, DC size: %lu\n", FC_size, DC_size);
-  int fail_count = 0, count = 0;
-
-  // "first pass flag" is used to avoid inconsistency when eliminating global
-  // lock. ???
-  bool first_pass_flag = true;
-  ListNode* temp_node = m_fast_head.m_next;
-  ListNode* deleted_node = nullptr;
-  HashMapConstAccessor temp_hash_accessor;
-
-  while (temp_node != &m_fast_tail) {
-    count++;
-    auto eviction_num = eviction_counter.load();
-    if (!m_map.find(temp_hash_accessor, temp_node->m_key)) {
-      deleted_node = temp_node;
-      temp_node = temp_node->m_next;
-      if (deleted_node->is_in_list()) {
-        LruRemove(deleted_node);
-      }
-      delete deleted_node;
-      fail_count++;
-      continue;
-    }
-    m_fast_hash->Insert(temp_node->m_key, temp_hash_accessor->second.m_value);
-    temp_node = temp_node->m_next;
-
-    if (count > FC_size - 20 /* magic number */ && first_pass_flag) {
-      std::unique_lock list_lock(m_list_mtx);
-      // m_fast_head.m_next is right
-      auto node_before = m_fast_head.m_next->m_prev;
-      auto node_after = temp_node;
-
-      // set m_fast_tail
-      m_fast_tail.m_prev = temp_node->m_prev;
-      temp_node->m_prev->m_next = &m_fast_tail;
-
-      // set first node
-      m_fast_head.m_next->m_prev = &m_fast_head;
-
-      // set m_head
-      node_before->m_next = node_after;
-      node_after->m_prev = node_before;
-      list_lock.unlock();
-      break;
-    } else if (eviction_num > DC_size - 20 /* magic number */ &&
-               first_pass_flag) {
-      // frozen all ???
-      std::unique_lock list_lock(m_list_mtx);
-      auto node = m_fast_head.m_next;
-
-      // set m_fast_tail
-      m_fast_tail.m_prev = m_tail.m_prev;
-      m_tail.m_prev->m_next = &m_fast_tail;
-
-      // set m_tail
-      m_tail.m_prev = node->m_prev;
-      m_tail.m_prev->m_next = &m_tail;
-
-      // set first node
-      node->m_prev = &m_fast_head;
-      list_lock.unlock();
-      first_pass_flag = false;
+  if (!kPromote) {
+    // FIFO: a hit never moves its entry, so it takes no lock. It only marks
+    // it once, for the next construction.
+    if (!node->m_referenced.load(std::memory_order_relaxed)) {
+      node->m_referenced.store(true, std::memory_order_relaxed);
     }
+    return Tickers::CACHE_HIT;
   }
-
-  if (fail_count > 0) {
-    printf(
-        "fast hash insert num: %u, fail count: %u, m_size: %ld (FC_ratio: "
-        "%.2lf)\n",
-        count, fail_count, m_size.load(), 1.0 * count / m_size.load());
+  std::unique_lock list_lock(Base::m_list_mtx, std::try_to_lock);
+  if (list_lock) {
+    // The list node may be out of the list if it is in the process of being
+    // inserted or evicted. Doing this check allows us to lock the list for
+    // shorter periods of time.
+    if (node->is_in_list()) {
+      LruRemove(node);
+      LruPushFront(node);
+    }
+    list_lock.unlock();
   } else {
-    printf(
-        "fast hash insert num: %u, m_size: %ld (FC_ratio: "
-        "%.2lf)\n",
-        count, m_size.load(), 1.0 * count / m_size.load());
+    Cache<Key, Value>::stats.RecordTick(Tickers::PROMOTION_SKIPPED);
   }
-
-  fast_cache_ready = true;
-  fast_cache_construct = false;
-  eviction_counter = 0;
-  return true;
+  return Tickers::CACHE_HIT;
 }
 
-template <class Key, class Value>
-void FrozenHotCache<Key, Value>::DeleteFastCache() {
-  std::unique_lock list_lock(m_list_mtx);
-
-  auto node = m_head.m_next;
-  m_fast_head.m_next->m_prev = &m_head;
-  m_fast_tail.m_prev->m_next = node;
-  m_head.m_next = m_fast_head.m_next;
-  node->m_prev = m_fast_tail.m_prev;
-
-  m_fast_head.m_next = &m_fast_tail;
-  m_fast_tail.m_prev = &m_fast_head;
-
-  if (fast_cache_ready) {
-    fast_cache_ready = false;
-  }
-  list_lock.unlock();
-
-  m_fast_hash->Clear();
-}
-
-template <class Key, class Value>
-bool FrozenHotCache<Key, Value>::GetCurve(bool should_stop) {
-  assert(enable_insert.load());
-  m_marker = new ListNode(kMarkerKey);
+template <class Key, class Value, bool kPromote>
+bool FrozenHotCache<Key, Value, kPromote>::GetCurve(
+    const FrozenOptions& options, const std::atomic<bool>& should_stop) {
   uint64_t pass_counter = 0;
+  uint64_t max_size = Base::m_max_size.load();
 
-  // stop sample
-  sample_flag_ = false;
+  // Every request is recorded while the curve is profiled.
+  bool sample_flag = Cache<Key, Value>::sample_flag_;
+  Cache<Key, Value>::sample_flag_ = false;
 
-  std::unique_lock list_lock(m_list_mtx);
-  LruPushFront(m_marker);
-  curve_flag = true;
+  std::unique_lock list_lock(Base::m_list_mtx);
+  m_marker.m_time = utils::NowMicros();
+  LruPushFront(&m_marker);
+  Base::curve_flag = true;
 
   Cache<Key, Value>::stats.ResetCursor();
   list_lock.unlock();
 
-  uint64_t start_time = NowMicros();
+  uint64_t start_time = utils::NowMicros();
   uint64_t FC_size = 0;
-  for (int i = 0; i < 45 && !should_stop; i++) {
+  for (uint32_t i = 0; i < options.curve_max_passes && !should_stop; i++) {
     do {
       usleep(1000);
       double temp_fast_hit = 0, temp_miss = 1;
       Cache<Key, Value>::stats.GetStep(temp_fast_hit, temp_miss);
       FC_size = movement_counter.load();
-      // a magic number to avoid too many passes
-      if (temp_fast_hit + temp_miss > 0.992 /* magic number */) {
+      // The rest of the curve is flat, so no need to wait for the marker.
+      if (temp_fast_hit + temp_miss > options.curve_flat_threshold) {
         break;
       }
-    } while (FC_size <= m_max_size * i * 1.0 / 100 * 2 && !should_stop);
+    } while (FC_size <= max_size * i * options.curve_step && !should_stop);
 
     printf("curve pass: %lu\n", pass_counter++);
-    double FC_size_ratio = 1.0 * FC_size / m_max_size;
+    double FC_size_ratio = 1.0 * FC_size / max_size;
     printf("FC_size: %lu (FC_ratio: %.3lf)\n", FC_size, FC_size_ratio);
 
     double FC_hit_ratio = 0, miss_ratio = 1;
     Cache<Key, Value>::stats.GetAndPrintStep(FC_hit_ratio, miss_ratio);
 
-    printf("duration: %.3lf ms\n", 1.0 * (NowMicros() - start_time) / 1e3);
-    start_time = NowMicros();
+    printf("duration: %.3lf ms\n",
+           1.0 * (utils::NowMicros() - start_time) / 1e3);
+    start_time = utils::NowMicros();
     fflush(stdout);
 
-    if (FC_hit_ratio + miss_ratio > 0.992 || FC_hit_ratio > 0.9) {
+    if (FC_hit_ratio + miss_ratio > options.curve_flat_threshold ||
+        FC_size_ratio > options.curve_max_ratio) {
       break;
     }
 
-    Cache<Key, Value>::curve_container.insert(
-        Cache<Key, Value>::curve_container.end(),
-        CurveDataNode(FC_size_ratio, FC_hit_ratio, miss_ratio));
+    Cache<Key, Value>::curve_container.push_back(
+        CurveDataNode{FC_size_ratio, FC_hit_ratio, miss_ratio});
   }
+  printf("curve container size: %lu\n",
+         Cache<Key, Value>::curve_container.size());
 
-  // start sample
-  sample_flag_ = true;
+  Cache<Key, Value>::sample_flag_ = sample_flag;
 
   // delete marker from list
   list_lock.lock();
-  curve_flag = false;
-  LruRemove(m_marker);
+  Base::curve_flag = false;
+  LruRemove(&m_marker);
   list_lock.unlock();
 
-  delete m_marker;
-  m_marker = nullptr;
-
   movement_counter = 0;
   return true;
 }
 
-template <class Key, class Value>
-bool FrozenHotCache<Key, Value>::Evict() {
-  std::unique_lock list_lock(m_list_mtx);
-  ListNode* node = m_tail.m_prev;
-
-  while (node->m_key == kTombKey) {
-    LruRemove(node);
-    delete node;
-    node = m_tail.m_prev;
-  }
-  if (node == &m_head) {
-    return false;
-  }
-
-  LruRemove(node);
-  list_lock.unlock();
-
-  HashMapAccessor hash_accessor;
-  if (!m_map.find(hash_accessor, node->m_key)) {
-    return false;
-  }
-  m_map.erase(hash_accessor);
-
-  delete node;
-  return true;
-}
-
 }  // namespace kvcache
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,249 @@
+#include "frozenhot_cache_null.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+using Value = std::shared_ptr<std::string>;
+
+class FrozenHotCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    cache_ = std::make_unique<kvcache::FrozenHotCache<uint64_t, Value>>(
+        capacity);
+  }
+
+ public:
+  bool Insert(uint64_t key) {
+    return cache_->Insert(key, std::make_shared<std::string>(
+                                   std::to_string(key)));
+  }
+
+  // The value is checked against the key, so stale values are caught.
+  bool Lookup(uint64_t key) {
+    Value value;
+    if (!cache_->Lookup(key, value)) {
+      return false;
+    }
+    EXPECT_EQ(std::to_string(key), *value);
+    return true;
+  }
+
+  uint64_t capacity = 200;
+  std::unique_ptr<kvcache::FrozenHotCache<uint64_t, Value>> cache_;
+};
+
+TEST_F(FrozenHotCacheTest, HitAndMiss) {
+  for (uint64_t i = 0; i < 300; i++) {
+    Insert(i);
+  }
+  ASSERT_EQ(capacity, cache_->get_size());
+  ASSERT_TRUE(Lookup(150));
+  ASSERT_TRUE(Lookup(299));
+  ASSERT_FALSE(Lookup(50));
+
+  ASSERT_TRUE(cache_->Erase(150));
+  ASSERT_FALSE(Lookup(150));
+  ASSERT_FALSE(cache_->Erase(150));
+  ASSERT_EQ(capacity - 1, cache_->get_size());
+}
+
+TEST_F(FrozenHotCacheTest, ConstructTier) {
+  for (uint64_t i = 0; i < capacity; i++) {
+    Insert(i);
+  }
+
+  // The frozen cache serves every entry.
+  ASSERT_TRUE(cache_->ConstructTier());
+  for (uint64_t i = 0; i < capacity; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  ASSERT_EQ(capacity, cache_->get_stats()->GetTickerCount(
+                          kvcache::Tickers::FAST_CACHE_HIT));
+
+  // New keys are still admitted. They evict the frozen ones from the list,
+  // which are still served by the fast cache.
+  for (uint64_t i = capacity; i < capacity * 2; i++) {
+    ASSERT_TRUE(Insert(i));
+  }
+  for (uint64_t i = 0; i < capacity * 2; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  ASSERT_EQ(capacity, cache_->get_size());
+
+  // Deleting it twice is harmless, and only the list is left.
+  cache_->DeleteFastCache();
+  cache_->DeleteFastCache();
+  ASSERT_FALSE(Lookup(0));
+  ASSERT_TRUE(Lookup(capacity));
+  uint64_t count = 0;
+  cache_->ForEachEntry([&](const uint64_t&, const Value&) { count++; });
+  ASSERT_EQ(capacity, count);
+}
+
+TEST_F(FrozenHotCacheTest, ConstructFastCache) {
+  for (uint64_t i = 0; i < capacity; i++) {
+    Insert(i);
+  }
+
+  // The most recent half is frozen, the rest stays a dynamic LRU.
+  ASSERT_TRUE(cache_->ConstructFastCache(0.5));
+  for (uint64_t i = capacity; i < capacity * 2; i++) {
+    Insert(i);
+  }
+  for (uint64_t i = capacity / 2; i < capacity; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  ASSERT_FALSE(Lookup(capacity / 2 - 1));
+  ASSERT_TRUE(Lookup(capacity * 2 - 1));
+  ASSERT_EQ(capacity, cache_->get_size());
+
+  // A new construction replaces it, without a gap. The frozen keys were all
+  // hit, so they stay, although they left the list.
+  ASSERT_TRUE(cache_->ConstructFastCache(0.5));
+  ASSERT_TRUE(Lookup(capacity / 2));
+  ASSERT_EQ(capacity / 2 + 1, cache_->get_stats()->GetTickerCount(
+                                  kvcache::Tickers::FAST_CACHE_HIT));
+
+  // Only one of them was hit since.
+  ASSERT_TRUE(cache_->ConstructFastCache(0.5));
+  ASSERT_TRUE(Lookup(capacity / 2));
+  ASSERT_FALSE(Lookup(capacity / 2 + 1));
+  ASSERT_TRUE(Lookup(capacity * 2 - 1));
+
+  cache_->DeleteFastCache();
+  uint64_t count = 0;
+  cache_->ForEachEntry([&](const uint64_t&, const Value&) { count++; });
+  ASSERT_EQ(capacity, count);
+}
+
+TEST_F(FrozenHotCacheTest, RefreshKeepsHotKeys) {
+  capacity = 100;
+  SetUp();
+  for (uint64_t i = 0; i < capacity; i++) {
+    Insert(i);
+  }
+  ASSERT_TRUE(cache_->ConstructFastCache(0.1));
+  ASSERT_EQ(10, cache_->get_fast_cache_size());
+
+  // The frozen keys are hot, but their hits don't promote them, so the
+  // misses push them out of the list.
+  for (uint64_t i = capacity; i < capacity * 3; i++) {
+    ASSERT_FALSE(Lookup(i));
+    Insert(i);
+    ASSERT_TRUE(Lookup(90 + i % 10));
+  }
+  ASSERT_FALSE(Lookup(0));
+
+  // They survive the refresh anyway.
+  ASSERT_TRUE(cache_->ConstructFastCache(0.1));
+  ASSERT_EQ(10, cache_->get_fast_cache_size());
+  auto fast_hits =
+      cache_->get_stats()->GetTickerCount(kvcache::Tickers::FAST_CACHE_HIT);
+  for (uint64_t i = 90; i < 100; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  ASSERT_EQ(fast_hits + 10, cache_->get_stats()->GetTickerCount(
+                                kvcache::Tickers::FAST_CACHE_HIT));
+
+  // Those that go cold make room for the head of the list.
+  ASSERT_TRUE(cache_->ConstructFastCache(0.1));
+  for (uint64_t i = 90; i < 95; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  ASSERT_TRUE(cache_->ConstructFastCache(0.1));
+  for (uint64_t i = 90; i < 95; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  for (uint64_t i = 95; i < 100; i++) {
+    ASSERT_FALSE(Lookup(i));
+  }
+  fast_hits =
+      cache_->get_stats()->GetTickerCount(kvcache::Tickers::FAST_CACHE_HIT);
+  ASSERT_TRUE(Lookup(capacity * 3 - 1));
+  ASSERT_EQ(fast_hits + 1, cache_->get_stats()->GetTickerCount(
+                               kvcache::Tickers::FAST_CACHE_HIT));
+}
+
+TEST_F(FrozenHotCacheTest, FastCacheHitIsBorrowed) {
+  for (uint64_t i = 0; i < capacity; i++) {
+    Insert(i);
+  }
+  ASSERT_TRUE(cache_->ConstructFastCache(0.5));
+  Value value;
+  ASSERT_TRUE(cache_->Lookup(capacity - 1, value));
+  ASSERT_EQ(1, cache_->get_stats()->GetTickerCount(
+                   kvcache::Tickers::FAST_CACHE_HIT));
+  ASSERT_EQ(std::to_string(capacity - 1), *value);
+
+  // A fast cache hit lends its value, so callers that keep values (e.g. an
+  // L0 cache) must not keep it. The other hits share the ownership.
+  ASSERT_TRUE(fast_hash::IsBorrowed(value));
+  ASSERT_TRUE(cache_->Lookup(0, value));
+  ASSERT_EQ(1, cache_->get_stats()->GetTickerCount(
+                   kvcache::Tickers::FAST_CACHE_HIT));
+  ASSERT_FALSE(fast_hash::IsBorrowed(value));
+}
+
+TEST_F(FrozenHotCacheTest, WritesReachFastCache) {
+  for (uint64_t i = 0; i < capacity; i++) {
+    Insert(i);
+  }
+  ASSERT_TRUE(cache_->ConstructTier());
+  ASSERT_EQ(capacity, cache_->get_fast_cache_size());
+  ASSERT_EQ(0, cache_->get_fast_cache_invalidations());
+
+  // An update of a frozen key is served by the fast cache.
+  Value value;
+  ASSERT_FALSE(cache_->Insert(1, std::make_shared<std::string>("one")));
+  ASSERT_TRUE(cache_->Lookup(1, value));
+  ASSERT_EQ("one", *value);
+
+  // An erase is not served anymore, and a later insert is.
+  ASSERT_TRUE(cache_->Erase(2));
+  ASSERT_FALSE(Lookup(2));
+  ASSERT_TRUE(Insert(2));
+  ASSERT_TRUE(Lookup(2));
+
+  // A frozen key evicted from the list is still written through.
+  for (uint64_t i = capacity; i < capacity * 2; i++) {
+    Insert(i);
+  }
+  ASSERT_TRUE(Lookup(3));
+  ASSERT_TRUE(cache_->Insert(3, std::make_shared<std::string>("three")));
+  ASSERT_TRUE(cache_->Lookup(3, value));
+  ASSERT_EQ("three", *value);
+  ASSERT_FALSE(cache_->Erase(4));
+  ASSERT_FALSE(Lookup(4));
+
+  // Keys that are not frozen don't count.
+  ASSERT_TRUE(cache_->Erase(capacity * 2 - 1));
+  ASSERT_EQ(5, cache_->get_fast_cache_invalidations());
+
+  // A new construction starts over.
+  ASSERT_TRUE(cache_->ConstructFastCache(0.5));
+  ASSERT_EQ(0, cache_->get_fast_cache_invalidations());
+}
+
+TEST_F(FrozenHotCacheTest, EvictionCallback) {
+  uint64_t num_evicted = 0;
+  cache_->SetEvictionCallback([&](const uint64_t& key, const Value& value) {
+    ASSERT_EQ(std::to_string(key), *value);
+    num_evicted++;
+  });
+  for (uint64_t i = 0; i < capacity * 2; i++) {
+    Insert(i);
+  }
+  ASSERT_EQ(capacity, num_evicted);
+
+  cache_->SetCapacity(capacity / 2);
+  ASSERT_EQ(capacity / 2, cache_->EvictBatch(capacity));
+  ASSERT_EQ(capacity / 2, cache_->get_size());
+  ASSERT_EQ(capacity + capacity / 2, num_evicted);
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,31 @@
+#ifndef FROZENHOT_FIFO_CACHE_H
+#define FROZENHOT_FIFO_CACHE_H
+
+#include "frozenhot_cache_null.h"
+
+namespace kvcache {
+
+// FrozenFifoCache is a FIFO shard with a frozen fast cache in front of it,
+// ported from the FIFO variant of FrozenHot ('FIFO_FH').
+//
+// Entries are evicted in the order they were inserted, and a lookup never
+// moves them, so it takes no lock. The exception is 'GetCurve': while the
+// curve is profiled, a hit moves its entry to the head of the list like LRU
+// does, which is how the hot keys are found. So the fast cache freezes the
+// keys hit during the profile, and the newest ones behind them. The frozen
+// entries keep their place in the list, and are evicted in turn, but the fast
+// cache still serves them.
+//
+// Otherwise, a hit only marks its entry. A refresh freezes the frozen keys
+// that are still hit, then the marked entries, and only then the newest
+// unmarked ones.
+//
+// Everything else is the same as 'FrozenHotCache', which it is without the
+// promotion of the hits.
+
+template <class Key, class Value>
+using FrozenFifoCache = FrozenHotCache<Key, Value, false>;
+
+}  // namespace kvcache
+
+#endif
@@ -0,0 +1,126 @@
+#include "frozenhot_fifo_cache.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+using Value = std::shared_ptr<std::string>;
+
+class FrozenFifoCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    cache_ = std::make_unique<kvcache::FrozenFifoCache<uint64_t, Value>>(
+        capacity);
+  }
+
+ public:
+  bool Insert(uint64_t key) {
+    return cache_->Insert(key, std::make_shared<std::string>(
+                                   std::to_string(key)));
+  }
+
+  // The value is checked against the key, so stale values are caught.
+  bool Lookup(uint64_t key) {
+    Value value;
+    if (!cache_->Lookup(key, value)) {
+      return false;
+    }
+    EXPECT_EQ(std::to_string(key), *value);
+    return true;
+  }
+
+  uint64_t capacity = 200;
+  std::unique_ptr<kvcache::FrozenFifoCache<uint64_t, Value>> cache_;
+};
+
+TEST_F(FrozenFifoCacheTest, HitAndMiss) {
+  for (uint64_t i = 0; i < capacity; i++) {
+    Insert(i);
+  }
+  // A hit doesn't save the oldest entry from eviction.
+  ASSERT_TRUE(Lookup(0));
+  ASSERT_TRUE(Insert(capacity));
+  ASSERT_FALSE(Lookup(0));
+  ASSERT_TRUE(Lookup(1));
+  ASSERT_EQ(capacity, cache_->get_size());
+
+  ASSERT_TRUE(cache_->Erase(1));
+  ASSERT_FALSE(Lookup(1));
+  ASSERT_FALSE(cache_->Erase(1));
+  ASSERT_EQ(capacity - 1, cache_->get_size());
+}
+
+TEST_F(FrozenFifoCacheTest, ConstructFastCache) {
+  for (uint64_t i = 0; i < capacity; i++) {
+    Insert(i);
+  }
+
+  // The newest half is frozen, and still served once it is evicted.
+  ASSERT_TRUE(cache_->ConstructFastCache(0.5));
+  ASSERT_EQ(capacity / 2, cache_->get_fast_cache_size());
+  for (uint64_t i = capacity; i < capacity * 2; i++) {
+    Insert(i);
+  }
+  for (uint64_t i = capacity / 2; i < capacity; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  ASSERT_FALSE(Lookup(capacity / 2 - 1));
+  ASSERT_EQ(capacity / 2, cache_->get_stats()->GetTickerCount(
+                              kvcache::Tickers::FAST_CACHE_HIT));
+
+  // Writes go through.
+  Value value;
+  ASSERT_TRUE(cache_->Insert(capacity - 1, std::make_shared<std::string>("x")));
+  ASSERT_TRUE(cache_->Lookup(capacity - 1, value));
+  ASSERT_EQ("x", *value);
+  ASSERT_FALSE(cache_->Erase(capacity - 2));
+  ASSERT_FALSE(Lookup(capacity - 2));
+  ASSERT_EQ(2, cache_->get_fast_cache_invalidations());
+
+  cache_->DeleteFastCache();
+  ASSERT_FALSE(Lookup(capacity / 2));
+  uint64_t count = 0;
+  cache_->ForEachEntry([&](const uint64_t&, const Value&) { count++; });
+  ASSERT_EQ(capacity, count);
+}
+
+TEST_F(FrozenFifoCacheTest, RefreshKeepsHotKeys) {
+  capacity = 100;
+  SetUp();
+  for (uint64_t i = 0; i < capacity; i++) {
+    Insert(i);
+  }
+  ASSERT_TRUE(cache_->ConstructFastCache(0.1));
+
+  // The hot keys are evicted in turn from the list.
+  for (uint64_t i = capacity; i < capacity * 3; i++) {
+    ASSERT_FALSE(Lookup(i));
+    Insert(i);
+    ASSERT_TRUE(Lookup(90 + i % 10));
+  }
+  // Two of the list are hit as well, not the newest ones.
+  ASSERT_TRUE(Lookup(capacity * 2));
+  ASSERT_TRUE(Lookup(capacity * 2 + 1));
+
+  // A refresh keeps the hot keys, and freezes the hit ones of the list ahead
+  // of the newest.
+  ASSERT_TRUE(cache_->ConstructFastCache(0.13));
+  ASSERT_EQ(13, cache_->get_fast_cache_size());
+  auto fast_hits =
+      cache_->get_stats()->GetTickerCount(kvcache::Tickers::FAST_CACHE_HIT);
+  for (uint64_t i = 90; i < 100; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  ASSERT_TRUE(Lookup(capacity * 2));
+  ASSERT_TRUE(Lookup(capacity * 2 + 1));
+  ASSERT_TRUE(Lookup(capacity * 3 - 1));
+  ASSERT_TRUE(Lookup(capacity * 3 - 2));
+  ASSERT_EQ(fast_hits + 13, cache_->get_stats()->GetTickerCount(
+                                kvcache::Tickers::FAST_CACHE_HIT));
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,351 @@
+#ifndef FROZENHOT_LFU_CACHE_H
+#define FROZENHOT_LFU_CACHE_H
+
+#include <assert.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "cache.h"
+#include "frozenhot_shard.h"
+#include "statistics.h"
+#include "utils.h"
+
+namespace kvcache {
+
+template <class Key>
+struct FrozenFreqNode;
+
+// Entry node of 'FrozenLfuCache', in the list of its frequency node.
+// 'm_count' is the count of its frequency node, which lookups read without
+// the list mutex.
+template <class Key>
+struct FrozenLfuNode {
+  FrozenLfuNode()
+      : m_key(),
+        m_prev(out_of_list_marker_),
+        m_next(nullptr),
+        m_freq(nullptr),
+        m_count(0) {}
+
+  FrozenLfuNode(const Key& key)
+      : m_key(key),
+        m_prev(out_of_list_marker_),
+        m_next(nullptr),
+        m_freq(nullptr),
+        m_count(0) {}
+
+  bool is_in_list() const { return m_prev != out_of_list_marker_; }
+
+  inline static FrozenLfuNode* const out_of_list_marker_ =
+      reinterpret_cast<FrozenLfuNode*>(-1);
+
+  Key m_key;
+  FrozenLfuNode* m_prev;
+  FrozenLfuNode* m_next;
+  FrozenFreqNode<Key>* m_freq;
+  std::atomic<uint64_t> m_count;
+};
+
+// The entries with 'm_count' hits, from the newest to the oldest one.
+template <class Key>
+struct FrozenFreqNode {
+  FrozenFreqNode()
+      : m_count(0), m_size(0), m_prev(nullptr), m_next(nullptr) {
+    m_list.m_prev = &m_list;
+    m_list.m_next = &m_list;
+  }
+
+  explicit FrozenFreqNode(uint64_t count) : FrozenFreqNode() {
+    m_count = count;
+  }
+
+  bool empty() const { return m_list.m_next == &m_list; }
+
+  uint64_t m_count;
+  uint64_t m_size;
+  FrozenLfuNode<Key> m_list;
+  FrozenFreqNode* m_prev;
+  FrozenFreqNode* m_next;
+};
+
+// FrozenLfuCache is an LFU shard with a frozen fast cache in front of it,
+// ported from the LFU variant of FrozenHot ('lfu_FH').
+//
+// The entries are grouped by their number of hits into frequency nodes, which
+// are listed from the most to the least frequent one. A hit moves its entry to
+// the next frequency, and the least frequent entry is evicted, the oldest one
+// of a tie. The promotion only tries the list mutex like 'FrozenHotCache', so
+// the frequencies are approximate under contention.
+//
+// 'ConstructTier' and 'ConstructFastCache' freeze the most frequent entries
+// into a 'FrozenTier', and writes go through to the fast cache. A frozen entry
+// would keep the count of its hits before the freeze, and hold its place for
+// as long as it is frozen. So its count decays to 1 instead, as the oldest
+// entry of that frequency, and it makes room for the others.
+//
+// 'GetCurve' lowers a frequency threshold one frequency node at a time, and
+// counts the hits of the entries above it as fast cache hits. The lookups
+// don't promote while the curve is profiled.
+//
+// 'Value' must be a shared pointer.
+
+template <class Key, class Value>
+class FrozenLfuCache
+    : public FrozenHotShard<FrozenLfuCache<Key, Value>, Key, Value,
+                            FrozenLfuNode<Key>> {
+ private:
+  using ListNode = FrozenLfuNode<Key>;
+  using FreqNode = FrozenFreqNode<Key>;
+  using Base = FrozenHotShard<FrozenLfuCache, Key, Value, ListNode>;
+  friend Base;
+
+ public:
+  FrozenLfuCache(uint64_t capacity) : Base(capacity) {
+    m_head.m_next = &m_tail;
+    m_tail.m_prev = &m_head;
+  }
+
+  virtual ~FrozenLfuCache() {
+    auto freq = m_head.m_next;
+    while (freq != &m_tail) {
+      auto node = freq->m_list.m_next;
+      while (node != &freq->m_list) {
+        auto next = node->m_next;
+        delete node;
+        node = next;
+      }
+      auto next = freq->m_next;
+      delete freq;
+      freq = next;
+    }
+  }
+
+  virtual bool GetCurve(const FrozenOptions& options,
+                        const std::atomic<bool>& should_stop) override;
+
+ private:
+  // The caller must lock the list mutex while this is called
+  void FreqInsertBefore(FreqNode* next, FreqNode* freq) {
+    freq->m_next = next;
+    freq->m_prev = next->m_prev;
+    next->m_prev->m_next = freq;
+    next->m_prev = freq;
+  }
+
+  // The caller must lock the list mutex while this is called
+  void EntryPushFront(FreqNode* freq, ListNode* node) {
+    node->m_prev = &freq->m_list;
+    node->m_next = freq->m_list.m_next;
+    freq->m_list.m_next->m_prev = node;
+    freq->m_list.m_next = node;
+    node->m_freq = freq;
+    node->m_count.store(freq->m_count, std::memory_order_relaxed);
+    freq->m_size++;
+  }
+
+  // The caller must lock the list mutex while this is called
+  void EntryPushBack(FreqNode* freq, ListNode* node) {
+    node->m_next = &freq->m_list;
+    node->m_prev = freq->m_list.m_prev;
+    freq->m_list.m_prev->m_next = node;
+    freq->m_list.m_prev = node;
+    node->m_freq = freq;
+    node->m_count.store(freq->m_count, std::memory_order_relaxed);
+    freq->m_size++;
+  }
+
+  // The frequency node of the entries with 1 hit, which is added if needed.
+  // The caller must lock the list mutex while this is called
+  FreqNode* FirstFreq() {
+    auto freq = m_tail.m_prev;
+    if (freq == &m_head || freq->m_count != 1) {
+      freq = new FreqNode(1);
+      FreqInsertBefore(&m_tail, freq);
+    }
+    return freq;
+  }
+
+  // Remove 'node' from its frequency node, which is freed once empty.
+  // The caller must lock the list mutex while this is called
+  void EntryRemove(ListNode* node) {
+    assert(node != nullptr);
+    auto freq = node->m_freq;
+    node->m_prev->m_next = node->m_next;
+    node->m_next->m_prev = node->m_prev;
+    node->m_prev = ListNode::out_of_list_marker_;
+    node->m_freq = nullptr;
+    freq->m_size--;
+    if (freq->empty()) {
+      freq->m_prev->m_next = freq->m_next;
+      freq->m_next->m_prev = freq->m_prev;
+      delete freq;
+    }
+  }
+
+  // Move 'node' to the next frequency.
+  // The caller must lock the list mutex while this is called
+  void Promote(ListNode* node) {
+    auto freq = node->m_freq;
+    auto next = freq->m_prev;
+    if (next == &m_head || next->m_count != freq->m_count + 1) {
+      next = new FreqNode(freq->m_count + 1);
+      FreqInsertBefore(freq, next);
+    }
+    EntryRemove(node);
+    EntryPushFront(next, node);
+  }
+
+  // The hooks of 'FrozenHotShard'.
+  Tickers Touch(ListNode* node);
+
+  void ListInsert(ListNode* node) { EntryPushFront(FirstFreq(), node); }
+
+  void ListRemove(ListNode* node) { EntryRemove(node); }
+
+  ListNode* ListEvict() {
+    FreqNode* freq = m_tail.m_prev;
+    if (freq == &m_head) {
+      return nullptr;
+    }
+    // The oldest of the least frequent entries.
+    ListNode* node = freq->m_list.m_prev;
+    EntryRemove(node);
+    return node;
+  }
+
+  // From the most to the least frequent entry.
+  template <class Func>
+  void ForEachNode(Func&& func) {
+    for (auto freq = m_head.m_next; freq != &m_tail; freq = freq->m_next) {
+      for (auto node = freq->m_list.m_next; node != &freq->m_list;
+           node = node->m_next) {
+        if (!func(node)) {
+          return;
+        }
+      }
+    }
+  }
+
+  // The fast cache serves the hits of a frozen entry now, so it becomes the
+  // oldest entry of frequency 1, the next to evict.
+  void OnFrozen(ListNode* node) {
+    EntryRemove(node);
+    EntryPushBack(FirstFreq(), node);
+  }
+
+  // From the most to the least frequent.
+  FreqNode m_head;
+  FreqNode m_tail;
+
+  // While the curve is profiled, the hits of the entries with more than
+  // 'm_threshold' hits are counted as fast cache hits.
+  std::atomic<uint64_t> m_threshold{0};
+};
+
+template <class Key, class Value>
+Tickers FrozenLfuCache<Key, Value>::Touch(ListNode* node) {
+  if (Base::curve_flag.load()) {
+    return node->m_count.load(std::memory_order_relaxed) > m_threshold.load()
+               ? Tickers::FAST_CACHE_HIT
+               : Tickers::CACHE_HIT;
+  }
+
+  std::unique_lock list_lock(Base::m_list_mtx, std::try_to_lock);
+  if (list_lock) {
+    // The list node may be out of the list if it is in the process of being
+    // inserted or evicted.
+    if (node->is_in_list()) {
+      Promote(node);
+    }
+    list_lock.unlock();
+  } else {
+    Cache<Key, Value>::stats.RecordTick(Tickers::PROMOTION_SKIPPED);
+  }
+  return Tickers::CACHE_HIT;
+}
+
+template <class Key, class Value>
+bool FrozenLfuCache<Key, Value>::GetCurve(
+    const FrozenOptions& options, const std::atomic<bool>& should_stop) {
+  uint64_t pass_counter = 0;
+  uint64_t max_size = Base::m_max_size.load();
+
+  // Every request is recorded while the curve is profiled.
+  bool sample_flag = Cache<Key, Value>::sample_flag_;
+  Cache<Key, Value>::sample_flag_ = false;
+
+  // Nothing is above the highest frequency at first, which is the baseline.
+  std::unique_lock list_lock(Base::m_list_mtx);
+  m_threshold = m_head.m_next != &m_tail ? m_head.m_next->m_count : 0;
+  Base::curve_flag = true;
+  list_lock.unlock();
+
+  uint64_t start_time = utils::NowMicros();
+  for (uint32_t i = 0; i < options.curve_max_passes && !should_stop; i++) {
+    // Lower the threshold until the entries above it fill the fast cache
+    // size of this pass.
+    uint64_t FC_size = 0;
+    list_lock.lock();
+    auto freq = m_head.m_next;
+    while (freq != &m_tail && freq->m_count > m_threshold) {
+      FC_size += freq->m_size;
+      freq = freq->m_next;
+    }
+    while (freq != &m_tail && FC_size < max_size * i * options.curve_step) {
+      FC_size += freq->m_size;
+      freq = freq->m_next;
+    }
+    m_threshold = freq != &m_tail ? freq->m_count : 0;
+    list_lock.unlock();
+
+    Cache<Key, Value>::stats.ResetCursor();
+    uint64_t pass_start = utils::NowMicros();
+    while (!should_stop &&
+           utils::NowMicros() - pass_start < options.curve_pass_us) {
+      usleep(1000);
+      uint64_t fast_cache_hit = 0, o_hit = 0, miss = 0;
+      Cache<Key, Value>::stats.GetStep(fast_cache_hit, o_hit, miss);
+      if (fast_cache_hit + o_hit + miss >= options.curve_requests) {
+        break;
+      }
+    }
+
+    printf("curve pass: %lu\n", pass_counter++);
+    double FC_size_ratio = 1.0 * FC_size / max_size;
+    printf("FC_size: %lu (FC_ratio: %.3lf, threshold: %lu)\n", FC_size,
+           FC_size_ratio, m_threshold.load());
+
+    double FC_hit_ratio = 0, miss_ratio = 1;
+    Cache<Key, Value>::stats.GetAndPrintStep(FC_hit_ratio, miss_ratio);
+
+    printf("duration: %.3lf ms\n",
+           1.0 * (utils::NowMicros() - start_time) / 1e3);
+    start_time = utils::NowMicros();
+    fflush(stdout);
+
+    if (FC_hit_ratio + miss_ratio > options.curve_flat_threshold ||
+        FC_size_ratio > options.curve_max_ratio) {
+      break;
+    }
+
+    Cache<Key, Value>::curve_container.push_back(
+        CurveDataNode{FC_size_ratio, FC_hit_ratio, miss_ratio});
+    if (m_threshold == 0) {
+      // Every entry is above it.
+      break;
+    }
+  }
+  printf("curve container size: %lu\n",
+         Cache<Key, Value>::curve_container.size());
+
+  Cache<Key, Value>::sample_flag_ = sample_flag;
+  Base::curve_flag = false;
+  m_threshold = 0;
+  return true;
+}
+
+}  // namespace kvcache
+
+#endif
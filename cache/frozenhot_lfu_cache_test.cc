@@ -0,0 +1,185 @@
+#include "frozenhot_lfu_cache.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+using Value = std::shared_ptr<std::string>;
+
+class FrozenLfuCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    cache_ = std::make_unique<kvcache::FrozenLfuCache<uint64_t, Value>>(
+        capacity);
+  }
+
+ public:
+  bool Insert(uint64_t key) {
+    return cache_->Insert(key, std::make_shared<std::string>(
+                                   std::to_string(key)));
+  }
+
+  // The value is checked against the key, so stale values are caught.
+  bool Lookup(uint64_t key) {
+    Value value;
+    if (!cache_->Lookup(key, value)) {
+      return false;
+    }
+    EXPECT_EQ(std::to_string(key), *value);
+    return true;
+  }
+
+  // Fill the cache, and hit the first 'num_hot' keys three times.
+  void Warm(uint64_t num_hot) {
+    for (uint64_t i = 0; i < capacity; i++) {
+      Insert(i);
+    }
+    for (int round = 0; round < 3; round++) {
+      for (uint64_t i = 0; i < num_hot; i++) {
+        ASSERT_TRUE(Lookup(i));
+      }
+    }
+  }
+
+  uint64_t capacity = 200;
+  std::unique_ptr<kvcache::FrozenLfuCache<uint64_t, Value>> cache_;
+};
+
+TEST_F(FrozenLfuCacheTest, EvictLeastFrequent) {
+  Warm(10);
+
+  // The oldest of the entries without a hit goes first.
+  ASSERT_TRUE(Insert(capacity));
+  ASSERT_FALSE(Lookup(10));
+  ASSERT_TRUE(Lookup(0));
+  ASSERT_TRUE(Lookup(11));
+  ASSERT_EQ(capacity, cache_->get_size());
+
+  ASSERT_TRUE(cache_->Erase(0));
+  ASSERT_FALSE(Lookup(0));
+  ASSERT_FALSE(cache_->Erase(0));
+  ASSERT_EQ(capacity - 1, cache_->get_size());
+
+  // The visit goes from the most to the least frequent entry.
+  std::vector<uint64_t> keys;
+  cache_->ForEachEntry(
+      [&](const uint64_t& key, const Value&) { keys.push_back(key); });
+  ASSERT_EQ(capacity - 1, keys.size());
+  ASSERT_EQ(11, keys[9]);
+  ASSERT_LT(keys[0], 10);
+}
+
+TEST_F(FrozenLfuCacheTest, ConstructFastCache) {
+  Warm(10);
+
+  // The most frequent entries are frozen.
+  ASSERT_TRUE(cache_->ConstructFastCache(0.05));
+  ASSERT_EQ(10, cache_->get_fast_cache_size());
+  for (uint64_t i = 0; i < 10; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  ASSERT_TRUE(Lookup(10));
+  ASSERT_EQ(10, cache_->get_stats()->GetTickerCount(
+                    kvcache::Tickers::FAST_CACHE_HIT));
+
+  // Writes go through.
+  Value value;
+  ASSERT_FALSE(cache_->Insert(1, std::make_shared<std::string>("one")));
+  ASSERT_TRUE(cache_->Lookup(1, value));
+  ASSERT_EQ("one", *value);
+  ASSERT_TRUE(cache_->Erase(2));
+  ASSERT_FALSE(Lookup(2));
+  ASSERT_EQ(2, cache_->get_fast_cache_invalidations());
+
+  cache_->DeleteFastCache();
+  ASSERT_EQ(0, cache_->get_fast_cache_size());
+  ASSERT_TRUE(Lookup(3));
+}
+
+TEST_F(FrozenLfuCacheTest, FrozenEntriesDecay) {
+  Warm(10);
+  ASSERT_TRUE(cache_->ConstructFastCache(0.05));
+
+  // The frozen entries lost their hits, and are the next to evict.
+  std::vector<uint64_t> keys;
+  cache_->ForEachEntry(
+      [&](const uint64_t& key, const Value&) { keys.push_back(key); });
+  ASSERT_EQ(capacity, keys.size());
+  ASSERT_LT(keys.back(), 10);
+  for (uint64_t i = 0; i < 10; i++) {
+    ASSERT_TRUE(Insert(capacity + i));
+  }
+  // They make room for the new ones, and are still served.
+  for (uint64_t i = 0; i < 10; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  cache_->DeleteFastCache();
+  for (uint64_t i = 0; i < 10; i++) {
+    ASSERT_FALSE(Lookup(i));
+  }
+  ASSERT_TRUE(Lookup(10));
+  ASSERT_EQ(capacity, cache_->get_size());
+}
+
+TEST_F(FrozenLfuCacheTest, GetCurve) {
+  Warm(10);
+
+  // Half of the requests go to the frequent keys.
+  std::atomic<bool> should_stop = false;
+  std::atomic<bool> done = false;
+  std::thread monitor([&]() {
+    cache_->GetCurve(kvcache::FrozenOptions(), should_stop);
+    done = true;
+  });
+  // Lookups promote until the profile starts, which would split the frequent
+  // keys, and the first pass waits for requests.
+  usleep(20000);
+  for (uint64_t i = 0; !done; i++) {
+    Lookup(i % 10);
+    Lookup(10 + i % (capacity - 10));
+  }
+  monitor.join();
+
+  // Nothing is frozen at first, and then the frequent keys are.
+  auto& curve = cache_->get_container();
+  ASSERT_GE(curve.size(), 2);
+  ASSERT_EQ(0, curve[0].size);
+  ASSERT_EQ(0, curve[0].FC_hit);
+  ASSERT_DOUBLE_EQ(0.05, curve[1].size);
+  ASSERT_NEAR(0.5, curve[1].FC_hit, 0.05);
+}
+
+TEST_F(FrozenLfuCacheTest, GetCurveOptions) {
+  Warm(10);
+
+  // Only the baseline pass, measured over a few requests.
+  kvcache::FrozenOptions options;
+  options.curve_max_passes = 1;
+  options.curve_requests = 100;
+  std::atomic<bool> should_stop = false;
+  std::atomic<bool> done = false;
+  std::thread monitor([&]() {
+    cache_->GetCurve(options, should_stop);
+    done = true;
+  });
+  usleep(20000);
+  for (uint64_t i = 0; !done; i++) {
+    Lookup(i % 10);
+    Lookup(10 + i % (capacity - 10));
+  }
+  monitor.join();
+
+  auto& curve = cache_->get_container();
+  ASSERT_EQ(1, curve.size());
+  ASSERT_EQ(0, curve[0].size);
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
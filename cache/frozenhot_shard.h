@@ -0,0 +1,437 @@
+#ifndef FROZENHOT_SHARD_H
+#define FROZENHOT_SHARD_H
+
+#include <assert.h>
+#include <tbb/concurrent_hash_map.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "cache.h"
+#include "frozen_tier.h"
+#include "phase_timer.h"
+#include "statistics.h"
+
+namespace kvcache {
+
+// FrozenHotShard is what the FrozenHot shards ('FrozenHotCache',
+// 'FrozenFifoCache', 'FrozenLfuCache') have in common: the map of the entries,
+// the frozen fast cache in front of it ('FrozenTier'), and the inserts,
+// erases, evictions and constructions of the fast cache.
+//
+// The policy ('Derived') keeps the entries of the map in its list of 'Node's,
+// from the hottest to the coldest one, under 'm_list_mtx'. It implements:
+//
+//   // A hit of 'node' in the map, and the ticker it counts as. The list mutex
+//   // is not held.
+//   Tickers Touch(Node* node);
+//   // Link a new node, unlink a node, and unlink the next node to evict (or
+//   // return nullptr). The list mutex is held.
+//   void ListInsert(Node* node);
+//   void ListRemove(Node* node);
+//   Node* ListEvict();
+//   // Visit the nodes from the hottest one while 'func' returns true. The
+//   // list mutex is held.
+//   template <class Func> void ForEachNode(Func&& func);
+//   // Optional: 'node' was frozen. The list mutex is held.
+//   void OnFrozen(Node* node);
+//   // Optional: whether 'node' was hit, if the order of the list doesn't
+//   // tell. Unhit nodes are only frozen after the hit ones. The list mutex
+//   // is held.
+//   bool Referenced(Node* node);
+//
+// and the curve of the fast cache ratio ('GetCurve'). A node has a copy of
+// its key ('m_key'), allowing us to find the TBB::CHM element from the node,
+// and 'is_in_list'. The policy frees the nodes left in its list.
+//
+// The probe of a lookup is the one of the fast cache, and of the map after a
+// miss of it. 'Touch' times as the update of the list, including its wait.
+//
+// 'Value' must be a shared pointer.
+
+template <class Derived, class Key, class Value, class Node>
+class FrozenHotShard : public Cache<Key, Value> {
+ protected:
+  // The value is stored in the hashtable. The Node* is owned by the list.
+  struct HashMapValue {
+    HashMapValue() : m_list_node(nullptr) {}
+    HashMapValue(const Value& value, Node* node)
+        : m_value(value), m_list_node(node) {}
+
+    Value m_value;
+    Node* m_list_node;
+  };
+
+  using HashMap =
+      tbb::concurrent_hash_map<Key, HashMapValue, tbb::tbb_hash_compare<Key>>;
+  using HashMapConstAccessor = typename HashMap::const_accessor;
+  using HashMapAccessor = typename HashMap::accessor;
+  using HashMapValuePair = typename HashMap::value_type;
+
+ public:
+  explicit FrozenHotShard(uint64_t capacity)
+      : m_max_size(capacity),
+        m_size(0),
+        m_map(std::thread::hardware_concurrency() * 4) {}
+  // Disable copying or assigment
+  FrozenHotShard(const FrozenHotShard&) = delete;
+  FrozenHotShard& operator=(const FrozenHotShard&) = delete;
+
+  bool Lookup(Key key, Value& value) override;
+
+  bool Insert(Key key, const Value& value) override;
+
+  bool Erase(Key key) override;
+
+  virtual bool ConstructTier() override;
+
+  virtual bool ConstructFastCache(double ratio) override;
+
+  virtual void DeleteFastCache() override { m_tier.Delete(); }
+
+  virtual uint64_t get_fast_cache_invalidations() override {
+    return m_tier.invalidations();
+  }
+
+  virtual uint64_t get_fast_cache_size() override { return m_tier.size(); }
+
+  virtual uint64_t get_size() override { return m_size.load(); }
+
+  virtual bool is_full() override { return m_size.load() >= m_max_size; }
+
+  virtual void SetCapacity(uint64_t capacity) override {
+    m_max_size.store(capacity);
+  }
+
+  virtual uint64_t EvictBatch(uint64_t max_num) override;
+
+  virtual void ForEachEntry(
+      const std::function<void(const Key&, const Value&)>& func) override;
+
+ protected:
+  Derived& derived() { return *static_cast<Derived*>(this); }
+
+  // Defaults unless the policy hides them.
+  void OnFrozen(Node*) {}
+  bool Referenced(Node*) { return true; }
+
+  // Freeze the 'num' hottest entries into a new fast cache, and publish it:
+  // first the frozen keys that are still hit, then the hottest of the list.
+  // Return the number of frozen entries.
+  uint64_t Freeze(uint64_t num);
+
+  // Pass a write of 'key' to the fast cache: its new value, or nullptr for an
+  // erase. The caller holds the accessor of 'key', which orders the writes of
+  // a key.
+  void WriteFrozen(const Key& key, const Value* value, bool stat_yes) {
+    if (m_tier.Write(key, value) && stat_yes) {
+      Cache<Key, Value>::stats.RecordTick(Tickers::FROZEN_INVALIDATE);
+    }
+  }
+
+  // Takes the list mutex.
+  bool Evict();
+
+  std::atomic<uint64_t> m_max_size;
+  std::atomic<uint64_t> m_size;
+
+  HashMap m_map;
+  FrozenTier<Key, Value> m_tier;
+
+  CountedMutex m_list_mtx{Cache<Key, Value>::get_stats(),
+                          Tickers::LIST_LOCK_ACQUIRE,
+                          Tickers::LIST_LOCK_CONTENDED};
+
+  // Set while 'GetCurve' profiles the curve.
+  std::atomic<bool> curve_flag = false;
+};
+
+template <class Derived, class Key, class Value, class Node>
+bool FrozenHotShard<Derived, Key, Value, Node>::Lookup(Key key,
+                                                      Value& value) {
+  bool stat_yes = Cache<Key, Value>::sample_generator();
+  PHASE_TIMER_START(timer);
+  HashMapConstAccessor hash_accessor;
+
+  if (m_tier.Lookup(key, value)) {
+    PHASE_TIMER_RECORD(timer, LOOKUP_PROBE);
+    if (stat_yes) {
+      Cache<Key, Value>::stats.RecordTick(Tickers::FAST_CACHE_HIT);
+    }
+    return true;
+  }
+
+  bool found = m_map.find(hash_accessor, key);
+  PHASE_TIMER_RECORD(timer, LOOKUP_PROBE);
+  if (!found) {
+    if (stat_yes) {
+      Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_MISS);
+    }
+    return false;
+  }
+
+  value = hash_accessor->second.m_value;
+  auto ticker = derived().Touch(hash_accessor->second.m_list_node);
+  PHASE_TIMER_RECORD(timer, LOOKUP_LIST_UPDATE);
+  if (stat_yes) {
+    Cache<Key, Value>::stats.RecordTick(ticker);
+  }
+  return true;
+}
+
+template <class Derived, class Key, class Value, class Node>
+bool FrozenHotShard<Derived, Key, Value, Node>::Insert(Key key,
+                                                      const Value& value) {
+  bool stat_yes = Cache<Key, Value>::sample_generator();
+  if (stat_yes) {
+    Cache<Key, Value>::stats.RecordTick(Tickers::INSERT);
+  }
+
+  PHASE_TIMER_START(timer);
+  auto node = new Node(key);
+  PHASE_TIMER_RECORD(timer, INSERT_ALLOC);
+  HashMapAccessor hash_accessor;
+  HashMapValuePair value_pair(key, HashMapValue(value, node));
+  bool inserted = m_map.insert(hash_accessor, value_pair);
+  PHASE_TIMER_RECORD(timer, INSERT_PROBE);
+  if (!inserted) {
+    // update value, the node in the list stays
+    hash_accessor->second.m_value = value;
+    WriteFrozen(key, &value, stat_yes);
+    delete node;
+    return false;
+  }
+  // A frozen key may have been evicted from the list.
+  WriteFrozen(key, &value, stat_yes);
+
+  auto s = m_size.load();
+  bool done = false;
+  if (s >= m_max_size) {
+    done = Evict();
+    PHASE_TIMER_RECORD(timer, INSERT_EVICT);
+  }
+
+  // Note that we have to update the list before we increment m_size.
+  std::unique_lock list_lock(m_list_mtx);
+  PHASE_TIMER_RECORD(timer, INSERT_LIST_WAIT);
+  derived().ListInsert(node);
+  list_lock.unlock();
+  PHASE_TIMER_RECORD(timer, INSERT_LIST_UPDATE);
+
+  hash_accessor.release();  // for deadlock
+
+  if (!done) {
+    s = m_size++;
+  }
+  if (s > m_max_size) {
+    // It is possible for the size to temporarily exceed the maximum if there is
+    // a heavy-insert workload, once only as the cache fills. Only the thread
+    // whose increment went over the maximum evicts an entry for it, so that
+    // the threads don't all evict at once and leave the cache underfilled.
+    if (Evict()) {
+      m_size--;
+    }
+    PHASE_TIMER_RECORD(timer, INSERT_EVICT);
+  }
+  return true;
+}
+
+template <class Derived, class Key, class Value, class Node>
+bool FrozenHotShard<Derived, Key, Value, Node>::Erase(Key key) {
+  bool stat_yes = Cache<Key, Value>::sample_generator();
+  PHASE_TIMER_START(timer);
+  HashMapAccessor hash_accessor;
+  bool found = m_map.find(hash_accessor, key);
+  PHASE_TIMER_RECORD(timer, ERASE_PROBE);
+  if (!found) {
+    // A frozen key may have been evicted from the list. An invalidation only
+    // sends lookups to the map, so it needs no accessor.
+    WriteFrozen(key, nullptr, stat_yes);
+    return false;
+  }
+  WriteFrozen(key, nullptr, stat_yes);
+
+  auto node = hash_accessor->second.m_list_node;
+  bool release = false;
+  std::unique_lock list_lock(m_list_mtx);
+  PHASE_TIMER_RECORD(timer, ERASE_LIST_WAIT);
+  if (node->is_in_list()) {
+    derived().ListRemove(node);
+    release = true;
+  }
+  // Otherwise, it is being evicted, and the eviction frees it.
+  list_lock.unlock();
+  PHASE_TIMER_RECORD(timer, ERASE_LIST_UPDATE);
+
+  m_map.erase(hash_accessor);
+  if (release) {
+    delete node;
+  }
+  m_size--;
+  return true;
+}
+
+template <class Derived, class Key, class Value, class Node>
+uint64_t FrozenHotShard<Derived, Key, Value, Node>::Freeze(uint64_t num) {
+  m_tier.BeginBuild();
+
+  // The hits of the frozen keys never reach the list, where they sink or are
+  // even evicted, so the list alone would drop the hottest keys at every
+  // refresh. The ones still hit are frozen again first, with the value of the
+  // fast cache, which the writes go through.
+  std::vector<Key> keys;
+  std::unordered_set<Key> seeded;
+  m_tier.ForEachHit([&](const Key& key, const Value& value) {
+    if (keys.size() < num) {
+      m_tier.Stage(key, value);
+      keys.push_back(key);
+      seeded.insert(key);
+    }
+  });
+  auto num_seeded = keys.size();
+
+  // Only the keys are copied under the lock, so inserts and evictions just
+  // wait for the copy. The values are frozen and built without it.
+  std::unique_lock list_lock(m_list_mtx);
+  keys.reserve(std::min<uint64_t>(num, num_seeded + m_size.load()));
+  for (bool referenced : {true, false}) {
+    if (keys.size() >= num) {
+      break;
+    }
+    derived().ForEachNode([&](Node* node) {
+      if (keys.size() >= num) {
+        return false;
+      }
+      if (derived().Referenced(node) == referenced &&
+          seeded.count(node->m_key) == 0) {
+        keys.push_back(node->m_key);
+      }
+      return true;
+    });
+  }
+  list_lock.unlock();
+
+  for (size_t i = num_seeded; i < keys.size(); i++) {
+    HashMapConstAccessor hash_accessor;
+    // Evicted or erased since the copy.
+    if (m_map.find(hash_accessor, keys[i])) {
+      m_tier.Stage(keys[i], hash_accessor->second.m_value);
+    }
+  }
+  auto count = m_tier.Publish();
+
+  // The accessor keeps the node from being freed, and the list mutex is
+  // taken after it, as 'Insert' does.
+  for (auto& key : keys) {
+    HashMapConstAccessor hash_accessor;
+    if (m_map.find(hash_accessor, key)) {
+      auto node = hash_accessor->second.m_list_node;
+      list_lock.lock();
+      if (node->is_in_list()) {
+        derived().OnFrozen(node);
+      }
+      list_lock.unlock();
+    }
+  }
+  return count;
+}
+
+template <class Derived, class Key, class Value, class Node>
+bool FrozenHotShard<Derived, Key, Value, Node>::ConstructTier() {
+  auto count = Freeze(UINT64_MAX);
+  printf("fast cache insert num: %lu, m_size: %ld, (FC_ratio: %.2lf)\n", count,
+         m_size.load(), 1.0 * count / std::max<uint64_t>(m_size.load(), 1));
+  return count > 0;
+}
+
+template <class Derived, class Key, class Value, class Node>
+bool FrozenHotShard<Derived, Key, Value, Node>::ConstructFastCache(
+    double FC_ratio) {
+  assert(FC_ratio <= 1 && FC_ratio >= 0);
+  uint64_t max_size = m_max_size.load();
+  uint64_t FC_size = FC_ratio * max_size;
+  printf("FC size: %lu, DC size: %lu\n", FC_size, max_size - FC_size);
+  auto count = Freeze(FC_size);
+  printf("fast hash insert num: %lu, m_size: %ld (FC_ratio: %.2lf)\n", count,
+         m_size.load(), 1.0 * count / std::max<uint64_t>(m_size.load(), 1));
+  return count > 0;
+}
+
+template <class Derived, class Key, class Value, class Node>
+bool FrozenHotShard<Derived, Key, Value, Node>::Evict() {
+  PHASE_TIMER_START(timer);
+  std::unique_lock list_lock(m_list_mtx);
+  PHASE_TIMER_RECORD(timer, EVICT_LIST_WAIT);
+  Node* node = derived().ListEvict();
+  if (node == nullptr) {
+    return false;
+  }
+  list_lock.unlock();
+  PHASE_TIMER_RECORD(timer, EVICT_LIST_UPDATE);
+
+  HashMapAccessor hash_accessor;
+  bool found = m_map.find(hash_accessor, node->m_key);
+  PHASE_TIMER_RECORD(timer, EVICT_PROBE);
+  if (!found || hash_accessor->second.m_list_node != node) {
+    // Erased concurrently, which leaves the node to us.
+    delete node;
+    return false;
+  }
+  if (Cache<Key, Value>::eviction_callback_) {
+    Cache<Key, Value>::eviction_callback_(node->m_key,
+                                          hash_accessor->second.m_value);
+  }
+  m_map.erase(hash_accessor);
+
+  delete node;
+  return true;
+}
+
+template <class Derived, class Key, class Value, class Node>
+uint64_t FrozenHotShard<Derived, Key, Value, Node>::EvictBatch(
+    uint64_t max_num) {
+  uint64_t count = 0;
+  while (count < max_num) {
+    uint64_t s = m_size.load();
+    if (s <= m_max_size.load()) {
+      break;
+    }
+    if (!m_size.compare_exchange_strong(s, s - 1)) {
+      continue;
+    }
+    if (!Evict()) {
+      m_size++;
+      break;
+    }
+    count++;
+  }
+  return count;
+}
+
+template <class Derived, class Key, class Value, class Node>
+void FrozenHotShard<Derived, Key, Value, Node>::ForEachEntry(
+    const std::function<void(const Key&, const Value&)>& func) {
+  std::vector<Key> keys;
+  std::unique_lock list_lock(m_list_mtx);
+  keys.reserve(m_size.load());
+  derived().ForEachNode([&](Node* node) {
+    keys.push_back(node->m_key);
+    return true;
+  });
+  list_lock.unlock();
+
+  for (auto& key : keys) {
+    HashMapConstAccessor hash_accessor;
+    if (m_map.find(hash_accessor, key)) {
+      func(key, hash_accessor->second.m_value);
+    }
+  }
+}
+
+}  // namespace kvcache
+
+#endif
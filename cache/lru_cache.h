@@ -7,9 +7,11 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include "cache.h"
 #include "options.h"
+#include "phase_timer.h"
 #include "statistics.h"
 #include "tbb/concurrent_hash_map.h"
 
@@ -36,23 +38,30 @@ class LruCache : public Cache<Key, Value> {
 
   bool Lookup(Key key, Value& value) override {
     bool stat_yes = Cache<Key, Value>::sample_generator();
+    PHASE_TIMER_START(timer);
     HashMapConstAccessor const_accessor;
-    if (!hash_map_.find(const_accessor, key)) {
+    bool found = hash_map_.find(const_accessor, key);
+    PHASE_TIMER_RECORD(timer, LOOKUP_PROBE);
+    if (!found) {
       if (stat_yes) {
         Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_MISS);
       }
       return false;
     }
     auto node = const_accessor->second;
+    value = node->value;
     // Acquire the lock, but don't block if it is already held.
     std::unique_lock list_lock(list_mtx_, std::try_to_lock);
     if (list_lock) {
-      value = node->value;
+      PHASE_TIMER_RECORD(timer, LOOKUP_LIST_WAIT);
       if (node->is_in_list()) {
         LruRemove(node);
         LruAppend(node);
       }
       list_lock.unlock();
+      PHASE_TIMER_RECORD(timer, LOOKUP_LIST_UPDATE);
+    } else {
+      Cache<Key, Value>::stats.RecordTick(Tickers::PROMOTION_SKIPPED);
     }
     if (stat_yes) {
       Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_HIT);
@@ -65,14 +74,18 @@ class LruCache : public Cache<Key, Value> {
       Cache<Key, Value>::stats.RecordTick(Tickers::INSERT);
     }
 
+    PHASE_TIMER_START(timer);
     auto node = new ListNode();
     node->key = key;
     node->value = value;
     node->charge = 1;
+    PHASE_TIMER_RECORD(timer, INSERT_ALLOC);
 
     HashMapAccessor accessor;
     HashMapValuePair value_pair(key, node);
-    if (!hash_map_.insert(accessor, value_pair)) {
+    bool inserted = hash_map_.insert(accessor, value_pair);
+    PHASE_TIMER_RECORD(timer, INSERT_PROBE);
+    if (!inserted) {
       // update value
       accessor->second->value = value;
       delete node;
@@ -85,11 +98,14 @@ class LruCache : public Cache<Key, Value> {
     if (s >= capacity_) {
       EvictOne();
       done = true;
+      PHASE_TIMER_RECORD(timer, INSERT_EVICT);
     }
 
     std::unique_lock list_lock(list_mtx_);
+    PHASE_TIMER_RECORD(timer, INSERT_LIST_WAIT);
     LruAppend(node);
     list_lock.unlock();
+    PHASE_TIMER_RECORD(timer, INSERT_LIST_UPDATE);
 
     if (!done) {
       usage_++;
@@ -98,6 +114,7 @@ class LruCache : public Cache<Key, Value> {
     if (s > capacity_) {
       if (usage_.compare_exchange_strong(s, s - 1)) {
         EvictOne();
+        PHASE_TIMER_RECORD(timer, INSERT_EVICT);
       }
     }
 
@@ -105,16 +122,21 @@ class LruCache : public Cache<Key, Value> {
   }
 
   bool Erase(Key key) override {
+    PHASE_TIMER_START(timer);
     HashMapAccessor accessor;
-    if (!hash_map_.find(accessor, key)) {
+    bool found = hash_map_.find(accessor, key);
+    PHASE_TIMER_RECORD(timer, ERASE_PROBE);
+    if (!found) {
       return false;
     }
 
     // Remove from list.
     std::unique_lock list_lock(list_mtx_);
+    PHASE_TIMER_RECORD(timer, ERASE_LIST_WAIT);
     auto node = reinterpret_cast<ListNode*>(accessor->second);
     LruRemove(node);
     list_lock.unlock();
+    PHASE_TIMER_RECORD(timer, ERASE_LIST_UPDATE);
 
     hash_map_.erase(accessor);
     delete node;
@@ -126,21 +148,77 @@ class LruCache : public Cache<Key, Value> {
 
   virtual bool is_full() override { return usage_.load() >= capacity_; }
 
+  virtual void SetCapacity(uint64_t capacity) override {
+    capacity_.store(capacity);
+  }
+
+  virtual uint64_t EvictBatch(uint64_t max_num) override {
+    uint64_t count = 0;
+    while (count < max_num) {
+      uint64_t s = usage_.load();
+      if (s <= capacity_.load()) {
+        break;
+      }
+      // Same as the overfill handling in 'Insert', the exclusive right to
+      // reduce the size is acquired by compare-and-exchange.
+      if (!usage_.compare_exchange_strong(s, s - 1)) {
+        continue;
+      }
+      if (!EvictOne()) {
+        usage_++;
+        break;
+      }
+      count++;
+    }
+    return count;
+  }
+
+  virtual void ForEachEntry(
+      const std::function<void(const Key&, const Value&)>& func) override {
+    // Collect the keys first, so the list is not locked while visiting. The
+    // value is read under the accessor because an update writes it there.
+    std::vector<Key> keys;
+    std::unique_lock list_lock(list_mtx_);
+    keys.reserve(usage_.load());
+    for (auto node = head_.next; node != &tail_; node = node->next) {
+      keys.push_back(node->key);
+    }
+    list_lock.unlock();
+
+    for (auto& key : keys) {
+      HashMapConstAccessor const_accessor;
+      if (hash_map_.find(const_accessor, key)) {
+        func(key, const_accessor->second->value);
+      }
+    }
+  }
+
  private:
-  void EvictOne() {
+  bool EvictOne() {
+    PHASE_TIMER_START(timer);
     std::unique_lock list_lock(list_mtx_);
+    PHASE_TIMER_RECORD(timer, EVICT_LIST_WAIT);
     auto node = tail_.prev;
+    if (node == &head_) {
+      return false;
+    }
     LruRemove(node);
     list_lock.unlock();
+    PHASE_TIMER_RECORD(timer, EVICT_LIST_UPDATE);
 
     HashMapAccessor accessor;
-    if (!hash_map_.find(accessor, node->key)) {
+    bool found = hash_map_.find(accessor, node->key);
+    PHASE_TIMER_RECORD(timer, EVICT_PROBE);
+    if (!found) {
       printf("key: %ld Presumably unreachable\n", node->key);
-      return;
+      return false;
+    }
+    if (Cache<Key, Value>::eviction_callback_) {
+      Cache<Key, Value>::eviction_callback_(node->key, node->value);
     }
     hash_map_.erase(accessor);
     delete node;
-    return;
+    return true;
   }
 
  private:
@@ -181,12 +259,14 @@ class LruCache : public Cache<Key, Value> {
   ListNode head_;
   ListNode tail_;
 
-  const uint64_t capacity_;
+  std::atomic<uint64_t> capacity_;
   std::atomic<uint64_t> usage_;
 
   HashMap hash_map_;
 
-  std::mutex list_mtx_;
+  CountedMutex list_mtx_{Cache<Key, Value>::get_stats(),
+                         Tickers::LIST_LOCK_ACQUIRE,
+                         Tickers::LIST_LOCK_CONTENDED};
 };
 
 template <class Key, class Value>
@@ -48,15 +48,17 @@ class LruCacheSharedHash : public Cache<Key, Value> {
     }
     point_time += (utils::NowMicros() - start_time);
     auto node = reinterpret_cast<ListNode*>(const_accessor->second);
+    value = node->value;
     // Acquire the lock, but don't block if it is already held.
     std::unique_lock list_lock(list_mtx_, std::try_to_lock);
     if (list_lock) {
-      value = node->value;
       if (node->is_in_list()) {
         LruRemove(node);
         LruAppend(node);
       }
       list_lock.unlock();
+    } else {
+      Cache<Key, Value>::stats.RecordTick(Tickers::PROMOTION_SKIPPED);
     }
     if (stat_yes) {
       Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_HIT);
@@ -205,7 +207,9 @@ class LruCacheSharedHash : public Cache<Key, Value> {
   const uint64_t capacity_;
   std::atomic<uint64_t> usage_;
 
-  std::mutex list_mtx_;
+  CountedMutex list_mtx_{Cache<Key, Value>::get_stats(),
+                         Tickers::LIST_LOCK_ACQUIRE,
+                         Tickers::LIST_LOCK_CONTENDED};
 };
 
 template <class Key, class Value>
@@ -1,6 +1,9 @@
 
 #include "lru_cache.h"
 
+#include <thread>
+#include <vector>
+
 #include "gtest/gtest.h"
 
 class LruCacheTest : public testing::Test {
@@ -20,6 +23,16 @@ class LruCacheTest : public testing::Test {
 
   bool Erase(uint64_t key) { return lru_cache_->Erase(key); }
 
+  void SetCapacity(uint64_t capacity) { lru_cache_->SetCapacity(capacity); }
+
+  uint64_t EvictBatch(uint64_t max_num) {
+    return lru_cache_->EvictBatch(max_num);
+  }
+
+  uint64_t Size() { return lru_cache_->get_size(); }
+
+  kvcache::Statistics* Stats() { return lru_cache_->get_stats(); }
+
  private:
   uint64_t capacity = 200;
   kvcache::LruCache<uint64_t, uint64_t>* lru_cache_;
@@ -41,6 +54,70 @@ TEST_F(LruCacheTest, HitAndMiss) {
   ASSERT_EQ(false, Lookup(400, ret_value));
 }
 
+TEST_F(LruCacheTest, SetCapacity) {
+  uint64_t ret_value = 0;
+  for (uint64_t i = 0; i < 200; i++) {
+    Insert(i, i);
+  }
+  ASSERT_EQ(200, Size());
+
+  // Shrinking evicts nothing until 'EvictBatch' is called, and each batch is
+  // bounded.
+  SetCapacity(100);
+  ASSERT_EQ(200, Size());
+  ASSERT_EQ(64, EvictBatch(64));
+  ASSERT_EQ(136, Size());
+  ASSERT_EQ(36, EvictBatch(64));
+  ASSERT_EQ(100, Size());
+  ASSERT_EQ(0, EvictBatch(64));
+
+  // The least recently used entries are gone.
+  ASSERT_EQ(false, Lookup(99, ret_value));
+  ASSERT_EQ(true, Lookup(100, ret_value));
+  ASSERT_EQ(100, ret_value);
+
+  // Grow back.
+  SetCapacity(150);
+  for (uint64_t i = 200; i < 250; i++) {
+    Insert(i, i);
+  }
+  ASSERT_EQ(150, Size());
+  ASSERT_EQ(true, Lookup(100, ret_value));
+}
+
+TEST_F(LruCacheTest, LockCounts) {
+  uint64_t ret_value = 0;
+  for (uint64_t i = 0; i < 100; i++) {
+    Insert(i, i);
+  }
+  auto before = Stats()->Snapshot();
+  ASSERT_LE(100, before[kvcache::Tickers::LIST_LOCK_ACQUIRE]);
+
+  // Every hit either promotes its entry under the list lock, or skips it if
+  // the lock is held by another lookup.
+  const uint64_t num_threads = 8, num_lookups = 100000;
+  std::vector<std::thread> threads;
+  for (uint64_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&]() {
+      uint64_t value = 0;
+      for (uint64_t k = 0; k < num_lookups; k++) {
+        Lookup(k % 100, value);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto delta = Stats()->Snapshot() - before;
+  ASSERT_EQ(num_threads * num_lookups,
+            delta[kvcache::Tickers::LIST_LOCK_ACQUIRE] +
+                delta[kvcache::Tickers::PROMOTION_SKIPPED]);
+  ASSERT_EQ(delta[kvcache::Tickers::PROMOTION_SKIPPED],
+            delta[kvcache::Tickers::LIST_LOCK_CONTENDED]);
+  ASSERT_EQ(0, delta[kvcache::Tickers::LOCK_WAIT_NANOS]);
+  ASSERT_EQ(true, Lookup(0, ret_value));
+}
+
 int main(int argc, char* argv[]) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
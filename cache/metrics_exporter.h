@@ -0,0 +1,275 @@
+#ifndef KVCACHE_METRICS_EXPORTER_H
+#define KVCACHE_METRICS_EXPORTER_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+namespace kvcache {
+
+// Latencies of the sampled requests of an interval, in us.
+struct LatencyMetrics {
+  uint64_t count = 0;
+  double avg = 0;
+  double p50 = 0;
+  double p99 = 0;
+  double p999 = 0;
+
+  static LatencyMetrics From(const utils::LatencyHistogram::Snapshot& step) {
+    LatencyMetrics metrics;
+    metrics.count = step.count;
+    metrics.avg = step.Average();
+    metrics.p50 = step.Percentile(0.5);
+    metrics.p99 = step.Percentile(0.99);
+    metrics.p999 = step.Percentile(0.999);
+    return metrics;
+  }
+};
+
+struct ShardMetrics {
+  uint64_t fast_cache_hit = 0;
+  uint64_t hit = 0;
+  uint64_t miss = 0;
+  uint64_t size = 0;
+  // 'FrozenState' of the shard at the last pass of 'FrozenMonitor', or -1.
+  int32_t state = -1;
+};
+
+// The cache over one interval of the exporter: counts are since the previous
+// record, sizes and states are at the end of the interval.
+struct MetricsRecord {
+  uint64_t time_us = 0;
+  double duration_s = 0;
+  // Lookups per second.
+  double throughput = 0;
+  uint64_t fast_cache_hit = 0;
+  uint64_t hit = 0;
+  uint64_t miss = 0;
+  uint64_t insert = 0;
+  LatencyMetrics hit_lat;
+  LatencyMetrics other_lat;
+  uint64_t size = 0;
+  uint64_t capacity = 0;
+  uint64_t lock_contended = 0;
+  uint64_t promotion_skipped = 0;
+  // Stage of the monitor thread, and the 'CacheType' of the shards.
+  std::string stage;
+  uint32_t policy = 0;
+  std::vector<ShardMetrics> shards;
+};
+
+enum class MetricsFormat : uint8_t {
+  JSON = 0,  // one object a line
+  CSV = 1,   // a header, then one row a record, with columns for every shard
+};
+
+// MetricsExporter writes records to a file, or to a Unix stream socket for a
+// target "unix:<socket path>", which a collector must be listening on. Records
+// are formatted and written by the caller, which is the exporter thread of
+// the cache, so neither the requests nor the monitor wait for them.
+//
+// Once a write fails (e.g. the collector went away), the exporter is closed
+// and drops the next records.
+
+class MetricsExporter {
+ public:
+  explicit MetricsExporter(MetricsFormat format) : format_(format) {}
+  ~MetricsExporter() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+  MetricsExporter(const MetricsExporter&) = delete;
+  MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+  bool Open(const std::string& target);
+
+  // Return false if the record couldn't be written.
+  bool Write(const MetricsRecord& record);
+
+  static std::string FormatJson(const MetricsRecord& record);
+  static std::string CsvHeader(size_t num_shards);
+  static std::string FormatCsv(const MetricsRecord& record);
+
+ private:
+  constexpr static const char* kSocketPrefix = "unix:";
+
+  static void Append(std::string& out, const char* format, ...)
+      __attribute__((format(printf, 2, 3)));
+
+  const MetricsFormat format_;
+  int fd_ = -1;
+  bool is_socket_ = false;
+  bool header_written_ = false;
+};
+
+inline bool MetricsExporter::Open(const std::string& target) {
+  auto prefix_len = strlen(kSocketPrefix);
+  if (target.compare(0, prefix_len, kSocketPrefix) == 0) {
+    auto path = target.substr(prefix_len);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+      printf("metrics socket path is too long: %s\n", path.c_str());
+      return false;
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+    fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ < 0 ||
+        connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+      printf("fail to connect metrics socket %s: %s\n", path.c_str(),
+             strerror(errno));
+      if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+      }
+      return false;
+    }
+    is_socket_ = true;
+  } else {
+    fd_ = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+      printf("fail to open metrics file %s: %s\n", target.c_str(),
+             strerror(errno));
+      return false;
+    }
+  }
+  printf("metrics: %s (%s)\n", target.c_str(),
+         format_ == MetricsFormat::JSON ? "json" : "csv");
+  return true;
+}
+
+inline bool MetricsExporter::Write(const MetricsRecord& record) {
+  if (fd_ < 0) {
+    return false;
+  }
+  std::string out;
+  if (format_ == MetricsFormat::JSON) {
+    out = FormatJson(record);
+  } else {
+    if (!header_written_) {
+      out = CsvHeader(record.shards.size());
+      header_written_ = true;
+    }
+    out += FormatCsv(record);
+  }
+  size_t written = 0;
+  while (written < out.size()) {
+    // A collector that went away must not kill the process with SIGPIPE.
+    auto ret = is_socket_ ? send(fd_, out.data() + written,
+                                 out.size() - written, MSG_NOSIGNAL)
+                          : write(fd_, out.data() + written,
+                                  out.size() - written);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      printf("fail to write metrics: %s\n", strerror(errno));
+      close(fd_);
+      fd_ = -1;
+      return false;
+    }
+    written += ret;
+  }
+  return true;
+}
+
+inline void MetricsExporter::Append(std::string& out, const char* format,
+                                    ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  out.append(buffer, std::min<size_t>(std::max(len, 0), sizeof(buffer) - 1));
+}
+
+inline std::string MetricsExporter::FormatJson(const MetricsRecord& record) {
+  std::string out;
+  Append(out,
+         "{\"time_us\": %lu, \"duration_s\": %.6g, \"throughput\": %.6g, "
+         "\"fast_cache_hit\": %lu, \"hit\": %lu, \"miss\": %lu, "
+         "\"insert\": %lu",
+         record.time_us, record.duration_s, record.throughput,
+         record.fast_cache_hit, record.hit, record.miss, record.insert);
+  const std::pair<const char*, const LatencyMetrics*> latencies[] = {
+      {"hit_lat", &record.hit_lat}, {"other_lat", &record.other_lat}};
+  for (auto& [name, lat] : latencies) {
+    Append(out,
+           ", \"%s\": {\"count\": %lu, \"avg\": %.6g, \"p50\": %.6g, "
+           "\"p99\": %.6g, \"p999\": %.6g}",
+           name, lat->count, lat->avg, lat->p50, lat->p99, lat->p999);
+  }
+  Append(out,
+         ", \"size\": %lu, \"capacity\": %lu, \"lock_contended\": %lu, "
+         "\"promotion_skipped\": %lu, \"stage\": \"%s\", \"policy\": %u, "
+         "\"shards\": [",
+         record.size, record.capacity, record.lock_contended,
+         record.promotion_skipped, record.stage.c_str(), record.policy);
+  for (size_t i = 0; i < record.shards.size(); i++) {
+    auto& shard = record.shards[i];
+    Append(out,
+           "%s{\"fast_cache_hit\": %lu, \"hit\": %lu, \"miss\": %lu, "
+           "\"size\": %lu, \"state\": %d}",
+           i == 0 ? "" : ", ", shard.fast_cache_hit, shard.hit, shard.miss,
+           shard.size, shard.state);
+  }
+  out += "]}\n";
+  return out;
+}
+
+inline std::string MetricsExporter::CsvHeader(size_t num_shards) {
+  std::string out =
+      "time_us,duration_s,throughput,fast_cache_hit,hit,miss,insert";
+  for (auto name : {"hit_lat", "other_lat"}) {
+    for (auto field : {"count", "avg", "p50", "p99", "p999"}) {
+      Append(out, ",%s_%s", name, field);
+    }
+  }
+  out += ",size,capacity,lock_contended,promotion_skipped,stage,policy";
+  for (size_t i = 0; i < num_shards; i++) {
+    for (auto field : {"fast_cache_hit", "hit", "miss", "size", "state"}) {
+      Append(out, ",shard%lu_%s", i, field);
+    }
+  }
+  out += "\n";
+  return out;
+}
+
+inline std::string MetricsExporter::FormatCsv(const MetricsRecord& record) {
+  std::string out;
+  Append(out, "%lu,%.6g,%.6g,%lu,%lu,%lu,%lu", record.time_us,
+         record.duration_s, record.throughput, record.fast_cache_hit,
+         record.hit, record.miss, record.insert);
+  for (auto lat : {&record.hit_lat, &record.other_lat}) {
+    Append(out, ",%lu,%.6g,%.6g,%.6g,%.6g", lat->count, lat->avg, lat->p50,
+           lat->p99, lat->p999);
+  }
+  Append(out, ",%lu,%lu,%lu,%lu,%s,%u", record.size, record.capacity,
+         record.lock_contended, record.promotion_skipped,
+         record.stage.c_str(), record.policy);
+  for (auto& shard : record.shards) {
+    Append(out, ",%lu,%lu,%lu,%lu,%d", shard.fast_cache_hit, shard.hit,
+           shard.miss, shard.size, shard.state);
+  }
+  out += "\n";
+  return out;
+}
+
+}  // namespace kvcache
+
+#endif
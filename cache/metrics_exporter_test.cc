@@ -0,0 +1,179 @@
+#include "metrics_exporter.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "scalable_cache.h"
+
+using kvcache::MetricsExporter;
+using kvcache::MetricsFormat;
+using kvcache::MetricsRecord;
+using StringCache =
+    kvcache::ConcurrentScalableCache<uint64_t, std::shared_ptr<std::string>>;
+
+class MetricsExporterTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = "/tmp/kvcache_metrics_test." + std::to_string(getpid());
+  }
+
+  void TearDown() override { unlink(path_.c_str()); }
+
+  std::vector<std::string> ReadLines() {
+    std::ifstream file(path_);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line)) {
+      lines.push_back(line);
+    }
+    return lines;
+  }
+
+  static MetricsRecord TestRecord() {
+    MetricsRecord record;
+    record.time_us = 1000;
+    record.duration_s = 0.5;
+    record.throughput = 20;
+    record.hit = 8;
+    record.miss = 2;
+    record.hit_lat.count = 3;
+    record.hit_lat.p99 = 1.5;
+    record.stage = "frozen";
+    record.policy = 4;
+    record.shards.resize(2);
+    record.shards[1].miss = 2;
+    record.shards[1].state = 3;
+    return record;
+  }
+
+  static size_t CountFields(const std::string& line) {
+    return std::count(line.begin(), line.end(), ',') + 1;
+  }
+
+  std::string path_;
+};
+
+TEST_F(MetricsExporterTest, Json) {
+  auto json = MetricsExporter::FormatJson(TestRecord());
+  ASSERT_EQ('\n', json.back());
+  ASSERT_EQ(1, std::count(json.begin(), json.end(), '\n'));
+  ASSERT_NE(std::string::npos, json.find("\"time_us\": 1000, "));
+  ASSERT_NE(std::string::npos, json.find("\"miss\": 2, "));
+  ASSERT_NE(std::string::npos,
+            json.find("\"hit_lat\": {\"count\": 3, \"avg\": 0, \"p50\": 0, "
+                      "\"p99\": 1.5, \"p999\": 0}"));
+  ASSERT_NE(std::string::npos,
+            json.find("\"stage\": \"frozen\", \"policy\": 4, \"shards\": "
+                      "[{\"fast_cache_hit\": 0, \"hit\": 0, \"miss\": 0, "
+                      "\"size\": 0, \"state\": -1}, {"));
+  ASSERT_NE(std::string::npos, json.find("\"state\": 3}]}"));
+}
+
+TEST_F(MetricsExporterTest, Csv) {
+  auto record = TestRecord();
+  MetricsExporter exporter(MetricsFormat::CSV);
+  ASSERT_TRUE(exporter.Open(path_));
+  ASSERT_TRUE(exporter.Write(record));
+  ASSERT_TRUE(exporter.Write(record));
+
+  // A header, then rows with as many fields.
+  auto lines = ReadLines();
+  ASSERT_EQ(3, lines.size());
+  ASSERT_EQ(0, lines[0].find("time_us,duration_s,throughput,"));
+  ASSERT_NE(std::string::npos, lines[0].find(",shard1_state"));
+  ASSERT_EQ(CountFields(lines[0]), CountFields(lines[1]));
+  ASSERT_EQ(lines[1], lines[2]);
+  ASSERT_EQ(0, lines[1].find("1000,0.5,20,0,8,2,0,3,0,0,1.5,0,"));
+  ASSERT_NE(std::string::npos, lines[1].find(",frozen,4,"));
+  ASSERT_EQ(lines[1].size() - 10, lines[1].rfind(",0,0,2,0,3"));
+}
+
+TEST_F(MetricsExporterTest, Socket) {
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  ASSERT_GE(listener, 0);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+  ASSERT_EQ(0, bind(listener, reinterpret_cast<sockaddr*>(&addr),
+                    sizeof(addr)));
+  ASSERT_EQ(0, listen(listener, 1));
+
+  auto exporter = std::make_unique<MetricsExporter>(MetricsFormat::JSON);
+  ASSERT_FALSE(exporter->Open("unix:" + path_ + ".missing"));
+  exporter = std::make_unique<MetricsExporter>(MetricsFormat::JSON);
+  ASSERT_TRUE(exporter->Open("unix:" + path_));
+  int collector = accept(listener, nullptr, nullptr);
+  ASSERT_GE(collector, 0);
+  auto record = TestRecord();
+  ASSERT_TRUE(exporter->Write(record));
+
+  auto expected = MetricsExporter::FormatJson(record);
+  std::string received(expected.size(), '\0');
+  size_t num_read = 0;
+  while (num_read < expected.size()) {
+    auto ret = read(collector, received.data() + num_read,
+                    expected.size() - num_read);
+    ASSERT_GT(ret, 0);
+    num_read += ret;
+  }
+  ASSERT_EQ(expected, received);
+
+  // The collector went away: records are dropped, without a SIGPIPE.
+  close(collector);
+  close(listener);
+  bool written = true;
+  for (int i = 0; i < 10 && written; i++) {
+    written = exporter->Write(record);
+  }
+  ASSERT_FALSE(written);
+  ASSERT_FALSE(exporter->Write(record));
+}
+
+TEST_F(MetricsExporterTest, Cache) {
+  StringCache cache(1000, 4, kvcache::CacheType::LRU);
+  ASSERT_TRUE(cache.EnableMetricsExport(path_, MetricsFormat::JSON, 10));
+  std::shared_ptr<std::string> value;
+  for (uint64_t i = 0; i < 500; i++) {
+    if (!cache.Lookup(i, value)) {
+      cache.Insert(i, std::make_shared<std::string>(std::to_string(i)));
+    }
+    ASSERT_TRUE(cache.Lookup(i, value));
+  }
+  usleep(50000);
+  cache.Stop();
+
+  // Records cover every request once, the last one written at 'Stop'.
+  auto lines = ReadLines();
+  ASSERT_LE(2, lines.size());
+  uint64_t total_hit = 0, total_miss = 0;
+  for (auto& line : lines) {
+    uint64_t hit = 0, miss = 0;
+    auto pos = line.find("\"hit\": ");
+    ASSERT_EQ(2, sscanf(line.c_str() + pos, "\"hit\": %lu, \"miss\": %lu",
+                        &hit, &miss));
+    total_hit += hit;
+    total_miss += miss;
+    ASSERT_NE(std::string::npos, line.find("\"capacity\": 1000, "));
+  }
+  ASSERT_EQ(500, total_hit);
+  ASSERT_EQ(500, total_miss);
+  ASSERT_NE(std::string::npos, lines.back().find("\"size\": 500, "));
+  ASSERT_NE(std::string::npos, lines.back().find("\"stage\": \"start\""));
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
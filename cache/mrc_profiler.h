@@ -0,0 +1,229 @@
+#ifndef KVCACHE_MRC_PROFILER_H
+#define KVCACHE_MRC_PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+namespace kvcache {
+
+// MrcProfiler estimates the LRU miss ratio curve online with SHARDS
+// (Waldspurger et al., FAST'15).
+//
+// A key is sampled if its hash falls below 'rate * kModulus', so all requests
+// to a sampled key are seen. The reuse distance of a sampled request is the
+// number of distinct sampled keys referenced since the last request to the
+// same key, counted with a Fenwick tree over the logical time of the last
+// reference of every sampled key. Scaled by '1 / rate', it estimates the
+// reuse distance in the full stream, i.e. the smallest LRU capacity that hits.
+//
+// The histogram is adjusted as SHARDS-adj does: the difference between the
+// expected and the actual number of sampled requests is added to the first
+// bucket, which corrects the bias of hot keys being in or out of the sample.
+//
+// The sampled keys are split by hash into 'num_partitions' partitions, each
+// with its own lock, tree and histogram, so that the sampled requests don't
+// all serialize on one lock. A partition is itself a SHARDS sample of rate
+// 'rate / num_partitions', so its distances are scaled by
+// 'num_partitions / rate', and the histograms are merged at read time. One
+// partition is exact at rate 1; more of them trade accuracy for concurrency.
+
+template <class Key>
+class MrcProfiler {
+ private:
+  constexpr static uint64_t kModulus = 1 << 24;
+  constexpr static uint32_t kNumCounterSlots = 64;
+  constexpr static uint64_t kMinTimeRange = 1 << 16;
+
+  struct alignas(64) Counter {
+    std::atomic<uint64_t> count{0};
+  };
+
+  // The sampled keys of one partition, guarded by 'mtx'.
+  struct alignas(64) Partition {
+    std::mutex mtx;
+    std::unordered_map<Key, uint64_t> last_access;
+    uint64_t now = 0;
+    uint64_t num_sampled = 0;
+    uint64_t num_cold = 0;
+    std::vector<int64_t> tree = std::vector<int64_t>(kMinTimeRange + 1, 0);
+    // Number of sampled requests by (unscaled) reuse distance.
+    std::vector<uint64_t> histogram;
+  };
+
+ public:
+  constexpr static uint32_t kDefaultPartitions = 8;
+
+  explicit MrcProfiler(double rate,
+                       uint32_t num_partitions = kDefaultPartitions)
+      : rate_(rate),
+        threshold_(static_cast<uint64_t>(rate * kModulus)),
+        num_partitions_(std::max<uint32_t>(num_partitions, 1)),
+        partitions_(new Partition[num_partitions_]),
+        counters_(new Counter[kNumCounterSlots]) {}
+  MrcProfiler(const MrcProfiler&) = delete;
+  MrcProfiler& operator=(const MrcProfiler&) = delete;
+
+  double get_rate() const { return rate_; }
+
+  void Access(const Key& key) {
+    static thread_local uint32_t slot =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) %
+        kNumCounterSlots;
+    counters_[slot].count.fetch_add(1, std::memory_order_relaxed);
+    auto hash = Hash(key);
+    if (hash % kModulus < threshold_) {
+      // The partition takes other bits of the hash than the sampling.
+      SampledAccess(partitions_[(hash >> 32) % num_partitions_], key);
+    }
+  }
+
+  // Estimated miss ratio of an LRU cache holding 'capacity' entries.
+  double GetMissRatio(uint64_t capacity);
+
+ private:
+  static uint64_t Hash(const Key& key) {
+    return utils::Mix64(std::hash<Key>()(key));
+  }
+
+  void SampledAccess(Partition& part, const Key& key);
+
+  // Fenwick tree over [0, tree.size() - 1), 1 at the time of the last
+  // reference of every sampled key. The caller must hold 'part.mtx'.
+  static void TreeAdd(Partition& part, uint64_t time, int64_t delta) {
+    for (uint64_t i = time + 1; i < part.tree.size(); i += i & (~i + 1)) {
+      part.tree[i] += delta;
+    }
+  }
+
+  static int64_t TreeSum(Partition& part, uint64_t time) {  // [0, time]
+    int64_t sum = 0;
+    for (uint64_t i = time + 1; i > 0; i -= i & (~i + 1)) {
+      sum += part.tree[i];
+    }
+    return sum;
+  }
+
+  // Renumber the last references from 0 when the time runs out of the tree.
+  static void Compact(Partition& part);
+
+ private:
+  const double rate_;
+  const uint64_t threshold_;
+
+  const uint32_t num_partitions_;
+  std::unique_ptr<Partition[]> partitions_;
+
+  // All requests, sampled or not, counted in padded per-thread slots.
+  std::unique_ptr<Counter[]> counters_;
+};
+
+template <class Key>
+void MrcProfiler<Key>::SampledAccess(Partition& part, const Key& key) {
+  std::unique_lock lock(part.mtx);
+  if (part.now + 1 >= part.tree.size()) {
+    Compact(part);
+  }
+  part.num_sampled++;
+  auto time = part.now++;
+  auto iter = part.last_access.find(key);
+  if (iter == part.last_access.end()) {
+    part.num_cold++;
+    part.last_access.emplace(key, time);
+  } else {
+    auto last = iter->second;
+    uint64_t distance = TreeSum(part, time) - TreeSum(part, last);
+    auto& histogram = part.histogram;
+    if (distance >= histogram.size()) {
+      histogram.resize(std::max<uint64_t>(distance + 1, histogram.size() * 2),
+                       0);
+    }
+    histogram[distance]++;
+    TreeAdd(part, last, -1);
+    iter->second = time;
+  }
+  TreeAdd(part, time, 1);
+}
+
+template <class Key>
+void MrcProfiler<Key>::Compact(Partition& part) {
+  std::vector<std::pair<uint64_t, Key>> order;
+  order.reserve(part.last_access.size());
+  for (auto& [key, time] : part.last_access) {
+    order.emplace_back(time, key);
+  }
+  std::sort(order.begin(), order.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  uint64_t range = std::max<uint64_t>(order.size() * 2, kMinTimeRange);
+  auto& tree = part.tree;
+  tree.assign(range + 1, 0);
+  for (uint64_t i = 0; i < order.size(); i++) {
+    part.last_access[order[i].second] = i;
+    tree[i + 1] = 1;
+  }
+  // Build the tree in linear time, every node passes its sum to its parent.
+  for (uint64_t i = 1; i < tree.size(); i++) {
+    auto parent = i + (i & (~i + 1));
+    if (parent < tree.size()) {
+      tree[parent] += tree[i];
+    }
+  }
+  part.now = order.size();
+}
+
+template <class Key>
+double MrcProfiler<Key>::GetMissRatio(uint64_t capacity) {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < kNumCounterSlots; i++) {
+    total += counters_[i].count.load(std::memory_order_relaxed);
+  }
+
+  // A distance 'd' of a partition hits iff 'd * num_partitions_ / rate_ <
+  // capacity'.
+  uint64_t limit = static_cast<uint64_t>(
+      std::ceil(capacity * rate_ / num_partitions_));
+  uint64_t num_sampled = 0, first_bucket_count = 0;
+  double hits = 0;
+  for (uint32_t p = 0; p < num_partitions_; p++) {
+    auto& part = partitions_[p];
+    std::unique_lock lock(part.mtx);
+    num_sampled += part.num_sampled;
+    auto& histogram = part.histogram;
+    if (!histogram.empty()) {
+      first_bucket_count += histogram[0];
+    }
+    for (uint64_t d = 1; d < std::min<uint64_t>(limit, histogram.size());
+         d++) {
+      hits += histogram[d];
+    }
+  }
+
+  // SHARDS-adj: the first bucket absorbs the sampling error, which is
+  // negative if hot keys are oversampled. Reuses shorter than any capacity
+  // are hits anyway.
+  double expected = total * rate_;
+  double first_bucket =
+      first_bucket_count + expected - static_cast<double>(num_sampled);
+  if (limit > 0) {
+    hits += first_bucket;
+  }
+  double sampled = std::max(expected, 1.0);
+  return std::clamp(1.0 - hits / sampled, 0.0, 1.0);
+}
+
+}  // namespace kvcache
+
+#endif
@@ -0,0 +1,77 @@
+#include "mrc_profiler.h"
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "lru_cache.h"
+
+// Skewed keys: key 'k' is about twice as likely as key '2k'.
+static std::vector<uint64_t> MakeTrace(uint64_t num_requests) {
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<uint64_t> trace;
+  for (uint64_t i = 0; i < num_requests; i++) {
+    auto u = uniform(rng);
+    trace.push_back(static_cast<uint64_t>(100000 * u * u * u));
+  }
+  return trace;
+}
+
+static double SimulateLru(const std::vector<uint64_t>& trace,
+                          uint64_t capacity) {
+  kvcache::LruCache<uint64_t, uint64_t> cache(capacity);
+  uint64_t misses = 0, value = 0;
+  for (auto key : trace) {
+    if (!cache.Lookup(key, value)) {
+      misses++;
+      cache.Insert(key, key);
+    }
+  }
+  return 1.0 * misses / trace.size();
+}
+
+TEST(MrcProfilerTest, ExactWithoutSampling) {
+  auto trace = MakeTrace(200000);
+  kvcache::MrcProfiler<uint64_t> profiler(1.0, 1);
+  for (auto key : trace) {
+    profiler.Access(key);
+  }
+  for (uint64_t capacity : {1000, 5000, 20000}) {
+    ASSERT_NEAR(SimulateLru(trace, capacity), profiler.GetMissRatio(capacity),
+                1e-9);
+  }
+  ASSERT_DOUBLE_EQ(1.0, profiler.GetMissRatio(0));
+}
+
+TEST(MrcProfilerTest, Partitioned) {
+  // Every partition samples a part of the keys, so the merged curve is close
+  // but not exact.
+  auto trace = MakeTrace(200000);
+  kvcache::MrcProfiler<uint64_t> profiler(1.0);
+  for (auto key : trace) {
+    profiler.Access(key);
+  }
+  for (uint64_t capacity : {1000, 5000, 20000}) {
+    ASSERT_NEAR(SimulateLru(trace, capacity), profiler.GetMissRatio(capacity),
+                0.002);
+  }
+  ASSERT_DOUBLE_EQ(1.0, profiler.GetMissRatio(0));
+}
+
+TEST(MrcProfilerTest, Sampled) {
+  auto trace = MakeTrace(1000000);
+  kvcache::MrcProfiler<uint64_t> profiler(0.1);
+  for (auto key : trace) {
+    profiler.Access(key);
+  }
+  for (uint64_t capacity : {1000, 5000, 20000}) {
+    ASSERT_NEAR(SimulateLru(trace, capacity), profiler.GetMissRatio(capacity),
+                0.02);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,118 @@
+#ifndef KVCACHE_NUMA_UTILS_H
+#define KVCACHE_NUMA_UTILS_H
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#ifdef KVCACHE_USE_NUMA
+#include <numa.h>
+#endif
+
+#include "utils.h"
+
+namespace utils {
+namespace numa {
+
+// Thin wrapper of libnuma. When the library is not available (KVCACHE_USE_NUMA
+// is not defined), the machine is regarded as a single node that owns all the
+// cores, so that callers don't have to care about the topology.
+
+inline bool Available() {
+#ifdef KVCACHE_USE_NUMA
+  static const bool available = (numa_available() >= 0);
+  return available;
+#else
+  return false;
+#endif
+}
+
+// Nodes that have memory and can be used by this process.
+inline std::vector<int> GetNodes() {
+  std::vector<int> nodes;
+#ifdef KVCACHE_USE_NUMA
+  if (Available()) {
+    for (int node = 0; node <= numa_max_node(); node++) {
+      if (numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+        nodes.push_back(node);
+      }
+    }
+  }
+#endif
+  if (nodes.empty()) {
+    nodes.push_back(0);
+  }
+  return nodes;
+}
+
+// Cores that belong to 'node'.
+inline std::vector<int> GetCpus(int node) {
+  std::vector<int> cpus;
+#ifdef KVCACHE_USE_NUMA
+  if (Available()) {
+    auto mask = numa_allocate_cpumask();
+    if (numa_node_to_cpus(node, mask) == 0) {
+      for (uint32_t cpu = 0; cpu < mask->size; cpu++) {
+        if (numa_bitmask_isbitset(mask, cpu)) {
+          cpus.push_back(cpu);
+        }
+      }
+    }
+    numa_free_cpumask(mask);
+    return cpus;
+  }
+#endif
+  for (uint32_t cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++) {
+    cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+// The node of the core that the calling thread is running on. It is cached in
+// TLS, so the thread should be pinned before the first call.
+inline int ThisThreadNode() {
+  static thread_local int node = -1;
+  if (UNLIKELY(node < 0)) {
+    node = 0;
+#ifdef KVCACHE_USE_NUMA
+    if (Available()) {
+      int cpu = sched_getcpu();
+      if (cpu >= 0) {
+        node = std::max(numa_node_of_cpu(cpu), 0);
+      }
+    }
+#endif
+  }
+  return node;
+}
+
+// Run 'func' in a helper thread that is bound to 'node' and prefers to
+// allocate memory from it. Everything allocated and first-touched by 'func'
+// (e.g., a shard and its hash table) is therefore placed on 'node', while the
+// affinity of the calling thread is left untouched. It is not bound if 'node'
+// is not one of 'GetNodes'.
+template <class Func>
+void RunOnNode(int node, Func&& func) {
+  std::thread worker([&]() {
+#ifdef KVCACHE_USE_NUMA
+    if (Available() && node <= numa_max_node() &&
+        numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+      if (numa_run_on_node(node) != 0) {
+        printf("failed to run on numa node %d\n", node);
+      }
+      numa_set_preferred(node);
+    }
+#endif
+    func();
+  });
+  worker.join();
+}
+
+}  // namespace numa
+}  // namespace utils
+
+#endif
@@ -17,6 +17,97 @@ struct Options {
   Options() : capacity(0), stats(nullptr) {}
 };
 
+// Parameters of the controller of the frozen fast cache ('FrozenMonitor'),
+// which can be set by the properties prefixed with "fh_".
+struct FrozenOptions {
+  // The cache is stable once its miss ratio stops falling for
+  // 'wait_stable_threshold' checks, 'wait_stable_interval_us' apart.
+  uint32_t wait_stable_interval_us;
+  uint32_t wait_stable_threshold;
+  // Interval of the checks of a frozen cache.
+  uint32_t check_interval_us;
+  // A fast cache must be faster than the baseline by this (relative), both
+  // predicted by the cost model and measured by the construction.
+  double gain_threshold;
+  // The fast cache is not constructed if the best ratio is below this.
+  double min_ratio;
+  // Passes of the first round of a construction, which sets the length of a
+  // round.
+  uint32_t construct_passes;
+  // Benefit (in rounds of construction steps) that the fast cache may lose
+  // before it is dropped.
+  double drop_threshold;
+  // Bounds of the lifetime of a construction, in construction steps.
+  uint32_t min_lifetime;
+  uint32_t max_lifetime;
+  // Seconds to back off after a stage without benefit, multiplied by
+  // 'backoff_factor' every time, and halved by a stage that lasts.
+  uint32_t backoff_s;
+  uint32_t backoff_factor;
+  uint32_t max_backoff_s;
+  // Weight of a new sample in the averages of the cost model.
+  double ewma_weight;
+  // Every shard is frozen on its own, and at most this fraction of the shards
+  // (at least one) searches, constructs, refreshes or drops its fast cache
+  // in a pass.
+  double transition_fraction;
+  // The fast cache of a shard is refreshed once writes replaced or
+  // invalidated more than this ratio of its entries.
+  double invalidation_budget;
+  // The fast cache of a shard is refreshed early when its hot set drifts:
+  // 'PhaseDetector' samples every 'phase_sample_ratio'-th request (0 to
+  // disable it), compares windows of 'phase_min_samples' samples to the first
+  // ones after the construction, and a shift is a distance over
+  // 'phase_distance_threshold'. 'ChangeDetector' also looks for a fall of the
+  // fast cache hit ratio, with a tolerance of 'phase_change_delta' a pass and
+  // a threshold of 'phase_change_threshold'.
+  uint32_t phase_sample_ratio;
+  uint32_t phase_min_samples;
+  double phase_distance_threshold;
+  double phase_change_delta;
+  double phase_change_threshold;
+  // 'GetCurve' grows the fast cache by 'curve_step' of the shard capacity a
+  // pass, for at most 'curve_max_passes' passes. It stops once the fast cache
+  // hit ratio plus the miss ratio is over 'curve_flat_threshold' (the rest of
+  // the curve is flat), or the fast cache is over 'curve_max_ratio' of the
+  // shard. The LFU shard measures a pass over 'curve_requests' requests, or
+  // for at most 'curve_pass_us'.
+  uint32_t curve_max_passes;
+  double curve_step;
+  double curve_flat_threshold;
+  double curve_max_ratio;
+  uint64_t curve_requests;
+  uint64_t curve_pass_us;
+
+  FrozenOptions()
+      : wait_stable_interval_us(500000),
+        wait_stable_threshold(2),
+        check_interval_us(100000),
+        gain_threshold(0.2),
+        min_ratio(0.05),
+        construct_passes(3),
+        drop_threshold(2),
+        min_lifetime(1),
+        max_lifetime(100),
+        backoff_s(2),
+        backoff_factor(8),
+        max_backoff_s(3600),
+        ewma_weight(0.3),
+        transition_fraction(0.25),
+        invalidation_budget(0.1),
+        phase_sample_ratio(16),
+        phase_min_samples(4096),
+        phase_distance_threshold(0.3),
+        phase_change_delta(0.02),
+        phase_change_threshold(0.3),
+        curve_max_passes(45),
+        curve_step(0.02),
+        curve_flat_threshold(0.992),
+        curve_max_ratio(0.9),
+        curve_requests(10000),
+        curve_pass_us(100000) {}
+};
+
 }  // namespace kvcache
 
 #endif
\ No newline at end of file
@@ -0,0 +1,188 @@
+#ifndef KVCACHE_PHASE_DETECTOR_H
+#define KVCACHE_PHASE_DETECTOR_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+
+#include "utils.h"
+
+namespace kvcache {
+
+// ChangeDetector tells when a metric observed once a window (e.g. the fast
+// cache hit share) falls for good, with the Page-Hinkley test: the drops of
+// the observations below their moving average, less a tolerance of 'delta',
+// are summed, and a change is detected once the sum rises 'threshold' above
+// its lowest point. Noise around the average is not detected, and neither is
+// a decline that the average follows within 'delta'.
+
+class ChangeDetector {
+ private:
+  // Weight of an observation in the average, which lags a decline of 'd' a
+  // window by about 'd / kWeight'.
+  constexpr static double kWeight = 0.1;
+
+ public:
+  ChangeDetector(double delta, double threshold)
+      : delta_(delta), threshold_(threshold) {}
+
+  // Return whether a change is detected with this observation. The detector
+  // is reset then, so that the next change is measured from the new level.
+  bool Observe(double value) {
+    mean_ = num_observations_++ == 0 ? value
+                                      : mean_ + (value - mean_) * kWeight;
+    sum_ += mean_ - value - delta_;
+    min_sum_ = std::min(min_sum_, sum_);
+    statistic_ = sum_ - min_sum_;
+    if (statistic_ <= threshold_) {
+      return false;
+    }
+    Reset();
+    return true;
+  }
+
+  void Reset() {
+    num_observations_ = 0;
+    mean_ = sum_ = min_sum_ = 0;
+  }
+
+  // Rise of the sum above its lowest point at the last observation.
+  double statistic() const { return statistic_; }
+
+ private:
+  double delta_;
+  double threshold_;
+  uint64_t num_observations_ = 0;
+  double mean_ = 0;
+  double sum_ = 0;
+  double min_sum_ = 0;
+  double statistic_ = 0;
+};
+
+// PhaseDetector tells how far the key popularity of recent requests drifted
+// from a reference, e.g. the requests right after the fast cache was frozen.
+//
+// Every 'sample_ratio'-th request of a thread is sampled. After a reset, the
+// keys of the first 'min_samples' samples are set in a bitmap, a sketch of the
+// keys that were popular then, and the next 'min_samples' samples measure the
+// share of requests to them. The distance of a later window is the fraction
+// of this share that it lost: about 0 while the same keys are hot, and 1 once
+// none of them are. Shares don't count the requests to other keys that hit
+// the bitmap, as expected from the fraction of its bits that are set.
+
+template <class Key>
+class PhaseDetector {
+ private:
+  enum class Stage : uint32_t { SKETCH, CALIBRATE, COMPARE };
+
+  struct alignas(64) Counter {
+    std::atomic<uint64_t> count{0};
+  };
+
+ public:
+  PhaseDetector(uint32_t sample_ratio, uint64_t min_samples)
+      : sample_ratio_(std::max<uint32_t>(sample_ratio, 1)),
+        min_samples_(std::max<uint64_t>(min_samples, 1)) {
+    // At least 32 bits a sampled key, so that 1/32 at most are set.
+    uint64_t num_bits = 64;
+    while (num_bits < min_samples_ * 32) {
+      num_bits *= 2;
+    }
+    num_words_ = num_bits / 64;
+    bitmap_.reset(new std::atomic<uint64_t>[num_words_]);
+    Reset();
+  }
+  PhaseDetector(const PhaseDetector&) = delete;
+  PhaseDetector& operator=(const PhaseDetector&) = delete;
+
+  void Record(const Key& key) {
+    static thread_local uint32_t countdown = 0;
+    if (countdown > 0) {
+      countdown--;
+      return;
+    }
+    countdown = sample_ratio_ - 1;
+    // Bits of the hash that neither the MRC profiler nor the shadows sample.
+    auto bit = (utils::Mix64(std::hash<Key>()(key)) >> 16) % (num_words_ * 64);
+    auto& word = bitmap_[bit / 64];
+    uint64_t mask = 1ull << (bit % 64);
+    samples_.count.fetch_add(1, std::memory_order_relaxed);
+    if (stage_.load(std::memory_order_relaxed) == Stage::SKETCH) {
+      word.fetch_or(mask, std::memory_order_relaxed);
+    } else if (word.load(std::memory_order_relaxed) & mask) {
+      popular_.count.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Drop the sketch. The next windows build a new one.
+  void Reset() {
+    stage_ = Stage::SKETCH;
+    for (uint64_t i = 0; i < num_words_; i++) {
+      bitmap_[i].store(0, std::memory_order_relaxed);
+    }
+    samples_.count = 0;
+    popular_.count = 0;
+    false_positive_ = 0;
+    reference_share_ = 0;
+  }
+
+  // Return the distance of the current window to the reference, and start a
+  // new window. Return -1 if the window has less than 'min_samples' samples,
+  // in which case it goes on, or if it built the reference, or if the
+  // reference requests were too spread for a distance.
+  double Distance() {
+    if (samples_.count.load(std::memory_order_relaxed) < min_samples_) {
+      return -1;
+    }
+    auto popular = popular_.count.exchange(0);
+    auto samples = samples_.count.exchange(0);
+    double share = std::max(1.0 * std::min(popular, samples) / samples -
+                                false_positive_,
+                            0.0) /
+                   (1 - false_positive_);
+    switch (stage_.load()) {
+      case Stage::SKETCH: {
+        stage_ = Stage::CALIBRATE;
+        uint64_t num_set = 0;
+        for (uint64_t i = 0; i < num_words_; i++) {
+          num_set += __builtin_popcountll(bitmap_[i].load());
+        }
+        false_positive_ = 1.0 * num_set / (num_words_ * 64);
+        return -1;
+      }
+      case Stage::CALIBRATE:
+        stage_ = Stage::COMPARE;
+        reference_share_ = share;
+        return -1;
+      default:
+        if (reference_share_ < kMinShare) {
+          return -1;
+        }
+        return std::max(1 - share / reference_share_, 0.0);
+    }
+  }
+
+ private:
+  // Below this share of requests to the sketched keys, the hot set is too
+  // small to tell its drift from noise.
+  constexpr static double kMinShare = 0.05;
+
+  const uint32_t sample_ratio_;
+  const uint64_t min_samples_;
+  uint64_t num_words_;
+  std::unique_ptr<std::atomic<uint64_t>[]> bitmap_;
+  std::atomic<Stage> stage_;
+  Counter samples_;
+  Counter popular_;
+  // Only read and written by the caller of 'Distance' and 'Reset'.
+  double false_positive_ = 0;
+  double reference_share_ = 0;
+};
+
+}  // namespace kvcache
+
+#endif
@@ -0,0 +1,91 @@
+#include "phase_detector.h"
+
+#include <random>
+
+#include "gtest/gtest.h"
+
+// Skewed keys from 'offset': key 'offset + k' is about twice as likely as key
+// 'offset + 2k'.
+static void Feed(kvcache::PhaseDetector<uint64_t>& detector,
+                 uint64_t num_requests, uint64_t offset) {
+  static std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  for (uint64_t i = 0; i < num_requests; i++) {
+    auto u = uniform(rng);
+    detector.Record(offset + static_cast<uint64_t>(1000000 * u * u * u));
+  }
+}
+
+TEST(PhaseDetectorTest, Distance) {
+  const uint64_t window = 4 * 4096;
+  kvcache::PhaseDetector<uint64_t> detector(4, 4096);
+  // Not enough samples yet, then the sketch and the reference share.
+  Feed(detector, window / 2, 0);
+  ASSERT_EQ(-1, detector.Distance());
+  Feed(detector, window / 2, 0);
+  ASSERT_EQ(-1, detector.Distance());
+  Feed(detector, window, 0);
+  ASSERT_EQ(-1, detector.Distance());
+
+  // The same hot set is close to the reference.
+  Feed(detector, window, 0);
+  auto same = detector.Distance();
+  ASSERT_GE(same, 0);
+  ASSERT_LT(same, 0.2);
+
+  // Another hot set is far from it.
+  Feed(detector, window, 1000000000);
+  ASSERT_GT(detector.Distance(), 0.8);
+
+  // A reset sketches the new hot set.
+  detector.Reset();
+  Feed(detector, window * 2, 1000000000);
+  ASSERT_EQ(-1, detector.Distance());
+  Feed(detector, window, 1000000000);
+  ASSERT_EQ(-1, detector.Distance());
+  Feed(detector, window, 1000000000);
+  ASSERT_LT(detector.Distance(), 0.2);
+}
+
+TEST(PhaseDetectorTest, SpreadKeys) {
+  // Requests spread over too many keys have no hot set to drift.
+  kvcache::PhaseDetector<uint64_t> detector(1, 4096);
+  for (uint64_t round = 0; round < 4; round++) {
+    for (uint64_t i = 0; i < 4096; i++) {
+      detector.Record(round * 4096 + i);
+    }
+    ASSERT_EQ(-1, detector.Distance());
+  }
+}
+
+TEST(PhaseDetectorTest, ChangeDetector) {
+  kvcache::ChangeDetector detector(0.02, 0.3);
+  std::mt19937_64 rng(42);
+  std::normal_distribution<double> noise(0, 0.03);
+
+  // Noise around a level, or a slow decline, is not a change.
+  double level = 0.8;
+  for (int i = 0; i < 200; i++) {
+    ASSERT_FALSE(detector.Observe(level + noise(rng)));
+    level -= 0.001;
+  }
+
+  // A fall is detected in a few observations, and the detector starts over.
+  int observations = 0;
+  while (!detector.Observe(0.4 + noise(rng))) {
+    ASSERT_LT(++observations, 5);
+  }
+  for (int i = 0; i < 200; i++) {
+    ASSERT_FALSE(detector.Observe(0.4 + noise(rng)));
+  }
+
+  // A rise is not a change.
+  for (int i = 0; i < 200; i++) {
+    ASSERT_FALSE(detector.Observe(0.9 + noise(rng)));
+  }
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,119 @@
+#ifndef KVCACHE_PHASE_TIMER_H
+#define KVCACHE_PHASE_TIMER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "utils.h"
+
+namespace kvcache {
+
+// Phases of the shard operations, timed with the TSC when built with
+// KVCACHE_PHASE_TIMERS: the probe of the hash table (including the wait for
+// its bucket lock), the wait for the list lock, the update of the list under
+// it, the eviction in an insert, and the allocation of a node.
+//
+// Without KVCACHE_PHASE_TIMERS, the PHASE_TIMER_* macros expand to nothing,
+// so the shards compile to the same code as without the timers.
+
+enum class Phase : uint32_t {
+  LOOKUP_PROBE,
+  LOOKUP_LIST_WAIT,
+  LOOKUP_LIST_UPDATE,
+  INSERT_ALLOC,
+  INSERT_PROBE,
+  INSERT_EVICT,
+  INSERT_LIST_WAIT,
+  INSERT_LIST_UPDATE,
+  ERASE_PROBE,
+  ERASE_LIST_WAIT,
+  ERASE_LIST_UPDATE,
+  EVICT_LIST_WAIT,
+  EVICT_LIST_UPDATE,
+  EVICT_PROBE,
+  PHASE_ENUM_MAX
+};
+
+#ifdef KVCACHE_PHASE_TIMERS
+class PhaseTimers {
+ public:
+  static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  // Record the phase that started at 'start' (from 'Now'), and return the
+  // start of the next phase, which leaves out the time of the record.
+  static uint64_t Record(Phase phase, uint64_t start) {
+    histograms_[static_cast<uint32_t>(phase)].insert((Now() - start) /
+                                                     ticks_per_us_);
+    return Now();
+  }
+
+  // Print the latencies of every phase since the last call.
+  static void Print() {
+    printf("phase timers (%.1lf ticks/us):\n", ticks_per_us_);
+    for (uint32_t i = 0; i < kNumPhases; i++) {
+      auto step = histograms_[i].Step();
+      if (step.count == 0) {
+        continue;
+      }
+      printf("  %-18s ", kNames[i]);
+      step.Print();
+    }
+  }
+
+ private:
+  constexpr static uint32_t kNumPhases =
+      static_cast<uint32_t>(Phase::PHASE_ENUM_MAX);
+  constexpr static const char* kNames[kNumPhases] = {
+      "lookup.probe",      "lookup.list_wait",   "lookup.list_update",
+      "insert.alloc",      "insert.probe",       "insert.evict",
+      "insert.list_wait",  "insert.list_update", "erase.probe",
+      "erase.list_wait",   "erase.list_update",  "evict.list_wait",
+      "evict.list_update", "evict.probe"};
+
+  // Ticks of 'Now' per us, measured against the steady clock over 10 ms.
+  static double Calibrate() {
+    auto clock_start = std::chrono::steady_clock::now();
+    auto start = Now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto ticks = Now() - start;
+    auto us = std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - clock_start)
+                  .count();
+    return ticks / us;
+  }
+
+  inline static const double ticks_per_us_ = Calibrate();
+  inline static utils::LatencyHistogram histograms_[kNumPhases];
+};
+#endif
+
+}  // namespace kvcache
+
+#ifdef KVCACHE_PHASE_TIMERS
+// Start 'timer' at the start of a phase.
+#define PHASE_TIMER_START(timer) \
+  uint64_t timer = kvcache::PhaseTimers::Now()
+// End 'phase', which started at 'timer', and start the next one.
+#define PHASE_TIMER_RECORD(timer, phase) \
+  timer = kvcache::PhaseTimers::Record(kvcache::Phase::phase, timer)
+#else
+#define PHASE_TIMER_START(timer)
+#define PHASE_TIMER_RECORD(timer, phase)
+#endif
+
+#endif
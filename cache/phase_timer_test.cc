@@ -0,0 +1,54 @@
+// The timers are compiled in for this test only.
+#define KVCACHE_PHASE_TIMERS
+
+#include "phase_timer.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "lru_cache.h"
+
+TEST(PhaseTimerTest, Record) {
+  PHASE_TIMER_START(timer);
+  auto start = timer;
+  PHASE_TIMER_RECORD(timer, LOOKUP_PROBE);
+  ASSERT_GE(timer, start);
+  // A phase ends where the next one starts.
+  start = timer;
+  PHASE_TIMER_RECORD(timer, LOOKUP_LIST_WAIT);
+  ASSERT_GE(timer, start);
+  kvcache::PhaseTimers::Print();
+}
+
+TEST(PhaseTimerTest, LruCache) {
+  kvcache::LruCache<uint64_t, std::shared_ptr<std::string>> cache(100);
+  for (uint64_t i = 0; i < 200; i++) {
+    cache.Insert(i, std::make_shared<std::string>(std::to_string(i)));
+  }
+  std::shared_ptr<std::string> value;
+  for (uint64_t i = 0; i < 200; i++) {
+    cache.Lookup(i, value);
+  }
+  for (uint64_t i = 150; i < 200; i++) {
+    ASSERT_TRUE(cache.Erase(i));
+  }
+  // Every phase was timed, printed, and starts over.
+  testing::internal::CaptureStdout();
+  kvcache::PhaseTimers::Print();
+  auto output = testing::internal::GetCapturedStdout();
+  for (auto name : {"lookup.probe", "lookup.list_update", "insert.alloc",
+                    "insert.evict", "erase.list_wait", "evict.probe"}) {
+    ASSERT_NE(std::string::npos, output.find(name)) << name;
+  }
+  ASSERT_NE(std::string::npos, output.find("stat size: 200"));
+  testing::internal::CaptureStdout();
+  kvcache::PhaseTimers::Print();
+  output = testing::internal::GetCapturedStdout();
+  ASSERT_EQ(std::string::npos, output.find("lookup.probe"));
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
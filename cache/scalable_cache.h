@@ -2,33 +2,119 @@
 #ifndef SCALABLE_CACHE_H
 #define SCALABLE_CACHE_H
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <initializer_list>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
 #include "async_cache.h"
+#include "compact_lru_cache.h"
+#include "compressed_tier.h"
+#include "epoch.h"
 #include "fifo_cache.h"
+#include "flash_tier.h"
+#include "frozen_cost_model.h"
+#include "frozenhot_cache_null.h"
+#include "frozenhot_fifo_cache.h"
+#include "frozenhot_lfu_cache.h"
 #include "group_cache.h"
 #include "lru_cache.h"
 #include "lru_cache_shared_hash.h"
+#include "metrics_exporter.h"
+#include "mrc_profiler.h"
+#include "numa_utils.h"
+#include "options.h"
+#include "phase_detector.h"
 #include "segment_cache.h"
+#include "shadow_simulator.h"
+#include "snapshot.h"
 #include "statistics.h"
 
 namespace kvcache {
 
-const uint32_t check_sleep_internal_us = 100000;  // 0.1s
-uint32_t sleep_threshold = 2;
-const uint32_t wait_stable_sleep_interval_us = 500000;  // 0.5s
-const uint32_t wait_stable_threshold = 2;
-const double fast_performance_threshold = 0.2;
-const uint32_t pass_threshold = 3;
-const uint32_t drop_threshold = 2;
-const uint32_t frozen_threshold = 100;
+// Per-thread L0 cache. Every 'l0_refresh_interval'-th hit of an L0 entry goes
+// to the shard instead, so that the LRU position of hot keys is still renewed.
+const uint32_t l0_cache_size = 256;
+const uint32_t l0_num_versions = 1024;
+const uint32_t l0_refresh_interval = 32;
+
+// The writes of a key and its promotions from the lower tiers take one of
+// these mutexes.
+const uint32_t tier_num_mutexes = 1024;
+
+// Under the LOCAL numa policy, the writes of a key and the copies of it into
+// other nodes take one of these stripes. A key is copied once it has been read
+// 'replica_min_reads' times from the home shard since its last write, as
+// counted by a count-min sketch of 'replica_sketch_rows' rows of
+// 'replica_sketch_width' counters, so that a hot key doesn't get the other
+// keys of its stripe copied.
+const uint32_t replica_num_stripes = 4096;
+const uint32_t replica_min_reads = 4;
+const uint32_t replica_sketch_rows = 4;
+const uint32_t replica_sketch_width = 16384;
+
+// Used by the background thread that shrinks the cache after 'SetCapacity'.
+const uint64_t resize_batch_size = 1024;
+const uint32_t resize_sleep_interval_us = 1000;  // 1ms
+
+// Shard buffers of a snapshot are written in chunks of this size.
+const uint64_t snapshot_write_chunk_size = 8 << 20;  // 8MB
+
+// Used by the adaptive policy. Shadows simulate 1/'shadow_sample_ratio' of
+// the keys, and their segments are scaled down by the same ratio. A policy
+// replaces the current one when its miss ratio is lower by
+// 'policy_switch_margin' (relative) in 'policy_switch_rounds' windows in a
+// row. After a switch, no other one is considered for
+// 'policy_cooldown_rounds' windows.
+const uint32_t shadow_sample_ratio = 64;
+const uint64_t shadow_min_samples = 1000;  // per window
+const double policy_switch_margin = 0.05;
+const uint32_t policy_switch_rounds = 3;
+const uint32_t policy_cooldown_rounds = 10;
 
 // Used in 'FrozenMonitor'
-utils::MySet request_latency_set[16];
+utils::LatencyHistogram request_latency_set[16];
 
-utils::MySet hit_latency_set;
-utils::MySet other_latency_set;
+utils::LatencyHistogram hit_latency_set;
+utils::LatencyHistogram other_latency_set;
 uint64_t time_cursor = 0;
 size_t print_step_counter = 0;
 
+// States of a shard in 'FrozenMonitor', which runs one state machine per
+// shard:
+//
+// WAIT_STABLE: back off, without the fast cache.
+// SEARCH: profile the curve of the fast cache ratio of the shard, and pick its
+//   best ratio.
+// CONSTRUCT: construct the fast cache of the shard.
+// FROZEN: run with the fast cache, until its benefit is depleted (go to
+//   DECONSTRUCT) or it needs to be refreshed (go to REFRESH).
+// DECONSTRUCT: delete the fast cache, and back off.
+// REFRESH: rebuild the fast cache while the old one serves.
+//
+// SEARCH, CONSTRUCT, DECONSTRUCT and REFRESH are transitions, and only a
+// fraction of the shards go through one in the same pass.
+enum class FrozenState : uint8_t {
+  WAIT_STABLE = 0,
+  SEARCH = 1,
+  CONSTRUCT = 2,
+  FROZEN = 3,
+  DECONSTRUCT = 4,
+  REFRESH = 5,
+};
+
 enum class CacheType : uint8_t {
   ASYNC = 1,
   LRU = 2,
@@ -36,30 +122,165 @@ enum class CacheType : uint8_t {
   FROZENHOT = 4,
   GROUP = 5,
   SEGMENT = 6,
+  COMPACT_LRU = 7,
+  FROZENHOT_FIFO = 8,
+  FROZENHOT_LFU = 9,
+};
+
+// The shards with a frozen fast cache, which run 'FrozenMonitor'.
+inline bool IsFrozenHot(CacheType type) {
+  return type == CacheType::FROZENHOT || type == CacheType::FROZENHOT_FIFO ||
+         type == CacheType::FROZENHOT_LFU;
+}
+
+// NONE: shards are allocated wherever first-touch lands, and a key always
+// goes to shard 'key % num_shards'.
+//
+// PLACE: shard i is constructed on numa node 'i % num_nodes', so its table is
+// local to that node. Key-to-shard mapping is the same as NONE.
+//
+// LOCAL: besides PLACE, every key has a home shard in the group of node
+// 'key % num_nodes', which takes its writes. A read-mostly key is also copied
+// into the shard group of the nodes that read it, where they look it up
+// first. Insert/Erase invalidate the copies under the stripe of the key, and
+// bump its version, so a copy of an older value never survives a write.
+enum class NumaPolicy : uint8_t {
+  NONE = 0,
+  PLACE = 1,
+  LOCAL = 2,
 };
 
 template <class Key, class Value>
 class ConcurrentScalableCache {
   using Shard = Cache<Key, Value>;
+  using ShardPtr = std::shared_ptr<Shard>;
 
  public:
+  // Unless the policy is NONE, shards are placed on 'nodes', or on all numa
+  // nodes of the machine if it is empty.
   explicit ConcurrentScalableCache(uint64_t capacity, uint32_t num_shards,
-                                   CacheType type);
+                                   CacheType type,
+                                   NumaPolicy numa_policy = NumaPolicy::NONE,
+                                   const std::vector<int>& nodes = {});
   ~ConcurrentScalableCache() { Stop(); }
 
  public:
   bool Lookup(Key key, Value& value) {
-    return get_shard(key).Lookup(key, value);
+    auto guard = ProtectShards();
+    if (mrc_profiler_) {
+      mrc_profiler_->Access(key);
+    }
+    if (shadow_) {
+      shadow_->Access(key);
+    }
+    if (l0_versions_) {
+      return L0Lookup(key, value);
+    }
+    return ShardLookup(key, value);
   }
 
   bool Insert(Key key, const Value& value) {
-    return get_shard(key).Insert(key, value);
+    auto guard = ProtectShards();
+    auto index = get_shard_index(key);
+    auto replica_lock = LockReplicas(key);
+    auto tier_lock = LockTiers(key);
+    bool ret = WriteShard(
+        index, key, [&](Shard& shard) { return shard.Insert(key, value); });
+    InvalidateReplicas(index, key);
+    EraseFromTiers(index, key);
+    L0Invalidate(key);
+    return ret;
+  }
+
+  bool Erase(Key key) {
+    auto guard = ProtectShards();
+    auto index = get_shard_index(key);
+    auto replica_lock = LockReplicas(key);
+    auto tier_lock = LockTiers(key);
+    bool ret =
+        WriteShard(index, key, [&](Shard& shard) { return shard.Erase(key); });
+    InvalidateReplicas(index, key);
+    EraseFromTiers(index, key);
+    L0Invalidate(key);
+    return ret;
+  }
+
+  // Enable the per-thread L0 cache. It must be called before any request.
+  void EnableL0Cache();
+
+  // Spill evicted entries into a log file of 'capacity' bytes on 'path', which
+  // is checked before reporting a miss. It must be called before any request.
+  bool EnableFlashTier(const std::string& path, uint64_t capacity);
+
+  // Profile the miss ratio curve of the lookups with SHARDS, sampling keys at
+  // 'rate'. It must be called before any request.
+  void EnableMrcProfiler(double rate);
+
+  // Set the parameters of 'FrozenMonitor'. It must be called before any
+  // request, as it replaces the phase detectors of the shards.
+  void SetFrozenOptions(const FrozenOptions& options);
+
+  // Write a 'MetricsRecord' every 'interval_ms' to 'target', a file or
+  // "unix:<socket path>", from a background thread until 'Stop'. Records are
+  // deltas of the cumulative tickers and latencies, so the steps and resets
+  // of the monitor don't change them. It must be called before any request.
+  bool EnableMetricsExport(const std::string& target, MetricsFormat format,
+                           uint32_t interval_ms);
+
+  // Estimated LRU miss ratio with 'capacity' entries, or -1 without the
+  // profiler.
+  double EstimateMissRatio(uint64_t capacity) {
+    return mrc_profiler_ ? mrc_profiler_->GetMissRatio(capacity) : -1;
   }
 
-  bool Erase(Key key) { return get_shard(key).Erase(key); }
+  // Print the estimated miss ratios around the current capacity.
+  void PrintMrc();
+
+  // Simulate LRU, FIFO and Segment on sampled keys, and let 'Monitor' migrate
+  // the shards to the one with the lowest miss ratio. Only these cache types
+  // can be switched. It must be called before any request.
+  bool EnableAdaptivePolicy();
+
+  CacheType get_type() const { return type_.load(); }
+
+  // Migrate all shards to 'type' one by one, keeping their entries, while
+  // requests are being served. The adaptive policy must be enabled, which
+  // lets the requests guard the shards.
+  void SwitchPolicy(CacheType type);
+
+  // Keep only the 'depth' most recent entries uncompressed, and the ones
+  // evicted from there in a compressed arena of 'arena_size' bytes in total
+  // (split over shards). With the flash tier, entries dropped from the arena
+  // go to flash. It must be called before any request. The capacity of the
+  // cache stays the configured one, only the shards hold 'depth' entries.
+  void EnableCompressedTier(uint64_t depth, uint64_t arena_size);
+
+  // Redistribute 'capacity' over shards. When the cache shrinks, the extra
+  // entries are evicted incrementally by a background thread, in batches of
+  // 'resize_batch_size' entries per shard. With the compressed tier, the
+  // shards keep its depth.
+  void SetCapacity(uint64_t capacity);
 
   double get_size();
 
+  // Write the entries of all shards to 'path', from the most to the least
+  // recently used one in each shard. Shards are encoded in parallel and the
+  // file is written with large sequential writes to a temporary file, which is
+  // renamed to 'path' when complete.
+  bool SaveSnapshot(const std::string& path);
+
+  // Load a snapshot written by 'SaveSnapshot', possibly with a different
+  // number of shards. The file is mapped, and every shard inserts its entries
+  // in parallel from the least to the most recently used one, so the recency
+  // order is preserved. It should be called before serving requests.
+  bool LoadSnapshot(const std::string& path);
+
+  // Numa nodes that hold shards, and the indexes of shards placed on 'node'.
+  const std::vector<int>& GetNodes() const { return nodes_; }
+  const std::vector<uint32_t>& GetNodeShards(int node) const {
+    return node_shards_.at(node);
+  }
+
  public:
   void PrintMissRatio();
   void PrintMissRatio(double& miss_ratio);
@@ -76,8 +297,15 @@ class ConcurrentScalableCache {
 
   void PrintStatus();
 
+  // Acquisitions, contention and waits of the shard locks, and the hits that
+  // skipped their promotion, since the shards were created.
+  void PrintLockStat();
+
   void Monitor();
-  void FrozenMonitor() { printf("FrozenMoniter is not implemented!\n"); };
+  // Monitor that drives the fast cache of every shard ('ConstructTier',
+  // 'ConstructFastCache', 'DeleteFastCache' and 'GetCurve') through the
+  // states of 'FrozenState', with its own curve and ratio.
+  void FrozenMonitor();
   void Stop();
 
   // A flag to switch on/off the sampling of inner counters
@@ -91,90 +319,1330 @@ class ConcurrentScalableCache {
   /**
    * Get the child container for a given key
    */
-  Shard& get_shard(const Key& key) {
-    size_t h = key % num_shards_;
-    return *shards_.at(h);
+  Shard& get_shard(const Key& key) { return *shards_[get_shard_index(key)]; }
+
+  // Under the LOCAL policy, it is the home shard of the key.
+  uint32_t get_shard_index(const Key& key) {
+    if (numa_policy_ == NumaPolicy::LOCAL) {
+      return get_node_shard_index(nodes_[key % nodes_.size()], key);
+    }
+    return key % num_shards_;
   }
 
-  const uint32_t num_shards_;
-  using ShardPtr = std::shared_ptr<Shard>;
-  std::vector<ShardPtr> shards_;
+  /**
+   * Get the child container for a given key in the shard group of 'node'. A
+   * node without shards falls back to the global mapping.
+   */
+  Shard& get_node_shard(int node, const Key& key) {
+    return *shards_[get_node_shard_index(node, key)];
+  }
+
+  uint32_t get_node_shard_index(int node, const Key& key) {
+    if (static_cast<size_t>(node) >= node_shards_.size() ||
+        node_shards_[node].empty()) {
+      return key % num_shards_;
+    }
+    auto& group = node_shards_[node];
+    return group[key % group.size()];
+  }
+
+  /**
+   * The per-thread L0 cache is a tiny direct-mapped array holding the values
+   * of keys that the thread hit recently. Each entry remembers the version of
+   * its key stripe when it was filled. Insert/Erase bump the version after
+   * modifying the shard, so an entry is validated with a single read and never
+   * returns a value that has been overwritten or erased.
+   *
+   * Note that an evicted key may still be served by L0, but its value is
+   * exactly the one the shard held. A value borrowed from a fast cache is not
+   * kept, as the fast cache may free it.
+   */
+  struct L0Entry {
+    Key key;
+    Value value;
+    uint64_t version = 0;
+    uint32_t hits = 0;
+    bool valid = false;
+  };
+
+  struct L0Cache {
+    uint64_t owner = 0;
+    L0Entry entries[l0_cache_size];
+  };
+
+  struct alignas(64) L0Version {
+    std::atomic<uint64_t> version{0};
+  };
+
+  L0Cache& get_l0() {
+    static thread_local L0Cache l0;
+    if (UNLIKELY(l0.owner != instance_id_)) {
+      for (uint32_t i = 0; i < l0_cache_size; i++) {
+        l0.entries[i] = L0Entry();
+      }
+      l0.owner = instance_id_;
+    }
+    return l0;
+  }
+
+  std::atomic<uint64_t>& get_l0_version(const Key& key) {
+    return l0_versions_[key % l0_num_versions].version;
+  }
+
+  static uint32_t L0Index(const Key& key) {
+    return (static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL) >> 56;
+  }
+
+  bool L0Lookup(const Key& key, Value& value) {
+    auto& entry = get_l0().entries[L0Index(key)];
+    auto& version = get_l0_version(key);
+    if (entry.valid && entry.key == key &&
+        entry.version == version.load(std::memory_order_acquire) &&
+        ++entry.hits % l0_refresh_interval != 0) {
+      value = entry.value;
+      auto& shard = get_shard(key);
+      if (shard.sample_generator()) {
+        shard.stats.RecordTick(Tickers::L0_CACHE_HIT);
+      }
+      return true;
+    }
+
+    // The version must be read before the shard, so that a concurrent update
+    // always makes the new entry invalid.
+    auto v = version.load(std::memory_order_acquire);
+    // A value borrowed from a fast cache may be freed with it.
+    bool found = ShardLookup(key, value);
+    if (!found || fast_hash::IsBorrowed(value)) {
+      if (entry.key == key) {
+        entry.valid = false;
+      }
+      return found;
+    }
+    if (!entry.valid || entry.key != key) {
+      entry.hits = 0;
+    }
+    entry.key = key;
+    entry.value = value;
+    entry.version = v;
+    entry.valid = true;
+    return true;
+  }
+
+  bool ShardLookup(const Key& key, Value& value) {
+    if (replica_stripes_) {
+      return ReplicaLookup(key, value);
+    }
+    return ShardLookup(get_shard_index(key), key, value);
+  }
+
+  /**
+   * Under the LOCAL policy, look up the copy in the shard group of this node,
+   * then the home shard. A key read often enough from the home shard is
+   * copied, unless a write of it bumped the version of its stripe since the
+   * home shard was read.
+   */
+  bool ReplicaLookup(const Key& key, Value& value) {
+    auto index = get_shard_index(key);
+    auto local = get_node_shard_index(utils::numa::ThisThreadNode(), key);
+    if (local == index) {
+      return ShardLookup(index, key, value);
+    }
+    // A miss of the copy is not a miss of the request.
+    auto& replica = *shards_[local];
+    if (replica.Probe(key, value)) {
+      if (replica.sample_generator()) {
+        replica.stats.RecordTick(Tickers::CACHE_HIT);
+      }
+      return true;
+    }
+    auto& stripe = replica_stripes_[key % replica_num_stripes];
+    auto version = stripe.version.load(std::memory_order_acquire);
+    if (!ShardLookup(index, key, value)) {
+      return false;
+    }
+    if (fast_hash::IsBorrowed(value)) {
+      return true;
+    }
+    if (CountReplicaRead(key)) {
+      return true;
+    }
+    std::lock_guard<std::mutex> lock(stripe.mtx);
+    if (stripe.version.load(std::memory_order_relaxed) == version) {
+      WriteShard(local, key,
+                 [&](Shard& shard) { return shard.Promote(key, value); });
+    }
+    return true;
+  }
+
+  /**
+   * Look up the shard, then its compressed tier and the flash tier. An entry
+   * found in a lower tier is promoted back into the shard, the same way a
+   * client fills the cache after a miss.
+   */
+  bool ShardLookup(uint32_t index, const Key& key, Value& value) {
+    auto& shard = *shards_[index];
+    if (!phase_detectors_.empty()) {
+      phase_detectors_[index]->Record(key);
+    }
+    if (shard.Lookup(key, value)) {
+      return true;
+    }
+    if (compressed_tiers_.empty() && !flash_tier_) {
+      return false;
+    }
+    bool stat_yes = shard.sample_generator();
+    // A write of the key since the miss erased it from the tiers, and the ones
+    // after it wait for the promotion, so it never overwrites a newer value.
+    auto tier_lock = LockTiers(key);
+    if (!compressed_tiers_.empty() &&
+        compressed_tiers_[index]->Lookup(key, value)) {
+      if (stat_yes) {
+        shard.stats.RecordTick(Tickers::COMPRESSED_TIER_HIT);
+      }
+      compressed_tiers_[index]->Erase(key);
+      shard.Promote(key, value);
+      return true;
+    }
+    if (!flash_tier_) {
+      return false;
+    }
+    if (!flash_tier_->Lookup(key, value)) {
+      if (stat_yes) {
+        shard.stats.RecordTick(Tickers::FLASH_TIER_MISS);
+      }
+      return false;
+    }
+    if (stat_yes) {
+      shard.stats.RecordTick(Tickers::FLASH_TIER_HIT);
+    }
+    flash_tier_->Erase(key);
+    shard.Promote(key, value);
+    return true;
+  }
+
+  // Take the stripe of 'key' for a write under the LOCAL policy. The version
+  // is bumped first, so a lookup that read the home shard before the write
+  // doesn't copy what it read.
+  std::unique_lock<std::mutex> LockReplicas(const Key& key) {
+    if (!replica_stripes_) {
+      return std::unique_lock<std::mutex>();
+    }
+    auto& stripe = replica_stripes_[key % replica_num_stripes];
+    std::unique_lock<std::mutex> lock(stripe.mtx);
+    stripe.version.fetch_add(1, std::memory_order_release);
+    ForEachReplicaCounter(key, [](std::atomic<uint8_t>& counter) {
+      counter.store(0, std::memory_order_relaxed);
+    });
+    return lock;
+  }
+
+  // Call 'func' with the counter of 'key' in every row of the sketch of the
+  // reads. The rows take disjoint bits of one hash of the key.
+  template <class Func>
+  void ForEachReplicaCounter(const Key& key, Func&& func) {
+    auto hash = utils::Mix64(std::hash<Key>()(key));
+    for (uint32_t row = 0; row < replica_sketch_rows; row++) {
+      func(replica_reads_[row * replica_sketch_width +
+                          hash % replica_sketch_width]);
+      hash /= replica_sketch_width;
+    }
+  }
+
+  // Count a read of 'key' from its home shard. Returns true while the key has
+  // not been read 'replica_min_reads' times yet. The reset of its counters by
+  // a write also resets the keys sharing them, which only delays their copy.
+  bool CountReplicaRead(const Key& key) {
+    uint8_t reads = replica_min_reads;
+    ForEachReplicaCounter(key, [&](std::atomic<uint8_t>& counter) {
+      reads = std::min(reads, counter.load(std::memory_order_relaxed));
+    });
+    if (reads >= replica_min_reads) {
+      return false;
+    }
+    // Conservative update: only the counters at the minimum count this read.
+    ForEachReplicaCounter(key, [&](std::atomic<uint8_t>& counter) {
+      if (counter.load(std::memory_order_relaxed) == reads) {
+        counter.store(reads + 1, std::memory_order_relaxed);
+      }
+    });
+    return true;
+  }
+
+  // Lock the promotions of 'key' from the lower tiers, if there are any.
+  std::unique_lock<std::mutex> LockTiers(const Key& key) {
+    if (!tier_mutexes_) {
+      return std::unique_lock<std::mutex>();
+    }
+    return std::unique_lock<std::mutex>(tier_mutexes_[key % tier_num_mutexes]);
+  }
+
+  void EraseFromTiers(uint32_t index, const Key& key) {
+    if (!compressed_tiers_.empty()) {
+      compressed_tiers_[index]->Erase(key);
+    }
+    if (flash_tier_) {
+      flash_tier_->Erase(key);
+    }
+  }
+
+  // Route evicted entries: shard -> compressed tier -> flash tier.
+  void SetupEvictionChain();
+
+  // Acquisitions of the shard locks that found them held, in 'delta'.
+  static uint64_t GetLockContended(const TickerSnapshot& delta) {
+    return delta[Tickers::LIST_LOCK_CONTENDED] +
+           delta[Tickers::HEAD_SEGMENT_LOCK_CONTENDED] +
+           delta[Tickers::TAIL_SEGMENT_LOCK_CONTENDED];
+  }
+
+  // Print the hit ratios of the tiers below the shards, and the ratio of
+  // requests that still go to the backend.
+  void PrintTierRatio(uint64_t total_hit, uint64_t total_miss,
+                      uint64_t compressed_hit, uint64_t flash_hit);
+
+  void L0Invalidate(const Key& key) {
+    if (l0_versions_) {
+      get_l0_version(key).fetch_add(1, std::memory_order_release);
+    }
+  }
+
+  // Capacity of every shard: its part of the depth of the compressed tier,
+  // or else of the capacity of the cache.
+  uint64_t get_shard_capacity() const {
+    return (compressed_depth_ > 0 ? compressed_depth_ : max_size_.load()) /
+           num_shards_;
+  }
 
-  const uint64_t max_size_;
-  double baseline_performance;
-  bool should_stop_;
+  void ResizeWorker();
+
+  // Collect and write the metrics every 'interval_ms', and once more at
+  // 'Stop'.
+  void MetricsWorker(uint32_t interval_ms);
+
+  // Make the states of 'frozen_shards_' visible to 'MetricsWorker'.
+  void PublishShardStates();
+
+  // Used by the monitors.
+  void WaitStable();
+  void SleepAndWatch(uint32_t seconds);
+  // Measure the latencies of the cost model: dynamic cache hits and misses
+  // without the fast cache, then fast cache hits with a fraction of the shards
+  // frozen. Return false if shards don't support the fast cache.
+  bool CalibrateFrozen();
+  // Run the transitions of 'batch'. Refreshed shards are added to
+  // 'refreshed'.
+  void RunTransitions(const std::vector<uint32_t>& batch,
+                      std::vector<uint32_t>& refreshed);
+  // Profile the curves of 'ids' in parallel, and pick the ratio of each one.
+  void SearchShards(const std::vector<uint32_t>& ids);
+  // Construct or refresh the fast cache of shard 'id' with its ratio.
+  void FreezeShard(uint32_t id, const char* event);
+  // Account a pass of the frozen shard 'id', and decide whether its fast cache
+  // is kept, refreshed or dropped.
+  void CheckFrozenShard(uint32_t id, uint64_t fast_cache_hit, uint64_t o_hit,
+                        uint64_t miss);
+  // Grow the back-off of shard 'id' after a stage without benefit, and let it
+  // wait without the fast cache.
+  void BackOff(uint32_t id, const char* reason);
+  // Log a decision of 'FrozenMonitor' as one line of JSON, after the
+  // "frozen_decision " prefix.
+  void LogFrozenDecision(
+      const char* event,
+      std::initializer_list<std::pair<const char*, double>> fields);
+
+  ShardPtr NewShard(CacheType type, uint64_t capacity);
+
+  // Compare the shadows of the last window, and switch the policy of all
+  // shards once another one has been better for long enough.
+  void CheckPolicy();
+
+  /**
+   * Replace shard 'index' by a shard of 'type' holding the same entries, while
+   * requests are being served.
+   *
+   * Until the new shard is published, writes go to the old one, and then
+   * erase their key from the new one ('WriteShard'). The entries are copied
+   * from the least to the most recently used one meanwhile, and the writes
+   * that raced with the copy record their keys, which are erased from the new
+   * shard once the copy is done. So the new shard holds no value older than a
+   * write that has returned when it is published. Once the requests that may
+   * use the old shard are done ('shard_epoch_'), the old shard is freed.
+   */
+  void MigrateShard(uint32_t index, CacheType type);
+
+  // Requests and workers hold a guard while they use a shard, so that a
+  // migrated shard is freed once they are done with it. Only the adaptive
+  // policy migrates shards, so there is no guard without it.
+  std::optional<utils::EpochManager::Guard> ProtectShards() {
+    if (!shadow_) {
+      return std::nullopt;
+    }
+    return std::optional<utils::EpochManager::Guard>(std::in_place,
+                                                     &shard_epoch_);
+  }
+
+  // Apply 'write' of 'key' to shard 'index', see 'MigrateShard'.
+  template <class Write>
+  bool WriteShard(uint32_t index, const Key& key, Write&& write) {
+    bool migrating = migrating_shard_.load(std::memory_order_seq_cst) ==
+                     static_cast<int64_t>(index);
+    if (UNLIKELY(migrating) &&
+        migration_copying_.load(std::memory_order_seq_cst)) {
+      migration_dirty_.insert({key, true});
+    }
+    auto shard = shards_[index].ptr.load(std::memory_order_seq_cst);
+    bool ret = write(*shard);
+    if (UNLIKELY(migrating)) {
+      auto target = migration_target_.load(std::memory_order_seq_cst);
+      if (target != shard) {
+        target->Erase(key);
+      }
+    }
+    return ret;
+  }
+
+  // Remove the copies of 'key' held by the shard groups of other nodes than
+  // its home shard 'index'. The caller holds the stripe of 'key'.
+  void InvalidateReplicas(uint32_t index, const Key& key) {
+    if (!replica_stripes_) {
+      return;
+    }
+    for (auto node : nodes_) {
+      auto replica = get_node_shard_index(node, key);
+      if (replica != index) {
+        WriteShard(replica, key,
+                   [&](Shard& shard) { return shard.Erase(key); });
+        if (!compressed_tiers_.empty()) {
+          compressed_tiers_[replica]->Erase(key);
+        }
+      }
+    }
+  }
+
+  const uint32_t num_shards_;
+  std::atomic<CacheType> type_;
+
+  // Shards are swapped by the adaptive policy while requests are served, so
+  // requests go through an atomic pointer under a guard ('ProtectShards'),
+  // and 'owner' is only changed by the migration.
+  struct ShardSlot {
+    ShardPtr owner;
+    std::atomic<Shard*> ptr{nullptr};
+
+    Shard* operator->() const { return ptr.load(std::memory_order_acquire); }
+    Shard& operator*() const { return *operator->(); }
+  };
+  std::unique_ptr<ShardSlot[]> shards_;
+
+  const NumaPolicy numa_policy_;
+  std::vector<int> nodes_;
+  std::vector<std::vector<uint32_t>> node_shards_;
+
+  // Only under the LOCAL policy with more than one node.
+  struct ReplicaStripe {
+    std::mutex mtx;
+    std::atomic<uint64_t> version{0};
+  };
+  std::unique_ptr<ReplicaStripe[]> replica_stripes_;
+  // Reads of the home shards since the last write, see 'CountReplicaRead'.
+  std::unique_ptr<std::atomic<uint8_t>[]> replica_reads_;
+
+  uint64_t instance_id_;
+  std::unique_ptr<L0Version[]> l0_versions_;
+
+  std::unique_ptr<FlashTier<Key, Value>> flash_tier_;
+  std::unique_ptr<MrcProfiler<Key>> mrc_profiler_;
+
+  std::unique_ptr<ShadowSimulator<Key>> shadow_;
+  std::vector<CacheType> shadow_types_;  // by policy index of 'shadow_'
+  int32_t policy_candidate_ = -1;
+  uint32_t policy_candidate_rounds_ = 0;
+  uint32_t policy_cooldown_ = 0;
+  std::atomic<int64_t> migrating_shard_{-1};
+  std::atomic<Shard*> migration_target_{nullptr};
+  std::atomic<bool> migration_copying_{false};
+  // Keys written while the entries are copied.
+  tbb::concurrent_hash_map<Key, bool> migration_dirty_;
+  utils::EpochManager shard_epoch_;
+  std::vector<std::unique_ptr<CompressedTier<Key, Value>>> compressed_tiers_;
+  std::unique_ptr<std::mutex[]> tier_mutexes_;
+  uint64_t compressed_depth_ = 0;  // 0 without the compressed tier
+
+  std::atomic<uint64_t> max_size_;
+  // Set by 'Stop', read by the background threads.
+  std::atomic<bool> should_stop_;
+
+  std::thread resize_thread_;
+  std::mutex resize_mtx_;
+  std::condition_variable resize_cv_;
+  bool resize_pending_ = false;
+
+  std::unique_ptr<MetricsExporter> metrics_exporter_;
+  std::thread metrics_thread_;
+  std::mutex metrics_mtx_;
+  std::condition_variable metrics_cv_;
+  // What the monitor is doing, and the 'FrozenState' of every shard (or -1)
+  // at the last pass of 'FrozenMonitor', for the metrics.
+  std::atomic<const char*> monitor_stage_{"start"};
+  std::unique_ptr<std::atomic<int32_t>[]> shard_states_;
   bool beginning_flag_;
+  // State machine of a shard in 'FrozenMonitor'.
+  struct FrozenShard {
+    explicit FrozenShard(const FrozenOptions& options)
+        : backoff_s(options.backoff_s),
+          model(options),
+          hit_change(options.phase_change_delta,
+                     options.phase_change_threshold) {}
+
+    FrozenState state = FrozenState::SEARCH;
+    // Fast cache ratio picked from the curve of the shard, 1 for 100% frozen.
+    double ratio = 0;
+    // Miss ratio of the shard without the fast cache, from its curve.
+    double baseline_miss = 1;
+    // Passes and requests since the construction, requests in the current
+    // round, and in the first round (the length of a round).
+    uint32_t num_passes = 0;
+    uint64_t total_step = 0;
+    uint64_t round_step = 0;
+    uint64_t construct_step = 0;
+    double depletion = 0;
+    uint32_t backoff_s;
+    uint64_t wake_time_us = 0;
+    FrozenCostModel model;
+    // Falls of the fast cache hit ratio after the first round.
+    ChangeDetector hit_change;
+  };
+  std::vector<FrozenShard> frozen_shards_;
+  FrozenOptions frozen_options_;
+  // Drift of the key popularity of every shard since its construction.
+  std::vector<std::unique_ptr<PhaseDetector<Key>>> phase_detectors_;
 
   tbb::concurrent_hash_map<uint64_t, void*> shared_hash_;
 };
 
 template <class Key, class Value>
 ConcurrentScalableCache<Key, Value>::ConcurrentScalableCache(
-    uint64_t capacity, uint32_t num_shards, CacheType type)
+    uint64_t capacity, uint32_t num_shards, CacheType type,
+    NumaPolicy numa_policy, const std::vector<int>& nodes)
     : num_shards_(num_shards),
+      type_(type),
+      shards_(new ShardSlot[num_shards]),
+      numa_policy_(numa_policy),
       max_size_(capacity),
-      baseline_performance(0),
       should_stop_(false),
       beginning_flag_(true) {
+  if (numa_policy_ != NumaPolicy::NONE) {
+    nodes_ = nodes.empty() ? utils::numa::GetNodes() : nodes;
+  } else {
+    nodes_.push_back(0);
+  }
+  node_shards_.resize(*std::max_element(nodes_.begin(), nodes_.end()) + 1);
+
   for (uint32_t i = 0; i < num_shards_; i++) {
-    size_t s = max_size_ / num_shards_;
+    size_t s = get_shard_capacity();
+    auto node = nodes_[i % nodes_.size()];
+
+    auto make_shard = [&]() {
+      shards_[i].owner = NewShard(type, s);
+      shards_[i].ptr.store(shards_[i].owner.get());
+    };
+
+    if (numa_policy_ == NumaPolicy::NONE) {
+      make_shard();
+    } else {
+      utils::numa::RunOnNode(node, make_shard);
+    }
+    node_shards_[node].push_back(i);
+  }
 
-    if (CacheType::FIFO == type) {
-      shards_.emplace_back(std::make_shared<FifoCache<Key, Value>>(s));
-    } else if (CacheType::LRU == type) {
-      shards_.emplace_back(std::make_shared<LruCache<Key, Value>>(s));
-      // shards_.emplace_back(
-      //     std::make_shared<LruCacheSharedHash<Key, Value>>(shared_hash_, s));
-    } else if (CacheType::GROUP == type) {
-      shards_.emplace_back(std::make_shared<GroupCache<Key, Value>>(s));
-    } else if (CacheType::ASYNC == type) {
-      shards_.emplace_back(std::make_shared<AsyncCache<Key, Value>>(s));
-    } else if (CacheType::SEGMENT == type) {
-      shards_.emplace_back(std::make_shared<SegmentCache<Key, Value>>(s));
+  if (numa_policy_ != NumaPolicy::NONE) {
+    for (auto node : nodes_) {
+      printf("numa node %d: %lu shards\n", node, node_shards_[node].size());
     }
   }
+  if (numa_policy_ == NumaPolicy::LOCAL && nodes_.size() > 1) {
+    replica_stripes_.reset(new ReplicaStripe[replica_num_stripes]);
+    replica_reads_.reset(
+        new std::atomic<uint8_t>[replica_sketch_rows * replica_sketch_width]());
+  }
+  if (IsFrozenHot(type_)) {
+    SetFrozenOptions(frozen_options_);
+  }
+
+  static std::atomic<uint64_t> next_instance_id{1};
+  instance_id_ = next_instance_id++;
+}
+
+template <class Key, class Value>
+typename ConcurrentScalableCache<Key, Value>::ShardPtr
+ConcurrentScalableCache<Key, Value>::NewShard(CacheType type,
+                                              uint64_t capacity) {
+  auto s = capacity;
+  if (CacheType::FIFO == type) {
+    return std::make_shared<FifoCache<Key, Value>>(s);
+  } else if (CacheType::LRU == type) {
+    return std::make_shared<LruCache<Key, Value>>(s);
+    // return std::make_shared<LruCacheSharedHash<Key, Value>>(shared_hash_,
+    //                                                         s);
+  } else if (CacheType::GROUP == type) {
+    return std::make_shared<GroupCache<Key, Value>>(s);
+  } else if (CacheType::ASYNC == type) {
+    return std::make_shared<AsyncCache<Key, Value>>(s);
+  } else if (CacheType::SEGMENT == type) {
+    return std::make_shared<SegmentCache<Key, Value>>(s);
+  } else if (CacheType::COMPACT_LRU == type) {
+    return std::make_shared<CompactLruCache<Key, Value>>(s);
+  } else if (IsFrozenHot(type)) {
+    // The fast cache returns values without a reference, so they must be
+    // shared pointers.
+    if constexpr (std::is_same_v<Value, std::shared_ptr<std::string>>) {
+      if (CacheType::FROZENHOT_FIFO == type) {
+        return std::make_shared<FrozenFifoCache<Key, Value>>(s);
+      } else if (CacheType::FROZENHOT_LFU == type) {
+        return std::make_shared<FrozenLfuCache<Key, Value>>(s);
+      }
+      return std::make_shared<FrozenHotCache<Key, Value>>(s);
+    }
+    printf("frozenhot cache is not supported by this value type\n");
+  }
+  return nullptr;
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::SetCapacity(uint64_t capacity) {
+  auto old_capacity = max_size_.exchange(capacity);
+  printf("set capacity: %lu -> %lu\n", old_capacity, capacity);
+  auto guard = ProtectShards();
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    shards_[i]->SetCapacity(get_shard_capacity());
+  }
+  if (shadow_) {
+    shadow_->SetCapacity(capacity);
+  }
+  if (capacity >= old_capacity || compressed_depth_ > 0) {
+    return;
+  }
+
+  std::unique_lock resize_lock(resize_mtx_);
+  if (should_stop_) {
+    return;
+  }
+  if (!resize_thread_.joinable()) {
+    resize_thread_ = std::thread(&ConcurrentScalableCache::ResizeWorker, this);
+  }
+  resize_pending_ = true;
+  resize_cv_.notify_one();
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::MetricsWorker(uint32_t interval_ms) {
+  // Cumulative counts at the previous record, from 0 as the export starts
+  // before any request. A migrated shard has new tickers, which count from 0
+  // too.
+  struct ShardCursor {
+    Shard* shard = nullptr;
+    TickerSnapshot tickers;
+  };
+  std::vector<ShardCursor> cursors(num_shards_);
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    cursors[i].shard = shards_[i].ptr.load(std::memory_order_acquire);
+  }
+  utils::LatencyHistogram::Snapshot hit_cursor, other_cursor;
+  auto last_time_us = utils::NowMicros();
+
+  bool stop = false;
+  while (!stop) {
+    std::unique_lock metrics_lock(metrics_mtx_);
+    stop = metrics_cv_.wait_for(metrics_lock,
+                                std::chrono::milliseconds(interval_ms),
+                                [&]() { return should_stop_.load(); });
+    metrics_lock.unlock();
+
+    MetricsRecord record;
+    record.time_us = utils::NowMicros();
+    record.duration_s = 1.0 * (record.time_us - last_time_us) / 1e6;
+    last_time_us = record.time_us;
+    record.shards.resize(num_shards_);
+    auto guard = ProtectShards();
+    for (uint32_t i = 0; i < num_shards_; i++) {
+      auto shard = shards_[i].ptr.load(std::memory_order_acquire);
+      if (shard != cursors[i].shard) {
+        cursors[i].shard = shard;
+        cursors[i].tickers = TickerSnapshot();
+      }
+      auto tickers = shard->get_stats()->Snapshot();
+      auto delta = tickers - cursors[i].tickers;
+      cursors[i].tickers = tickers;
+
+      auto& metrics = record.shards[i];
+      metrics.fast_cache_hit = delta[Tickers::FAST_CACHE_HIT];
+      // Hits served by the per-thread L0 cache are regular hits.
+      metrics.hit = delta[Tickers::CACHE_HIT] + delta[Tickers::L0_CACHE_HIT];
+      metrics.miss = delta[Tickers::CACHE_MISS];
+      metrics.size = shard->get_size();
+      metrics.state = shard_states_[i].load(std::memory_order_relaxed);
+      record.fast_cache_hit += metrics.fast_cache_hit;
+      record.hit += metrics.hit;
+      record.miss += metrics.miss;
+      record.insert += delta[Tickers::INSERT];
+      record.size += metrics.size;
+      record.lock_contended += delta[Tickers::LIST_LOCK_CONTENDED] +
+                               delta[Tickers::HEAD_SEGMENT_LOCK_CONTENDED] +
+                               delta[Tickers::TAIL_SEGMENT_LOCK_CONTENDED];
+      record.promotion_skipped += delta[Tickers::PROMOTION_SKIPPED];
+    }
+    if (record.duration_s > 0) {
+      record.throughput =
+          (record.fast_cache_hit + record.hit + record.miss) /
+          record.duration_s;
+    }
+
+    auto hit_current = hit_latency_set.Current();
+    auto other_current = other_latency_set.Current();
+    record.hit_lat = LatencyMetrics::From(hit_current - hit_cursor);
+    record.other_lat = LatencyMetrics::From(other_current - other_cursor);
+    hit_cursor = std::move(hit_current);
+    other_cursor = std::move(other_current);
+
+    record.capacity = max_size_.load();
+    record.stage = monitor_stage_.load();
+    record.policy = static_cast<uint32_t>(type_.load());
+    metrics_exporter_->Write(record);
+  }
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::PublishShardStates() {
+  if (!shard_states_) {
+    return;
+  }
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    shard_states_[i].store(static_cast<int32_t>(frozen_shards_[i].state),
+                           std::memory_order_relaxed);
+  }
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::ResizeWorker() {
+  while (true) {
+    std::unique_lock resize_lock(resize_mtx_);
+    resize_cv_.wait(resize_lock,
+                    [&]() { return resize_pending_ || should_stop_; });
+    if (should_stop_) {
+      return;
+    }
+    resize_pending_ = false;
+    resize_lock.unlock();
+
+    auto start_time = utils::NowMicros();
+    uint64_t total = 0, evicted = 0;
+    do {
+      evicted = 0;
+      for (uint32_t i = 0; i < num_shards_ && !should_stop_; i++) {
+        auto guard = ProtectShards();
+        evicted += shards_[i]->EvictBatch(resize_batch_size);
+      }
+      total += evicted;
+      usleep(resize_sleep_interval_us);
+    } while (evicted > 0 && !should_stop_);
+
+    printf("shrink done: evict %lu entries in %.3lf s, size: %.0lf\n", total,
+           1.0 * (utils::NowMicros() - start_time) / 1e6, get_size());
+    fflush(stdout);
+  }
+}
+
+template <class Key, class Value>
+bool ConcurrentScalableCache<Key, Value>::SaveSnapshot(
+    const std::string& path) {
+  static_assert(std::is_trivially_copyable_v<Key>,
+                "snapshot keys are written as raw bytes");
+  auto start_time = utils::NowMicros();
+
+  std::vector<std::string> buffers(num_shards_);
+  std::vector<SnapshotShardInfo> infos(num_shards_);
+  std::vector<std::thread> workers;
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    workers.emplace_back([&, i]() {
+      auto& buffer = buffers[i];
+      uint32_t rank = 0;
+      auto guard = ProtectShards();
+      shards_[i]->ForEachEntry([&](const Key& key, const Value& value) {
+        buffer.append(reinterpret_cast<const char*>(&key), sizeof(Key));
+        buffer.append(reinterpret_cast<const char*>(&rank), sizeof(rank));
+        SnapshotCodec<Value>::Encode(value, buffer);
+        rank++;
+      });
+      infos[i].num_entries = rank;
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  SnapshotHeader header;
+  memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.version = kSnapshotVersion;
+  header.num_shards = num_shards_;
+  header.key_size = sizeof(Key);
+  header.reserved = 0;
+  header.num_entries = 0;
+  uint64_t offset = sizeof(header) + sizeof(SnapshotShardInfo) * num_shards_;
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    infos[i].offset = offset;
+    infos[i].size = buffers[i].size();
+    offset += infos[i].size;
+    header.num_entries += infos[i].num_entries;
+  }
+
+  auto tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("fail to open snapshot %s: %s\n", tmp_path.c_str(),
+           strerror(errno));
+    return false;
+  }
+  auto write_all = [&](const char* data, uint64_t size) {
+    while (size > 0) {
+      auto n = write(fd, data, std::min(size, snapshot_write_chunk_size));
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      data += n;
+      size -= n;
+    }
+    return true;
+  };
+  bool ok = write_all(reinterpret_cast<const char*>(&header), sizeof(header)) &&
+            write_all(reinterpret_cast<const char*>(infos.data()),
+                      sizeof(SnapshotShardInfo) * num_shards_);
+  for (uint32_t i = 0; ok && i < num_shards_; i++) {
+    ok = write_all(buffers[i].data(), buffers[i].size());
+  }
+  ok = ok && fsync(fd) == 0;
+  close(fd);
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    printf("fail to write snapshot %s: %s\n", path.c_str(), strerror(errno));
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  printf("save snapshot: %lu entries (%.1lf MB) in %.3lf s\n",
+         header.num_entries, 1.0 * offset / (1 << 20),
+         1.0 * (utils::NowMicros() - start_time) / 1e6);
+  fflush(stdout);
+  return true;
+}
+
+template <class Key, class Value>
+bool ConcurrentScalableCache<Key, Value>::LoadSnapshot(
+    const std::string& path) {
+  auto start_time = utils::NowMicros();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("fail to open snapshot %s: %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<uint64_t>(st.st_size) < sizeof(SnapshotHeader)) {
+    printf("invalid snapshot %s\n", path.c_str());
+    close(fd);
+    return false;
+  }
+  uint64_t file_size = st.st_size;
+  auto base = reinterpret_cast<const char*>(
+      mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0));
+  close(fd);
+  if (base == MAP_FAILED) {
+    printf("fail to map snapshot %s: %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  madvise(const_cast<char*>(base), file_size, MADV_SEQUENTIAL);
+
+  auto fail = [&](const char* reason) {
+    printf("invalid snapshot %s: %s\n", path.c_str(), reason);
+    munmap(const_cast<char*>(base), file_size);
+    return false;
+  };
+
+  SnapshotHeader header;
+  memcpy(&header, base, sizeof(header));
+  if (memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 ||
+      header.version != kSnapshotVersion) {
+    return fail("unknown format");
+  }
+  if (header.key_size != sizeof(Key)) {
+    return fail("key size mismatch");
+  }
+  uint64_t infos_end =
+      sizeof(header) + sizeof(SnapshotShardInfo) * header.num_shards;
+  if (infos_end > file_size) {
+    return fail("truncated");
+  }
+  std::vector<SnapshotShardInfo> infos(header.num_shards);
+  memcpy(infos.data(), base + sizeof(header),
+         sizeof(SnapshotShardInfo) * header.num_shards);
+  for (auto& info : infos) {
+    if (info.offset < infos_end || info.offset > file_size ||
+        info.size > file_size - info.offset) {
+      return fail("truncated");
+    }
+  }
+
+  // The rank is normalized by the number of entries of its source shard, so
+  // entries from different source shards can be merged by recency.
+  struct Record {
+    Key key;
+    Value value;
+    double rank;
+  };
+
+  // Decode the source shards in parallel, routing records to their new shard.
+  std::vector<std::vector<std::vector<Record>>> routed(
+      header.num_shards, std::vector<std::vector<Record>>(num_shards_));
+  std::atomic<bool> corrupted{false};
+  std::vector<std::thread> workers;
+  for (uint32_t i = 0; i < header.num_shards; i++) {
+    workers.emplace_back([&, i]() {
+      auto& info = infos[i];
+      auto p = base + info.offset;
+      auto end = p + info.size;
+      const uint64_t record_header_size = sizeof(Key) + 2 * sizeof(uint32_t);
+      while (p < end) {
+        Record record;
+        uint32_t rank, len;
+        if (static_cast<uint64_t>(end - p) < record_header_size) {
+          corrupted = true;
+          return;
+        }
+        memcpy(&record.key, p, sizeof(Key));
+        memcpy(&rank, p + sizeof(Key), sizeof(rank));
+        memcpy(&len, p + sizeof(Key) + sizeof(rank), sizeof(len));
+        p += record_header_size;
+        uint64_t data_len = len == kSnapshotNullLength ? 0 : len;
+        if (static_cast<uint64_t>(end - p) < data_len ||
+            !SnapshotCodec<Value>::Decode(p, len, record.value)) {
+          corrupted = true;
+          return;
+        }
+        p += data_len;
+        record.rank = (rank + 0.5) / std::max<uint64_t>(info.num_entries, 1);
+        routed[i][get_shard_index(record.key)].emplace_back(
+            std::move(record));
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  munmap(const_cast<char*>(base), file_size);
+  if (corrupted) {
+    printf("invalid snapshot %s: corrupted records\n", path.c_str());
+    return false;
+  }
+
+  // Insert from the least recently used entry, so the most recently used one
+  // ends up at the head of the shard.
+  std::atomic<uint64_t> num_loaded{0};
+  workers.clear();
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    workers.emplace_back([&, i]() {
+      std::vector<Record> records;
+      for (uint32_t j = 0; j < header.num_shards; j++) {
+        auto& part = routed[j][i];
+        std::move(part.begin(), part.end(), std::back_inserter(records));
+        std::vector<Record>().swap(part);
+      }
+      std::stable_sort(
+          records.begin(), records.end(),
+          [](const Record& a, const Record& b) { return a.rank > b.rank; });
+      for (auto& record : records) {
+        shards_[i]->Insert(record.key, record.value);
+        L0Invalidate(record.key);
+      }
+      num_loaded += records.size();
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  printf("load snapshot: %lu entries (%u -> %u shards) in %.3lf s, "
+         "size: %.0lf\n",
+         num_loaded.load(), header.num_shards, num_shards_,
+         1.0 * (utils::NowMicros() - start_time) / 1e6, get_size());
+  fflush(stdout);
+  return true;
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::EnableL0Cache() {
+  printf("l0 cache: %u entries per thread\n", l0_cache_size);
+  l0_versions_.reset(new L0Version[l0_num_versions]);
+}
+
+template <class Key, class Value>
+bool ConcurrentScalableCache<Key, Value>::EnableFlashTier(
+    const std::string& path, uint64_t capacity) {
+  flash_tier_.reset(new FlashTier<Key, Value>(path, capacity));
+  if (!flash_tier_->Open()) {
+    flash_tier_.reset();
+    return false;
+  }
+  SetupEvictionChain();
+  return true;
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::EnableCompressedTier(
+    uint64_t depth, uint64_t arena_size) {
+  printf("compressed tier: depth %lu, arena %lu MB, codec: %s\n", depth,
+         arena_size >> 20, utils::compress::Name());
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    compressed_tiers_.emplace_back(
+        new CompressedTier<Key, Value>(arena_size / num_shards_));
+  }
+  SetupEvictionChain();
+  // The shards are still empty, so there is nothing to evict.
+  compressed_depth_ = depth;
+  auto guard = ProtectShards();
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    shards_[i]->SetCapacity(get_shard_capacity());
+  }
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::EnableMrcProfiler(double rate) {
+  printf("mrc profiler: sampling rate %.4lf\n", rate);
+  mrc_profiler_.reset(new MrcProfiler<Key>(rate));
+}
+
+template <class Key, class Value>
+bool ConcurrentScalableCache<Key, Value>::EnableMetricsExport(
+    const std::string& target, MetricsFormat format, uint32_t interval_ms) {
+  metrics_exporter_.reset(new MetricsExporter(format));
+  if (!metrics_exporter_->Open(target)) {
+    metrics_exporter_.reset();
+    return false;
+  }
+  shard_states_.reset(new std::atomic<int32_t>[num_shards_]);
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    shard_states_[i] = -1;
+  }
+  printf("metrics interval: %u ms\n", interval_ms);
+  metrics_thread_ = std::thread(&ConcurrentScalableCache::MetricsWorker, this,
+                                std::max<uint32_t>(interval_ms, 1));
+  return true;
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::SetFrozenOptions(
+    const FrozenOptions& options) {
+  frozen_options_ = options;
+  phase_detectors_.clear();
+  if (options.phase_sample_ratio == 0) {
+    return;
+  }
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    phase_detectors_.emplace_back(new PhaseDetector<Key>(
+        options.phase_sample_ratio, options.phase_min_samples));
+  }
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::PrintMrc() {
+  if (!mrc_profiler_) {
+    return;
+  }
+  const double scales[] = {0.25, 0.5, 1, 2, 4};
+  auto capacity = max_size_.load();
+  printf("estimated miss ratio:");
+  for (auto scale : scales) {
+    auto c = static_cast<uint64_t>(capacity * scale);
+    printf(" %lu: %.4lf", c, mrc_profiler_->GetMissRatio(c));
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+template <class Key, class Value>
+bool ConcurrentScalableCache<Key, Value>::EnableAdaptivePolicy() {
+  if (type_ != CacheType::LRU && type_ != CacheType::FIFO &&
+      type_ != CacheType::SEGMENT) {
+    printf("adaptive policy: only lru, fifo and segment can be switched\n");
+    return false;
+  }
+  constexpr uint64_t kShadowSlotsPerSegment = 65536 / shadow_sample_ratio;
+  auto capacity = max_size_.load() / shadow_sample_ratio;
+  shadow_.reset(new ShadowSimulator<Key>(shadow_sample_ratio));
+  shadow_->AddPolicy("lru",
+                     std::make_unique<LruCache<Key, uint8_t>>(capacity));
+  shadow_types_.push_back(CacheType::LRU);
+  shadow_->AddPolicy("fifo",
+                     std::make_unique<FifoCache<Key, uint8_t>>(capacity));
+  shadow_types_.push_back(CacheType::FIFO);
+  shadow_->AddPolicy(
+      "segment",
+      std::make_unique<SegmentCache<Key, uint8_t, kShadowSlotsPerSegment>>(
+          capacity));
+  shadow_types_.push_back(CacheType::SEGMENT);
+  printf("adaptive policy: 1/%u keys sampled, shadow capacity %lu\n",
+         shadow_sample_ratio, capacity);
+  return true;
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::CheckPolicy() {
+  if (!shadow_) {
+    return;
+  }
+  std::vector<double> miss_ratios;
+  auto num_samples = shadow_->GetWindow(miss_ratios);
+  uint32_t current = 0, best = 0;
+  printf("shadow miss ratio (%lu samples):", num_samples);
+  for (uint32_t i = 0; i < miss_ratios.size(); i++) {
+    printf(" %s: %.4lf", shadow_->get_name(i).c_str(), miss_ratios[i]);
+    if (shadow_types_[i] == type_) {
+      current = i;
+    }
+    if (miss_ratios[i] < miss_ratios[best]) {
+      best = i;
+    }
+  }
+  printf("\n");
+
+  if (policy_cooldown_ > 0) {
+    policy_cooldown_--;
+    return;
+  }
+  if (num_samples < shadow_min_samples || best == current ||
+      miss_ratios[best] >=
+          miss_ratios[current] * (1 - policy_switch_margin)) {
+    policy_candidate_ = -1;
+    policy_candidate_rounds_ = 0;
+    return;
+  }
+  if (policy_candidate_ != static_cast<int32_t>(best)) {
+    policy_candidate_ = best;
+    policy_candidate_rounds_ = 0;
+  }
+  policy_candidate_rounds_++;
+  printf("policy %s is better than %s (%.4lf < %.4lf), %u/%u windows\n",
+         shadow_->get_name(best).c_str(), shadow_->get_name(current).c_str(),
+         miss_ratios[best], miss_ratios[current], policy_candidate_rounds_,
+         policy_switch_rounds);
+  if (policy_candidate_rounds_ < policy_switch_rounds) {
+    fflush(stdout);
+    return;
+  }
+
+  printf("switch policy: %s -> %s\n", shadow_->get_name(current).c_str(),
+         shadow_->get_name(best).c_str());
+  fflush(stdout);
+  SwitchPolicy(shadow_types_[best]);
+  policy_candidate_ = -1;
+  policy_candidate_rounds_ = 0;
+  policy_cooldown_ = policy_cooldown_rounds;
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::SwitchPolicy(CacheType type) {
+  if (!shadow_) {
+    printf("switch policy: the adaptive policy is not enabled\n");
+    return;
+  }
+  auto start_time = utils::NowMicros();
+  for (uint32_t i = 0; i < num_shards_ && !should_stop_; i++) {
+    MigrateShard(i, type);
+  }
+  type_ = type;
+  printf("switch policy done in %.3lf s, size: %.0lf\n",
+         1.0 * (utils::NowMicros() - start_time) / 1e6, get_size());
+  fflush(stdout);
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::MigrateShard(uint32_t index,
+                                                       CacheType type) {
+  auto& slot = shards_[index];
+  auto old_shard = slot.owner;
+  auto node = nodes_[index % nodes_.size()];
+  ShardPtr new_shard;
+  auto make_shard = [&]() {
+    new_shard = NewShard(type, get_shard_capacity());
+  };
+  if (numa_policy_ == NumaPolicy::NONE) {
+    make_shard();
+  } else {
+    utils::numa::RunOnNode(node, make_shard);
+  }
+  new_shard->eviction_callback_ = old_shard->eviction_callback_;
+
+  // The writers that may have missed the flag are done after this, and the
+  // next ones record their keys and erase them from the new shard.
+  migration_target_.store(new_shard.get(), std::memory_order_seq_cst);
+  migration_copying_.store(true, std::memory_order_seq_cst);
+  migrating_shard_.store(index, std::memory_order_seq_cst);
+  shard_epoch_.Synchronize();
+
+  std::vector<std::pair<Key, Value>> entries;
+  old_shard->ForEachEntry([&](const Key& key, const Value& value) {
+    entries.emplace_back(key, value);
+  });
+  for (auto iter = entries.rbegin(); iter != entries.rend(); iter++) {
+    new_shard->Insert(iter->first, iter->second);
+  }
+  for (int i = 0; i < (int)Tickers::TICKER_ENUM_MAX; i++) {
+    auto ticker = static_cast<Tickers>(i);
+    new_shard->stats.SetTickerCount(ticker,
+                                    old_shard->stats.GetTickerCount(ticker));
+  }
+
+  // A write that raced with the copy may have been overwritten by its older
+  // value. The next writes erase their keys after the copy by themselves.
+  migration_copying_.store(false, std::memory_order_seq_cst);
+  shard_epoch_.Synchronize();
+  for (auto& [key, dirty] : migration_dirty_) {
+    new_shard->Erase(key);
+  }
+  migration_dirty_.clear();
+
+  // Requests go to the new shard now. Once the ones that may still use the
+  // old shard are done, it is unused.
+  slot.ptr.store(new_shard.get(), std::memory_order_seq_cst);
+  migrating_shard_.store(-1, std::memory_order_seq_cst);
+  shard_epoch_.Synchronize();
+  migration_target_.store(nullptr, std::memory_order_seq_cst);
+  slot.owner = new_shard;
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::SetupEvictionChain() {
+  if (!tier_mutexes_) {
+    tier_mutexes_.reset(new std::mutex[tier_num_mutexes]);
+  }
+  std::function<void(const Key&, const Value&)> to_flash;
+  if (flash_tier_) {
+    to_flash = [this](const Key& key, const Value& value) {
+      flash_tier_->Append(key, value);
+    };
+  }
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    if (compressed_tiers_.empty()) {
+      shards_[i]->SetEvictionCallback(to_flash);
+      continue;
+    }
+    auto tier = compressed_tiers_[i].get();
+    tier->SetEvictionCallback(to_flash);
+    shards_[i]->SetEvictionCallback(
+        [tier](const Key& key, const Value& value) {
+          tier->Append(key, value);
+        });
+  }
 }
 
 template <class Key, class Value>
 double ConcurrentScalableCache<Key, Value>::get_size() {
   uint64_t size = 0;
+  auto guard = ProtectShards();
   for (uint32_t i = 0; i < num_shards_; i++) {
     size += shards_[i]->get_size();
   }
   return size;
 }
 
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::PrintTierRatio(
+    uint64_t total_hit, uint64_t total_miss, uint64_t compressed_hit,
+    uint64_t flash_hit) {
+  if (compressed_tiers_.empty() && !flash_tier_) {
+    return;
+  }
+  // Shard misses served by a lower tier don't go to the backend.
+  if (!compressed_tiers_.empty()) {
+    printf("compressed tier hit ratio: %.4lf, ",
+           total_miss ? 1.0 * compressed_hit / total_miss : 0.0);
+  }
+  if (flash_tier_) {
+    printf("flash tier hit ratio: %.4lf, ",
+           total_miss ? 1.0 * flash_hit / total_miss : 0.0);
+  }
+  uint64_t tier_hit = std::min(compressed_hit + flash_hit, total_miss);
+  printf("backend miss ratio: %.4lf\n",
+         1.0 * (total_miss - tier_hit) / (total_hit + total_miss));
+}
+
 template <class Key, class Value>
 void ConcurrentScalableCache<Key, Value>::PrintMissRatio() {
-  uint64_t total_hit = 0, total_miss = 0;
+  uint64_t total_hit = 0, total_miss = 0, total_l0_hit = 0;
+  uint64_t compressed_hit = 0, flash_hit = 0;
+  uint64_t skipped = 0, contended = 0;
   for (uint32_t i = 0; i < num_shards_; i++) {
-    uint64_t fast_cache_hit = 0, o_hit = 0, miss = 0;
-    shards_[i]->get_stats()->GetStat(fast_cache_hit, o_hit, miss);
-    total_hit += (fast_cache_hit + o_hit);
-    total_miss += miss;
+    // All the counts come from one delta, taken as the tickers start over.
+    auto delta = shards_[i]->get_stats()->GetStat();
+    total_l0_hit += delta[Tickers::L0_CACHE_HIT];
+    compressed_hit += delta[Tickers::COMPRESSED_TIER_HIT];
+    flash_hit += delta[Tickers::FLASH_TIER_HIT];
+    skipped += delta[Tickers::PROMOTION_SKIPPED];
+    contended += GetLockContended(delta);
+    // Hits served by the per-thread L0 cache are regular hits.
+    total_hit += delta[Tickers::FAST_CACHE_HIT] + delta[Tickers::CACHE_HIT] +
+                 delta[Tickers::L0_CACHE_HIT];
+    total_miss += delta[Tickers::CACHE_MISS];
   }
   double temp = 1;
   if (total_hit + total_miss != 0) {
     temp = 1.0 * total_miss / (total_hit + total_miss);
     printf("total miss ratio: %.4lf, hit num: %lu, miss num: %lu\n", temp,
            total_hit, total_miss);
+    if (l0_versions_) {
+      printf("l0 hit ratio: %.4lf, l0 hit num: %lu\n",
+             1.0 * total_l0_hit / (total_hit + total_miss), total_l0_hit);
+    }
+    PrintTierRatio(total_hit, total_miss, compressed_hit, flash_hit);
+    if (contended != 0) {
+      printf("contended shard locks: %lu, skipped promotions: %lu\n",
+             contended, skipped);
+    }
     fflush(stdout);
   }
 }
 
 template <class Key, class Value>
 void ConcurrentScalableCache<Key, Value>::PrintMissRatio(double& miss_ratio) {
-  uint64_t total_hit = 0, total_miss = 0;
+  uint64_t total_hit = 0, total_miss = 0, total_l0_hit = 0;
+  uint64_t compressed_hit = 0, flash_hit = 0;
+  uint64_t skipped = 0, contended = 0;
   for (uint32_t i = 0; i < num_shards_; i++) {
-    uint64_t fast_cache_hit = 0, o_hit = 0, miss = 0;
-    shards_[i]->get_stats()->GetStat(fast_cache_hit, o_hit, miss);
-    total_hit += (fast_cache_hit + o_hit);
-    total_miss += miss;
+    // All the counts come from one delta, taken as the tickers start over.
+    auto delta = shards_[i]->get_stats()->GetStat();
+    total_l0_hit += delta[Tickers::L0_CACHE_HIT];
+    compressed_hit += delta[Tickers::COMPRESSED_TIER_HIT];
+    flash_hit += delta[Tickers::FLASH_TIER_HIT];
+    skipped += delta[Tickers::PROMOTION_SKIPPED];
+    contended += GetLockContended(delta);
+    // Hits served by the per-thread L0 cache are regular hits.
+    total_hit += delta[Tickers::FAST_CACHE_HIT] + delta[Tickers::CACHE_HIT] +
+                 delta[Tickers::L0_CACHE_HIT];
+    total_miss += delta[Tickers::CACHE_MISS];
   }
   if (total_hit + total_miss != 0) {
     miss_ratio = 1.0 * total_miss / (total_hit + total_miss);
     printf("total miss ratio: %.4lf, hit num: %lu, miss num: %lu\n", miss_ratio,
            total_hit, total_miss);
+    if (l0_versions_) {
+      printf("l0 hit ratio: %.4lf, l0 hit num: %lu\n",
+             1.0 * total_l0_hit / (total_hit + total_miss), total_l0_hit);
+    }
+    PrintTierRatio(total_hit, total_miss, compressed_hit, flash_hit);
+    if (contended != 0) {
+      printf("contended shard locks: %lu, skipped promotions: %lu\n",
+             contended, skipped);
+    }
     fflush(stdout);
   }
 }
@@ -207,8 +1675,7 @@ void ConcurrentScalableCache<Key, Value>::PrintFrozenStat() {
 
 template <class Key, class Value>
 uint64_t ConcurrentScalableCache<Key, Value>::GetStepSize() {
-  return hit_latency_set.size_from_last_end() +
-         other_latency_set.size_from_last_end();
+  return hit_latency_set.StepSize() + other_latency_set.StepSize();
 }
 
 template <class Key, class Value>
@@ -216,9 +1683,13 @@ double ConcurrentScalableCache<Key, Value>::PrintStepLat() {
   uint64_t num_hit = 0, num_other = 0;
   auto curr_time = utils::NowMicros();
   printf(" -hit ");
-  auto avg_hit = hit_latency_set.print_from_last_end(num_hit);
+  auto hit_step = hit_latency_set.Step();
+  auto avg_hit = hit_step.Print();
+  num_hit = hit_step.count;
   printf(" -other ");
-  auto avg_other = other_latency_set.print_from_last_end(num_other);
+  auto other_step = other_latency_set.Step();
+  auto avg_other = other_step.Print();
+  num_other = other_step.count;
 
   auto total_num = num_hit + num_other;
   auto temp = (avg_hit * num_hit + avg_other * num_other) / total_num;
@@ -236,9 +1707,13 @@ double ConcurrentScalableCache<Key, Value>::PrintStepLat(uint64_t& total_num) {
   uint64_t num_hit = 0, num_other = 0;
   auto curr_time = utils::NowMicros();
   printf(" -hit ");
-  auto avg_hit = hit_latency_set.print_from_last_end(num_hit);
+  auto hit_step = hit_latency_set.Step();
+  auto avg_hit = hit_step.Print();
+  num_hit = hit_step.count;
   printf(" -other ");
-  auto avg_other = other_latency_set.print_from_last_end(num_other);
+  auto other_step = other_latency_set.Step();
+  auto avg_other = other_step.Print();
+  num_other = other_step.count;
 
   total_num = num_hit + num_other;
   auto temp = (avg_hit * num_hit + avg_other * num_other) / total_num;
@@ -257,9 +1732,13 @@ double ConcurrentScalableCache<Key, Value>::PrintStepLat(double& avg_hit,
   uint64_t num_hit = 0, num_other = 0;
   auto curr_time = utils::NowMicros();
   printf(" -hit ");
-  avg_hit = hit_latency_set.print_from_last_end(num_hit);
+  auto hit_step = hit_latency_set.Step();
+  avg_hit = hit_step.Print();
+  num_hit = hit_step.count;
   printf(" -other ");
-  avg_other = other_latency_set.print_from_last_end(num_other);
+  auto other_step = other_latency_set.Step();
+  avg_other = other_step.Print();
+  num_other = other_step.count;
 
   auto total_num = num_hit + num_other;
   auto temp = (avg_hit * num_hit + avg_other * num_other) / total_num;
@@ -276,9 +1755,13 @@ template <class Key, class Value>
 void ConcurrentScalableCache<Key, Value>::PrintGlobalLat() {
   size_t num_hit = 0, num_other = 0;
   printf(" -hit ");
-  auto avg_hit = hit_latency_set.print_tail(num_hit);
+  auto hit_total = hit_latency_set.Total();
+  auto avg_hit = hit_total.Print();
+  num_hit = hit_total.count;
   printf(" -other ");
-  auto avg_other = other_latency_set.print_tail(num_other);
+  auto other_total = other_latency_set.Total();
+  auto avg_other = other_total.Print();
+  num_other = other_total.count;
 
   auto total_num = num_hit + num_other;
   printf("total avg lat: %.3lf (size: %lu, miss ratio: %.6lf)\n",
@@ -287,8 +1770,8 @@ void ConcurrentScalableCache<Key, Value>::PrintGlobalLat() {
   fflush(stdout);
 
   time_cursor = utils::NowMicros();
-  hit_latency_set.reset();
-  other_latency_set.reset();
+  hit_latency_set.Reset();
+  other_latency_set.Reset();
 }
 
 template <class Key, class Value>
@@ -297,33 +1780,67 @@ void ConcurrentScalableCache<Key, Value>::PrintStatus() {
   for (uint32_t i = 0; i < num_shards_; i++) {
     shards_[i]->PrintStatus();
   }
+  for (auto& tier : compressed_tiers_) {
+    tier->PrintStatus();
+  }
+  if (flash_tier_) {
+    flash_tier_->PrintStatus();
+  }
+  PrintLockStat();
+#ifdef KVCACHE_PHASE_TIMERS
+  PhaseTimers::Print();
+#endif
 }
 
 template <class Key, class Value>
-void ConcurrentScalableCache<Key, Value>::Monitor() {
-  printf("start monitoring ...\n");
-  printf("wait stable interval: %d us (%.3lf s)\n",
-         wait_stable_sleep_interval_us,
-         1.0 * wait_stable_sleep_interval_us / 1000 / 1000);
+void ConcurrentScalableCache<Key, Value>::PrintLockStat() {
+  TickerSnapshot total;
+  utils::LatencyHistogram::Snapshot wait;
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    total += shards_[i]->get_stats()->Snapshot();
+    wait += shards_[i]->get_stats()->lock_wait().Total();
+  }
+  printf("shard locks:\n");
+  const std::tuple<const char*, Tickers, Tickers> locks[] = {
+      {"list", Tickers::LIST_LOCK_ACQUIRE, Tickers::LIST_LOCK_CONTENDED},
+      {"head segment", Tickers::HEAD_SEGMENT_LOCK_ACQUIRE,
+       Tickers::HEAD_SEGMENT_LOCK_CONTENDED},
+      {"tail segment", Tickers::TAIL_SEGMENT_LOCK_ACQUIRE,
+       Tickers::TAIL_SEGMENT_LOCK_CONTENDED}};
+  for (auto& [name, acquire, contended] : locks) {
+    if (total[acquire] + total[contended] == 0) {
+      continue;
+    }
+    printf("  %-12s acquired: %lu, contended: %lu\n", name, total[acquire],
+           total[contended]);
+  }
+  printf("  skipped promotions: %lu, wait: %.3lf s\n",
+         total[Tickers::PROMOTION_SKIPPED],
+         total[Tickers::LOCK_WAIT_NANOS] / 1e9);
+  printf("  wait latency: ");
+  wait.Print();
+}
 
-  auto start_wait_stable = utils::NowMicros();
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::WaitStable() {
   double last_miss_ratio = 1;
   double miss_ratio = 0;
   size_t last_size = 0, size = 0;
   uint32_t wait_count = 0;
 
-  // warm up
+  monitor_stage_ = "wait_stable";
   while (!should_stop_) {
     printf("\ndata pass %lu\n", print_step_counter++);
     PrintMissRatio(miss_ratio);
     PrintStepLat();
+    // The cache is full, and the miss ratio doesn't decrease any more.
     if (last_size >= size) {
       if (last_miss_ratio <= miss_ratio) {
         wait_count++;
       }
-      if (wait_count >= wait_stable_threshold) {
+      if (wait_count >= frozen_options_.wait_stable_threshold) {
         printf("- miss ratio = %.5lf -> %.5lf, with m_size = %lu (max = %lu)\n",
-               last_miss_ratio, miss_ratio, size, max_size_);
+               last_miss_ratio, miss_ratio, size, max_size_.load());
         fflush(stdout);
         break;
       }
@@ -331,11 +1848,23 @@ void ConcurrentScalableCache<Key, Value>::Monitor() {
     last_size = size;
     size = get_size();
     printf("- miss ratio = %.5lf -> %.5lf, with m_size = %lu (max = %lu)\n",
-           last_miss_ratio, miss_ratio, size, max_size_);
+           last_miss_ratio, miss_ratio, size, max_size_.load());
     fflush(stdout);
     last_miss_ratio = miss_ratio;
-    usleep(wait_stable_sleep_interval_us);
+    usleep(frozen_options_.wait_stable_interval_us);
   }
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::Monitor() {
+  printf("start monitoring ...\n");
+  printf("wait stable interval: %d us (%.3lf s)\n",
+         frozen_options_.wait_stable_interval_us,
+         1.0 * frozen_options_.wait_stable_interval_us / 1000 / 1000);
+
+  auto start_wait_stable = utils::NowMicros();
+  // warm up
+  WaitStable();
 
   printf("\nfirst wait stable\n");
   printf("clear stat for next stage:\n");
@@ -345,395 +1874,472 @@ void ConcurrentScalableCache<Key, Value>::Monitor() {
   printf("\nwait stable spend time: %lf s\n",
          1.0 * wait_stable_duration / 1000 / 1000);
 
+  monitor_stage_ = "monitor";
   while (!should_stop_) {
     printf("\ndata pass %lu\n", print_step_counter++);
     sleep(1);
     PrintMissRatio();
+    PrintMrc();
+    CheckPolicy();
     PrintStepLat();
   }
+  monitor_stage_ = "stopped";
   return;
 }
 
-// template <class Key, class Value>
-// void ConcurrentScalableCache<Key, Value>::FrozenMonitor() {
-//   printf("start monitoring ...\n");
-//   printf("wait stable internal: %d us (%.1lf s)\n",
-//          wait_stable_sleep_interval_us,
-//          wait_stable_sleep_interval_us * 1.0 / 1000 / 1000);
-//   printf("add fast performance threshold %.2lf for construction & frozen\n",
-//          fast_performance_threshold);
-
-// WAIT_STABLE:
-//   auto start_wait_stable_time = utils::NowMicros();
-//   double last_miss_ratio = 1, miss_ratio = 0;
-
-//   double performance = 0;
-//   size_t throughput_step = 0;
-//   size_t last_size = 0, size = 0;
-//   stop_sample_stat = true;
-//   int wait_count = 0;
-
-//   printf("\n* start observation *\n");
-//   while (!should_stop_) {
-//     printf("data pass %lu\n", print_step_counter++);
-//     PrintMissRatio(miss_ratio);
-//     PrintStepLat();
-
-//     if (last_size >= size) {                // Cache is full
-//       if (last_miss_ratio <= miss_ratio) {  // The miss ratio is
-//       non-decreasing
-//         wait_count++;
-//         if (wait_count >=
-//             wait_stable_threshold) {  // Waiting too long, stop filling
-//             process
-//           printf("miss ratio = %.5lf -> %.5lf, with m_size = %lu (max =
-//           %lu)\n",
-//                  last_miss_ratio, miss_ratio, size, max_size_);
-//           fflush(stdout);
-//           break;
-//         }
-//       }
-//     }
-
-//     // Update size & miss ratio
-//     last_size = size;
-//     size = get_size();
-//     printf("- miss ratio = %.5lf -> %.5lf, with m_size = %lu (max = %lu)\n",
-//            last_miss_ratio, miss_ratio, size, max_size_);
-//     fflush(stdout);
-//     last_miss_ratio = miss_ratio;  // Update miss ratio
-//     usleep(wait_stable_sleep_interval_us);
-//   }
-//   printf("\ncache is stable\n");
-
-//   // Message for end filling
-//   if (beginning_flag_) {
-//     printf("first wait stable && clear stat for next stage\n");
-//     PrintGlobalLat();
-//     beginning_flag_ = false;
-//   }
-
-//   // cache is stable
-//   printf("wait stable spend time: %.4lf s\n",
-//          1.0 * (utils::NowMicros() - start_wait_stable_time) / 1e6);
-
-//   printf("end observation\n");
-
-//   printf("start to search\n");
-//   auto start_search_time = utils::NowMicros();
-
-//   // Get curve
-//   if (!should_stop_) {
-//     shards_[0]->GetCurve(should_stop_);
-//   }
-
-//   // calculate optimal fast_cache's size ratio
-//   double best_avg = 1000, best_size = 0;
-//   double FC_hit_lat = 0, DC_hit_lat = 0, miss_lat = 0, disk_lat = 0;
-//   double frozen_avg = 0, frozen_miss = 0, best_option_miss = 0;
-
-//   while (other_latency_set.size_from_last_end() < 5 && !should_stop_) {
-//     usleep(wait_stable_sleep_interval_us);
-//   }
-//   printf("draw curve\n");
-//   printf("data pass %lu\n", print_step_counter++);
-
-//   PrintMissRatio();
-
-//   // become aware of DC hit latency and DC miss lat + disk latency
-//   PrintStepLat(DC_hit_lat, miss_lat);
-
-//   // first do 100% FC
-//   for (uint32_t i = 0; i < num_shards_; i++) {
-//     shards_[i]->ConstructTier();
-//   }
-
-//   PrintMissRatio();  // clear stat
-//   PrintStepLat();    // clear latency
-
-//   usleep(wait_stable_sleep_interval_us);
-//   printf("data pass %lu\n", print_step_counter++);
-
-//   // get one endpoint of FC miss ratio in curve -- when 100% FC but not used
-//   // (only printed)
-//   frozen_miss = PrintMissRatio();
-
-//   // become awaare of FC latency and disk latency
-//   frozen_avg = PrintStepLat(FC_hit_lat, disk_lat);
-//   for (uint32_t i = 0; i < num_shards_; i++) {
-//     shards_[i]->DeleteFastCache();
-//   }
-
-//   printf("FC hit lat: %.3lf us, frozen avg: %.3lf us, frozen miss: %.3lf\n",
-//          FC_hit_lat, frozen_avg, frozen_miss);
-//   fflush(stdout);
-
-//   // calculate the best FC size ratio
-//   auto container = shards_[0]->get_container();
-//   for (int i = 0; i < container.size(); i++) {
-//     auto t_size = container[i].size;
-//     auto t_FC_hit = container[i].FC_hit;
-//     auto t_miss = container[i].miss;
-//     double avg = 0;
-
-//     if (t_size < 0.01) {
-//       avg = t_miss * miss_lat + (1 - t_miss) * DC_hit_lat;
-//       t_size = 0;
-//       printf("when baseline, avg from %.3lf to %.3lf\n", avg,
-//              avg / (1 + fast_performance_threshold));
-//       avg = avg / (1 + fast_performance_threshold);
-//     } else {
-//       // when t_size is large, we regard it as 100% FC
-//       if (i == container.size() - 1 && t_size > 0.65) {
-//         printf("regard t_size from %.3lf to %d\n", t_size, 1);
-//         t_size = 1;
-//       }
-//       avg = t_FC_hit * FC_hit_lat + t_miss * (miss_lat + FC_hit_lat) +
-//             (1 - t_FC_hit - t_miss) * (FC_hit_lat + DC_hit_lat);
-//     }
-
-//     if (avg < best_avg) {
-//       best_avg = avg;
-//       best_size = t_size;
-//       best_option_miss = t_miss;
-//       printf(
-//           "(update) best avg: %.31f us, best size: %3.1f (w. FC_hit: %3.1f, "
-//           "miss: %3.1f)\n",
-//           best_avg, best_size, t_FC_hit, best_option_miss);
-//     }
-//   }
-
-//   // Compare best "partially" frozen [0, 100%) with 100% Frozen
-//   if (best_avg > frozen_avg) {
-//     printf("(update) best avg: %.31f us, best size: %3.1f\n",
-//     frozen_avg, 1.0); best_avg = frozen_avg; best_size = 1.0;
-//   }
-
-//   shards_[0]->get_container().clear();
-//   printf("\n search spend time: %lf s\n",
-//          1.0 * (utils::NowMicros() - start_search_time) / 1e6);
-//   printf("profiling best size: %.3lf\n", best_size);
-
-//   printf("end search\n");
-
-//   if (!should_stop_ && best_size < 0.05 /* 0.05 is a magic number*/) {
-//     // not suitable for fast cache.
-//     sleep_threshold *= 8;  // 8 is a magic number
-//     printf("sleep threshold increase to %u\n", sleep_threshold);
-//     printf("sleep %u s\n", sleep_threshold);
-//     fflush(stdout);
-//     for (int i = 0; i < sleep_threshold; i++) {
-//       if (should_stop_) break;
-//       sleep(1);
-//       printf("data pass %lu\n", print_step_counter++);
-//       PrintMissRatio();
-//       PrintStepLat();
-//     }
-//     if (!should_stop_) goto WAIT_STABLE;
-//   }
-
-// CONSTRUCT:
-//   auto start_construct_time = utils::NowMicros();
-//   printf("start construct fast cache\n");
-//   request_latency_set.reset();
-
-//   printf("find median avg lat of baseline:");
-//   while (!should_stop_ && GetStepSize() < 100) {
-//     sleep(1);
-//   }
-//   printf("data pass %lu\n", print_step_counter++);
-//   PrintMissRatio();
-
-//   uint64_t construct_step = 0;
-//   baseline_performance = PrintStepLat(construct_step);
-//   double baseline_performance_with_threshold =
-//       baseline_performance / (1 + fast_performance_threshold);
-
-//   printf("FC compare with baseline metric: %.3lf\n", baseline_performance);
-//   printf("FC compare with baseline metric with threshould: %.3lf\n",
-//          baseline_performance_with_threshold);
-
-//   // enable request_latency_set
-//   stop_sample_stat = false;
-
-//   usleep(wait_stable_sleep_interval_us);
-//   double baseline_metric = request_latency_set.print_tail();
-
-//   // call the construct function for each shard
-//   for(uint32_t i = 0; i <
-//   if (double_is_equal(best_size, 1)) {
-//     shard_->ConstructTier();
-//   } else {
-//     shard_->ConstructFastCache(best_size);
-//   }
-//   shard_->get_stats()->ResetCursor();
-//   request_latency_set.reset();
-
-//   printf("try query\n");
-//   fflush(stdout);
-//   double monitor_time = 500;
-//   usleep(monitor_time);
-
-//   // check if it is not suitable for FH and DeleteFastCache
-//   shard_->get_stats()->PrintStep();
-//   performance = request_latency_set.print_tail();
-
-//   // If the latency is larger than the baseline plus threshold, then
-//   // DeleteFastCache(fail)
-//   uint32_t pass_count = 0;
-//   bool failed = false;
-//   while (!should_stop_ && !failed) {
-//     if (pass_count >= pass_threshold) {
-//       break;
-//     }
-
-//     if (performance > baseline_metric / (1 + fast_performance_threshold)) {
-//       shard_->DeleteFastCache();
-//       request_latency_set.reset();
-//       usleep(monitor_time);
-//       printf("baseline metric (update):\n");
-//       baseline_metric = request_latency_set.print_tail();
-//       failed = true;
-//     }
-
-//     printf("pass %d end\n", pass_count++);
-//     fflush(stdout);
-
-//     printf("data pass %lu\n", print_step_counter++);
-//     PrintMissRatio();
-//     uint64_t temp_step = 0;
-//     PrintStepLat(temp_step);
-//     construct_step += temp_step;
-//   }
-
-//   printf("construct step: %lu\n", construct_step);
-//   if (failed) {
-//     goto WAIT_STABLE;
-//   }
-
-//   printf("construct time:%lf s\n",
-//          1.0 * (utils::NowMicros() - start_construct_time) / (1e6));
-//   printf("end construct\n");
-
-//   // disable request_latency_set
-//   stop_sample_stat = true;
-
-//   // start of frozen run after construction, and monitor it.
-//   auto start_query_time = utils::NowMicros();
-//   printf("start frozen\n");
-
-//   double check_time = check_sleep_internal_us;
-//   printf("check interval: %.3lf\n", check_time / (1e6));
-
-//   double performance_depletion = drop_threshold;
-//   bool first_flag = true;
-//   uint64_t sum_step = 0;
-//   uint64_t now_step = 0;
-
-//   uint64_t baseline_step = 0;
-//   uint64_t temp_step = 0;
-//   while (!should_stop_) {
-//     do {
-//       usleep(check_time);
-//     } while (GetStepSize() < 50 && !should_stop_);
-
-//     printf("data pass %lu\n", print_step_counter++);
-//     PrintFrozenStat();
-//     performance = PrintStepLat(temp_step);
-//     if (first_flag) {
-//       baseline_step = temp_step;
-//       first_flag = false;
-//     }
-
-//     auto delta = (baseline_performance_with_threshold - performance) /
-//                  baseline_performance_with_threshold * temp_step /
-//                  baseline_step;
-//     performance_depletion += delta;
-
-//     if (performance_depletion <= 0) {
-//       printf("depleted: %.3lf <= 0\n", performance_depletion);
-//       sleep_threshold *= 8;
-//       printf("sleep threshold increase to %u\n", sleep_threshold);
-//       goto DECONSTRUCT;
-//     } else {
-//       printf("not depleted: %.31f > 0\n", performance_depletion);
-//     }
-
-//     sum_step += temp_step;
-//     now_step += temp_step;
-
-//     if (sum_step > construct_step * frozen_threshold) {
-//       // periodic reconstruction of FH
-//       printf(
-//           "after %lu frozen step (> %d * %lu = %lu), need periodlically "
-//           "refresh!\n",
-//           sum_step, frozen_threshold, construct_step,
-//           construct_step * frozen_threshold);
-//       shard_->DeleteFastCache();
-
-//       sleep(1);
-
-//       if (sleep_threshold >= 2) sleep_threshold /= 2;
-//       printf("perform well, sleep threshold decrease into %u\n",
-//              sleep_threshold);
-//       goto CONSTRUCT;
-//     } else if (now_step > construct_step) {
-//       // this is a round to check whether need to deconstruct. If
-//       // performance_depletion > drop_threshold, it means fast cache still
-//       // outperforms baseline.
-//       //
-//       // so we can continue to run fast cache, but need to reset
-//       // performance_depletion to drop_threshold.
-//       //
-//       // or we will not be able to beaware of the performance degradation
-//       till
-//       // deplete all benefits.
-//       if (performance_depletion > drop_threshold) {
-//         printf("performance depletion set to %d after %lu step for a
-//         round!\n",
-//                drop_threshold, now_step);
-//         performance = drop_threshold;
-//         now_step = 0;
-//       } else {
-//         printf("after %lu frozen step (~ %lu * %lu), need to refresh!\n",
-//                sum_step, sum_step / construct_step, construct_step);
-//         shard_->DeleteFastCache();
-//         sleep(1);
-//         goto CONSTRUCT;
-//       }
-//     }
-//     fflush(stdout);
-//   }
-
-// DECONSTRUCT:
-//   printf("frozen duration time: %lf\n",
-//          1.0 * (utils::NowMicros() - start_query_time) / 1e6);
-//   shard_->DeleteFastCache();
-//   printf("end frozen\n");
-
-//   if (!should_stop_) {
-//     printf("sleep: %u s\n", sleep_threshold);
-//     fflush(stdout);
-//     for (int i = 0; i < sleep_threshold; i++) {
-//       sleep(1);
-//       printf("data pass: %lu\n", print_step_counter++);
-//       PrintMissRatio();
-//       PrintStepLat();
-
-//       if (should_stop_) break;
-//     }
-//   }
-
-//   if (!should_stop_) {
-//     printf("go back to wait stable\n");
-//     goto WAIT_STABLE;
-//   }
-//   printf("end mointor\n");
-// }
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::FrozenMonitor() {
+  printf("start frozen monitoring ...\n");
+  printf("wait stable interval: %d us (%.3lf s)\n",
+         frozen_options_.wait_stable_interval_us,
+         1.0 * frozen_options_.wait_stable_interval_us / 1000 / 1000);
+  printf("add fast performance threshold %.2lf for construction & frozen\n",
+         frozen_options_.gain_threshold);
+  // At most 'budget' shards go through a transition in a pass, so the fast
+  // cache is never rebuilt or dropped by all shards at once.
+  const uint32_t budget = std::max<uint32_t>(
+      1, frozen_options_.transition_fraction * num_shards_);
+  printf("transitions per pass: %u of %u shards\n", budget, num_shards_);
+
+  stop_sample_stat = true;
+  frozen_shards_.assign(num_shards_, FrozenShard(frozen_options_));
+  uint32_t backoff_s = frozen_options_.backoff_s;
+  while (!should_stop_) {
+    auto start_time = utils::NowMicros();
+    printf("\n* start observation *\n");
+    WaitStable();
+    printf("\ncache is stable\n");
+    if (beginning_flag_) {
+      printf("first wait stable && clear stat for next stage\n");
+      PrintGlobalLat();
+      beginning_flag_ = false;
+    }
+    printf("wait stable spend time: %.4lf s\n",
+           1.0 * (utils::NowMicros() - start_time) / 1e6);
+    if (should_stop_ || CalibrateFrozen()) {
+      break;
+    }
+    backoff_s = std::min(backoff_s * frozen_options_.backoff_factor,
+                         frozen_options_.max_backoff_s);
+    LogFrozenDecision("calibrate", {{"backoff_s", 1.0 * backoff_s}});
+    SleepAndWatch(backoff_s);
+  }
+
+  // Every shard starts by searching its ratio, 'budget' shards a pass.
+  uint32_t cursor = 0;
+  std::vector<uint32_t> refreshed;
+  double last_avg = 0;
+  monitor_stage_ = "frozen";
+  PublishShardStates();
+  while (!should_stop_) {
+    do {
+      usleep(frozen_options_.check_interval_us);
+    } while (GetStepSize() < 50 && !should_stop_);
+    if (should_stop_) {
+      break;
+    }
+
+    printf("\ndata pass %lu\n", print_step_counter++);
+    uint64_t total_fc_hit = 0, total_o_hit = 0, total_miss = 0;
+    uint32_t num_frozen = 0;
+    for (uint32_t i = 0; i < num_shards_; i++) {
+      uint64_t fast_cache_hit = 0, o_hit = 0, miss = 0;
+      auto stats = shards_[i]->get_stats();
+      stats->GetStep(fast_cache_hit, o_hit, miss);
+      stats->ResetCursor();
+      total_fc_hit += fast_cache_hit;
+      total_o_hit += o_hit;
+      total_miss += miss;
+      if (frozen_shards_[i].state == FrozenState::FROZEN) {
+        CheckFrozenShard(i, fast_cache_hit, o_hit, miss);
+        num_frozen++;
+      }
+    }
+    uint64_t total = total_fc_hit + total_o_hit + total_miss;
+    printf("fast cache hit: %lu, o hit: %lu, miss: %lu (frozen shards: %u)\n",
+           total_fc_hit, total_o_hit, total_miss, num_frozen);
+    uint64_t step = 0;
+    auto avg = PrintStepLat(step);
+
+    // The cost of a refresh is the latency it added to the requests of the
+    // next pass, against the pass before it.
+    if (!refreshed.empty() && step > 0) {
+      double cost = (avg - last_avg) * total / refreshed.size();
+      for (auto id : refreshed) {
+        frozen_shards_[id].model.ObserveRefreshCost(cost);
+      }
+    }
+    refreshed.clear();
+    last_avg = avg;
+
+    auto now = utils::NowMicros();
+    std::vector<uint32_t> batch;
+    for (uint32_t k = 0; k < num_shards_; k++) {
+      auto id = (cursor + k) % num_shards_;
+      auto& shard = frozen_shards_[id];
+      if (shard.state == FrozenState::WAIT_STABLE &&
+          now >= shard.wake_time_us) {
+        shard.state = FrozenState::SEARCH;
+      }
+      if (shard.state != FrozenState::WAIT_STABLE &&
+          shard.state != FrozenState::FROZEN && batch.size() < budget) {
+        batch.push_back(id);
+      }
+    }
+    // Shards left out of this pass go first in the next one.
+    if (!batch.empty()) {
+      cursor = (batch.back() + 1) % num_shards_;
+    }
+    RunTransitions(batch, refreshed);
+    PublishShardStates();
+    fflush(stdout);
+  }
+
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    shards_[i]->DeleteFastCache();
+  }
+  monitor_stage_ = "stopped";
+  printf("\nend frozen monitoring\n");
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::SleepAndWatch(uint32_t seconds) {
+  printf("sleep %u s\n", seconds);
+  fflush(stdout);
+  monitor_stage_ = "backoff";
+  for (uint32_t i = 0; i < seconds && !should_stop_; i++) {
+    sleep(1);
+    printf("\ndata pass %lu\n", print_step_counter++);
+    PrintMissRatio();
+    PrintStepLat();
+  }
+}
+
+template <class Key, class Value>
+bool ConcurrentScalableCache<Key, Value>::CalibrateFrozen() {
+  printf("\n* start calibration *\n");
+  auto start_time = utils::NowMicros();
+  monitor_stage_ = "calibrate";
+
+  // Latencies of the baseline: hits and misses (with the backend).
+  double dc_hit_lat = 0, miss_lat = 0;
+  do {
+    usleep(frozen_options_.wait_stable_interval_us);
+  } while (other_latency_set.StepSize() < 5 && !should_stop_);
+  printf("\ndata pass %lu\n", print_step_counter++);
+  PrintMissRatio();
+  PrintStepLat(dc_hit_lat, miss_lat);
+
+  // Fast cache hits are measured with a fraction of the shards 100% frozen,
+  // as their transitions are.
+  const uint32_t budget = std::max<uint32_t>(
+      1, frozen_options_.transition_fraction * num_shards_);
+  std::vector<uint32_t> frozen;
+  for (uint32_t i = 0; i < num_shards_ && frozen.size() < budget; i++) {
+    if (shards_[i]->ConstructTier()) {
+      frozen.push_back(i);
+    }
+  }
+  if (frozen.empty()) {
+    printf("shards don't support the fast cache\n");
+    return false;
+  }
+  printf("\ndata pass %lu\n", print_step_counter++);
+  PrintMissRatio();
+  PrintStepLat();
+  usleep(frozen_options_.wait_stable_interval_us);
+  printf("\ndata pass %lu\n", print_step_counter++);
+  uint64_t total_fc_hit = 0, total_o_hit = 0;
+  for (uint32_t i = 0; i < num_shards_; i++) {
+    uint64_t fast_cache_hit = 0, o_hit = 0, miss = 0;
+    shards_[i]->get_stats()->GetStat(fast_cache_hit, o_hit, miss);
+    total_fc_hit += fast_cache_hit;
+    total_o_hit += o_hit;
+  }
+  double avg_hit = 0, avg_other = 0;
+  PrintStepLat(avg_hit, avg_other);
+  for (auto id : frozen) {
+    shards_[id]->DeleteFastCache();
+  }
+  if (total_fc_hit == 0) {
+    printf("no fast cache hit\n");
+    return false;
+  }
+
+  // Hits are fast cache hits of the frozen shards, and dynamic cache hits.
+  double fc_hit_lat =
+      std::max((avg_hit * (total_fc_hit + total_o_hit) -
+                dc_hit_lat * total_o_hit) / total_fc_hit,
+               0.0);
+  for (auto& shard : frozen_shards_) {
+    shard.model.ObserveBaseline(dc_hit_lat, miss_lat);
+    shard.model.ObserveFastCacheHit(fc_hit_lat);
+  }
+  printf("FC hit lat: %.3lf us, DC hit lat: %.3lf us, miss lat: %.3lf us\n",
+         fc_hit_lat, dc_hit_lat, miss_lat);
+  LogFrozenDecision("calibrate", {{"fc_hit_lat_us", fc_hit_lat},
+                                  {"dc_hit_lat_us", dc_hit_lat},
+                                  {"miss_lat_us", miss_lat},
+                                  {"frozen_shards", 1.0 * frozen.size()}});
+  printf("calibration spend time: %lf s\n",
+         1.0 * (utils::NowMicros() - start_time) / 1e6);
+  printf("\n* end calibration *\n");
+  fflush(stdout);
+  return true;
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::RunTransitions(
+    const std::vector<uint32_t>& batch, std::vector<uint32_t>& refreshed) {
+  std::vector<uint32_t> searching;
+  for (auto id : batch) {
+    auto& shard = frozen_shards_[id];
+    switch (shard.state) {
+      case FrozenState::SEARCH:
+        searching.push_back(id);
+        break;
+
+      case FrozenState::CONSTRUCT:
+        FreezeShard(id, "construct");
+        break;
+
+      case FrozenState::REFRESH:
+        FreezeShard(id, "refresh");
+        if (shard.state == FrozenState::FROZEN) {
+          refreshed.push_back(id);
+        }
+        break;
+
+      case FrozenState::DECONSTRUCT:
+        shards_[id]->DeleteFastCache();
+        BackOff(id, "deconstruct");
+        break;
+
+      default:
+        break;
+    }
+  }
+  if (!searching.empty()) {
+    SearchShards(searching);
+  }
+  // The next pass only tells the cost of a refresh if nothing else changed.
+  if (refreshed.size() != batch.size()) {
+    refreshed.clear();
+  }
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::SearchShards(
+    const std::vector<uint32_t>& ids) {
+  printf("\n* start search *\n");
+  auto start_time = utils::NowMicros();
+
+  // Every shard profiles its own curve, on its own keys.
+  std::vector<char> profiled(ids.size(), false);
+  std::vector<std::thread> threads;
+  for (size_t k = 0; k < ids.size(); k++) {
+    threads.emplace_back([this, &ids, &profiled, k]() {
+      profiled[k] =
+          shards_[ids[k]]->GetCurve(frozen_options_, should_stop_);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (size_t k = 0; k < ids.size(); k++) {
+    auto id = ids[k];
+    auto& shard = frozen_shards_[id];
+    auto& container = shards_[id]->get_container();
+    double best_avg = 0;
+    shard.ratio =
+        profiled[k] ? shard.model.ChooseRatio(container, 0, best_avg) : 0;
+    shard.baseline_miss = container.empty() ? 1 : container[0].miss;
+    container.clear();
+    // 'GetCurve' moved the cursor of the shard.
+    shards_[id]->get_stats()->ResetCursor();
+
+    printf("shard %u best size: %.3lf\n", id, shard.ratio);
+    LogFrozenDecision("search", {{"shard", 1.0 * id},
+                                 {"ratio", shard.ratio},
+                                 {"predicted_avg_us", best_avg},
+                                 {"baseline_miss", shard.baseline_miss}});
+    if (shard.ratio < frozen_options_.min_ratio) {
+      // Not suitable for the fast cache, so wait longer and longer.
+      BackOff(id, "search");
+    } else {
+      shard.state = FrozenState::CONSTRUCT;
+    }
+  }
+
+  printf("\nsearch %lu shards in %lf s\n", ids.size(),
+         1.0 * (utils::NowMicros() - start_time) / 1e6);
+  printf("\n* end search *\n");
+  fflush(stdout);
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::FreezeShard(uint32_t id,
+                                                      const char* event) {
+  auto& shard = frozen_shards_[id];
+  auto start_time = utils::NowMicros();
+  // A refresh builds the next generation while the last one still serves,
+  // and replaces it at once.
+  bool frozen = double_is_equal(shard.ratio, 1)
+                    ? shards_[id]->ConstructTier()
+                    : shards_[id]->ConstructFastCache(shard.ratio);
+  auto duration = utils::NowMicros() - start_time;
+  if (!frozen) {
+    BackOff(id, event);
+    return;
+  }
+  if (shard.state == FrozenState::REFRESH && shard.backoff_s >= 2) {
+    // The last fast cache lasted, so back off less after the next failure.
+    shard.backoff_s /= 2;
+  }
+  shard.state = FrozenState::FROZEN;
+  shard.depletion = frozen_options_.drop_threshold;
+  shard.num_passes = 0;
+  shard.total_step = shard.round_step = shard.construct_step = 0;
+  shard.model.StartFrozen();
+  shard.hit_change.Reset();
+  if (!phase_detectors_.empty()) {
+    phase_detectors_[id]->Reset();
+  }
+  // Only requests with the fast cache count for the first pass.
+  shards_[id]->get_stats()->ResetCursor();
+  LogFrozenDecision(event, {{"shard", 1.0 * id},
+                            {"ratio", shard.ratio},
+                            {"duration_us", 1.0 * duration},
+                            {"refresh_cost_us", shard.model.refresh_cost()}});
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::CheckFrozenShard(
+    uint32_t id, uint64_t fast_cache_hit, uint64_t o_hit, uint64_t miss) {
+  auto& shard = frozen_shards_[id];
+  uint64_t step = fast_cache_hit + o_hit + miss;
+  if (step == 0) {
+    return;
+  }
+  double fc_hit_ratio = 1.0 * fast_cache_hit / step;
+  double miss_ratio = 1.0 * miss / step;
+  // The first 'construct_passes' passes of a construction are the first
+  // round, whose length is kept for the next ones.
+  bool first_round = ++shard.num_passes <= frozen_options_.construct_passes;
+  if (first_round) {
+    shard.construct_step += step;
+  }
+  shard.total_step += step;
+  shard.round_step += step;
+  shard.model.ObserveFrozenPass(shard.total_step, fc_hit_ratio);
+
+  // The benefit over the baseline of the shard, both predicted from its hit
+  // ratios, is integrated over its requests, starting with a capital of
+  // 'drop_threshold' rounds. The fast cache is dropped once it is depleted.
+  double baseline = shard.model.BaselineLatency(shard.baseline_miss) /
+                    (1 + frozen_options_.gain_threshold);
+  double performance = shard.model.FrozenLatency(fc_hit_ratio, miss_ratio);
+  if (baseline > 0) {
+    shard.depletion += (baseline - performance) / baseline * step /
+                       shard.construct_step;
+  }
+  if (shard.depletion <= 0) {
+    LogFrozenDecision("drop", {{"shard", 1.0 * id},
+                               {"total_step", 1.0 * shard.total_step},
+                               {"fc_hit_ratio", fc_hit_ratio},
+                               {"depletion", shard.depletion}});
+    shard.state = FrozenState::DECONSTRUCT;
+    return;
+  }
+
+  // The lifetime is chosen again with every pass, as the decay of this
+  // construction is fitted.
+  auto lifetime = shard.model.ChooseLifetime(shard.construct_step);
+  bool refresh = shard.total_step > lifetime;
+  if (!refresh && !first_round && shard.round_step > shard.construct_step) {
+    // A round is over. If the fast cache still beats the baseline, the
+    // capital is reset, so that a later degradation is noticed before all of
+    // the benefit is depleted. Otherwise, it is refreshed.
+    refresh = shard.depletion <= frozen_options_.drop_threshold;
+    shard.depletion = std::min(shard.depletion, frozen_options_.drop_threshold);
+    shard.round_step = 0;
+  }
+  // Writes wear the fast cache out, even if it still pays off.
+  auto invalidations = shards_[id]->get_fast_cache_invalidations();
+  if (invalidations > frozen_options_.invalidation_budget *
+                          shards_[id]->get_fast_cache_size()) {
+    refresh = true;
+  }
+  // A shift of the workload makes the frozen keys stale before the fitted
+  // decay does: the popularity of the keys moved away from the one after the
+  // construction, or the fast cache hit ratio fell at once. Both start over
+  // with every construction.
+  double distance =
+      phase_detectors_.empty() ? -1 : phase_detectors_[id]->Distance();
+  bool fall = !first_round && shard.hit_change.Observe(fc_hit_ratio);
+  if (!refresh &&
+      (fall || distance > frozen_options_.phase_distance_threshold)) {
+    LogFrozenDecision("phase_shift", {{"shard", 1.0 * id},
+                                      {"total_step", 1.0 * shard.total_step},
+                                      {"fc_hit_ratio", fc_hit_ratio},
+                                      {"distance", distance},
+                                      {"hit_fall", fall ? 1.0 : 0.0}});
+    refresh = true;
+  }
+  if (refresh) {
+    LogFrozenDecision("refresh_due",
+                      {{"shard", 1.0 * id},
+                       {"total_step", 1.0 * shard.total_step},
+                       {"lifetime", 1.0 * lifetime},
+                       {"fc_hit_ratio", fc_hit_ratio},
+                       {"depletion", shard.depletion},
+                       {"decay_rate", shard.model.decay_rate()},
+                       {"invalidations", 1.0 * invalidations}});
+    shard.state = FrozenState::REFRESH;
+  }
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::BackOff(uint32_t id,
+                                                  const char* reason) {
+  auto& shard = frozen_shards_[id];
+  shard.backoff_s = std::min(shard.backoff_s * frozen_options_.backoff_factor,
+                             frozen_options_.max_backoff_s);
+  shard.wake_time_us = utils::NowMicros() + shard.backoff_s * 1000000ull;
+  shard.state = FrozenState::WAIT_STABLE;
+  LogFrozenDecision(reason, {{"shard", 1.0 * id},
+                             {"backoff_s", 1.0 * shard.backoff_s}});
+}
+
+template <class Key, class Value>
+void ConcurrentScalableCache<Key, Value>::LogFrozenDecision(
+    const char* event,
+    std::initializer_list<std::pair<const char*, double>> fields) {
+  printf("frozen_decision {\"time_us\": %lu, \"event\": \"%s\"",
+         utils::NowMicros(), event);
+  for (auto& field : fields) {
+    printf(", \"%s\": %.6g", field.first, field.second);
+  }
+  printf("}\n");
+  fflush(stdout);
+}
 
 template <class Key, class Value>
 void ConcurrentScalableCache<Key, Value>::Stop() {
+  std::unique_lock resize_lock(resize_mtx_);
   should_stop_ = true;
+  resize_cv_.notify_one();
+  resize_lock.unlock();
+  if (resize_thread_.joinable()) {
+    resize_thread_.join();
+  }
+  std::unique_lock metrics_lock(metrics_mtx_);
+  metrics_cv_.notify_one();
+  metrics_lock.unlock();
+  if (metrics_thread_.joinable()) {
+    metrics_thread_.join();
+  }
 }
 
 }  // namespace kvcache
@@ -0,0 +1,128 @@
+#include "scalable_cache.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using LocalCache = kvcache::ConcurrentScalableCache<uint64_t, uint64_t>;
+
+// The tests run on node 0, and the odd keys have their home on node 1.
+const std::vector<int> local_nodes = {0, 1};
+
+TEST(ScalableCacheTest, LocalPolicyCopiesReadMostlyKeys) {
+  LocalCache cache(1024, 4, kvcache::CacheType::LRU,
+                   kvcache::NumaPolicy::LOCAL, local_nodes);
+  ASSERT_EQ(2, cache.GetNodeShards(0).size());
+  ASSERT_EQ(2, cache.GetNodeShards(1).size());
+
+  uint64_t value = 0;
+  ASSERT_TRUE(cache.Insert(1, 10));
+  ASSERT_TRUE(cache.Insert(2, 20));
+  for (uint32_t i = 0; i < kvcache::replica_min_reads; i++) {
+    ASSERT_TRUE(cache.Lookup(1, value));
+    ASSERT_EQ(10, value);
+    ASSERT_EQ(2, cache.get_size());
+  }
+  // Read often enough, the key is copied to node 0.
+  ASSERT_TRUE(cache.Lookup(1, value));
+  ASSERT_EQ(10, value);
+  ASSERT_EQ(3, cache.get_size());
+  ASSERT_TRUE(cache.Lookup(1, value));
+  ASSERT_EQ(10, value);
+
+  // A key of node 0 is never copied.
+  for (uint32_t i = 0; i < 2 * kvcache::replica_min_reads; i++) {
+    ASSERT_TRUE(cache.Lookup(2, value));
+    ASSERT_EQ(20, value);
+  }
+  ASSERT_EQ(3, cache.get_size());
+
+  // A write drops the copy, and the key has to be read again to be copied.
+  cache.Insert(1, 11);
+  ASSERT_EQ(2, cache.get_size());
+  ASSERT_TRUE(cache.Lookup(1, value));
+  ASSERT_EQ(11, value);
+  ASSERT_EQ(2, cache.get_size());
+  for (uint32_t i = 0; i < kvcache::replica_min_reads; i++) {
+    ASSERT_TRUE(cache.Lookup(1, value));
+  }
+  ASSERT_EQ(3, cache.get_size());
+
+  cache.Erase(1);
+  ASSERT_FALSE(cache.Lookup(1, value));
+  ASSERT_EQ(1, cache.get_size());
+}
+
+TEST(ScalableCacheTest, LocalPolicyCountsReadsPerKey) {
+  LocalCache cache(1024, 4, kvcache::CacheType::LRU,
+                   kvcache::NumaPolicy::LOCAL, local_nodes);
+  // Both keys are on node 1, in the same stripe.
+  const uint64_t hot = 1;
+  const uint64_t cold = hot + 2 * kvcache::replica_num_stripes;
+  uint64_t value = 0;
+  ASSERT_TRUE(cache.Insert(hot, 10));
+  ASSERT_TRUE(cache.Insert(cold, 20));
+  for (uint32_t i = 0; i < 4 * kvcache::replica_min_reads; i++) {
+    ASSERT_TRUE(cache.Lookup(hot, value));
+  }
+  ASSERT_EQ(3, cache.get_size());
+  // The reads of the hot key don't count for the cold one.
+  ASSERT_TRUE(cache.Lookup(cold, value));
+  ASSERT_EQ(20, value);
+  ASSERT_EQ(3, cache.get_size());
+}
+
+TEST(ScalableCacheTest, LocalPolicyCopiesNeverOutliveWrites) {
+  LocalCache cache(1024, 4, kvcache::CacheType::LRU,
+                   kvcache::NumaPolicy::LOCAL, local_nodes);
+  const uint64_t num_keys = 8;
+  const uint64_t num_writes = 5000;
+  // The last value of every key whose write has returned.
+  std::vector<std::atomic<uint64_t>> written(num_keys);
+  for (uint64_t key = 0; key < num_keys; key++) {
+    cache.Insert(key, 0);
+  }
+
+  std::atomic<bool> stop = false;
+  std::atomic<uint64_t> stale = 0;
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 3; i++) {
+    readers.emplace_back([&, i] {
+      uint64_t key = i;
+      while (!stop.load()) {
+        key = (key + 1) % num_keys;
+        auto expected = written[key].load();
+        uint64_t value = 0;
+        if (!cache.Lookup(key, value) || value < expected) {
+          stale++;
+        }
+      }
+    });
+  }
+  for (uint64_t i = 1; i <= num_writes; i++) {
+    auto key = i % num_keys;
+    cache.Insert(key, i);
+    written[key] = i;
+    if (i % 64 == 0) {
+      std::this_thread::yield();
+    }
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  ASSERT_EQ(0, stale.load());
+
+  for (uint64_t key = 0; key < num_keys; key++) {
+    uint64_t value = 0;
+    ASSERT_TRUE(cache.Lookup(key, value));
+    ASSERT_EQ(written[key].load(), value);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -11,6 +11,7 @@
 
 #include "cache.h"
 #include "options.h"
+#include "phase_timer.h"
 #include "tbb/concurrent_hash_map.h"
 
 namespace kvcache {
@@ -27,8 +28,11 @@ namespace kvcache {
 //
 // A const_accessor is simliar, except that is represents read-only access.
 // Multiple const_accessors can point to the same element at the same time.
+//
+// 'NumSlotsPerSegment' is only changed by scaled-down simulations of the
+// cache, e.g. the shadows of the adaptive policy.
 
-template <class Key, class Value>
+template <class Key, class Value, uint64_t NumSlotsPerSegment = 65536>
 class SegmentCache : public Cache<Key, Value> {
  private:
   struct Entry;
@@ -66,7 +70,9 @@ class SegmentCache : public Cache<Key, Value> {
   // 32768
   // 65536
   // 131072
-  constexpr static uint64_t kNumSlotsPerSegment = 65536;
+  constexpr static uint64_t kNumSlotsPerSegment = NumSlotsPerSegment;
+
+  constexpr static uint32_t kMaxEvictionsPerInsert = 2;
 
   struct Segment {
     Slot slot_array[kNumSlotsPerSegment];
@@ -96,15 +102,22 @@ class SegmentCache : public Cache<Key, Value> {
   };
 
   struct SegmentList {
-    std::mutex head_segment_mtx;
+    CountedMutex head_segment_mtx;
     std::atomic<Segment*> head_segment;
 
-    std::mutex tail_segment_mtx;
+    CountedMutex tail_segment_mtx;
     std::atomic<Segment*> tail_segment;
 
     std::atomic<uint64_t> count;
 
-    SegmentList() : head_segment(nullptr), tail_segment(nullptr), count(0) {
+    explicit SegmentList(Statistics* stats)
+        : head_segment_mtx(stats, Tickers::HEAD_SEGMENT_LOCK_ACQUIRE,
+                           Tickers::HEAD_SEGMENT_LOCK_CONTENDED),
+          head_segment(nullptr),
+          tail_segment_mtx(stats, Tickers::TAIL_SEGMENT_LOCK_ACQUIRE,
+                           Tickers::TAIL_SEGMENT_LOCK_CONTENDED),
+          tail_segment(nullptr),
+          count(0) {
       auto segment = new Segment();
       head_segment.store(segment);
       tail_segment.store(segment);
@@ -157,8 +170,11 @@ class SegmentCache : public Cache<Key, Value> {
 
   virtual bool Lookup(Key key, Value& value) override {
     bool stat_yes = Cache<Key, Value>::sample_generator();
+    PHASE_TIMER_START(timer);
     HashMapConstAccessor const_accessor;
-    if (hash_map_.find(const_accessor, key)) {
+    bool found = hash_map_.find(const_accessor, key);
+    PHASE_TIMER_RECORD(timer, LOOKUP_PROBE);
+    if (found) {
       auto entry = const_accessor->second;
       value = entry->value;
       if (entry->belong != segment_list_.head_segment.load()) {
@@ -167,6 +183,7 @@ class SegmentCache : public Cache<Key, Value> {
         entry->refs++;
         uint32_t old_version = entry->version++;
         segment_list_.Add(entry, old_version + 1);
+        PHASE_TIMER_RECORD(timer, LOOKUP_LIST_UPDATE);
       }
       if (stat_yes) {
         Cache<Key, Value>::stats.RecordTick(Tickers::CACHE_HIT);
@@ -185,6 +202,7 @@ class SegmentCache : public Cache<Key, Value> {
       Cache<Key, Value>::stats.RecordTick(Tickers::INSERT);
     }
 
+    PHASE_TIMER_START(timer);
     HashMapAccessor accessor;
     auto entry = new Entry();
     entry->key = key;
@@ -193,10 +211,13 @@ class SegmentCache : public Cache<Key, Value> {
     entry->belong = segment_list_.head_segment.load();
     entry->charge = 1;
     entry->refs = 1;  // referred by hash_map
+    PHASE_TIMER_RECORD(timer, INSERT_ALLOC);
 
     // Add into hash_table
     HashMapValuePair value_pair(key, entry);
-    if (!hash_map_.insert(accessor, value_pair)) {
+    bool inserted = hash_map_.insert(accessor, value_pair);
+    PHASE_TIMER_RECORD(timer, INSERT_PROBE);
+    if (!inserted) {
       // Update the value
       accessor->second->value = value;
       delete entry;
@@ -207,17 +228,27 @@ class SegmentCache : public Cache<Key, Value> {
     segment_list_.Add(entry, entry->version.load());
     usage_.fetch_add(entry->charge);
     accessor.release();
-
-    while (usage_.load() > capacity_) {
-      EvictOne();
+    PHASE_TIMER_RECORD(timer, INSERT_LIST_UPDATE);
+
+    // Evict a bounded number of segments, so that a shrunk capacity doesn't
+    // turn a single insert into a stop-the-world eviction loop. The rest is
+    // left to 'EvictBatch'.
+    for (uint32_t i = 0; i < kMaxEvictionsPerInsert; i++) {
+      if (usage_.load() <= capacity_.load() || !EvictOne()) {
+        break;
+      }
+      PHASE_TIMER_RECORD(timer, INSERT_EVICT);
     }
 
     return true;
   }
 
   virtual bool Erase(Key key) override {
+    PHASE_TIMER_START(timer);
     HashMapAccessor accessor;
-    if (!hash_map_.find(accessor, key)) {
+    bool found = hash_map_.find(accessor, key);
+    PHASE_TIMER_RECORD(timer, ERASE_PROBE);
+    if (!found) {
       return false;
     }
 
@@ -241,11 +272,64 @@ class SegmentCache : public Cache<Key, Value> {
     return usage >= capacity_;
   }
 
+  virtual void SetCapacity(uint64_t capacity) override {
+    capacity_.store(capacity);
+  }
+
+  // Segments are evicted as a whole, so the batch may exceed 'max_num' by up
+  // to one segment.
+  virtual uint64_t EvictBatch(uint64_t max_num) override {
+    uint64_t start_usage = usage_.load();
+    uint64_t count = 0;
+    while (count < max_num && usage_.load() > capacity_.load()) {
+      if (!EvictOne()) {
+        break;
+      }
+      uint64_t usage = usage_.load();
+      count = start_usage > usage ? start_usage - usage : 0;
+    }
+    return count;
+  }
+
+  // Segments are walked from the head, and slots from the last one, so the
+  // most recent version of each entry is visited first. Eviction is blocked
+  // during the walk by holding the tail lock.
+  virtual void ForEachEntry(
+      const std::function<void(const Key&, const Value&)>& func) override {
+    std::unique_lock tail_lock(segment_list_.tail_segment_mtx);
+    auto tail = segment_list_.tail_segment.load();
+    for (auto segment = segment_list_.head_segment.load(); segment != nullptr;
+         segment = segment->next) {
+      uint64_t used = std::min<uint64_t>(segment->used.load(),
+                                         kNumSlotsPerSegment);
+      for (uint64_t i = used; i-- > 0;) {
+        auto& slot = segment->slot_array[i];
+        // A slot is published by its version, 0 means it is being filled.
+        auto slot_version = slot.version.load();
+        auto entry = slot.entry;
+        if (slot_version == 0 || entry->version.load() != slot_version) {
+          continue;
+        }
+        HashMapConstAccessor const_accessor;
+        if (hash_map_.find(const_accessor, entry->key) &&
+            const_accessor->second == entry) {
+          func(entry->key, entry->value);
+        }
+      }
+      if (segment == tail) {
+        break;
+      }
+    }
+  }
+
  private:
-  void EvictOne() {
+  // The probes of all the entries of the evicted segment are timed as one.
+  bool EvictOne() {
+    PHASE_TIMER_START(timer);
     auto segment = segment_list_.Evict();
+    PHASE_TIMER_RECORD(timer, EVICT_LIST_UPDATE);
     // printf("evict segment number: %d\n", segment->number);
-    if (!segment) return;
+    if (!segment) return false;
 
     for (uint64_t i = 0; i < kNumSlotsPerSegment; i++) {
       auto entry = segment->slot_array[i].entry;
@@ -264,13 +348,18 @@ class SegmentCache : public Cache<Key, Value> {
           // The entry is exclusively occupied, so there won't be any readers
           // accessing it. And, we remove it from hash_map.
           assert(entry->refs.load() > 1);
+          if (Cache<Key, Value>::eviction_callback_) {
+            Cache<Key, Value>::eviction_callback_(entry->key, entry->value);
+          }
           entry->refs--;
           hash_map_.erase(accessor);
         }
       }
       TryFreeEntry(entry);
     }
+    PHASE_TIMER_RECORD(timer, EVICT_PROBE);
     delete segment;
+    return true;
   }
 
   void TryFreeEntry(Entry* entry) {
@@ -284,10 +373,10 @@ class SegmentCache : public Cache<Key, Value> {
   }
 
  private:
-  SegmentList segment_list_;
+  SegmentList segment_list_{Cache<Key, Value>::get_stats()};
   HashMap hash_map_;
 
-  const uint64_t capacity_;
+  std::atomic<uint64_t> capacity_;
   std::atomic<uint64_t> usage_;
 };
 
@@ -0,0 +1,131 @@
+#ifndef KVCACHE_SHADOW_SIMULATOR_H
+#define KVCACHE_SHADOW_SIMULATOR_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache.h"
+#include "utils.h"
+
+namespace kvcache {
+
+// ShadowSimulator runs scaled-down copies of several eviction policies on the
+// same request stream, to tell which one would have the lowest miss ratio.
+//
+// Like SHARDS, only keys whose hash is a multiple of 'sample_ratio' are
+// simulated, so every request to a sampled key is seen, and a shadow of
+// 'capacity / sample_ratio' entries behaves like the full cache. Shadows only
+// keep keys, and a missed lookup fills the shadow as a client would.
+//
+// As SHARDS-adj does, misses are divided by the expected number of sampled
+// requests rather than the actual one, which is skewed by whether the hottest
+// keys are in the sample. The difference would be hits in any policy.
+
+template <class Key>
+class ShadowSimulator {
+ private:
+  constexpr static uint32_t kNumCounterSlots = 64;
+
+  struct alignas(64) Counter {
+    std::atomic<uint64_t> count{0};
+  };
+
+ public:
+  using Shadow = Cache<Key, uint8_t>;
+
+  explicit ShadowSimulator(uint32_t sample_ratio)
+      : sample_ratio_(sample_ratio),
+        counters_(new Counter[kNumCounterSlots]) {}
+  ShadowSimulator(const ShadowSimulator&) = delete;
+  ShadowSimulator& operator=(const ShadowSimulator&) = delete;
+
+  uint32_t get_sample_ratio() const { return sample_ratio_; }
+
+  // Add a policy simulated by 'shadow', whose capacity is already scaled
+  // down, and return its index. It must be called before any request.
+  uint32_t AddPolicy(const std::string& name, std::unique_ptr<Shadow> shadow) {
+    policies_.emplace_back(new Policy{name, std::move(shadow)});
+    return policies_.size() - 1;
+  }
+
+  uint32_t get_num_policies() const { return policies_.size(); }
+
+  const std::string& get_name(uint32_t index) const {
+    return policies_[index]->name;
+  }
+
+  void Access(const Key& key) {
+    static thread_local uint32_t slot =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) %
+        kNumCounterSlots;
+    counters_[slot].count.fetch_add(1, std::memory_order_relaxed);
+    // The high half of the hash, so that the sample is independent of the
+    // one of the MRC profiler.
+    if ((utils::Mix64(std::hash<Key>()(key)) >> 32) % sample_ratio_ != 0) {
+      return;
+    }
+    uint8_t value = 0;
+    for (auto& policy : policies_) {
+      if (policy->shadow->Lookup(key, value)) {
+        policy->hits.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        policy->misses.fetch_add(1, std::memory_order_relaxed);
+        policy->shadow->Insert(key, 1);
+      }
+    }
+  }
+
+  // Set the capacity of the full cache. Shadows evict their extra entries
+  // right away, since they are small.
+  void SetCapacity(uint64_t capacity) {
+    for (auto& policy : policies_) {
+      policy->shadow->SetCapacity(capacity / sample_ratio_);
+      while (policy->shadow->EvictBatch(1024) > 0) {
+      }
+    }
+  }
+
+  // Get the miss ratio of every policy since the last call, and return the
+  // number of sampled requests.
+  uint64_t GetWindow(std::vector<double>& miss_ratios) {
+    uint64_t total = 0, num_samples = 0;
+    for (uint32_t i = 0; i < kNumCounterSlots; i++) {
+      total += counters_[i].count.exchange(0);
+    }
+    double expected = 1.0 * total / sample_ratio_;
+    miss_ratios.clear();
+    for (auto& policy : policies_) {
+      auto hits = policy->hits.exchange(0);
+      auto misses = policy->misses.exchange(0);
+      num_samples = std::max(num_samples, hits + misses);
+      miss_ratios.push_back(
+          std::min(1.0 * misses / std::max(expected, 1.0), 1.0));
+    }
+    return num_samples;
+  }
+
+ private:
+  struct Policy {
+    std::string name;
+    std::unique_ptr<Shadow> shadow;
+    alignas(64) std::atomic<uint64_t> hits{0};
+    alignas(64) std::atomic<uint64_t> misses{0};
+  };
+
+  const uint32_t sample_ratio_;
+  std::vector<std::unique_ptr<Policy>> policies_;
+
+  // All requests, sampled or not, counted in padded per-thread slots.
+  std::unique_ptr<Counter[]> counters_;
+};
+
+}  // namespace kvcache
+
+#endif
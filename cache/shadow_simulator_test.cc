@@ -0,0 +1,211 @@
+#include "shadow_simulator.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fifo_cache.h"
+#include "gtest/gtest.h"
+#include "lru_cache.h"
+#include "scalable_cache.h"
+
+// Skewed keys: key 'k' is about twice as likely as key '2k'.
+static std::vector<uint64_t> MakeTrace(uint64_t num_requests) {
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<uint64_t> trace;
+  for (uint64_t i = 0; i < num_requests; i++) {
+    auto u = uniform(rng);
+    trace.push_back(static_cast<uint64_t>(100000 * u * u * u));
+  }
+  return trace;
+}
+
+static double SimulateLru(const std::vector<uint64_t>& trace,
+                          uint64_t capacity) {
+  kvcache::LruCache<uint64_t, uint64_t> cache(capacity);
+  uint64_t misses = 0, value = 0;
+  for (auto key : trace) {
+    if (!cache.Lookup(key, value)) {
+      misses++;
+      cache.Insert(key, key);
+    }
+  }
+  return 1.0 * misses / trace.size();
+}
+
+TEST(ShadowSimulatorTest, ScaledMissRatio) {
+  const uint64_t capacity = 20000;
+  const uint32_t ratio = 16;
+  auto trace = MakeTrace(1000000);
+  kvcache::ShadowSimulator<uint64_t> simulator(ratio);
+  simulator.AddPolicy(
+      "lru",
+      std::make_unique<kvcache::LruCache<uint64_t, uint8_t>>(capacity / ratio));
+  simulator.AddPolicy("fifo",
+                      std::make_unique<kvcache::FifoCache<uint64_t, uint8_t>>(
+                          capacity / ratio));
+  for (auto key : trace) {
+    simulator.Access(key);
+  }
+
+  std::vector<double> miss_ratios;
+  auto num_samples = simulator.GetWindow(miss_ratios);
+  ASSERT_NEAR(1.0 * trace.size() / ratio, num_samples,
+              0.5 * trace.size() / ratio);
+  ASSERT_EQ(2, miss_ratios.size());
+  ASSERT_NEAR(SimulateLru(trace, capacity), miss_ratios[0], 0.03);
+  // LRU keeps the hot keys of a skewed trace better than FIFO.
+  ASSERT_LT(miss_ratios[0], miss_ratios[1]);
+
+  // The window is reset.
+  ASSERT_EQ(0, simulator.GetWindow(miss_ratios));
+}
+
+TEST(ShadowSimulatorTest, SwitchPolicyKeepsEntries) {
+  const uint64_t num_keys = 2000;
+  const uint32_t num_writers = 2;
+  kvcache::ConcurrentScalableCache<uint64_t, uint64_t> cache(
+      num_keys, 2, kvcache::CacheType::FIFO);
+  ASSERT_TRUE(cache.EnableAdaptivePolicy());
+  for (uint64_t key = 0; key < num_keys; key++) {
+    cache.Insert(key, key);
+  }
+
+  // Every writer owns the keys 'key % num_writers == id', and updates them
+  // while the shards are migrated.
+  std::atomic<bool> stop{false};
+  std::vector<std::vector<uint64_t>> latest(num_writers);
+  std::vector<std::thread> writers;
+  for (uint32_t id = 0; id < num_writers; id++) {
+    writers.emplace_back([&, id]() {
+      std::vector<uint64_t> values(num_keys);
+      uint64_t round = 0;
+      while (!stop.load()) {
+        round++;
+        for (uint64_t key = id; key < num_keys; key += num_writers) {
+          values[key] = key + round * num_keys;
+          cache.Insert(key, values[key]);
+        }
+      }
+      latest[id] = values;
+    });
+  }
+
+  for (auto type : {kvcache::CacheType::LRU, kvcache::CacheType::SEGMENT,
+                    kvcache::CacheType::FIFO}) {
+    cache.SwitchPolicy(type);
+    ASSERT_EQ(type, cache.get_type());
+  }
+  stop = true;
+  for (auto& writer : writers) {
+    writer.join();
+  }
+
+  uint64_t value = 0, num_found = 0;
+  for (uint64_t key = 0; key < num_keys; key++) {
+    if (cache.Lookup(key, value)) {
+      ASSERT_EQ(latest[key % num_writers][key], value);
+      num_found++;
+    }
+  }
+  ASSERT_GT(num_found, num_keys / 2);
+}
+
+TEST(ShadowSimulatorTest, SwitchPolicyUnderReaders) {
+  const uint64_t num_keys = 2000;
+  kvcache::ConcurrentScalableCache<uint64_t, uint64_t> cache(
+      num_keys, 4, kvcache::CacheType::LRU);
+  ASSERT_TRUE(cache.EnableAdaptivePolicy());
+  for (uint64_t key = 0; key < num_keys; key++) {
+    cache.Insert(key, key);
+  }
+
+  // The readers keep using the shards while they are migrated and freed,
+  // and always find the value of the key.
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> errors{0};
+  std::vector<std::thread> readers;
+  for (uint32_t id = 0; id < 2; id++) {
+    readers.emplace_back([&, id]() {
+      uint64_t value = 0;
+      for (uint64_t i = id; !stop.load(); i++) {
+        auto key = i % num_keys;
+        if (cache.Lookup(key, value) && value != key) {
+          errors++;
+        }
+      }
+    });
+  }
+  for (int i = 0; i < 10; i++) {
+    for (auto type : {kvcache::CacheType::FIFO, kvcache::CacheType::SEGMENT,
+                      kvcache::CacheType::LRU}) {
+      cache.SwitchPolicy(type);
+    }
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  ASSERT_EQ(0, errors.load());
+  ASSERT_EQ(num_keys, cache.get_size());
+}
+
+TEST(ShadowSimulatorTest, SwitchPolicyNeverReadsOlderWrites) {
+  const uint64_t num_keys = 512;
+  kvcache::ConcurrentScalableCache<uint64_t, uint64_t> cache(
+      num_keys * 2, 2, kvcache::CacheType::LRU);
+  ASSERT_TRUE(cache.EnableAdaptivePolicy());
+  // The last value of every key whose write has returned.
+  std::vector<std::atomic<uint64_t>> written(num_keys);
+  for (uint64_t key = 0; key < num_keys; key++) {
+    cache.Insert(key, 0);
+  }
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> stale{0};
+  std::thread writer([&]() {
+    for (uint64_t i = 1; !stop.load(); i++) {
+      auto key = i % num_keys;
+      cache.Insert(key, i);
+      written[key] = i;
+    }
+  });
+  std::thread reader([&]() {
+    uint64_t value = 0;
+    for (uint64_t i = 0; !stop.load(); i++) {
+      auto key = i % num_keys;
+      auto expected = written[key].load();
+      if (cache.Lookup(key, value) && value < expected) {
+        stale++;
+      }
+    }
+  });
+  for (int i = 0; i < 5; i++) {
+    for (auto type : {kvcache::CacheType::FIFO, kvcache::CacheType::SEGMENT,
+                      kvcache::CacheType::LRU}) {
+      cache.SwitchPolicy(type);
+    }
+  }
+  stop = true;
+  writer.join();
+  reader.join();
+  ASSERT_EQ(0, stale.load());
+
+  // The writes after the last switch are all there.
+  uint64_t value = 0;
+  for (uint64_t key = 0; key < num_keys; key++) {
+    cache.Insert(key, key);
+  }
+  cache.SwitchPolicy(kvcache::CacheType::FIFO);
+  for (uint64_t key = 0; key < num_keys; key++) {
+    ASSERT_TRUE(cache.Lookup(key, value));
+    ASSERT_EQ(key, value);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,94 @@
+#ifndef KVCACHE_SNAPSHOT_H
+#define KVCACHE_SNAPSHOT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace kvcache {
+
+// Layout of a snapshot file:
+//
+//   SnapshotHeader
+//   SnapshotShardInfo[num_shards]
+//   records of shard 0, records of shard 1, ...
+//
+// Records of a shard are written from the most to the least recently used
+// entry, and each record is 'key | rank (uint32) | value length (uint32) |
+// value bytes'. The rank is the position of the record in its shard, so a
+// snapshot can be loaded into a cache with a different number of shards while
+// keeping the (approximate) global recency order.
+
+constexpr char kSnapshotMagic[8] = {'K', 'V', 'C', 'S', 'N', 'A', 'P', '1'};
+constexpr uint32_t kSnapshotVersion = 1;
+
+// A value length that is followed by no bytes, e.g. for a null pointer.
+constexpr uint32_t kSnapshotNullLength = UINT32_MAX;
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_shards;
+  uint32_t key_size;
+  uint32_t reserved;
+  uint64_t num_entries;
+};
+
+struct SnapshotShardInfo {
+  uint64_t offset;  // from the beginning of the file
+  uint64_t size;    // in bytes
+  uint64_t num_entries;
+};
+
+// Encode/decode values into snapshot records. Specialize it for other value
+// types.
+template <class Value, class Enable = void>
+struct SnapshotCodec;
+
+template <class Value>
+struct SnapshotCodec<Value,
+                     std::enable_if_t<std::is_trivially_copyable_v<Value>>> {
+  static void Encode(const Value& value, std::string& out) {
+    uint32_t len = sizeof(Value);
+    out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    out.append(reinterpret_cast<const char*>(&value), sizeof(Value));
+  }
+
+  static bool Decode(const char* data, uint32_t len, Value& value) {
+    if (len != sizeof(Value)) {
+      return false;
+    }
+    memcpy(&value, data, sizeof(Value));
+    return true;
+  }
+};
+
+// A null pointer is encoded with the length 'kSnapshotNullLength'.
+template <>
+struct SnapshotCodec<std::shared_ptr<std::string>> {
+  static void Encode(const std::shared_ptr<std::string>& value,
+                     std::string& out) {
+    uint32_t len = value ? value->size() : kSnapshotNullLength;
+    out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    if (value) {
+      out.append(*value);
+    }
+  }
+
+  static bool Decode(const char* data, uint32_t len,
+                     std::shared_ptr<std::string>& value) {
+    if (len == kSnapshotNullLength) {
+      value.reset();
+    } else {
+      value = std::make_shared<std::string>(data, len);
+    }
+    return true;
+  }
+};
+
+}  // namespace kvcache
+
+#endif
@@ -0,0 +1,87 @@
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "scalable_cache.h"
+
+using kvcache::CacheType;
+using StringCache =
+    kvcache::ConcurrentScalableCache<uint64_t, std::shared_ptr<std::string>>;
+
+class SnapshotTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = "/tmp/kvcache_snapshot_test." + std::to_string(getpid());
+  }
+
+  void TearDown() override { unlink(path_.c_str()); }
+
+  std::string path_;
+};
+
+TEST_F(SnapshotTest, SaveAndLoad) {
+  StringCache cache(400, 4, CacheType::LRU);
+  for (uint64_t i = 0; i < 400; i++) {
+    cache.Insert(i, std::make_shared<std::string>("v" + std::to_string(i)));
+  }
+  cache.Insert(7, nullptr);
+  ASSERT_TRUE(cache.SaveSnapshot(path_));
+
+  StringCache loaded(400, 4, CacheType::LRU);
+  ASSERT_TRUE(loaded.LoadSnapshot(path_));
+  ASSERT_EQ(400, loaded.get_size());
+
+  std::shared_ptr<std::string> value;
+  ASSERT_TRUE(loaded.Lookup(123, value));
+  ASSERT_EQ("v123", *value);
+  ASSERT_TRUE(loaded.Lookup(7, value));
+  ASSERT_EQ(nullptr, value);
+}
+
+TEST_F(SnapshotTest, KeepRecencyAcrossShardCounts) {
+  kvcache::ConcurrentScalableCache<uint64_t, uint64_t> cache(
+      400, 4, CacheType::LRU);
+  for (uint64_t i = 0; i < 400; i++) {
+    cache.Insert(i, i);
+  }
+  // The lower half becomes more recently used than the upper half.
+  uint64_t value = 0;
+  for (uint64_t i = 0; i < 200; i++) {
+    ASSERT_TRUE(cache.Lookup(i, value));
+  }
+  ASSERT_TRUE(cache.SaveSnapshot(path_));
+
+  // Loaded into a smaller cache with a different number of shards, only the
+  // most recently used half survives.
+  for (auto type : {CacheType::LRU, CacheType::FIFO, CacheType::COMPACT_LRU}) {
+    kvcache::ConcurrentScalableCache<uint64_t, uint64_t> loaded(200, 2, type);
+    ASSERT_TRUE(loaded.LoadSnapshot(path_));
+    ASSERT_EQ(200, loaded.get_size());
+    for (uint64_t i = 0; i < 200; i++) {
+      ASSERT_TRUE(loaded.Lookup(i, value));
+      ASSERT_EQ(i, value);
+    }
+  }
+}
+
+TEST_F(SnapshotTest, RejectInvalidFile) {
+  kvcache::ConcurrentScalableCache<uint64_t, uint64_t> cache(
+      100, 2, CacheType::LRU);
+  ASSERT_FALSE(cache.LoadSnapshot(path_));
+
+  FILE* file = fopen(path_.c_str(), "w");
+  fputs("not a snapshot file at all", file);
+  fclose(file);
+  ASSERT_FALSE(cache.LoadSnapshot(path_));
+  ASSERT_EQ(0, cache.get_size());
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
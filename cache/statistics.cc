@@ -10,54 +10,106 @@ const std::vector<std::pair<Tickers, std::string>> TickersNameMap = {
     {FAST_CACHE_HIT, "fast.cache.hit"},
     {CACHE_HIT, "cache.hit"},
     {CACHE_MISS, "cache.miss"},
-    {INSERT, "insert"}};
+    {INSERT, "insert"},
+    {L0_CACHE_HIT, "l0.cache.hit"},
+    {FLASH_TIER_HIT, "flash.tier.hit"},
+    {FLASH_TIER_MISS, "flash.tier.miss"},
+    {COMPRESSED_TIER_HIT, "compressed.tier.hit"},
+    {FROZEN_INVALIDATE, "frozen.invalidate"},
+    {LIST_LOCK_ACQUIRE, "list.lock.acquire"},
+    {LIST_LOCK_CONTENDED, "list.lock.contended"},
+    {HEAD_SEGMENT_LOCK_ACQUIRE, "head.segment.lock.acquire"},
+    {HEAD_SEGMENT_LOCK_CONTENDED, "head.segment.lock.contended"},
+    {TAIL_SEGMENT_LOCK_ACQUIRE, "tail.segment.lock.acquire"},
+    {TAIL_SEGMENT_LOCK_CONTENDED, "tail.segment.lock.contended"},
+    {LOCK_WAIT_NANOS, "lock.wait.nanos"},
+    {PROMOTION_SKIPPED, "promotion.skipped"}};
+
+std::atomic<uint32_t> Statistics::next_slot_{0};
+
+Statistics::Statistics() : slots_(new Slot[kNumSlots]) {
+  for (uint32_t i = 0; i < kNumSlots; i++) {
+    for (auto& ticker : slots_[i].tickers) {
+      ticker.store(0, std::memory_order_relaxed);
+    }
+  }
+}
 
-uint64_t Statistics::GetTickerCount(Tickers ticker_type) const {
-  return tickers_[static_cast<int>(ticker_type)].load();
+TickerSnapshot Statistics::Snapshot() const {
+  TickerSnapshot snapshot;
+  for (uint32_t i = 0; i < kNumSlots; i++) {
+    for (int t = 0; t < (int)Tickers::TICKER_ENUM_MAX; t++) {
+      snapshot.tickers[t] +=
+          slots_[i].tickers[t].load(std::memory_order_relaxed);
+    }
+  }
+  return snapshot;
 }
 
-void Statistics::RecordTick(Tickers ticker_type, uint64_t count) {
-  tickers_[static_cast<int>(ticker_type)].fetch_add(count);
+uint64_t Statistics::GetTickerCount(Tickers ticker_type) const {
+  uint64_t count = 0;
+  for (uint32_t i = 0; i < kNumSlots; i++) {
+    count += slots_[i].tickers[ticker_type].load(std::memory_order_relaxed);
+  }
+  std::lock_guard<std::mutex> lock(mtx_);
+  return count - base_[ticker_type];
 }
 
 void Statistics::SetTickerCount(Tickers ticker_type, uint64_t count) {
-  tickers_[static_cast<int>(ticker_type)].store(count);
+  uint64_t current = 0;
+  for (uint32_t i = 0; i < kNumSlots; i++) {
+    current += slots_[i].tickers[ticker_type].load(std::memory_order_relaxed);
+  }
+  std::lock_guard<std::mutex> lock(mtx_);
+  base_.tickers[ticker_type] = current - count;
 }
 
 void Statistics::ResetStat() {
-  for (int i = 0; i < (int)Tickers::TICKER_ENUM_MAX; i++) {
-    tickers_[i] = 0;
-    cursors_[i] = 0;
-  }
+  auto snapshot = Snapshot();
+  std::lock_guard<std::mutex> lock(mtx_);
+  base_ = cursor_ = snapshot;
 }
 
 void Statistics::PrintStat() {}
 
+TickerSnapshot Statistics::GetStat() {
+  auto snapshot = Snapshot();
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto delta = snapshot - base_;
+  base_ = cursor_ = snapshot;
+  return delta;
+}
+
 void Statistics::GetStat(uint64_t& fast_cache_hit, uint64_t& o_hit,
                          uint64_t& miss) {
-  fast_cache_hit = tickers_[Tickers::FAST_CACHE_HIT].load();
-  o_hit = tickers_[Tickers::CACHE_HIT].load();
-  miss = tickers_[Tickers::CACHE_MISS].load();
-  ResetStat();
+  auto delta = GetStat();
+  fast_cache_hit = delta[Tickers::FAST_CACHE_HIT];
+  // Hits served by the per-thread L0 cache are regular hits.
+  o_hit = delta[Tickers::CACHE_HIT] + delta[Tickers::L0_CACHE_HIT];
+  miss = delta[Tickers::CACHE_MISS];
 }
 
 void Statistics::GetAndPrintStat(uint64_t& fast_cache_hit, uint64_t& o_hit,
                                  uint64_t& miss) {}
 
 void Statistics::ResetCursor() {
-  for (int i = 0; i < (int)Tickers::TICKER_ENUM_MAX; i++) {
-    cursors_[i] = tickers_[i].load();
-  }
+  auto snapshot = Snapshot();
+  std::lock_guard<std::mutex> lock(mtx_);
+  cursor_ = snapshot;
+}
+
+TickerSnapshot Statistics::GetStepDelta() const {
+  auto snapshot = Snapshot();
+  std::lock_guard<std::mutex> lock(mtx_);
+  return snapshot - cursor_;
 }
 
 void Statistics::PrintStep() {
-  auto t_fast_cache_hit = tickers_[Tickers::FAST_CACHE_HIT].load() -
-                          cursors_[Tickers::FAST_CACHE_HIT];
-  auto t_o_hit =
-      tickers_[Tickers::CACHE_HIT].load() - cursors_[Tickers::CACHE_HIT];
-  auto t_miss =
-      tickers_[Tickers::CACHE_MISS].load() - cursors_[Tickers::CACHE_MISS];
-  auto t_insert = tickers_[Tickers::INSERT].load() - cursors_[Tickers::INSERT];
+  auto delta = GetStepDelta();
+  auto t_fast_cache_hit = delta[Tickers::FAST_CACHE_HIT];
+  auto t_o_hit = delta[Tickers::CACHE_HIT];
+  auto t_miss = delta[Tickers::CACHE_MISS];
+  auto t_insert = delta[Tickers::INSERT];
 
   double total = t_fast_cache_hit + t_o_hit + t_insert;
   double temp = 0, global_miss = 0;
@@ -77,13 +129,10 @@ void Statistics::PrintStep() {
 }
 
 void Statistics::GetStep(double& FC_hit_ratio, double& miss_ratio) {
-  auto t_fast_cache_hit = tickers_[Tickers::FAST_CACHE_HIT].load() -
-                          cursors_[Tickers::FAST_CACHE_HIT];
-  auto t_o_hit =
-      tickers_[Tickers::CACHE_HIT].load() - cursors_[Tickers::CACHE_HIT];
-  // auto t_miss =
-  //     tickers_[Tickers::CACHE_MISS].load() - cursors_[Tickers::CACHE_MISS];
-  auto t_insert = tickers_[Tickers::INSERT].load() - cursors_[Tickers::INSERT];
+  auto delta = GetStepDelta();
+  auto t_fast_cache_hit = delta[Tickers::FAST_CACHE_HIT];
+  auto t_o_hit = delta[Tickers::CACHE_HIT];
+  auto t_insert = delta[Tickers::INSERT];
 
   uint64_t total = t_fast_cache_hit + t_o_hit + t_insert;
   double temp = 0;
@@ -98,14 +147,20 @@ void Statistics::GetStep(double& FC_hit_ratio, double& miss_ratio) {
   FC_hit_ratio = 1 - temp;
 }
 
+void Statistics::GetStep(uint64_t& fast_cache_hit, uint64_t& o_hit,
+                         uint64_t& miss) {
+  auto delta = GetStepDelta();
+  fast_cache_hit = delta[Tickers::FAST_CACHE_HIT];
+  o_hit = delta[Tickers::CACHE_HIT] + delta[Tickers::L0_CACHE_HIT];
+  miss = delta[Tickers::CACHE_MISS];
+}
+
 void Statistics::GetAndPrintStep(double& FC_hit_ratio, double& miss_ratio) {
-  auto t_fast_cache_hit = tickers_[Tickers::FAST_CACHE_HIT].load() -
-                          cursors_[Tickers::FAST_CACHE_HIT];
-  auto t_o_hit =
-      tickers_[Tickers::CACHE_HIT].load() - cursors_[Tickers::CACHE_HIT];
-  auto t_miss =
-      tickers_[Tickers::CACHE_MISS].load() - cursors_[Tickers::CACHE_MISS];
-  auto t_insert = tickers_[Tickers::INSERT].load() - cursors_[Tickers::INSERT];
+  auto delta = GetStepDelta();
+  auto t_fast_cache_hit = delta[Tickers::FAST_CACHE_HIT];
+  auto t_o_hit = delta[Tickers::CACHE_HIT];
+  auto t_miss = delta[Tickers::CACHE_MISS];
+  auto t_insert = delta[Tickers::INSERT];
 
   uint64_t total = t_fast_cache_hit + t_o_hit + t_insert;
   double temp = 0;
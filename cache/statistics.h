@@ -1,10 +1,14 @@
-
 #ifndef KVCACHE_STATISTIC_H
 #define KVCACHE_STATISTIC_H
 
 #include <stdint.h>
 
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+#include "utils.h"
 
 namespace kvcache {
 
@@ -13,22 +17,90 @@ enum Tickers : uint32_t {
   CACHE_HIT,
   CACHE_MISS,
   INSERT,
+  L0_CACHE_HIT,
+  FLASH_TIER_HIT,
+  FLASH_TIER_MISS,
+  COMPRESSED_TIER_HIT,
+  // Writes that replaced or invalidated a frozen entry.
+  FROZEN_INVALIDATE,
+  // Acquisitions of the shard locks, and those that found the lock held. See
+  // 'CountedMutex'.
+  LIST_LOCK_ACQUIRE,
+  LIST_LOCK_CONTENDED,
+  HEAD_SEGMENT_LOCK_ACQUIRE,
+  HEAD_SEGMENT_LOCK_CONTENDED,
+  TAIL_SEGMENT_LOCK_ACQUIRE,
+  TAIL_SEGMENT_LOCK_CONTENDED,
+  // Time spent waiting for a held shard lock.
+  LOCK_WAIT_NANOS,
+  // Hits that left the entry in place because the list lock was held.
+  PROMOTION_SKIPPED,
   TICKER_ENUM_MAX
 };
 
+// Counts of every ticker at a point in time. The difference of two snapshots
+// is exact, whatever the increments in between.
+struct TickerSnapshot {
+  uint64_t tickers[TICKER_ENUM_MAX] = {};
+
+  uint64_t operator[](Tickers ticker_type) const {
+    return tickers[ticker_type];
+  }
+
+  TickerSnapshot& operator+=(const TickerSnapshot& other) {
+    for (int i = 0; i < (int)TICKER_ENUM_MAX; i++) {
+      tickers[i] += other.tickers[i];
+    }
+    return *this;
+  }
+
+  TickerSnapshot operator-(const TickerSnapshot& base) const {
+    TickerSnapshot delta;
+    for (int i = 0; i < (int)TICKER_ENUM_MAX; i++) {
+      delta.tickers[i] = tickers[i] - base.tickers[i];
+    }
+    return delta;
+  }
+};
+
+// Statistics counts the tickers of a shard. Every thread increments its own
+// cache line, out of 'kNumSlots', and reads sum them up. Counters are never
+// reset: 'GetStat' and 'ResetStat' move a base snapshot, and the step
+// functions a cursor, so a read never loses a concurrent increment. The base
+// and the cursor are shared by the monitor, metrics and curve threads, and
+// guarded by a mutex.
+//
+// Building with KVCACHE_NO_STATS compiles the tickers out: 'RecordTick' does
+// nothing and every count is 0, so the frozen fast cache monitor can't work.
+
 class Statistics {
  public:
-  Statistics() {}
+  Statistics();
   ~Statistics() {}
 
+  // Count of 'ticker_type' since the last 'GetStat' or 'ResetStat'.
   uint64_t GetTickerCount(Tickers ticker_type) const;
 
-  void RecordTick(Tickers ticker_type, uint64_t count = 1);
+  void RecordTick(Tickers ticker_type, uint64_t count = 1) {
+#ifndef KVCACHE_NO_STATS
+    static thread_local uint32_t slot = next_slot_++ % kNumSlots;
+    slots_[slot].tickers[ticker_type].fetch_add(count,
+                                                std::memory_order_relaxed);
+#endif
+  }
 
+  // Make 'GetTickerCount' of 'ticker_type' return 'count'.
   void SetTickerCount(Tickers ticker_type, uint64_t count);
 
+  // Current counts since the statistics were created.
+  TickerSnapshot Snapshot() const;
+
   void PrintStat();
 
+  // Counts since the last call, and start over.
+  TickerSnapshot GetStat();
+
+  // Requests since the last call, and start over.
   void GetStat(uint64_t& fast_cache_hit, uint64_t& o_hit, uint64_t& miss);
 
   void GetAndPrintStat(uint64_t& fast_cache_hit, uint64_t& o_hit,
@@ -40,15 +112,85 @@ class Statistics {
 
   void GetStep(double& FC_hit_ratio, double& miss_ratio);
 
+  // Requests since the cursor, counted like 'GetStat' but without a reset.
+  void GetStep(uint64_t& fast_cache_hit, uint64_t& o_hit, uint64_t& miss);
+
   void GetAndPrintStep(double& FC_hit_ratio, double& miss_ratio);
 
   void ResetCursor();
 
+  // Waits for the held shard locks, since the statistics were created.
+  utils::LatencyHistogram& lock_wait() { return lock_wait_; }
+
+ private:
+  constexpr static uint32_t kNumSlots = 32;
+
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> tickers[TICKER_ENUM_MAX];
+  };
+
+  static std::atomic<uint32_t> next_slot_;
+
+  // Counts since the cursor.
+  TickerSnapshot GetStepDelta() const;
+
+  std::unique_ptr<Slot[]> slots_;
+  mutable std::mutex mtx_;
+  // Snapshots of the last 'GetStat' or 'ResetStat', and of the cursor.
+  TickerSnapshot base_;
+  TickerSnapshot cursor_;
+  utils::LatencyHistogram lock_wait_;
+};
+
+// CountedMutex is a shard lock that counts its acquisitions in the shard
+// statistics, under 'acquire', and those that found it held, under
+// 'contended'. The wait of a contended 'lock' goes to LOCK_WAIT_NANOS and the
+// lock wait histogram. A failed 'try_lock' is contended but not acquired.
+//
+// With KVCACHE_NO_STATS, it is a plain std::mutex.
+
+class CountedMutex {
+ public:
+  CountedMutex(Statistics* stats, Tickers acquire, Tickers contended)
+      : stats_(stats), acquire_(acquire), contended_(contended) {}
+  CountedMutex(const CountedMutex&) = delete;
+  CountedMutex& operator=(const CountedMutex&) = delete;
+
+  void lock() {
+#ifndef KVCACHE_NO_STATS
+    if (mutex_.try_lock()) {
+      stats_->RecordTick(acquire_);
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    mutex_.lock();
+    uint64_t wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    stats_->RecordTick(acquire_);
+    stats_->RecordTick(contended_);
+    stats_->RecordTick(Tickers::LOCK_WAIT_NANOS, wait_ns);
+    stats_->lock_wait().insert(wait_ns / 1e3);
+#else
+    mutex_.lock();
+#endif
+  }
+
+  bool try_lock() {
+    bool locked = mutex_.try_lock();
+    stats_->RecordTick(locked ? acquire_ : contended_);
+    return locked;
+  }
+
+  void unlock() { mutex_.unlock(); }
+
  private:
-  std::atomic<uint64_t> tickers_[static_cast<int>(Tickers::TICKER_ENUM_MAX)];
-  uint64_t cursors_[static_cast<int>(Tickers::TICKER_ENUM_MAX)];
+  std::mutex mutex_;
+  Statistics* stats_;
+  Tickers acquire_;
+  Tickers contended_;
 };
 
 }  // namespace kvcache
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,147 @@
+#include "statistics.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(StatisticsTest, SnapshotAndStep) {
+  kvcache::Statistics stats;
+  stats.RecordTick(kvcache::Tickers::FAST_CACHE_HIT, 3);
+  stats.RecordTick(kvcache::Tickers::CACHE_HIT);
+  stats.RecordTick(kvcache::Tickers::L0_CACHE_HIT);
+  stats.RecordTick(kvcache::Tickers::CACHE_MISS, 2);
+  auto first = stats.Snapshot();
+  ASSERT_EQ(3, first[kvcache::Tickers::FAST_CACHE_HIT]);
+
+  // Steps don't reset the counts.
+  uint64_t fast_cache_hit = 0, o_hit = 0, miss = 0;
+  stats.GetStep(fast_cache_hit, o_hit, miss);
+  ASSERT_EQ(3, fast_cache_hit);
+  ASSERT_EQ(2, o_hit);
+  ASSERT_EQ(2, miss);
+  stats.ResetCursor();
+  stats.RecordTick(kvcache::Tickers::CACHE_MISS);
+  stats.GetStep(fast_cache_hit, o_hit, miss);
+  ASSERT_EQ(0, fast_cache_hit);
+  ASSERT_EQ(1, miss);
+  ASSERT_EQ(3, stats.GetTickerCount(kvcache::Tickers::CACHE_MISS));
+  auto delta = stats.Snapshot() - first;
+  ASSERT_EQ(1, delta[kvcache::Tickers::CACHE_MISS]);
+
+  // 'GetStat' starts over, and so does the cursor.
+  stats.GetStat(fast_cache_hit, o_hit, miss);
+  ASSERT_EQ(3, miss);
+  ASSERT_EQ(0, stats.GetTickerCount(kvcache::Tickers::CACHE_MISS));
+  stats.GetStep(fast_cache_hit, o_hit, miss);
+  ASSERT_EQ(0, miss);
+  ASSERT_EQ(3, stats.Snapshot()[kvcache::Tickers::CACHE_MISS]);
+
+  stats.SetTickerCount(kvcache::Tickers::INSERT, 10);
+  stats.RecordTick(kvcache::Tickers::INSERT);
+  ASSERT_EQ(11, stats.GetTickerCount(kvcache::Tickers::INSERT));
+}
+
+TEST(StatisticsTest, ConcurrentReads) {
+  const uint64_t num_threads = 8, num_ticks = 200000;
+  kvcache::Statistics stats;
+  std::atomic<bool> stop{false};
+  // Reads that start over in the middle of the increments lose none.
+  uint64_t total = 0;
+  std::thread reader([&]() {
+    uint64_t fast_cache_hit = 0, o_hit = 0, miss = 0;
+    while (!stop) {
+      stats.GetStat(fast_cache_hit, o_hit, miss);
+      total += o_hit;
+    }
+    stats.GetStat(fast_cache_hit, o_hit, miss);
+    total += o_hit;
+  });
+  std::vector<std::thread> threads;
+  for (uint64_t i = 0; i < num_threads; i++) {
+    threads.emplace_back([&]() {
+      for (uint64_t k = 0; k < num_ticks; k++) {
+        stats.RecordTick(kvcache::Tickers::CACHE_HIT);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  stop = true;
+  reader.join();
+  ASSERT_EQ(num_threads * num_ticks, total);
+}
+
+TEST(StatisticsTest, ConcurrentReaders) {
+  const uint64_t num_ticks = 200000;
+  kvcache::Statistics stats;
+  std::atomic<bool> stop{false};
+  // The monitor, metrics and curve threads share the base and the cursor:
+  // every count goes to exactly one 'GetStat'.
+  std::atomic<uint64_t> total{0};
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 2; i++) {
+    readers.emplace_back([&]() {
+      uint64_t fast_cache_hit = 0, o_hit = 0, miss = 0;
+      while (!stop) {
+        stats.GetStat(fast_cache_hit, o_hit, miss);
+        total += o_hit;
+        stats.ResetCursor();
+        stats.GetStep(fast_cache_hit, o_hit, miss);
+      }
+    });
+  }
+  for (uint64_t k = 0; k < num_ticks; k++) {
+    stats.RecordTick(kvcache::Tickers::CACHE_HIT);
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  total += stats.GetStat()[kvcache::Tickers::CACHE_HIT];
+  ASSERT_EQ(num_ticks, total.load());
+}
+
+TEST(StatisticsTest, CountedMutex) {
+  kvcache::Statistics stats;
+  kvcache::CountedMutex mutex(&stats, kvcache::Tickers::LIST_LOCK_ACQUIRE,
+                              kvcache::Tickers::LIST_LOCK_CONTENDED);
+  {
+    std::unique_lock lock(mutex);
+  }
+  ASSERT_EQ(1, stats.GetTickerCount(kvcache::Tickers::LIST_LOCK_ACQUIRE));
+  ASSERT_EQ(0, stats.GetTickerCount(kvcache::Tickers::LIST_LOCK_CONTENDED));
+  ASSERT_EQ(0, stats.lock_wait().Total().count);
+
+  // A failed 'try_lock' is contended, and a blocking 'lock' waits.
+  std::unique_lock lock(mutex);
+  std::atomic<bool> tried{false};
+  std::thread waiter([&]() {
+    ASSERT_FALSE(mutex.try_lock());
+    tried = true;
+    std::unique_lock wait_lock(mutex);
+  });
+  while (!tried) {
+    std::this_thread::yield();
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  lock.unlock();
+  waiter.join();
+  ASSERT_EQ(3, stats.GetTickerCount(kvcache::Tickers::LIST_LOCK_ACQUIRE));
+  ASSERT_EQ(2, stats.GetTickerCount(kvcache::Tickers::LIST_LOCK_CONTENDED));
+  auto wait = stats.lock_wait().Total();
+  ASSERT_EQ(1, wait.count);
+  ASSERT_LT(0, stats.GetTickerCount(kvcache::Tickers::LOCK_WAIT_NANOS));
+  // The histogram has the wait in us, rounded back to ns.
+  ASSERT_NEAR(wait.sum_ns,
+              stats.GetTickerCount(kvcache::Tickers::LOCK_WAIT_NANOS), 1);
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
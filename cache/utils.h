@@ -14,8 +14,6 @@
 #include <thread>
 #include <vector>
 
-#include "sys/mman.h"
-
 namespace utils {
 
 #if defined(__GNUC__) && __GNUC__ >= 4
@@ -33,145 +31,203 @@ inline uint64_t NowMicros() {
   return static_cast<uint64_t>(tv.tv_sec) * kUsecondsPerSecond + tv.tv_usec;
 }
 
-class MySet {
- public:
-  MySet() : size_(0), cursor_(0) {
-    data_ = (double*)mmap(nullptr, capacity_, PROT_READ | PROT_WRITE,
-                          MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+// The finalizer of splitmix64. Used to sample keys, so that sampling doesn't
+// correlate with the shard or any other hash of the key.
+inline uint64_t Mix64(uint64_t h) {
+  h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+  return h ^ (h >> 31);
+}
 
-    assert(data_ != nullptr);
-  }
+// LatencyHistogram records latencies (us) in log-linear buckets, as HDR
+// histograms do: exact below 64 ns, then 64 buckets per power of 2, so that a
+// percentile is within 1/64 of the recorded value, up to about 4.9 hours.
+// Memory is constant, and a percentile is a walk over the buckets.
+//
+// Every thread records into its own slot, out of 'kNumSlots', which is only
+// allocated by its first record. Reads merge the slots without resetting
+// them: 'Total' covers the records since the last 'Reset', and 'Step' the ones
+// since the last 'Step'. Reads must come from a single thread.
+class LatencyHistogram {
+ public:
+  constexpr static uint32_t kSubBits = 6;
+  constexpr static uint32_t kSubBuckets = 1 << kSubBits;
+  constexpr static uint32_t kMaxBits = 44;
+  constexpr static uint32_t kNumBuckets = (kMaxBits - kSubBits + 1) *
+                                          kSubBuckets;
+
+  // Merged buckets of the slots at a point in time, or the difference of two.
+  struct Snapshot {
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(kNumBuckets, 0);
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+
+    Snapshot operator-(const Snapshot& base) const {
+      Snapshot delta;
+      for (uint32_t i = 0; i < kNumBuckets; i++) {
+        delta.buckets[i] = buckets[i] - base.buckets[i];
+      }
+      delta.count = count - base.count;
+      delta.sum_ns = sum_ns - base.sum_ns;
+      return delta;
+    }
 
-  ~MySet() { munmap(data_, capacity_); }
+    Snapshot& operator+=(const Snapshot& other) {
+      for (uint32_t i = 0; i < kNumBuckets; i++) {
+        buckets[i] += other.buckets[i];
+      }
+      count += other.count;
+      sum_ns += other.sum_ns;
+      return *this;
+    }
 
-  void insert(double value) {
-    uint64_t index = __sync_fetch_and_add(&size_, 1);
-    assert(index < max_size_);
-    data_[index] = value;
-    sorted_ = false;
-  }
+    double Average() const { return count == 0 ? 0 : sum_ns / 1e3 / count; }
+
+    // The latency (us) below which a fraction 'f' of the records are.
+    double Percentile(double f) const {
+      if (count == 0) {
+        return 0;
+      }
+      uint64_t rank = std::min<uint64_t>(count * f, count - 1);
+      uint64_t seen = 0;
+      for (uint32_t i = 0; i < kNumBuckets; i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+          return BucketMiddle(i) / 1e3;
+        }
+      }
+      return 0;
+    }
 
-  double sum() { return std::accumulate(data_, data_ + size_, 0.0); }
+    // Print the average and the percentiles, and return the average, or 100
+    // without records.
+    double Print() const {
+      if (count == 0) {
+        printf("none\n");
+        return 100;
+      }
+      printf(
+          "avg: %.3lf (stat size: %lu), median: %.3lf, p9999: %.3lf, p999: "
+          "%.3lf, p99: %.3lf, p90: %.3lf\n",
+          Average(), count, Percentile(0.5), Percentile(0.9999),
+          Percentile(0.999), Percentile(0.99), Percentile(0.9));
+      fflush(stdout);
+      return Average();
+    }
+  };
 
-  double get(uint64_t index) {
-    assert(index < size_);
-    return data_[index];
+  LatencyHistogram() = default;
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+  ~LatencyHistogram() {
+    for (auto& slot : slots_) {
+      delete slot.load();
+    }
   }
 
-  double& operator[](uint64_t index) {
-    assert(index < size_);
-    return data_[index];
+  void insert(double latency_us) {
+    static thread_local uint32_t index = next_slot_++ % kNumSlots;
+    auto slot = slots_[index].load(std::memory_order_acquire);
+    if (UNLIKELY(slot == nullptr)) {
+      slot = AllocateSlot(index);
+    }
+    uint64_t ns = std::max(latency_us, 0.0) * 1e3;
+    slot->buckets[BucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    slot->count.fetch_add(1, std::memory_order_relaxed);
+    slot->sum_ns.fetch_add(ns, std::memory_order_relaxed);
   }
 
-  uint64_t size() { return size_; }
+  // Records since the histogram was created, whatever the resets and steps.
+  Snapshot Current() const { return Merge(); }
 
-  void reset() {
-    memset(data_, 0, sizeof(double) * size_);
-    size_ = 0;
-    cursor_ = 0;
-    sorted_ = false;
-  }
+  // Records since the last 'Reset'.
+  Snapshot Total() const { return Merge() - base_; }
 
-  double get_tail(double f) {
-    if (!sorted_) {
-      std::sort(data_, data_ + size_);
-      sorted_ = true;
-    }
-    return data_[(uint64_t)(size_ * f)];
+  // Records since the last 'Step', which starts a new step.
+  Snapshot Step() {
+    auto current = Merge();
+    auto delta = current - cursor_;
+    cursor_ = std::move(current);
+    return delta;
   }
 
-  double print_tail() {
-    if (size_ == 0) {
-      printf("no stat to print tail\n");
-      fflush(stdout);
-      return 100;
+  // Number of records since the last 'Step'.
+  uint64_t StepSize() const { return Count() - cursor_.count; }
+
+  void Reset() { base_ = cursor_ = Merge(); }
+
+  static uint32_t BucketIndex(uint64_t ns) {
+    ns = std::min<uint64_t>(ns, (1ull << kMaxBits) - 1);
+    if (ns < kSubBuckets) {
+      return ns;
     }
-    auto size = size_;
-    std::sort(data_, data_ + size);
-    sorted_ = true;
-    auto sum = std::accumulate(data_, data_ + size, 0.0);
-    printf(
-        "Avg: %.3lf (stat size: %ld, real size_: %ld), median: %.3lf, p9999: "
-        "%.3lf, p999: %.3lf, p99: %.3lf, p90: %.3lf\n",
-        sum * 1.0 / size, size, size_, data_[uint64_t(size * 0.50)],
-        data_[uint64_t(size * 0.9999)], data_[uint64_t(size * 0.999)],
-        data_[uint64_t(size * 0.99)], data_[uint64_t(size * 0.90)]);
-    fflush(stdout);
-    return sum * 1.0 / size;
+    uint32_t exponent = 63 - __builtin_clzll(ns);
+    uint32_t shift = exponent - kSubBits;
+    return (shift + 1) * kSubBuckets + (ns >> shift) - kSubBuckets;
   }
 
-  double print_tail(uint64_t& size) {
-    if (size_ == 0) {
-      printf("no stat to print tail\n");
-      return 100;
+  // The middle of bucket 'index', in ns.
+  static double BucketMiddle(uint32_t index) {
+    if (index < kSubBuckets * 2) {
+      return index;
     }
-    size = size_;
-    std::sort(data_, data_ + size);
-    sorted_ = true;
-    auto sum = std::accumulate(data_, data_ + size, 0.0);
-    printf(
-        "avg: %.3lf (stat size: %ld, real size_: %ld), median: %.3lf, p9999: "
-        "%.3lf, p999: %.3lf, p99: %.3lf, p90: %.3lf\n",
-        sum * 1.0 / size, size, size_, data_[uint64_t(size * 0.50)],
-        data_[uint64_t(size * 0.9999)], data_[uint64_t(size * 0.999)],
-        data_[uint64_t(size * 0.99)], data_[uint64_t(size * 0.90)]);
-    fflush(stdout);
-    return sum * 1.0 / size;
+    uint32_t shift = index / kSubBuckets - 1;
+    uint64_t low = uint64_t{index % kSubBuckets + kSubBuckets} << shift;
+    return low + ((1ull << shift) - 1) / 2.0;
   }
 
-  // single writer!
-  double print_from_last_end(uint64_t& step) {
-    if (size_ == 0 || cursor_ >= size_) {
-      printf("none\n");
-      return 100;
+ private:
+  constexpr static uint32_t kNumSlots = 32;
+
+  struct Slot {
+    std::atomic<uint64_t> buckets[kNumBuckets] = {};
+    alignas(64) std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum_ns{0};
+  };
+
+  Slot* AllocateSlot(uint32_t index) {
+    Slot* expected = nullptr;
+    auto slot = new Slot();
+    if (!slots_[index].compare_exchange_strong(expected, slot)) {
+      delete slot;
+      return expected;
     }
-    auto size = size_;
-    auto sum = std::accumulate(data_ + cursor_, data_ + size, 0.0);
-    step = size - cursor_;
-    printf("avg: %.3lf (stat size: %ld, size: %ld -> %ld)\n", sum * 1.0 / step,
-           step, cursor_, size);
-    fflush(stdout);
-    cursor_ = size + 1;
-    return sum * 1.0 / step;
+    return slot;
   }
 
-  uint64_t size_from_last_end() {
-    auto size = size_;
-    // assert(cursor <= size);
-    if (size == 0 || cursor_ >= size) {
-      return 0;
-    } else {
-      return size - cursor_;
+  Snapshot Merge() const {
+    Snapshot snapshot;
+    for (auto& entry : slots_) {
+      auto slot = entry.load(std::memory_order_acquire);
+      if (slot == nullptr) {
+        continue;
+      }
+      for (uint32_t i = 0; i < kNumBuckets; i++) {
+        snapshot.buckets[i] += slot->buckets[i].load(std::memory_order_relaxed);
+      }
+      snapshot.count += slot->count.load(std::memory_order_relaxed);
+      snapshot.sum_ns += slot->sum_ns.load(std::memory_order_relaxed);
     }
+    return snapshot;
   }
 
-  void print_data(std::string filename) {
-    if (size_ == 0) return;
-    FILE* out = fopen(filename.c_str(), "w");
-    for (uint64_t i = 0; i < size_; i++) {
-      fprintf(out, "%lf\n", data_[i]);
+  uint64_t Count() const {
+    uint64_t count = 0;
+    for (auto& entry : slots_) {
+      auto slot = entry.load(std::memory_order_acquire);
+      if (slot != nullptr) {
+        count += slot->count.load(std::memory_order_relaxed);
+      }
     }
-    fclose(out);
-    std::sort(data_, data_ + size_);
-    sorted_ = true;
-    printf("%s: %lf %lu %lf\n", filename.c_str(), sum(), (long int)size_,
-           sum() / size_);
-    printf("        p9999: %.2lf, p999: %.2lf, p99: %.2lf, p90: %.2lf\n",
-           data_[uint64_t(size_ * 0.9999)], data_[uint64_t(size_ * 0.999)],
-           data_[uint64_t(size_ * 0.99)], data_[uint64_t(size_ * 0.90)]);
+    return count;
   }
 
-  void deallocate() { assert(munmap(data_, capacity_) == 0); }
+  inline static std::atomic<uint32_t> next_slot_{0};
 
- private:
-  const uint64_t max_size_ = 1UL << 30;
-  uint64_t capacity_ = max_size_ * sizeof(double);
-  bool sorted_;
-
-  uint64_t size_;
-  uint64_t cursor_;
-  double* data_;
-  std::string describe_;
+  std::atomic<Slot*> slots_[kNumSlots] = {};
+  // Only used by the reader.
+  Snapshot base_;
+  Snapshot cursor_;
 };
 
 namespace random {
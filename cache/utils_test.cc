@@ -0,0 +1,91 @@
+#include "utils.h"
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(LatencyHistogramTest, Buckets) {
+  using utils::LatencyHistogram;
+  uint32_t last = 0;
+  for (uint64_t ns = 1; ns < (1ull << 40); ns += ns / 7 + 1) {
+    auto index = LatencyHistogram::BucketIndex(ns);
+    ASSERT_LT(index, LatencyHistogram::kNumBuckets);
+    ASSERT_GE(index, last);
+    last = index;
+    // A bucket is at most 1/64 of its values wide.
+    ASSERT_NEAR(ns, LatencyHistogram::BucketMiddle(index), ns / 64.0);
+  }
+  ASSERT_EQ(LatencyHistogram::kNumBuckets - 1,
+            LatencyHistogram::BucketIndex(UINT64_MAX));
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+  utils::LatencyHistogram histogram;
+  for (uint32_t i = 1; i <= 100000; i++) {
+    histogram.insert(i / 10.0);
+  }
+  auto total = histogram.Total();
+  ASSERT_EQ(100000, total.count);
+  ASSERT_NEAR(5000.05, total.Average(), 0.01);
+  ASSERT_NEAR(5000, total.Percentile(0.5), 5000 / 64.0);
+  ASSERT_NEAR(9900, total.Percentile(0.99), 9900 / 64.0);
+  ASSERT_NEAR(9999, total.Percentile(0.9999), 9999 / 64.0);
+}
+
+TEST(LatencyHistogramTest, StepAndTotal) {
+  utils::LatencyHistogram histogram;
+  histogram.insert(1);
+  histogram.insert(3);
+  ASSERT_EQ(2, histogram.StepSize());
+  auto step = histogram.Step();
+  ASSERT_EQ(2, step.count);
+  ASSERT_NEAR(2, step.Average(), 1e-9);
+  ASSERT_EQ(0, histogram.StepSize());
+
+  // Steps don't reset the total.
+  histogram.insert(5);
+  ASSERT_EQ(1, histogram.Step().count);
+  ASSERT_EQ(3, histogram.Total().count);
+  ASSERT_NEAR(3, histogram.Total().Average(), 1e-9);
+
+  histogram.Reset();
+  ASSERT_EQ(0, histogram.Total().count);
+  ASSERT_EQ(0, histogram.StepSize());
+  histogram.insert(7);
+  ASSERT_EQ(1, histogram.Total().count);
+  ASSERT_NEAR(7, histogram.Step().Percentile(1), 7 / 64.0);
+}
+
+TEST(LatencyHistogramTest, ConcurrentInserts) {
+  const uint64_t num_threads = 8, num_records = 100000;
+  utils::LatencyHistogram histogram;
+  uint64_t stepped = 0;
+  std::atomic<bool> stop{false};
+  std::thread reader([&]() {
+    while (!stop) {
+      stepped += histogram.Step().count;
+    }
+  });
+  std::vector<std::thread> threads;
+  for (uint64_t i = 0; i < num_threads; i++) {
+    threads.emplace_back([&]() {
+      for (uint64_t k = 0; k < num_records; k++) {
+        histogram.insert(k % 100);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  stop = true;
+  reader.join();
+  stepped += histogram.Step().count;
+  ASSERT_EQ(num_threads * num_records, stepped);
+  ASSERT_EQ(num_threads * num_records, histogram.Total().count);
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
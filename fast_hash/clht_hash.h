@@ -5,6 +5,9 @@
 #include <string>
 
 #include "clht.h"
+// clht.h defines them for C, which breaks the standard headers included after.
+#undef true
+#undef false
 #include "fast_hash.h"
 
 namespace fast_hash {
@@ -31,11 +34,9 @@ class CLHT_Hash : public FastHash<Value> {
     clht_gc_thread_init(hash_table_, tid);
   }
 
-  virtual bool find(uint64_t key, Value& value) override {
+  virtual typename FastHash<Value>::Element* borrow(uint64_t key) override {
     auto v = clht_get(hash_table_->ht, (clht_addr_t)key);
-    if (v == 0) return false;
-    value.reset((std::string*)v, [](auto p) {});
-    return true;
+    return (typename FastHash<Value>::Element*)v;
   }
 
   virtual bool insert(uint64_t key, Value value) override {
@@ -3,20 +3,62 @@
 #ifndef KVCACHE_FAST_HASH_H
 #define KVCACHE_FAST_HASH_H
 
+#include <memory>
+
 namespace fast_hash {
 
+// Value must be a shared pointer. The table keeps a frozen value alive until
+// it is cleared or rebuilt, or the value is replaced, so a hit lends the value
+// out instead of sharing its ownership: it costs no allocation and no
+// reference count.
 template <class Value>
 class FastHash {
  public:
+  using Element = typename Value::element_type;
+
   virtual void thread_init(uint32_t tid) = 0;
 
-  virtual bool find(uint64_t key, Value& value) = 0;
+  // The value of 'key', or nullptr. A hit neither allocates nor touches the
+  // reference count of the value.
+  virtual Element* borrow(uint64_t key) = 0;
+
+  // 'value' is set to the borrowed value of 'key', which doesn't own it
+  // ('IsBorrowed'). It must not be kept after the table is cleared or rebuilt,
+  // or the key is written.
+  virtual bool find(uint64_t key, Value& value) {
+    Element* element = borrow(key);
+    if (element == nullptr) {
+      return false;
+    }
+    value = Value(Value(), element);
+    return true;
+  }
 
   virtual bool insert(uint64_t key, Value value) = 0;
 
+  // Replace the value of a frozen 'key', or invalidate it, in place. Return
+  // false if 'key' is not frozen, or the table doesn't support writes.
+  virtual bool update(uint64_t key, Value value) { return false; }
+  virtual bool invalidate(uint64_t key) { return false; }
+
+  // Called after the inserts of a construction, before any find of them.
+  virtual void build() {}
+
   virtual void clear() = 0;
 };
 
+// Whether 'value' was lent by a fast cache ('FastHash::find'), so that it
+// must not be kept, e.g. by another cache.
+template <class Value>
+bool IsBorrowed(const Value& value) {
+  return false;
+}
+
+template <class Element>
+bool IsBorrowed(const std::shared_ptr<Element>& value) {
+  return value != nullptr && value.use_count() == 0;
+}
+
 }  // namespace fast_hash
 
 #endif
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache/utils.h"
+#include "fast_hash/frozen_hash.h"
+
+// Latency of a fast cache hit of 'FrozenHash': 'find' lends the value, while
+// a hit that shares the ownership of its value (as 'find' did before) also
+// copies its owning pointer, i.e. takes and drops a reference. Every thread
+// hits random frozen keys and reads the value. With a few hot keys, the
+// reference counts of the shared hits bounce between the cores.
+
+using Value = std::shared_ptr<std::string>;
+
+// Average ns per hit of 'num_hits' hits of every thread on the first
+// 'num_hot' keys.
+template <class Func>
+double RunHits(uint64_t num_hot, uint32_t num_threads, uint64_t num_hits,
+               Func&& hit) {
+  std::vector<std::thread> threads;
+  std::vector<uint64_t> sums(num_threads);
+  uint64_t start = utils::NowMicros();
+  for (uint32_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      std::mt19937_64 rng(t);
+      uint64_t sum = 0;
+      for (uint64_t i = 0; i < num_hits; i++) {
+        sum += hit(rng() % num_hot);
+      }
+      sums[t] = sum;
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return 1e3 * (utils::NowMicros() - start) / num_hits;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 4) {
+    fprintf(stderr, "Usage: %s <num_keys> <num_hits> <num_threads>\n",
+            argv[0]);
+    return 1;
+  }
+  uint64_t num_keys = std::max<uint64_t>(std::stoull(argv[1]), 1);
+  uint64_t num_hits = std::stoull(argv[2]);
+  uint32_t num_threads = std::max<uint32_t>(std::stoul(argv[3]), 1);
+
+  fast_hash::FrozenHash<Value> hash;
+  std::vector<uint64_t> keys;
+  std::vector<Value> values;
+  std::mt19937_64 rng(42);
+  for (uint64_t i = 0; i < num_keys; i++) {
+    keys.push_back(rng());
+    values.push_back(std::make_shared<std::string>(std::to_string(i)));
+    hash.insert(keys.back(), values.back());
+  }
+  hash.build();
+  printf("keys: %lu, hits per thread: %lu, threads: %u\n", num_keys, num_hits,
+         num_threads);
+
+  for (uint64_t num_hot : {num_keys, std::min<uint64_t>(num_keys, 16)}) {
+    double lent = RunHits(num_hot, num_threads, num_hits, [&](uint64_t i) {
+      Value value;
+      hash.find(keys[i], value);
+      return (uint64_t)value->size();
+    });
+    double shared = RunHits(num_hot, num_threads, num_hits, [&](uint64_t i) {
+      Value value;
+      hash.find(keys[i], value);
+      Value owned = values[i];
+      return (uint64_t)owned->size();
+    });
+    printf("%lu hot keys: lent %.1lf ns/hit, shared %.1lf ns/hit\n", num_hot,
+           lent, shared);
+  }
+  return 0;
+}
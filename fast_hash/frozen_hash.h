@@ -0,0 +1,502 @@
+#ifndef FROZEN_HASH_H
+#define FROZEN_HASH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "cache/epoch.h"
+#include "cache/utils.h"
+#include "fast_hash.h"
+
+namespace fast_hash {
+
+// FrozenHash is the hash table of the frozen fast cache.
+//
+// The keys of the fast cache are fixed when it is constructed, so unlike CLHT
+// it needs no locks or per-thread registration, and a table is never resized.
+// 'insert' only stages a pair, and 'build' lays all of them out as a bucketed
+// cuckoo table: a key is in one of two buckets, and a bucket is one cache line
+// of four keys and their value pointers. A lookup hashes the key once, and
+// compares the keys of at most two cache lines without any lock, under an
+// epoch guard (see below).
+//
+// The table is split into partitions by the high bits of the hash, which are
+// built by parallel threads. The values are kept contiguously by the table,
+// which lends them out ('borrow', 'find') without touching their reference
+// count.
+//
+// The keys of a table never change, but a write can replace the value of a
+// frozen key ('update') or invalidate it ('invalidate') in place. A slot points
+// to its current value, which is swapped atomically, so a lookup sees either
+// the old or the new value. A replaced value is retired like a replaced table,
+// so the memory of a table doesn't grow with its writes. Every value of a
+// slot is a distinct allocation, so its pointer also identifies its version.
+// The writes of a key must be ordered by the caller.
+//
+// A hit also marks its slot, once, so that the next construction can keep the
+// frozen keys that are still hit ('for_each_hit'). The marks of a table only
+// count the hits since it was published.
+//
+// The table being served stays until a new one is built, which is published
+// with a single pointer swap. 'build' may be split into 'prepare' and
+// 'publish', so that the writes that raced with the construction are applied
+// to the new table ('update_prepared') before any lookup reads it. A lookup
+// holds a guard of the table ('Protect') while it reads a value, and a
+// replaced table is freed once the lookups that may have loaded it are done.
+//
+// Value must be a shared pointer.
+
+template <class Value>
+class FrozenHash : public FastHash<Value> {
+ private:
+  using Element = typename FastHash<Value>::Element;
+
+  constexpr static uint32_t kSlotsPerBucket = 4;
+  constexpr static double kLoadFactor = 0.9;
+  // Number of evictions before a partition is rebuilt with more buckets.
+  constexpr static uint32_t kMaxKicks = 500;
+  // Partitions are small enough to build in the cache, and a build of fewer
+  // keys than one of them runs in the calling thread.
+  constexpr static uint64_t kKeysPerPartition = 1 << 16;
+
+  // An empty slot has no value, so any key, including 0, can be stored. An
+  // invalidated one keeps its key, with the tombstone as its value.
+  struct alignas(64) Bucket {
+    uint64_t keys[kSlotsPerBucket];
+    std::atomic<const Value*> values[kSlotsPerBucket];
+  };
+
+  struct Partition {
+    Bucket* buckets;
+    uint32_t num_buckets;
+    // A bit per slot of a bucket, set by its first hit. They are kept apart
+    // from the buckets, which the hits only read.
+    std::atomic<uint8_t>* hits;
+  };
+
+  struct Table {
+    // The slots that were written last hold the only replacements left.
+    ~Table() {
+      for (auto& partition : partitions) {
+        for (uint32_t i = 0; i < partition.num_buckets; i++) {
+          for (auto& slot : partition.buckets[i].values) {
+            auto value = slot.load(std::memory_order_relaxed);
+            if (IsReplacement(value)) {
+              delete value;
+            }
+          }
+        }
+      }
+    }
+
+    // Whether 'value' of a slot was allocated by a write, rather than built.
+    bool IsReplacement(const Value* value) const {
+      std::less<const Value*> less;
+      return value != nullptr && value != Tombstone() &&
+             (less(value, values.data()) ||
+              !less(value, values.data() + values.size()));
+    }
+
+    std::vector<Partition> partitions;
+    uint32_t partition_mask;
+    std::vector<std::unique_ptr<Bucket[]>> bucket_arrays;
+    std::vector<std::unique_ptr<std::atomic<uint8_t>[]>> hit_arrays;
+    std::vector<Value> values;
+  };
+
+ public:
+  // 'num_threads' of 0 uses all the cores for a large build.
+  explicit FrozenHash(uint32_t num_threads = 0)
+      : num_threads_(num_threads != 0 ? num_threads
+                                      : std::thread::hardware_concurrency()) {
+    num_threads_ = std::max<uint32_t>(num_threads_, 1);
+  }
+
+  virtual void thread_init(uint32_t) override {}
+
+  // A borrowed value is only valid while the guard is held, which delays the
+  // free of a replaced table.
+  utils::EpochManager::Guard Protect() { return epoch_.Protect(); }
+
+  // The caller must hold a guard ('Protect').
+  virtual Element* borrow(uint64_t key) override {
+    auto value = Find(key);
+    return value != nullptr ? value->get() : nullptr;
+  }
+
+  // A hit lends the value like 'borrow', see 'FastHash::find'.
+  virtual bool find(uint64_t key, Value& value) override {
+    auto guard = Protect();
+    auto found = Find(key);
+    if (found == nullptr) {
+      return false;
+    }
+    value = Value(Value(), found->get());
+    return true;
+  }
+
+  virtual bool insert(uint64_t key, Value value) override {
+    if (value == nullptr) {
+      return false;
+    }
+    staged_.emplace_back(key, std::move(value));
+    return true;
+  }
+
+  virtual bool update(uint64_t key, Value value) override {
+    auto guard = Protect();
+    return Write(table_.load(std::memory_order_acquire), key, std::move(value));
+  }
+
+  virtual bool invalidate(uint64_t key) override {
+    auto guard = Protect();
+    return Write(table_.load(std::memory_order_acquire), key, nullptr);
+  }
+
+  virtual void build() override {
+    prepare();
+    publish();
+  }
+
+  // Build the staged pairs into a table that is not served yet.
+  void prepare();
+
+  // 'update' (or 'invalidate' with nullptr) a key of the prepared table.
+  bool update_prepared(uint64_t key, Value value) {
+    return Write(prepared_.get(), key, std::move(value));
+  }
+
+  // Serve the prepared table, and retire the last one. It doesn't wait for
+  // the lookups of the last one.
+  void publish() {
+    table_.store(prepared_.get(), std::memory_order_release);
+    Retire();
+    current_ = std::move(prepared_);
+  }
+
+  virtual void clear() override {
+    staged_.clear();
+    prepared_.reset();
+    table_.store(nullptr, std::memory_order_release);
+    Retire();
+  }
+
+  uint64_t size() const { return current_ ? current_->values.size() : 0; }
+
+  // Call 'func(key, value)' for every key of the served table that was hit
+  // since it was published, and is not invalidated.
+  template <class Func>
+  void for_each_hit(Func&& func);
+
+ private:
+  // The current value of 'key', or nullptr.
+  const Value* Find(uint64_t key) {
+    auto table = table_.load(std::memory_order_acquire);
+    if (table == nullptr) {
+      return nullptr;
+    }
+    uint64_t hash = utils::Mix64(key);
+    auto& partition = table->partitions[(hash >> 32) & table->partition_mask];
+    uint32_t first, second;
+    BucketIndex(hash, partition.num_buckets, first, second);
+
+    uint32_t index = first;
+    uint32_t slot;
+    const Value* value = Probe(partition.buckets[first], key, slot);
+    if (value == nullptr) {
+      index = second;
+      value = Probe(partition.buckets[second], key, slot);
+    }
+    if (value == nullptr || value == Tombstone()) {
+      return nullptr;
+    }
+    // Only the first hit writes, so the hot keys don't bounce the line.
+    auto& hits = partition.hits[index];
+    uint8_t bit = 1 << slot;
+    if ((hits.load(std::memory_order_relaxed) & bit) == 0) {
+      hits.fetch_or(bit, std::memory_order_relaxed);
+    }
+    return value;
+  }
+
+  // Retire the current table, which is not served anymore. It is freed once
+  // the lookups that may have loaded it are done.
+  void Retire() {
+    if (current_ == nullptr) {
+      return;
+    }
+    epoch_.Retire([table = current_.release()] { delete table; });
+  }
+
+  // Replace the value of a frozen 'key' of 'table' in place, or invalidate it
+  // if 'value' is nullptr. The value it replaces is retired if a write
+  // allocated it.
+  bool Write(Table* table, uint64_t key, Value value) {
+    auto slot = table != nullptr ? FindSlot(*table, key) : nullptr;
+    if (slot == nullptr) {
+      return false;
+    }
+    // Lookups that load the new pointer see the new value built.
+    auto replacement = value != nullptr ? new Value(std::move(value))
+                                        : Tombstone();
+    auto replaced = slot->exchange(replacement, std::memory_order_acq_rel);
+    if (table->IsReplacement(replaced)) {
+      epoch_.Retire([replaced] { delete replaced; });
+    }
+    return true;
+  }
+
+  static const Value* Tombstone() {
+    static const Value tombstone;
+    return &tombstone;
+  }
+
+  // The slot of a frozen (possibly invalidated) 'key', or nullptr.
+  static std::atomic<const Value*>* FindSlot(Table& table, uint64_t key) {
+    uint64_t hash = utils::Mix64(key);
+    auto& partition = table.partitions[(hash >> 32) & table.partition_mask];
+    uint32_t first, second;
+    BucketIndex(hash, partition.num_buckets, first, second);
+    for (auto index : {first, second}) {
+      auto& bucket = partition.buckets[index];
+      for (uint32_t slot = 0; slot < kSlotsPerBucket; slot++) {
+        if (bucket.keys[slot] == key &&
+            bucket.values[slot].load(std::memory_order_relaxed) != nullptr) {
+          return &bucket.values[slot];
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  static void BucketIndex(uint64_t hash, uint32_t num_buckets, uint32_t& first,
+                          uint32_t& second) {
+    // The low half picks the first bucket, and the high half (whose low bits
+    // pick the partition) is remixed for the second one.
+    first = (uint32_t)(((hash & 0xffffffff) * num_buckets) >> 32);
+    uint64_t alt = (hash >> 32) * 0x9e3779b97f4a7c15ULL;
+    second = (uint32_t)(((alt >> 32) * num_buckets) >> 32);
+    if (second == first) {
+      second = first + 1 == num_buckets ? 0 : first + 1;
+    }
+  }
+
+  // The value of 'key' in 'bucket' and its 'slot', or nullptr.
+  static const Value* Probe(const Bucket& bucket, uint64_t key,
+                            uint32_t& slot) {
+#ifdef __SSE2__
+    // Two keys per register: equal 64-bit lanes have both halves equal.
+    __m128i target = _mm_set1_epi64x((long long)key);
+    __m128i low = _mm_cmpeq_epi32(
+        _mm_load_si128((const __m128i*)&bucket.keys[0]), target);
+    __m128i high = _mm_cmpeq_epi32(
+        _mm_load_si128((const __m128i*)&bucket.keys[2]), target);
+    low = _mm_and_si128(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+    high =
+        _mm_and_si128(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(2, 3, 0, 1)));
+    int mask = _mm_movemask_pd(_mm_castsi128_pd(low)) |
+               (_mm_movemask_pd(_mm_castsi128_pd(high)) << 2);
+    while (mask != 0) {
+      slot = __builtin_ctz(mask);
+      auto value = bucket.values[slot].load(std::memory_order_acquire);
+      if (value != nullptr) {
+        return value;
+      }
+      mask &= mask - 1;
+    }
+#else
+    for (slot = 0; slot < kSlotsPerBucket; slot++) {
+      auto value = bucket.values[slot].load(std::memory_order_acquire);
+      if (bucket.keys[slot] == key && value != nullptr) {
+        return value;
+      }
+    }
+#endif
+    return nullptr;
+  }
+
+  // Build the partition of 'entries' (key and hash, in the order of the
+  // values) into 'table', growing it until every key finds a slot.
+  static void BuildPartition(
+      Table* table, uint32_t id,
+      const std::vector<std::pair<uint64_t, uint64_t>>& entries,
+      uint64_t begin, uint64_t end);
+
+  static bool CuckooInsert(Bucket* buckets, uint32_t num_buckets, uint64_t key,
+                           uint64_t hash, const Value* value,
+                           std::mt19937& rng);
+
+ private:
+  uint32_t num_threads_;
+  std::vector<std::pair<uint64_t, Value>> staged_;
+  std::atomic<Table*> table_{nullptr};
+  std::unique_ptr<Table> prepared_;
+  std::unique_ptr<Table> current_;
+  // Frees the retired tables.
+  utils::EpochManager epoch_;
+};
+
+template <class Value>
+bool FrozenHash<Value>::CuckooInsert(Bucket* buckets, uint32_t num_buckets,
+                                     uint64_t key, uint64_t hash,
+                                     const Value* value, std::mt19937& rng) {
+  uint32_t first, second;
+  BucketIndex(hash, num_buckets, first, second);
+  for (auto index : {first, second}) {
+    auto& bucket = buckets[index];
+    for (uint32_t slot = 0; slot < kSlotsPerBucket; slot++) {
+      if (bucket.values[slot].load(std::memory_order_relaxed) != nullptr &&
+          bucket.keys[slot] == key) {
+        // A duplicate key keeps the value staged first.
+        return true;
+      }
+    }
+  }
+
+  // Random walk: place the key, or evict a random victim to its other bucket.
+  uint32_t index = rng() & 1 ? second : first;
+  for (uint32_t kick = 0; kick <= kMaxKicks; kick++) {
+    for (auto candidate : {first, second}) {
+      auto& bucket = buckets[candidate];
+      for (uint32_t slot = 0; slot < kSlotsPerBucket; slot++) {
+        if (bucket.values[slot].load(std::memory_order_relaxed) == nullptr) {
+          bucket.keys[slot] = key;
+          bucket.values[slot].store(value, std::memory_order_relaxed);
+          return true;
+        }
+      }
+    }
+    auto& bucket = buckets[index];
+    uint32_t slot = rng() % kSlotsPerBucket;
+    std::swap(bucket.keys[slot], key);
+    value = bucket.values[slot].exchange(value, std::memory_order_relaxed);
+    hash = utils::Mix64(key);
+    BucketIndex(hash, num_buckets, first, second);
+    index = first == index ? second : first;
+  }
+  return false;
+}
+
+template <class Value>
+void FrozenHash<Value>::BuildPartition(
+    Table* table, uint32_t id,
+    const std::vector<std::pair<uint64_t, uint64_t>>& entries,
+    uint64_t begin, uint64_t end) {
+  uint64_t num = end - begin;
+  uint32_t num_buckets = std::max<uint32_t>(
+      2, (uint32_t)(num / (kSlotsPerBucket * kLoadFactor)) + 1);
+  std::mt19937 rng(id);
+
+  while (true) {
+    std::unique_ptr<Bucket[]> buckets(new Bucket[num_buckets]());
+    bool done = true;
+    for (uint64_t i = begin; i < end && done; i++) {
+      auto& [key, hash] = entries[i];
+      done = CuckooInsert(buckets.get(), num_buckets, key, hash,
+                          &table->values[i], rng);
+    }
+    if (done) {
+      table->hit_arrays[id].reset(new std::atomic<uint8_t>[num_buckets]());
+      table->partitions[id] =
+          Partition{buckets.get(), num_buckets, table->hit_arrays[id].get()};
+      table->bucket_arrays[id] = std::move(buckets);
+      return;
+    }
+    num_buckets += num_buckets / 8 + 1;
+  }
+}
+
+template <class Value>
+template <class Func>
+void FrozenHash<Value>::for_each_hit(Func&& func) {
+  auto guard = Protect();
+  auto table = table_.load(std::memory_order_acquire);
+  if (table == nullptr) {
+    return;
+  }
+  for (auto& partition : table->partitions) {
+    for (uint32_t i = 0; i < partition.num_buckets; i++) {
+      auto& bucket = partition.buckets[i];
+      uint8_t hits = partition.hits[i].load(std::memory_order_relaxed);
+      for (uint32_t slot = 0; slot < kSlotsPerBucket; slot++) {
+        auto value = bucket.values[slot].load(std::memory_order_acquire);
+        if ((hits & (1 << slot)) != 0 && value != nullptr &&
+            value != Tombstone()) {
+          func(bucket.keys[slot], *value);
+        }
+      }
+    }
+  }
+}
+
+template <class Value>
+void FrozenHash<Value>::prepare() {
+  auto table = std::make_unique<Table>();
+  uint64_t num = staged_.size();
+  uint32_t num_partitions = 1;
+  while (num_partitions * kKeysPerPartition < num) {
+    num_partitions <<= 1;
+  }
+  table->partitions.resize(num_partitions);
+  table->partition_mask = num_partitions - 1;
+  table->bucket_arrays.resize(num_partitions);
+  table->hit_arrays.resize(num_partitions);
+
+  // Group the entries by partition, and keep the values contiguous in the
+  // same order.
+  std::vector<uint64_t> offsets(num_partitions + 1, 0);
+  std::vector<uint64_t> hashes(num);
+  for (uint64_t i = 0; i < num; i++) {
+    hashes[i] = utils::Mix64(staged_[i].first);
+    offsets[((hashes[i] >> 32) & table->partition_mask) + 1]++;
+  }
+  for (uint32_t p = 0; p < num_partitions; p++) {
+    offsets[p + 1] += offsets[p];
+  }
+  std::vector<std::pair<uint64_t, uint64_t>> entries(num);
+  table->values.resize(num);
+  std::vector<uint64_t> cursor(offsets.begin(), offsets.end() - 1);
+  for (uint64_t i = 0; i < num; i++) {
+    auto pos = cursor[(hashes[i] >> 32) & table->partition_mask]++;
+    entries[pos] = std::make_pair(staged_[i].first, hashes[i]);
+    table->values[pos] = std::move(staged_[i].second);
+  }
+  staged_.clear();
+
+  uint32_t num_threads = std::min<uint64_t>(num_threads_, num_partitions);
+  auto worker = [&](uint32_t tid) {
+    for (uint32_t p = tid; p < num_partitions; p += num_threads) {
+      BuildPartition(table.get(), p, entries, offsets[p], offsets[p + 1]);
+    }
+  };
+  if (num_threads <= 1) {
+    worker(0);
+  } else {
+    std::vector<std::thread> threads;
+    for (uint32_t tid = 0; tid < num_threads; tid++) {
+      threads.emplace_back(worker, tid);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  prepared_ = std::move(table);
+}
+
+}  // namespace fast_hash
+
+#endif
@@ -0,0 +1,318 @@
+#include "frozen_hash.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using Value = std::shared_ptr<std::string>;
+
+static Value MakeValue(uint64_t key) {
+  return std::make_shared<std::string>(std::to_string(key));
+}
+
+TEST(FrozenHashTest, FindAfterBuild) {
+  fast_hash::FrozenHash<Value> hash;
+  for (uint64_t key = 0; key < 1000; key++) {
+    ASSERT_TRUE(hash.insert(key, MakeValue(key)));
+  }
+  Value value;
+  // Nothing is served until it is built.
+  ASSERT_FALSE(hash.find(1, value));
+
+  hash.build();
+  ASSERT_EQ(1000, hash.size());
+  for (uint64_t key = 0; key < 1000; key++) {
+    ASSERT_TRUE(hash.find(key, value));
+    ASSERT_EQ(std::to_string(key), *value);
+  }
+  ASSERT_FALSE(hash.find(1000, value));
+  ASSERT_FALSE(hash.find(UINT64_MAX, value));
+}
+
+TEST(FrozenHashTest, HitLendsValue) {
+  fast_hash::FrozenHash<Value> hash;
+  auto stored = MakeValue(5);
+  hash.insert(5, stored);
+  hash.build();
+  auto use_count = stored.use_count();
+
+  // A hit touches neither the ownership nor the reference count.
+  ASSERT_EQ(stored.get(), hash.borrow(5));
+  ASSERT_EQ(nullptr, hash.borrow(6));
+  ASSERT_EQ(use_count, stored.use_count());
+
+  Value value;
+  ASSERT_TRUE(hash.find(5, value));
+  ASSERT_EQ(stored.get(), value.get());
+  ASSERT_EQ(0, value.use_count());
+  ASSERT_TRUE(fast_hash::IsBorrowed(value));
+  ASSERT_EQ(use_count, stored.use_count());
+  ASSERT_FALSE(fast_hash::IsBorrowed(stored));
+  ASSERT_FALSE(fast_hash::IsBorrowed(Value()));
+}
+
+TEST(FrozenHashTest, ClearKeepsValues) {
+  fast_hash::FrozenHash<Value> hash;
+  auto value = MakeValue(7);
+  hash.insert(7, value);
+  hash.build();
+  value.reset();
+
+  // A guard keeps the cleared table, with the values lent by it.
+  Value found;
+  {
+    auto guard = hash.Protect();
+    ASSERT_TRUE(hash.find(7, found));
+    hash.clear();
+    ASSERT_FALSE(hash.find(7, value));
+    ASSERT_EQ("7", *found);
+  }
+
+  hash.insert(8, MakeValue(8));
+  hash.build();
+  ASSERT_FALSE(hash.find(7, value));
+  ASSERT_TRUE(hash.find(8, value));
+}
+
+TEST(FrozenHashTest, BuildReplaces) {
+  fast_hash::FrozenHash<Value> hash;
+  hash.insert(1, MakeValue(1));
+  hash.build();
+
+  // The old table is served while the new one is staged.
+  Value value;
+  hash.insert(2, MakeValue(2));
+  ASSERT_TRUE(hash.find(1, value));
+  ASSERT_FALSE(hash.find(2, value));
+
+  hash.build();
+  ASSERT_FALSE(hash.find(1, value));
+  ASSERT_TRUE(hash.find(2, value));
+  ASSERT_EQ(1, hash.size());
+
+  // The values of the last generation stay while a guard is held.
+  Value old;
+  {
+    auto guard = hash.Protect();
+    ASSERT_TRUE(hash.find(2, old));
+    hash.insert(3, MakeValue(3));
+    hash.build();
+    ASSERT_FALSE(hash.find(2, value));
+    ASSERT_TRUE(hash.find(3, value));
+    ASSERT_EQ("2", *old);
+  }
+}
+
+TEST(FrozenHashTest, UpdateInPlace) {
+  fast_hash::FrozenHash<Value> hash;
+  for (uint64_t key = 0; key < 100; key++) {
+    hash.insert(key, MakeValue(key));
+  }
+  // Nothing is frozen before the build.
+  ASSERT_FALSE(hash.update(1, MakeValue(101)));
+  hash.build();
+
+  Value old;
+  ASSERT_TRUE(hash.find(1, old));
+  ASSERT_TRUE(hash.update(1, MakeValue(101)));
+  Value value;
+  ASSERT_TRUE(hash.find(1, value));
+  ASSERT_EQ("101", *value);
+  // A found value stays valid after it is replaced.
+  ASSERT_EQ("1", *old);
+
+  // Keys that are not frozen are not added.
+  ASSERT_FALSE(hash.update(100, MakeValue(100)));
+  ASSERT_FALSE(hash.find(100, value));
+
+  // Key 0 is frozen like any other.
+  ASSERT_TRUE(hash.invalidate(0));
+  ASSERT_FALSE(hash.find(0, value));
+  ASSERT_TRUE(hash.invalidate(2));
+  ASSERT_FALSE(hash.find(2, value));
+  ASSERT_TRUE(hash.find(3, value));
+  // An invalidated key can be written again.
+  ASSERT_TRUE(hash.update(2, MakeValue(102)));
+  ASSERT_TRUE(hash.find(2, value));
+  ASSERT_EQ("102", *value);
+  ASSERT_FALSE(hash.invalidate(100));
+}
+
+TEST(FrozenHashTest, ForEachHit) {
+  fast_hash::FrozenHash<Value> hash;
+  for (uint64_t key = 0; key < 100; key++) {
+    hash.insert(key, MakeValue(key));
+  }
+  hash.build();
+  Value value;
+  ASSERT_TRUE(hash.find(3, value));
+  ASSERT_TRUE(hash.find(3, value));
+  ASSERT_NE(nullptr, hash.borrow(5));
+  ASSERT_FALSE(hash.find(100, value));
+  ASSERT_TRUE(hash.find(7, value));
+  ASSERT_TRUE(hash.update(7, MakeValue(107)));
+  ASSERT_TRUE(hash.find(9, value));
+  ASSERT_TRUE(hash.invalidate(9));
+
+  // Every hit key once, with its current value, but no invalidated one.
+  std::map<uint64_t, std::string> hits;
+  hash.for_each_hit([&](uint64_t key, const Value& value) {
+    ASSERT_TRUE(hits.emplace(key, *value).second);
+  });
+  std::map<uint64_t, std::string> expected = {
+      {3, "3"}, {5, "5"}, {7, "107"}};
+  ASSERT_EQ(expected, hits);
+
+  // A new table starts over.
+  for (uint64_t key = 0; key < 100; key++) {
+    hash.insert(key, MakeValue(key));
+  }
+  hash.build();
+  hash.for_each_hit([&](uint64_t, const Value&) { FAIL(); });
+}
+
+TEST(FrozenHashTest, UpdatesFreeReplacedValues) {
+  static std::atomic<int64_t> num_live{0};
+  auto make_value = [](uint64_t key) {
+    num_live++;
+    return Value(new std::string(std::to_string(key)), [](std::string* s) {
+      num_live--;
+      delete s;
+    });
+  };
+  {
+    fast_hash::FrozenHash<Value> hash;
+    for (uint64_t key = 0; key < 10; key++) {
+      hash.insert(key, make_value(key));
+    }
+    hash.build();
+    ASSERT_EQ(10, num_live.load());
+
+    // A replaced value is freed once no lookup may read it, so the memory
+    // doesn't grow with the writes of a frozen key.
+    for (int i = 0; i < 1000; i++) {
+      ASSERT_TRUE(hash.update(1, make_value(i)));
+    }
+    ASSERT_TRUE(hash.invalidate(2));
+    ASSERT_TRUE(hash.update(2, make_value(2)));
+    // The built values, the current ones of 1 and 2, and the last replaced
+    // one, which waits for the guard of its own write.
+    ASSERT_EQ(10 + 3, num_live.load());
+
+    // A guard holds the values replaced after it.
+    {
+      auto guard = hash.Protect();
+      auto borrowed = hash.borrow(1);
+      ASSERT_TRUE(hash.update(1, make_value(1)));
+      ASSERT_EQ("999", *borrowed);
+    }
+    hash.clear();
+    hash.insert(1, make_value(1));
+    hash.build();
+  }
+  ASSERT_EQ(0, num_live.load());
+}
+
+TEST(FrozenHashTest, ParallelBuild) {
+  // Random keys, enough for several partitions built by four threads.
+  fast_hash::FrozenHash<Value> hash(4);
+  std::mt19937_64 rng(42);
+  std::vector<uint64_t> keys;
+  for (int i = 0; i < 300000; i++) {
+    keys.push_back(rng());
+    hash.insert(keys.back(), MakeValue(keys.back()));
+  }
+  // A duplicate key keeps the first value.
+  hash.insert(keys[0], MakeValue(0));
+  hash.build();
+
+  Value value;
+  for (auto key : keys) {
+    ASSERT_TRUE(hash.find(key, value));
+    ASSERT_EQ(std::to_string(key), *value);
+  }
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_FALSE(hash.find(rng(), value));
+  }
+}
+
+TEST(FrozenHashTest, GuardKeepsRetiredTable) {
+  fast_hash::FrozenHash<Value> hash;
+  hash.insert(1, MakeValue(1));
+  hash.build();
+
+  // A borrowed value stays valid while the guard is held, however many
+  // tables replace its own, and the builds don't wait for the guard.
+  std::string* borrowed;
+  {
+    auto guard = hash.Protect();
+    borrowed = hash.borrow(1);
+    for (uint64_t key = 2; key < 5; key++) {
+      hash.insert(key, MakeValue(key));
+      hash.build();
+    }
+    hash.clear();
+    ASSERT_EQ(nullptr, hash.borrow(1));
+    ASSERT_EQ("1", *borrowed);
+  }
+  hash.insert(5, MakeValue(5));
+  hash.build();
+  ASSERT_NE(nullptr, hash.borrow(5));
+}
+
+TEST(FrozenHashTest, ConcurrentRebuilds) {
+  fast_hash::FrozenHash<Value> hash;
+  for (uint64_t key = 0; key < 100; key++) {
+    hash.insert(key, MakeValue(key));
+  }
+  hash.build();
+
+  std::atomic<bool> stop = false;
+  std::atomic<uint64_t> errors = 0;
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 2; i++) {
+    readers.emplace_back([&, i] {
+      Value value;
+      for (uint64_t key = 0; !stop.load(); key = (key + 1) % 100) {
+        {
+          auto guard = hash.Protect();
+          auto borrowed = hash.borrow(key);
+          if (borrowed != nullptr && *borrowed != std::to_string(key)) {
+            errors++;
+          }
+        }
+        if (hash.find(key, value) && *value != std::to_string(key)) {
+          errors++;
+        }
+        // The writes of a key are ordered by a single writer.
+        if (i == 0) {
+          hash.update(key, MakeValue(key));
+        }
+      }
+    });
+  }
+  // Every build replaces all the values, and frees the last table as soon
+  // as the lookups are done with it.
+  for (int round = 0; round < 200; round++) {
+    for (uint64_t key = 0; key < 100; key++) {
+      hash.insert(key, MakeValue(key));
+    }
+    hash.build();
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  ASSERT_EQ(0, errors.load());
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
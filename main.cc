@@ -72,6 +72,110 @@ void ParseCommandLine(int argc, const char* argv[],
       props.SetProperty("disk_latency", argv[index]);
       index++;
 
+    } else if (strcmp(argv[index], "-numa") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("numa", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-l0") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("l0", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-flash") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("flash", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-flash_size") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("flash_size", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-compress_depth") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("compress_depth", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-compress_size") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("compress_size", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-adaptive") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("adaptive", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-mrc") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("mrc", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-snapshot_load") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("snapshot_load", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-snapshot_save") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("snapshot_save", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-metrics") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("metrics", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-metrics_format") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("metrics_format", argv[index]);
+      index++;
+
+    } else if (strcmp(argv[index], "-metrics_interval_ms") == 0) {
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty("metrics_interval_ms", argv[index]);
+      index++;
+
     } else if (strcmp(argv[index], "-trace") == 0) {
       index++;
       if (index >= argc) {
@@ -88,6 +192,16 @@ void ParseCommandLine(int argc, const char* argv[],
       props.SetProperty("path", argv[index]);
       index++;
 
+    } else if (StringStartWith(argv[index], "-fh_")) {
+      // Parameters of the frozen fast cache controller, see FrozenOptions.
+      const char* name = argv[index] + 1;
+      index++;
+      if (index >= argc) {
+        break;
+      }
+      props.SetProperty(name, argv[index]);
+      index++;
+
     } else {
       break;
     }
@@ -107,7 +221,25 @@ void UsageMessage(const char* command) {
   std::cout << " -requests" << std::endl;
   std::cout << " -threads" << std::endl;
   std::cout << " -disk_latency" << std::endl;
+  std::cout << " -numa (none | place | local)" << std::endl;
+  std::cout << " -l0 (0 | 1)" << std::endl;
+  std::cout << " -flash (log file of the flash tier)" << std::endl;
+  std::cout << " -flash_size (MB, default: 1024)" << std::endl;
+  std::cout << " -compress_depth (entries kept uncompressed)" << std::endl;
+  std::cout << " -compress_size (MB, default: 1024)" << std::endl;
+  std::cout << " -adaptive (0 | 1, switch among lru, fifo and segment)"
+            << std::endl;
+  std::cout << " -mrc (sampling rate, e.g. 0.01, default: 0, disabled)"
+            << std::endl;
+  std::cout << " -snapshot_load" << std::endl;
+  std::cout << " -snapshot_save" << std::endl;
+  std::cout << " -metrics (file or unix:<socket path>, records every interval)"
+            << std::endl;
+  std::cout << " -metrics_format (json | csv, default: json)" << std::endl;
+  std::cout << " -metrics_interval_ms (default: 1000)" << std::endl;
   std::cout << " -path" << std::endl;
+  std::cout << " -fh_<option> (frozen controller, e.g. -fh_gain_threshold 0.2,"
+            << " see FrozenOptions)" << std::endl;
 }
 
 bool StringStartWith(const char* str1, const char* str2) {
@@ -4,6 +4,9 @@ cache_type_list = [
     # "fifo_cache",
     # "lru_cache",
     "frozenhot_cache",
+    # "frozenhot_fifo_cache",
+    # "frozenhot_lfu_cache",
+    # "origin_frozenhot_cache",
     # "segment_cache",
 ]
 
@@ -24,6 +27,15 @@ disk_latency_list = [
     # 20
 ]
 
+# Flash tier mode: evicted entries are spilled to a log file on local NVMe.
+# Pair it with a backend latency well above the flash read latency, e.g. 500.
+flash_path = None
+# flash_path = "/mnt/nvme/kvcache_flash_tier"
+flash_size_mb = 16384
+flash_args = ""
+if flash_path:
+    flash_args = " -flash " + flash_path + " -flash_size " + str(flash_size_mb)
+
 capacity_list = [
     10000000,
     # 100000000
@@ -90,6 +102,7 @@ for thread in num_threads:
                                 + str(thread)
                                 + " -disk_latency "
                                 + str(disk_latency)
+                                + flash_args
                                 + " -trace "
                                 + trace_type
                                 + " -path "
@@ -129,6 +142,7 @@ for thread in num_threads:
                                 + str(thread)
                                 + " -disk_latency "
                                 + str(disk_latency)
+                                + flash_args
                                 + " -trace "
                                 + trace_type
                                 + " -path "